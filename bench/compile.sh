@@ -0,0 +1,194 @@
+# Compile throughput benchmark.
+# Usage: ./bench/compile.sh [--runs N] [--threshold PERCENT] [--baseline FILE] [--update-baseline]
+#                           [--output FILE]
+# Generates programs along each axis of ./bench/generate.sh at a few sizes, compiles each of them
+# several times with --time-report, and prints the median time of every phase, the spread of the
+# total time and the throughput in lines and tokens per second.
+# The results are compared against the baseline (./bench/baseline.json by default). An input whose
+# fastest run is more than the threshold (20% by default) and more than a millisecond slower than in
+# the baseline is a regression, and makes the benchmark fail. Other processes only ever make a run
+# slower, so the fastest run is the least noisy measure. The phases whose median grew as much are
+# named as the likely cause. --update-baseline writes the results as the new baseline instead, which
+# is only meaningful on the machine that runs the comparisons.
+
+comp="./bin/paola"
+runs=5
+threshold=20
+baseline="./bench/baseline.json"
+update=0
+output=""
+
+while [ $# -gt 0 ]; do
+  case "$1" in
+    --runs) runs=$2; shift ;;
+    --threshold) threshold=$2; shift ;;
+    --baseline) baseline=$2; shift ;;
+    --update-baseline) update=1 ;;
+    --output) output=$2; shift ;;
+    *) echo "Unknown option $1"; exit 1 ;;
+  esac
+  shift
+done
+
+# The inputs, as axis:size.
+inputs="functions:100 functions:400 functions:1600
+long:500 long:2000 long:8000
+nesting:100 nesting:400 nesting:1600
+expressions:1000 expressions:4000 expressions:16000
+locals:250 locals:1000 locals:4000
+huge:2000 huge:8000 huge:32000"
+
+phases="lexer parser semcheck ctfe deadcode loopopt inline analysis codegen total"
+work=$(mktemp -d /tmp/paola-bench.XXXXXX)
+results="$work/results"
+fail=0
+
+printf "%-18s %7s %7s %9s %7s %7s %7s %7s %7s %7s %9s %9s\n" "input" "lines" "tokens" "total ms" \
+  "+-sd" "lexer" "parser" "check" "opt" "codegen" "klines/s" "ktok/s"
+for input in $inputs; do
+  axis=${input%:*}
+  size=${input#*:}
+  name="$axis-$size"
+  program="$work/$name.c"
+  ./bench/generate.sh $axis $size > $program
+  lines=$(wc -l < $program)
+
+  # Every run adds a line per phase: the phase and its wall time in milliseconds.
+  : > $work/runs
+  for run in $(seq $runs); do
+    $comp --time-report $program -o $work/out.s > $work/report
+    status=$?
+    if [ $status -ne 0 ]; then
+      echo "$name: compiling returned $status."
+      fail=1
+      continue 2
+    fi
+    awk -v phases="$phases" 'BEGIN { split(phases, names); for (i in names) wanted[names[i]] = 1 }
+      $1 in wanted { print $1, $2 }' $work/report >> $work/runs
+  done
+  tokens=$(sed -En 's/^Tokens: ([0-9]+)/\1/p' $work/report)
+
+  awk -v name="$name" -v lines="$lines" -v tokens="$tokens" -v runs="$runs" -v phases="$phases" \
+      -v json="$results" '
+    { times[$1, ++count[$1]] = $2 }
+    # The median of the times of a phase, which are sorted in place.
+    function median(phase,    n, i, j, t) {
+      n = count[phase]
+      for (i = 2; i <= n; i++) {
+        for (j = i; j > 1 && times[phase, j - 1] > times[phase, j]; j--) {
+          t = times[phase, j]; times[phase, j] = times[phase, j - 1]; times[phase, j - 1] = t
+        }
+      }
+      if (n == 0) return 0
+      return n % 2 ? times[phase, (n + 1) / 2] : (times[phase, n / 2] + times[phase, n / 2 + 1]) / 2
+    }
+    END {
+      split(phases, names)
+      for (i = 1; i in names; i++) {
+        medians[names[i]] = median(names[i])
+      }
+      n = count["total"]
+      mean = 0
+      for (i = 1; i <= n; i++) mean += times["total", i]
+      mean /= n
+      sd = 0
+      for (i = 1; i <= n; i++) sd += (times["total", i] - mean) ^ 2
+      sd = n > 1 ? sqrt(sd / (n - 1)) : 0
+      total = medians["total"]
+      seconds = total > 0 ? total / 1000 : 1e-6
+      optimize = medians["ctfe"] + medians["deadcode"] + medians["loopopt"] + medians["inline"] \
+        + medians["analysis"]
+      printf "%-18s %7d %7d %9.3f %7.3f %7.3f %7.3f %7.3f %7.3f %7.3f %9.1f %9.1f\n", name, lines,
+        tokens, total, sd, medians["lexer"], medians["parser"], medians["semcheck"], optimize,
+        medians["codegen"], lines / seconds / 1000, tokens / seconds / 1000
+
+      printf("    \"%s\": {\"lines\": %d, \"tokens\": %d, \"runs\": %d, \"min_ms\": %.3f, " \
+        "\"stddev_ms\": %.3f, \"phases\": {", name, lines, tokens, runs, times["total", 1], sd) >> json
+      for (i = 1; i in names; i++) {
+        printf("%s\"%s\": %.3f", (i > 1 ? ", " : ""), names[i], medians[names[i]]) >> json
+      }
+      printf "}}\n" >> json
+    }' $work/runs
+done
+
+# Joins the lines of the results into a JSON document.
+to_json () {
+  echo "{"
+  echo "  \"runs\": $runs,"
+  echo "  \"inputs\": {"
+  sed '$!s/$/,/' $results
+  echo "  }"
+  echo "}"
+}
+
+if [ "$output" != "" ]; then
+  to_json > $output
+fi
+
+if [ $update -eq 1 ]; then
+  to_json > $baseline
+  echo ""
+  echo "Wrote the baseline to $baseline."
+elif [ -f $baseline ]; then
+  echo ""
+  echo "Against $baseline (regressions are over $threshold% and 1 ms slower):"
+  # Reads the fastest run and the median of every phase of every input from the baseline, then from
+  # the results.
+  awk -v threshold="$threshold" '
+    function read(line, into,    name, rest, key) {
+      if (!match(line, /"[a-z]+-[0-9]+": /)) return ""
+      name = substr(line, RSTART + 1, RLENGTH - 4)
+      rest = substr(line, index(line, "\"min_ms\""))
+      while (match(rest, /"[a-z_]+": [0-9.]+/)) {
+        key = substr(rest, RSTART + 1, RLENGTH - 1)
+        split(key, parts, "\": ")
+        into[name, parts[1]] = parts[2] + 0
+        rest = substr(rest, RSTART + RLENGTH)
+      }
+      return name
+    }
+    FNR == NR { read($0, base); next }
+    {
+      name = read($0, current)
+      if (name == "") next
+      if (!((name, "total") in base)) {
+        printf "%-18s not in the baseline\n", name
+        next
+      }
+      was = base[name, "min_ms"]
+      now = current[name, "min_ms"]
+      change = was > 0 ? (now / was - 1) * 100 : 0
+      if (!slower(was, now)) {
+        printf "%-18s %+7.1f%%\n", name, change
+        next
+      }
+      causes = ""
+      split("lexer parser semcheck ctfe deadcode loopopt inline analysis codegen", phases, " ")
+      for (i = 1; i in phases; i++) {
+        if (slower(base[name, phases[i]], current[name, phases[i]])) {
+          causes = causes sprintf(", %s %.3f -> %.3f ms", phases[i], base[name, phases[i]],
+            current[name, phases[i]])
+        }
+      }
+      printf "%-18s %+7.1f%%  REGRESSION: %.3f -> %.3f ms%s\n", name, change, was, now, causes
+      regressions++
+    }
+    function slower(was, now) {
+      return now > was * (1 + threshold / 100) && now - was > 1
+    }
+    END {
+      if (regressions > 0) {
+        printf "\nRegressed inputs: %d\n", regressions
+        exit 1
+      }
+    }' $baseline $results
+  if [ $? -ne 0 ]; then
+    fail=1
+  fi
+else
+  echo ""
+  echo "No baseline at $baseline, run with --update-baseline to record one."
+fi
+
+rm -rf $work
+exit $fail
@@ -0,0 +1,110 @@
+#define _GNU_SOURCE
+
+#include <linux/perf_event.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+/* Runs a program and counts what it does with perf_event_open, for the runtime
+ * benchmark. Prints one line: the exit status of the program, the processor
+ * time it took in milliseconds, and the instructions, cycles, branches and
+ * branch misses it retired in user space. Counters that the machine does not
+ * have, like the hardware ones in most virtual machines, are printed as "-".
+ * Usage: counters PROGRAM [ARGS...] */
+
+typedef struct {
+  const char *name;
+  uint32_t type;
+  uint64_t config;
+  int fd;
+} counter_t;
+
+static counter_t counters[] = {
+  {"task-clock", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK, -1},
+  {"instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS, -1},
+  {"cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, -1},
+  {"branches", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_INSTRUCTIONS, -1},
+  {"branch-misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES, -1},
+};
+
+#define COUNTER_COUNT ((int) (sizeof(counters) / sizeof(counters[0])))
+
+static int open_counter(counter_t *, pid_t);
+
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    fprintf(stderr, "Usage: %s PROGRAM [ARGS...]\n", argv[0]);
+    return 1;
+  }
+
+  // The child waits until its counters are open, and they start counting when it execs.
+  int ready[2];
+  if (pipe(ready) != 0) {
+    perror("pipe");
+    return 1;
+  }
+  pid_t child = fork();
+  if (child == -1) {
+    perror("fork");
+    return 1;
+  }
+  if (child == 0) {
+    char start;
+    close(ready[1]);
+    if (read(ready[0], &start, 1) < 0) {
+      _exit(127);
+    }
+    close(ready[0]);
+    execv(argv[1], argv + 1);
+    perror(argv[1]);
+    _exit(127);
+  }
+
+  close(ready[0]);
+  for (int i = 0; i < COUNTER_COUNT; i++) {
+    counters[i].fd = open_counter(&counters[i], child);
+  }
+  close(ready[1]);
+
+  int status;
+  if (waitpid(child, &status, 0) != child) {
+    perror("waitpid");
+    return 1;
+  }
+  if (WIFEXITED(status)) {
+    printf("%d", WEXITSTATUS(status));
+  } else {
+    printf("signal-%d", WTERMSIG(status));
+  }
+
+  for (int i = 0; i < COUNTER_COUNT; i++) {
+    uint64_t value;
+    if (counters[i].fd == -1 || read(counters[i].fd, &value, sizeof(value)) != sizeof(value)) {
+      printf(" -");
+    } else if (counters[i].type == PERF_TYPE_SOFTWARE) {
+      printf(" %.3f", value / 1e6); // Nanoseconds
+    } else {
+      printf(" %llu", (unsigned long long) value);
+    }
+  }
+  printf("\n");
+  return 0;
+}
+
+/* Opens a counter of the user space work of the process, counting from its
+ * next exec. Returns -1 if the counter is not available. */
+static int open_counter(counter_t *counter, pid_t pid) {
+  struct perf_event_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = counter->type;
+  attr.config = counter->config;
+  attr.disabled = 1;
+  attr.enable_on_exec = 1;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  return (int) syscall(SYS_perf_event_open, &attr, pid, -1, -1, 0);
+}
@@ -0,0 +1,191 @@
+# Synthetic program generator for the compile benchmark.
+# Usage: ./bench/generate.sh AXIS SIZE [SEED]
+# Prints a program that grows along one axis with SIZE:
+#   functions    SIZE small functions that call earlier ones
+#   long         one function of SIZE statements
+#   nesting      if statements and blocks nested SIZE deep
+#   expressions  an expression of SIZE operands
+#   locals       one function with SIZE local variables
+#   huge         a mix of all of the above, about SIZE lines long
+# The same arguments always give the same program. Random choices come from a Park-Miller
+# generator rather than awk's rand(), which differs between awk implementations.
+
+if [ $# -lt 2 ]; then
+  echo "Usage: $0 AXIS SIZE [SEED]" >&2
+  exit 1
+fi
+
+awk -v axis="$1" -v size="$2" -v seed="${3:-1}" '
+function random(n) {
+  state = (state * 16807) % 2147483647
+  return state % n
+}
+
+# An expression of the given number of operands over the variables in vars[0..var_count).
+function expression(operands,    text, i, group) {
+  text = operand()
+  for (i = 1; i < operands; i++) {
+    if (random(8) == 0 && operands - i > 2) {
+      # A parenthesized group of up to four operands.
+      group = 2 + random(3)
+      text = text " " operator() " (" expression(group) ")"
+      i += group - 1
+    } else {
+      text = text " " operator() " " operand()
+    }
+  }
+  return text
+}
+
+function operand() {
+  if (var_count > 0 && random(3) > 0) {
+    return vars[random(var_count)]
+  }
+  return random(100)
+}
+
+function operator(    r) {
+  r = random(10)
+  return r < 4 ? "+" : r < 7 ? "-" : "*"
+}
+
+function condition() {
+  return vars[random(var_count)] " " (random(2) ? ">" : "<") " " random(100)
+}
+
+# A statement over the variables of the current function, with blocks nested at most depth deep.
+function statement(indent, depth,    r, v) {
+  r = random(depth > 0 ? 10 : 6)
+  v = vars[random(var_count)]
+  if (r < 4) {
+    print indent v " = " expression(2 + random(4)) ";"
+    lines++
+  } else if (r < 5) {
+    print indent "g = g + " operand() ";"
+    lines++
+  } else if (r < 6) {
+    print indent v " = " v " + f" random(function_count > 0 ? function_count : 1) "();"
+    lines++
+  } else if (r < 8) {
+    print indent "if (" condition() ") {"
+    statement(indent "  ", depth - 1)
+    print indent "} else {"
+    statement(indent "  ", depth - 1)
+    print indent "}"
+    lines += 3
+  } else if (r < 9) {
+    print indent "while (" v " > " random(50) ") {"
+    print indent "  " v " = " v " - " (1 + random(5)) ";"
+    statement(indent "  ", depth - 1)
+    print indent "}"
+    lines += 3
+  } else {
+    print indent "for (" v " = 0; " v " < " random(20) "; " v " = " v " + 1) {"
+    statement(indent "  ", depth - 1)
+    print indent "}"
+    lines += 2
+  }
+}
+
+# Declares the locals of a function, and makes them the variables that expressions use.
+function declare_locals(count,    i) {
+  var_count = 0
+  for (i = 0; i < count; i++) {
+    print "  int v" i " = " expression(1 + random(3)) ";"
+    vars[var_count++] = "v" i
+    lines++
+  }
+}
+
+# A function of the given number of statements, that calls earlier functions.
+function define_function(name, statements,    i) {
+  print "int " name "() {"
+  declare_locals(3 + random(3))
+  for (i = 0; i < statements; i++) {
+    statement("  ", 2)
+  }
+  print "  return " expression(3) ";"
+  print "}"
+  lines += 3
+}
+
+# A main that sums the results of every function, so that none of them is unreachable.
+function call_all(    i) {
+  print "int main() {"
+  print "  int sum = 0;"
+  for (i = 0; i < function_count; i++) {
+    print "  sum = sum + f" i "();"
+  }
+  print "  return sum;"
+  print "}"
+}
+
+BEGIN {
+  state = seed > 0 ? seed : 1
+  print "// " axis " " size " (seed " seed ")"
+  print "int g;"
+  lines = 2
+  function_count = 0
+
+  if (axis == "functions") {
+    # f0 calls no function, every other one calls earlier ones.
+    print "int f0() { g = g + 1; return g; }"
+    for (function_count = 1; function_count < size; function_count++) {
+      define_function("f" function_count, 1 + random(2))
+    }
+    call_all()
+  } else if (axis == "long") {
+    print "int f0() { g = g + 1; return g; }"
+    function_count = 1
+    print "int main() {"
+    declare_locals(8)
+    for (i = 0; i < size; i++) {
+      statement("  ", 1)
+    }
+    print "  return v0;"
+    print "}"
+  } else if (axis == "nesting") {
+    print "int main() {"
+    declare_locals(4)
+    indent = "  "
+    for (i = 0; i < size; i++) {
+      if (i % 2 == 0) {
+        print indent "if (" condition() ") {"
+      } else {
+        print indent "{"
+      }
+      print indent "  " vars[random(var_count)] " = " expression(3) ";"
+      indent = indent " "
+    }
+    for (i = 0; i < size; i++) {
+      indent = substr(indent, 2)
+      print indent "}"
+    }
+    print "  return v0;"
+    print "}"
+  } else if (axis == "expressions") {
+    print "int main() {"
+    declare_locals(8)
+    print "  return " expression(size) ";"
+    print "}"
+  } else if (axis == "locals") {
+    print "int main() {"
+    var_count = 0
+    for (i = 0; i < size; i++) {
+      # Each local is computed from earlier ones, so that every one is looked up.
+      print "  int v" i " = " expression(1 + random(3)) ";"
+      vars[var_count++] = "v" i
+    }
+    print "  return " expression(8) ";"
+    print "}"
+  } else if (axis == "huge") {
+    print "int f0() { g = g + 1; return g; }"
+    for (function_count = 1; lines < size; function_count++) {
+      define_function("f" function_count, 4 + random(12))
+    }
+    call_all()
+  } else {
+    print "Unknown axis " axis > "/dev/stderr"
+    exit 1
+  }
+}'
@@ -0,0 +1,42 @@
+# Interpreter benchmark.
+# Runs every program under ./bench/interp with the bytecode interpreter (--interpret) and with the
+# naive AST walker (--interpret-ast), and prints the best of a few wall clock times for each. Both
+# must return the same exit status.
+
+comp="./bin/paola"
+runs=3
+fail=0
+
+# Prints the best time in milliseconds of running paola with the given arguments.
+best_time () {
+  best=""
+  for run in $(seq $runs); do
+    start=$(date +%s%N)
+    $comp "$@" > /dev/null
+    elapsed=$(( ($(date +%s%N) - start) / 1000000 ))
+    if [ "$best" = "" ] || [ $elapsed -lt $best ]; then
+      best=$elapsed
+    fi
+  done
+  echo $best
+}
+
+printf "%-28s %10s %10s %8s\n" "program" "ast (ms)" "bytecode" "speedup"
+for program in $(find ./bench/interp -name '*.c' | sort); do
+  $comp --interpret $program > /dev/null
+  bytecode_status=$?
+  $comp --interpret-ast $program > /dev/null
+  ast_status=$?
+  if [ $bytecode_status -ne $ast_status ]; then
+    echo "$program: --interpret returned $bytecode_status, --interpret-ast returned $ast_status."
+    fail=1
+    continue
+  fi
+
+  ast=$(best_time --interpret-ast $program)
+  bytecode=$(best_time --interpret $program)
+  speedup=$(awk "BEGIN { printf \"%.2fx\", $ast / ($bytecode > 0 ? $bytecode : 1) }")
+  printf "%-28s %10s %10s %8s\n" "$program" "$ast" "$bytecode" "$speedup"
+done
+
+exit $fail
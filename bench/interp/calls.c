@@ -0,0 +1,17 @@
+// A small function called from a hot loop, through globals.
+int acc;
+int step;
+
+int advance() {
+  acc = acc + step;
+  if (acc > 1000000) acc = acc - 1000000;
+  return acc;
+}
+
+int main() {
+  int last = 0;
+  for (step = 1; step < 2000000; step = step + 1) {
+    last = advance();
+  }
+  return last;
+}
@@ -0,0 +1,12 @@
+// Nested counting loops over locals.
+int main() {
+  int sum = 0;
+  int i;
+  int j;
+  for (i = 0; i < 3000; i = i + 1) {
+    for (j = 0; j < 1000; j = j + 1) {
+      sum = sum + i * j - (sum / 7);
+    }
+  }
+  return sum;
+}
@@ -0,0 +1,19 @@
+// Counts primes by trial division.
+int main() {
+  int count = 0;
+  int n = 2;
+  while (n < 200000) {
+    int d = 2;
+    int prime = 1;
+    while (d * d <= n) {
+      if ((n / d) * d == n) {
+        prime = 0;
+        d = n;
+      }
+      d = d + 1;
+    }
+    count = count + prime;
+    n = n + 1;
+  }
+  return count;
+}
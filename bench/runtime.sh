@@ -0,0 +1,132 @@
+# Runtime benchmark of the generated code.
+# Usage: ./bench/runtime.sh [--runs N]
+# Compiles every program under ./bench/runtime with paola and with gcc -O0 and -O2, runs each
+# executable a few times (5 by default) and prints the processor time of the fastest run, how much
+# slower paola's code is than each of gcc's, and the size of the code: the bytes of its text
+# sections and the instructions in them. All three must return the same exit status.
+# The runs are measured by ./bench/counters.c with perf_event_open. Where the machine has hardware
+# counters, a last table shows the instructions, cycles and branch misses of the fastest runs;
+# virtual machines often have none, and then only the processor time is measured.
+
+comp="./bin/paola"
+runs=5
+
+while [ $# -gt 0 ]; do
+  case "$1" in
+    --runs) runs=$2; shift ;;
+    *) echo "Unknown option $1"; exit 1 ;;
+  esac
+  shift
+done
+
+work=$(mktemp -d /tmp/paola-runtime.XXXXXX)
+counters="$work/counters"
+if ! ${CC:-cc} -O2 -std=c11 ./bench/counters.c -o $counters; then
+  echo "Could not build ./bench/counters.c."
+  rm -rf $work
+  exit 1
+fi
+compilers="paola O0 O2"
+fail=0
+hardware=0
+
+# Builds the executable and the object of the program with the given compiler, as $work/NAME.COMPILER
+# and $work/NAME.COMPILER.o.
+build () {
+  program=$1
+  compiler=$2
+  out="$work/$(basename $program .c).$compiler"
+  if [ $compiler = paola ]; then
+    $comp $program -o $out.s > $out.log && $comp -c $program -o $out.o >> $out.log &&
+      gcc $out.s -o $out 2>> $out.log
+  else
+    gcc -w -$compiler $program -o $out 2> $out.log && gcc -w -$compiler -c $program -o $out.o 2>> $out.log
+  fi
+}
+
+# Prints the line of ./bench/counters.c of the fastest of the runs of the executable.
+fastest () {
+  for run in $(seq $runs); do
+    $counters $1
+  done | sort -k2,2n | head -n 1
+}
+
+# Prints the bytes in the text sections of the object, and the instructions in them.
+code_size () {
+  bytes=$(size -A $1 | awk '$1 ~ /^\.text/ { bytes += $2 } END { print bytes + 0 }')
+  instructions=$(objdump -d $1 | grep -cE '^ +[0-9a-f]+:')
+  echo $bytes $instructions
+}
+
+printf "%-12s %10s %10s %10s %8s %8s   %-17s %s\n" "program" "paola ms" "-O0 ms" "-O2 ms" \
+  "vs -O0" "vs -O2" "text bytes" "instructions"
+for program in $(find ./bench/runtime -name '*.c' | sort); do
+  name=$(basename $program .c)
+  line="$name"
+  statuses=""
+  for compiler in $compilers; do
+    if ! build $program $compiler; then
+      echo "$name: compiling with $compiler failed:"
+      cat $work/$name.$compiler.log
+      fail=1
+      continue 2
+    fi
+    fastest $work/$name.$compiler > $work/$name.$compiler.run
+    read status task instructions cycles branches misses < $work/$name.$compiler.run
+    statuses="$statuses $status"
+    echo "$(code_size $work/$name.$compiler.o)" >> $work/$name.size
+    if [ "$instructions" != "-" ]; then
+      hardware=1
+    fi
+  done
+
+  set -- $statuses
+  if [ "$1" != "$2" ] || [ "$1" != "$3" ]; then
+    echo "$name: paola returned $1, gcc -O0 returned $2, gcc -O2 returned $3."
+    fail=1
+    continue
+  fi
+
+  # The runs and the sizes, in the order of the compilers.
+  cat $work/$name.paola.run $work/$name.O0.run $work/$name.O2.run $work/$name.size |
+    awk -v name="$name" '
+      NR <= 3 { time[NR] = $2 }
+      NR > 3 { bytes[NR - 3] = $1; instructions[NR - 3] = $2 }
+      END {
+        printf("%-12s %10.1f %10.1f %10.1f %7.2fx %7.2fx   %5d %5d %5d   %5d %5d %5d\n", name,
+          time[1], time[2], time[3], time[1] / time[2], time[1] / time[3], bytes[1], bytes[2],
+          bytes[3], instructions[1], instructions[2], instructions[3])
+      }' | tee -a $work/table
+done
+
+# The geometric means of the ratios, which weigh every program the same however long it runs.
+if [ -f $work/table ]; then
+  awk '{ o0 += log($5 + 0); o2 += log($6 + 0); n++ }
+    END { printf("%-12s %32s %7.2fx %7.2fx\n", "geomean", "", exp(o0 / n), exp(o2 / n)) }' $work/table
+fi
+
+if [ $hardware -eq 1 ]; then
+  echo ""
+  printf "%-12s %-8s %14s %14s %6s %14s %8s\n" "program" "compiler" "instructions" "cycles" "IPC" \
+    "branches" "misses"
+  for program in $(find ./bench/runtime -name '*.c' | sort); do
+    name=$(basename $program .c)
+    for compiler in $compilers; do
+      if [ -f $work/$name.$compiler.run ]; then
+        read status task instructions cycles branches misses < $work/$name.$compiler.run
+        awk -v name="$name" -v compiler="$compiler" -v instructions="$instructions" \
+            -v cycles="$cycles" -v branches="$branches" -v misses="$misses" 'BEGIN {
+          ipc = cycles > 0 ? sprintf("%.2f", instructions / cycles) : "-"
+          printf("%-12s %-8s %14s %14s %6s %14s %8s\n", name, compiler, instructions, cycles, ipc,
+            branches, misses)
+        }'
+      fi
+    done
+  done
+else
+  echo ""
+  echo "No hardware counters on this machine, only the processor time was measured."
+fi
+
+rm -rf $work
+exit $fail
@@ -0,0 +1,18 @@
+// A small function called from a hot loop, through globals. The result is kept
+// in a global too, as locals do not survive calls yet.
+int acc;
+int step;
+int last;
+
+int advance() {
+  acc = acc + (step - ((step / 1000) * 1000));
+  if (acc > 1000000) acc = acc - 1000000;
+  return acc;
+}
+
+int main() {
+  for (step = 1; step < 20000000; step = step + 1) {
+    last = advance();
+  }
+  return last - ((last / 256) * 256);
+}
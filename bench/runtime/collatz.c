@@ -0,0 +1,18 @@
+// Sums the lengths of the Collatz sequences of the numbers below a bound.
+int main() {
+  int total = 0;
+  int n;
+  for (n = 1; n < 100000; n = n + 1) {
+    int x = n;
+    while (x > 1) {
+      if ((x / 2) * 2 == x) {
+        x = x / 2;
+      } else {
+        x = (3 * x) + 1;
+      }
+      total = total + 1;
+    }
+    if (total > 100000000) total = total - 100000000;
+  }
+  return total - ((total / 256) * 256);
+}
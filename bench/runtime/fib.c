@@ -0,0 +1,22 @@
+// Naive recursive Fibonacci. The argument and the result are passed in globals.
+int n;
+int result;
+
+int fib() {
+  if (n < 2) {
+    result = result + n;
+    return 0;
+  }
+  n = n - 1;
+  fib();
+  n = n - 1;
+  fib();
+  n = n + 2;
+  return 0;
+}
+
+int main() {
+  n = 32;
+  fib();
+  return result - ((result / 256) * 256);
+}
@@ -0,0 +1,20 @@
+// Sums the greatest common divisors of all pairs below a bound, by Euclid's algorithm.
+int main() {
+  int sum = 0;
+  int i;
+  int j;
+  for (i = 1; i < 1500; i = i + 1) {
+    for (j = 1; j < 1500; j = j + 1) {
+      int a = i;
+      int b = j;
+      while (b > 0) {
+        int r = a - ((a / b) * b);
+        a = b;
+        b = r;
+      }
+      sum = sum + a;
+      if (sum > 1000000) sum = sum - 1000000;
+    }
+  }
+  return sum - ((sum / 256) * 256);
+}
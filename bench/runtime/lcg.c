@@ -0,0 +1,12 @@
+// Steps a linear congruential generator, reducing by division instead of a remainder operator.
+int main() {
+  int x = 12345;
+  int hits = 0;
+  int i;
+  for (i = 0; i < 20000000; i = i + 1) {
+    x = (x * 1103) + 12345;
+    x = x - ((x / 1048573) * 1048573);
+    if (x < 524288) hits = hits + 1;
+  }
+  return hits - ((hits / 256) * 256);
+}
@@ -0,0 +1,14 @@
+// Nested counting loops evaluating a polynomial over locals.
+int main() {
+  int sum = 0;
+  int i;
+  int j;
+  for (i = 0; i < 4000; i = i + 1) {
+    for (j = 0; j < 2000; j = j + 1) {
+      sum = sum + ((i * j) - ((i + j) * 3));
+      while (sum > 1000000) sum = sum - 1000000;
+      if (sum < 0) sum = sum + 1000000;
+    }
+  }
+  return sum - ((sum / 256) * 256);
+}
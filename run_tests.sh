@@ -7,17 +7,105 @@
 # @COMPILE OK: Alias for @COMPILE_STATUS 0
 # @COMPILE_MESSAGE {string}: (TODO) Part of the messages the compiler is expected to print.
 # @EXPECT {int8}: The exit status of the compiled executable.
+# @EDIT {sed command}: With --incremental, the test is edited with the command and compiled again
+# from the index of the first compile, which must give the assembly of compiling it from scratch.
+# @NEEDS_PASS {name}: An optimization pass the program does not work without, like tail calls for
+# recursion deeper than the stack. The test is skipped when the pass does not run.
+# Programs that are expected to run are built twice: through the assembler, and as an object file
+# written by paola itself (-c). Both executables must return the expected status. The assembly
+# must not change when functions are compiled in parallel (-j 4).
+# With --jit, programs are only run in memory by paola (--run), without the assembler or linker.
+# With --interpret, programs are only run by paola's bytecode interpreter (--interpret).
+# With --server, every program is compiled by a paola compile server (--server) instead.
+# With --cache, programs are compiled with a fresh cache (--cache-dir), so that compiling them again
+# with -j 4 must give the cached assembly.
+# With --incremental, programs are compiled with --incremental, and compiling them with -j 4 starts
+# from the index of the first compile, so that reused functions must give the same assembly.
+# With --instrument, programs are compiled with --instrument, and every run must write a profile
+# that counts one call to main.
+# With --pgo, programs are first compiled with --profile-generate and run, which must give the
+# expected status and write a profile. They are then compiled with --profile-use, which must not
+# find the profile stale.
+# With --frame-pointer, programs are compiled with -fno-omit-frame-pointer.
+# With --O0 or --O1, programs are compiled with fewer optimization passes, -O0 or -O1, and the tests
+# that need the other passes are skipped.
 
 fail=0
 pass=0
 total=0
 comp="./bin/paola"
+run_flag=""
+if [ "$1" == "--jit" ]; then
+  run_flag="--run"
+elif [ "$1" == "--interpret" ]; then
+  run_flag="--interpret"
+elif [ "$1" == "--server" ]; then
+  socket=$(mktemp -u /tmp/paola.XXXXXX.sock)
+  $comp --server $socket -j 4 > /dev/null &
+  server=$!
+  while [ ! -S $socket ] && kill -0 $server 2> /dev/null; do
+    sleep 0.05
+  done
+  comp="$comp --connect $socket"
+elif [ "$1" == "--cache" ]; then
+  cache=$(mktemp -d /tmp/paola.XXXXXX)
+  comp="$comp --cache-dir $cache"
+elif [ "$1" == "--incremental" ]; then
+  incremental=1
+  comp="$comp --incremental"
+elif [ "$1" == "--instrument" ]; then
+  instrument=1
+  comp="$comp --instrument"
+elif [ "$1" == "--pgo" ]; then
+  pgo=1
+  comp="$comp --profile-use out.s.pgo"
+elif [ "$1" == "--frame-pointer" ]; then
+  comp="$comp -fno-omit-frame-pointer"
+elif [ "$1" == "--O0" ]; then
+  comp="$comp -O0"
+  disabled_passes="ctfe deadcode loopopt inline tailcall unroll"
+elif [ "$1" == "--O1" ]; then
+  comp="$comp -O1"
+  disabled_passes="loopopt unroll"
+fi
 
 REDCOL='\033[0;31m'
 GREENCOL='\033[0;32m'
 NOCOL='\033[0m'
 
+# Runs ./out, and checks the profile it writes when instrumented.
+run_out () {
+  rm -f paola-profile.txt
+  (./out)
+  actual_binary_status=$?
+  if [ "$instrument" != "" ] && ! grep -Eq '^main +1 ' paola-profile.txt 2> /dev/null; then
+    actual_binary_status="no profile"
+  fi
+}
+
+# Writes the profile that compiling with --pgo uses, with a build of the program that counts.
+train () {
+  rm -f out.s.pgo
+  (./bin/paola --profile-generate $test -o out.s > /dev/null) && g++ out.s -o out
+  if [ $? -ne 0 ]; then
+    training="could not build it"
+    return
+  fi
+  (./out)
+  training=$?
+  if [ ! -f out.s.pgo ]; then
+    training="no profile"
+  elif $comp $test -o out.s | grep -Fq "profile"; then
+    training="a stale profile"
+  fi
+}
+
 run_test () {
+  needed_pass=`cat $test | sed -En 's/.*@NEEDS_PASS ([a-z]+)/\1/p'`
+  if [ "$needed_pass" != "" ] && echo " $disabled_passes " | grep -Fq " $needed_pass "; then
+    echo " SKIP $test: needs the $needed_pass pass"
+    return;
+  fi
   total=$((total+1))
   expected_binary_status=`cat $test | sed -En 's/.*@EXPECT ([0-9]+)/\1/p'`
   expected_compile_status=`cat $test | sed -En 's/.*@COMPILE_STATUS ([0-9]+)/\1/p'`
@@ -40,6 +128,16 @@ run_test () {
     return;
   fi
 
+  if [ "$pgo" != "" ] && [ "$expected_compile_status" -eq 0 ]; then
+    train
+    if [ "$training" != "$expected_binary_status" ]; then
+      echo "$REDCOL FAIL$NOCOL $test:\n\tExpected $expected_binary_status from --profile-generate, \
+got $training."
+      fail=$((fail+1))
+      return;
+    fi
+  fi
+
   ($comp $test > /dev/null)
   compile_status=$?
   if [ "$compile_status" -ne "$expected_compile_status" ]; then
@@ -55,6 +153,45 @@ expected $expected_compile_status."
     return;
   fi
 
+  if [ "$run_flag" != "" ]; then
+    ($comp $run_flag $test > /dev/null)
+    actual_binary_status=$?
+    if [ "$actual_binary_status" -ne "$expected_binary_status" ]; then
+      echo "$REDCOL FAIL$NOCOL $test:\n\tExpected $expected_binary_status from $run_flag, got \
+$actual_binary_status."
+      fail=$((fail+1))
+    else
+      echo "$GREENCOL PASS$NOCOL $test "
+      pass=$((pass+1))
+    fi
+    return;
+  fi
+
+  if [ "$incremental" != "" ]; then
+    cp out.s.idx out.j4.s.idx
+  fi
+  ($comp -j 4 $test -o out.j4.s > /dev/null) && cmp -s out.s out.j4.s
+  if [ $? -ne 0 ]; then
+    echo "$REDCOL FAIL$NOCOL $test:\n\tCompiling with -j 4 gave different assembly."
+    fail=$((fail+1))
+    return;
+  fi
+
+  edit=`cat $test | sed -En 's/.*@EDIT (.*)/\1/p'`
+  if [ "$incremental" != "" ] && [ "$edit" != "" ]; then
+    sed -E "$edit" $test > out.edit.c
+    cp out.s.idx out.j4.s.idx
+    rm -f out.edit.s.idx
+    ($comp out.edit.c -o out.edit.s > /dev/null) && ($comp out.edit.c -o out.j4.s > /dev/null) \
+        && cmp -s out.edit.s out.j4.s
+    if [ $? -ne 0 ]; then
+      echo "$REDCOL FAIL$NOCOL $test:\n\tCompiling the edited test from the index gave different \
+assembly."
+      fail=$((fail+1))
+      return;
+    fi
+  fi
+
   g++ out.s -o out
   assemblestatus=$?
   if [ "$assemblestatus" -ne 0 ]; then
@@ -63,10 +200,25 @@ expected $expected_compile_status."
     return;
   fi
 
-  (./out)
-  actual_binary_status=$?
-  if [ "$actual_binary_status" -ne "$expected_binary_status" ]; then
-    echo "$REDCOL FAIL$NOCOL $test:\n\tExpected $expect, got $actual."
+  run_out
+  if [ "$actual_binary_status" != "$expected_binary_status" ]; then
+    echo "$REDCOL FAIL$NOCOL $test:\n\tExpected $expected_binary_status, got $actual_binary_status."
+    fail=$((fail+1))
+    return;
+  fi
+
+  ($comp -c $test -o out.o > /dev/null) && g++ out.o -o out
+  objectstatus=$?
+  if [ "$objectstatus" -ne 0 ]; then
+    echo "$REDCOL FAIL$NOCOL $test:\n\tBuilding from an object file returned exit status $objectstatus."
+    fail=$((fail+1))
+    return;
+  fi
+
+  run_out
+  if [ "$actual_binary_status" != "$expected_binary_status" ]; then
+    echo "$REDCOL FAIL$NOCOL $test:\n\tExpected $expected_binary_status from the object file, got \
+$actual_binary_status."
     fail=$((fail+1))
   else
     echo "$GREENCOL PASS$NOCOL $test "
@@ -78,8 +230,21 @@ for test in $(find ./tests -name '*.c'); do
   run_test
 done
 
+if [ "$socket" != "" ]; then
+  $comp --shutdown > /dev/null
+fi
+if [ "$cache" != "" ]; then
+  rm -rf $cache
+fi
+
 rm -f out.s
+rm -f out.j4.s
+rm -f out.s.idx out.j4.s.idx
+rm -f out.edit.c out.edit.s out.edit.s.idx
+rm -f out.o
 rm -f out
+rm -f paola-profile.txt
+rm -f out.s.pgo
 
 echo ""
 if [ $pass -eq $total ]; then
@@ -0,0 +1,101 @@
+#include <stdatomic.h>
+#include <stdlib.h>
+#include "arena.h"
+#include "context.h"
+
+/* Each thread allocates from a block of its own, by bumping a pointer, and
+ * only takes the lock of the arena to get the next block. Threads that work
+ * in the same context share its arena this way. */
+
+#define BLOCK_SIZE (1 << 16)
+
+typedef struct {
+  arena_t *arena;
+  uint64_t generation; // Of the arena when the block was taken
+  char *next, *end;
+} cursor_t;
+
+static uint64_t next_generation(void);
+static void take_block(arena_t *, size_t);
+
+static _Thread_local cursor_t cursor;
+
+void arena_init(arena_t *arena) {
+  mtx_init(&arena->lock, mtx_plain);
+  arena->used = NULL;
+  arena->free = NULL;
+  arena->allocated = 0;
+  arena->generation = next_generation();
+}
+
+/* Takes back everything allocated from the arena. Blocks of the usual size are
+ * kept for the next compilation, larger ones are freed. The arena must not be
+ * in use by other threads. */
+void arena_reset(arena_t *arena) {
+  while (arena->used) {
+    arena_block_t *block = arena->used;
+    arena->used = block->next;
+    if (block->size == BLOCK_SIZE) {
+      block->next = arena->free;
+      arena->free = block;
+    } else {
+      free(block);
+    }
+  }
+  arena->allocated = 0;
+  arena->generation = next_generation();
+}
+
+void arena_destroy(arena_t *arena) {
+  arena_reset(arena);
+  while (arena->free) {
+    arena_block_t *block = arena->free;
+    arena->free = block->next;
+    free(block);
+  }
+  mtx_destroy(&arena->lock);
+}
+
+/* Allocates memory from the arena of the calling thread's context, aligned
+ * for any type. */
+void *arena_alloc(size_t size) {
+  size = (size + sizeof(max_align_t) - 1) / sizeof(max_align_t) * sizeof(max_align_t);
+  arena_t *arena = &context->arena;
+  if (cursor.arena != arena || cursor.generation != arena->generation
+      || (size_t) (cursor.end - cursor.next) < size) {
+    take_block(arena, size);
+  }
+
+  void *memory = cursor.next;
+  cursor.next += size;
+  return memory;
+}
+
+/* Generations are unique among all arenas, so that a thread cannot mistake a
+ * new arena at the address of a destroyed one for the old one. */
+static uint64_t next_generation(void) {
+  static atomic_uint_least64_t generations = 1;
+  return atomic_fetch_add(&generations, 1);
+}
+
+/* Points the cursor to a block with at least size bytes. */
+static void take_block(arena_t *arena, size_t size) {
+  size_t block_size = size > BLOCK_SIZE ? size : BLOCK_SIZE;
+  mtx_lock(&arena->lock);
+  arena_block_t *block = arena->free;
+  if (block && block_size == BLOCK_SIZE) {
+    arena->free = block->next;
+  } else {
+    block = (arena_block_t *) malloc(sizeof(arena_block_t) + block_size);
+    block->size = block_size;
+  }
+  block->next = arena->used;
+  arena->used = block;
+  arena->allocated += block_size;
+  mtx_unlock(&arena->lock);
+
+  cursor.arena = arena;
+  cursor.generation = arena->generation;
+  cursor.next = (char *) block->data;
+  cursor.end = cursor.next + block_size;
+}
@@ -0,0 +1,30 @@
+#ifndef ARENA_H
+#define ARENA_H
+#include <stddef.h>
+#include <stdint.h>
+#include <threads.h>
+
+/* Memory for the objects that live as long as a compilation: names, the AST,
+ * symbols and call sites. They are never freed one by one, the whole arena is
+ * reset before the next compilation instead, and its blocks are used again. */
+
+typedef struct arena_block {
+  struct arena_block *next;
+  size_t size;
+  max_align_t data[]; // size bytes
+} arena_block_t;
+
+typedef struct {
+  mtx_t lock;
+  arena_block_t *used; // Blocks handed out since the last reset
+  arena_block_t *free; // Blocks to hand out again
+  uint64_t generation; // Changes on every reset, unique to the arena
+  uint64_t allocated; // Bytes in the blocks handed out since the last reset
+} arena_t;
+
+void arena_init(arena_t *);
+void arena_reset(arena_t *);
+void arena_destroy(arena_t *);
+void *arena_alloc(size_t);
+
+#endif
@@ -0,0 +1,19 @@
+#include "arith.h"
+
+/* Division as generated: idivq with the dividend zero-extended into rdx:rax.
+ * Returns false where the CPU faults, for a zero divisor or a quotient out of
+ * range. */
+bool arith_divide(int64_t dividend, int64_t divisor, int64_t *quotient) {
+  uint64_t magnitude = (uint64_t) dividend;
+  if (divisor == 0) {
+    return false;
+  }
+  if (divisor > 0) {
+    uint64_t result = magnitude / (uint64_t) divisor;
+    *quotient = (int64_t) result;
+    return result <= INT64_MAX;
+  }
+  uint64_t result = magnitude / (0 - (uint64_t) divisor);
+  *quotient = (int64_t) (0 - result);
+  return result <= (uint64_t) INT64_MAX + 1;
+}
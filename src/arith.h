@@ -0,0 +1,11 @@
+#ifndef ARITH_H
+#define ARITH_H
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Arithmetic as the generated code does it, for the passes that compute
+ * values at compile time. */
+
+bool arith_divide(int64_t, int64_t, int64_t *);
+
+#endif
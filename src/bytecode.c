@@ -0,0 +1,409 @@
+#pragma GCC diagnostic ignored "-Wwrite-strings"
+
+#include <stdlib.h>
+#include <string.h>
+#include "bytecode.h"
+#include "callgraph.h"
+#include "errors.h"
+
+/* Lowering of the checked AST to bytecode. Local variables get the first
+ * registers of their function's frame, in declaration order, and expression
+ * temporaries are allocated above them. Temporaries only live for the
+ * statement that computes them, so the frame is as large as the locals plus the
+ * most temporaries a single statement needs.
+ *
+ * Conditions that are comparisons become a single compare-and-branch, and
+ * return statements whose value is a call become tail calls.
+ *
+ * Lowering itself never reports errors, as the program may only be lowered to
+ * evaluate parts of it at compile time. Functions that cannot be lowered, being
+ * too large or calling a function without a body, are marked as failed. */
+
+#define MAX_FRAME_SIZE 65535
+#define MAX_BRANCH_TARGET 65535
+
+static void lower_function(bc_function_t *, symbol_t *);
+static void number_locals(stat_ast_t *);
+static void lower_stat(stat_ast_t *);
+static int lower_expr(expr_ast_t *, int);
+static void lower_branch(expr_ast_t *, bool, int **, int *);
+static bool has_assign(expr_ast_t *);
+static int temp(void);
+static int emit(bc_op_t, int, int, int);
+static int emit_imm(bc_op_t, int, int32_t);
+static void patch(int, int);
+static void patch_all(int *, int, int);
+static int function_number(expr_ast_t *);
+
+static _Thread_local bc_program_t *program;
+static _Thread_local bc_function_t *function; // The function being lowered
+static _Thread_local int next_temp;
+
+static const char *bc_op_names[BC_OP_COUNT] = {
+  "LOADI", "MOV", "ADD", "SUB", "MUL", "DIV", "EQ", "LT", "LTE", "GT", "GTE", "JEQ", "JNE",
+  "JLT", "JLTE", "JGT", "JGTE", "LOADG", "STOREG", "JMP", "JZ", "JNZ", "CALL", "TAILCALL",
+  "RET"
+};
+
+bc_program_t *lower_program(stat_ast_t *ast) {
+  program = (bc_program_t *) calloc(1, sizeof(bc_program_t));
+
+  // Globals, with their initial values.
+  int capacity = 16;
+  program->globals = (int64_t *) malloc(sizeof(int64_t) * capacity);
+  for (list_elem_t *e = list_begin(&ast->stats); e != list_end(&ast->stats);
+      e = list_next(e)) {
+    stat_ast_t *stat = list_entry(e, stat_ast_t, block_elem);
+    if (stat->type != DECL_STAT || stat->is_func || !stat->symbol) {
+      continue;
+    }
+    if (program->global_count == capacity) {
+      capacity *= 2;
+      program->globals = (int64_t *) realloc(program->globals, sizeof(int64_t) * capacity);
+    }
+    stat->symbol->slot = program->global_count;
+    program->globals[program->global_count++] = stat->value ? stat->value->ival : 0;
+  }
+
+  symbol_t **functions;
+  program->function_count = callgraph_functions(&functions);
+  program->functions = (bc_function_t *) calloc(program->function_count + 1,
+      sizeof(bc_function_t));
+  program->main = -1;
+  for (int i = 0; i < program->function_count; i++) {
+    if (strcmp(functions[i]->name, "main") == 0) {
+      program->main = i;
+    }
+    lower_function(&program->functions[i], functions[i]);
+  }
+
+  return program;
+}
+
+void bc_free(bc_program_t *prog) {
+  for (int i = 0; i < prog->function_count; i++) {
+    free(prog->functions[i].code);
+  }
+  free(prog->functions);
+  free(prog->globals);
+  free(prog);
+}
+
+/* Reports an error for each function that failed to lower, and for a missing
+ * main. Returns true if the whole program can be run. */
+bool bc_check(bc_program_t *program) {
+  bool runnable = program->main != -1;
+  if (!runnable) {
+    error(0, "The program has no main function.");
+  }
+  for (int i = 0; i < program->function_count; i++) {
+    bc_function_t *function = &program->functions[i];
+    if (function->failed) {
+      error(&function->symbol->decl->pos, "Function %s cannot be interpreted.",
+          function->symbol->name);
+      runnable = false;
+    }
+  }
+  return runnable;
+}
+
+/* Replaces the code of a function with returning a constant, once its value is
+ * known. */
+void bc_set_constant(bc_program_t *prog, int number, int32_t value) {
+  function = &prog->functions[number];
+  function->size = 0;
+  function->frame_size = function->frame_size > 0 ? function->frame_size : 1;
+  emit_imm(BC_LOADI, 0, value);
+  emit(BC_RET, 0, 0, 0);
+}
+
+const char *bc_op_to_str(bc_op_t op) {
+  return op < BC_OP_COUNT ? bc_op_names[op] : "INVALID";
+}
+
+static void lower_function(bc_function_t *target, symbol_t *symbol) {
+  function = target;
+  function->symbol = symbol;
+  function->local_count = 0;
+  number_locals(symbol->decl->func_body);
+  function->frame_size = function->local_count;
+
+  lower_stat(symbol->decl->func_body);
+
+  // Falling off the end returns 0.
+  next_temp = function->local_count;
+  int zero = temp();
+  emit_imm(BC_LOADI, zero, 0);
+  emit(BC_RET, zero, 0, 0);
+
+  if (function->frame_size > MAX_FRAME_SIZE || function->size > MAX_BRANCH_TARGET) {
+    function->failed = true;
+  }
+}
+
+/* Gives every local variable of the function body a register. Nested
+ * functions have frames of their own. */
+static void number_locals(stat_ast_t *stat) {
+  switch (stat->type) {
+    case IF_STAT:
+      number_locals(stat->tstat);
+      if (stat->fstat) {
+        number_locals(stat->fstat);
+      }
+      break;
+    case WHILE_STAT:
+    case FOR_STAT:
+      number_locals(stat->body);
+      break;
+    case BLOCK_STAT:
+      for (list_elem_t *e = list_begin(&stat->stats); e != list_end(&stat->stats);
+          e = list_next(e)) {
+        number_locals(list_entry(e, stat_ast_t, block_elem));
+      }
+      break;
+    case DECL_STAT:
+      if (!stat->is_func) {
+        stat->symbol->slot = function->local_count++;
+      }
+      break;
+    default:
+      break;
+  }
+}
+
+static void lower_stat(stat_ast_t *stat) {
+  next_temp = function->local_count;
+
+  switch (stat->type) {
+    case RETURN_STAT: {
+      int callee = stat->expr->type == FUNC_CALL ? function_number(stat->expr) : -1;
+      if (callee != -1) {
+        emit_imm(BC_TAILCALL, 0, callee);
+      } else {
+        emit(BC_RET, lower_expr(stat->expr, -1), 0, 0);
+      }
+      break;
+    } case IF_STAT: {
+      int *false_jumps = 0, false_count = 0;
+      lower_branch(stat->cond, false, &false_jumps, &false_count);
+      lower_stat(stat->tstat);
+
+      if (stat->fstat) {
+        int end_jump = emit_imm(BC_JMP, 0, 0);
+        patch_all(false_jumps, false_count, function->size);
+        lower_stat(stat->fstat);
+        patch(end_jump, function->size);
+      } else {
+        patch_all(false_jumps, false_count, function->size);
+      }
+      free(false_jumps);
+      break;
+    } case WHILE_STAT:
+      case FOR_STAT: {
+      // The condition is tested at the bottom, like in the generated code.
+      if (stat->type == FOR_STAT) {
+        lower_expr(stat->init, -1);
+      }
+      int cond_jump = emit_imm(BC_JMP, 0, 0);
+
+      int body = function->size;
+      lower_stat(stat->body);
+      if (stat->type == FOR_STAT) {
+        next_temp = function->local_count;
+        lower_expr(stat->iter, -1);
+      }
+
+      patch(cond_jump, function->size);
+      next_temp = function->local_count;
+      int *true_jumps = 0, true_count = 0;
+      lower_branch(stat->cond, true, &true_jumps, &true_count);
+      patch_all(true_jumps, true_count, body);
+      free(true_jumps);
+      break;
+    } case BLOCK_STAT: {
+      for (list_elem_t *e = list_begin(&stat->stats); e != list_end(&stat->stats);
+          e = list_next(e)) {
+        lower_stat(list_entry(e, stat_ast_t, block_elem));
+      }
+      break;
+    } case DECL_STAT: {
+      if (!stat->is_func && stat->value) {
+        lower_expr(stat->value, stat->symbol->slot);
+      }
+      break;
+    } case EXPR_STAT: {
+      lower_expr(stat->expr, -1);
+      break;
+    } case SKIP_STAT: {
+      break;
+    } default: {
+      function->failed = true;
+    }
+  }
+}
+
+/* Lowers the expression into the dst register, or into whatever register is
+ * convenient if dst is -1. Returns the register holding the value. */
+static int lower_expr(expr_ast_t *expr, int dst) {
+  switch (expr->type) {
+    case INT_LIT: {
+      dst = dst == -1 ? temp() : dst;
+      emit_imm(BC_LOADI, dst, expr->ival);
+      return dst;
+    } case VAR_REF: {
+      symbol_t *symbol = expr->symbol;
+      if (symbol->is_global) {
+        dst = dst == -1 ? temp() : dst;
+        emit_imm(BC_LOADG, dst, symbol->slot);
+      } else if (dst != -1 && dst != symbol->slot) {
+        emit(BC_MOV, dst, symbol->slot, 0);
+      } else {
+        dst = symbol->slot;
+      }
+      return dst;
+    } case FUNC_CALL: {
+      int callee = function_number(expr);
+      dst = dst == -1 ? temp() : dst;
+      emit_imm(BC_CALL, dst, callee == -1 ? 0 : callee);
+      return dst;
+    } case BIN_OP: {
+      if (expr->op == ASSIGN) {
+        symbol_t *symbol = expr->left->symbol;
+        if (symbol->is_global) {
+          int value = lower_expr(expr->right, dst);
+          emit_imm(BC_STOREG, value, symbol->slot);
+          return value;
+        }
+        lower_expr(expr->right, symbol->slot);
+        if (dst != -1 && dst != symbol->slot) {
+          emit(BC_MOV, dst, symbol->slot, 0);
+          return dst;
+        }
+        return symbol->slot;
+      }
+
+      int left = lower_expr(expr->left, -1);
+      if (left < function->local_count && has_assign(expr->right)) {
+        // The right operand changes a variable, keep the value read before.
+        int copy = temp();
+        emit(BC_MOV, copy, left, 0);
+        left = copy;
+      }
+      int right = lower_expr(expr->right, -1);
+      dst = dst == -1 ? temp() : dst;
+
+      bc_op_t op;
+      switch (expr->op) {
+        case ADD: op = BC_ADD; break;
+        case SUBS: op = BC_SUB; break;
+        case MUL: op = BC_MUL; break;
+        case DIV: op = BC_DIV; break;
+        case EQ: op = BC_EQ; break;
+        case LT: op = BC_LT; break;
+        case LTE: op = BC_LTE; break;
+        case GT: op = BC_GT; break;
+        case GTE: op = BC_GTE; break;
+        default:
+          function->failed = true;
+          return dst;
+      }
+      emit(op, dst, left, right);
+      return dst;
+    } default: {
+      function->failed = true;
+      return dst == -1 ? temp() : dst;
+    }
+  }
+}
+
+/* Emits a jump that is taken when the condition is equal to when, and adds it
+ * to the jumps to patch. */
+static void lower_branch(expr_ast_t *cond, bool when, int **jumps, int *count) {
+  int jump;
+
+  if (cond->type == BIN_OP && cond->op >= EQ && cond->op <= LTE) {
+    bc_op_t op;
+    switch (cond->op) {
+      case EQ: op = when ? BC_JEQ : BC_JNE; break;
+      case LT: op = when ? BC_JLT : BC_JGTE; break;
+      case LTE: op = when ? BC_JLTE : BC_JGT; break;
+      case GT: op = when ? BC_JGT : BC_JLTE; break;
+      default: op = when ? BC_JGTE : BC_JLT; break;
+    }
+
+    int left = lower_expr(cond->left, -1);
+    if (left < function->local_count && has_assign(cond->right)) {
+      int copy = temp();
+      emit(BC_MOV, copy, left, 0);
+      left = copy;
+    }
+    int right = lower_expr(cond->right, -1);
+    jump = emit(op, left, right, 0);
+  } else {
+    jump = emit_imm(when ? BC_JNZ : BC_JZ, lower_expr(cond, -1), 0);
+  }
+
+  *jumps = (int *) realloc(*jumps, sizeof(int) * (*count + 1));
+  (*jumps)[(*count)++] = jump;
+}
+
+static bool has_assign(expr_ast_t *expr) {
+  if (expr->type == FUNC_CALL) {
+    return false; // Calls cannot change the caller's locals.
+  }
+  return expr->type == BIN_OP
+      && (expr->op == ASSIGN || has_assign(expr->left) || has_assign(expr->right));
+}
+
+static int temp(void) {
+  int reg = next_temp++;
+  if (next_temp > function->frame_size) {
+    function->frame_size = next_temp;
+  }
+  return reg;
+}
+
+static int emit(bc_op_t op, int dst, int a, int b) {
+  if (function->size == function->capacity) {
+    function->capacity = function->capacity ? function->capacity * 2 : 64;
+    function->code = (bc_insn_t *) realloc(function->code,
+        sizeof(bc_insn_t) * function->capacity);
+  }
+  bc_insn_t *insn = &function->code[function->size];
+  insn->op = op;
+  insn->dst = dst;
+  insn->a = a;
+  insn->b = b;
+  return function->size++;
+}
+
+static int emit_imm(bc_op_t op, int dst, int32_t imm) {
+  int at = emit(op, dst, 0, 0);
+  function->code[at].imm = imm;
+  return at;
+}
+
+/* Sets the target of the jump at the given instruction. */
+static void patch(int at, int target) {
+  bc_insn_t *insn = &function->code[at];
+  if (insn->op >= BC_JEQ && insn->op <= BC_JGTE) {
+    insn->b = target;
+  } else {
+    insn->imm = target;
+  }
+}
+
+static void patch_all(int *jumps, int count, int target) {
+  for (int i = 0; i < count; i++) {
+    patch(jumps[i], target);
+  }
+}
+
+/* Gets the number of the called function, -1 if it has no body. */
+static int function_number(expr_ast_t *call) {
+  int number = call->symbol->callgraph_id;
+  if (number == -1) {
+    function->failed = true;
+  }
+  return number;
+}
@@ -0,0 +1,75 @@
+#ifndef BYTECODE_H
+#define BYTECODE_H
+#include <stdint.h>
+#include "parser.h"
+
+/* Register based bytecode. Every function has a frame of 64 bit registers,
+ * its local variables first and expression temporaries after them. Global
+ * variables live in a separate array and are accessed with LOADG/STOREG.
+ * Jump targets are instruction indices within the function. */
+typedef enum {
+  BC_LOADI,   // dst = imm
+  BC_MOV,     // dst = a
+  BC_ADD,     // dst = a + b
+  BC_SUB,
+  BC_MUL,
+  BC_DIV,
+  BC_EQ,      // dst = a == b
+  BC_LT,
+  BC_LTE,
+  BC_GT,
+  BC_GTE,
+  BC_JEQ,     // if dst == a goto b
+  BC_JNE,
+  BC_JLT,
+  BC_JLTE,
+  BC_JGT,
+  BC_JGTE,
+  BC_LOADG,   // dst = globals[imm]
+  BC_STOREG,  // globals[imm] = dst
+  BC_JMP,     // goto imm
+  BC_JZ,      // if dst == 0 goto imm
+  BC_JNZ,     // if dst != 0 goto imm
+  BC_CALL,    // dst = functions[imm]()
+  BC_TAILCALL,// return functions[imm]()
+  BC_RET,     // return dst
+  BC_OP_COUNT
+} bc_op_t;
+
+/* An instruction, 8 bytes. */
+typedef struct {
+  uint8_t op;
+  uint16_t dst;
+  union {
+    struct {
+      uint16_t a, b;
+    };
+    int32_t imm;
+  };
+} bc_insn_t;
+
+typedef struct {
+  symbol_t *symbol;
+  bc_insn_t *code;
+  int size, capacity;
+  int local_count;
+  int frame_size;
+  bool failed; // The function could not be lowered, and must not be run.
+} bc_function_t;
+
+/* Functions are numbered like in the call graph. */
+typedef struct {
+  bc_function_t *functions;
+  int function_count;
+  int64_t *globals;
+  int global_count;
+  int main; // The function number of main, -1 if there is none
+} bc_program_t;
+
+bc_program_t *lower_program(stat_ast_t *);
+bool bc_check(bc_program_t *);
+void bc_set_constant(bc_program_t *, int, int32_t);
+void bc_free(bc_program_t *);
+const char *bc_op_to_str(bc_op_t);
+
+#endif
@@ -0,0 +1,315 @@
+#define _DEFAULT_SOURCE
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "cache.h"
+#include "libpaola.h"
+
+/* Entries are files named by the hex digits of their key, in subdirectories
+ * named by the first two digits. An entry is written to a temporary file and
+ * renamed into place, so readers find either all of it or nothing. The
+ * modification time of an entry is the last time it was used. The stats file
+ * keeps count of hits, misses and the total size of the entries, and locking
+ * it locks the cache for eviction. Lookups are frequent, so instead of locking
+ * the stats file each one appends a byte to the lookups file, under a shared
+ * lock, and whoever locks the stats folds those bytes into them. */
+
+#define ENTRY_MAGIC "PAOLA01\n"
+#define PATH_SIZE 4096
+
+typedef struct {
+  char magic[8];
+  uint64_t output_size, message_size;
+} entry_header_t;
+
+typedef struct {
+  uint64_t hits, misses, stores, evictions;
+  uint64_t size, entries; // Exact after an eviction, counted up by stores in between
+} stats_t;
+
+typedef struct {
+  char *path;
+  uint64_t size;
+  struct timespec used;
+} cached_file_t;
+
+static void entry_path(const cache_t *, cache_key_t, char *, char *);
+static void count_lookup(const cache_t *, bool);
+static int lock_stats(const cache_t *, stats_t *);
+static void fold_lookups(const cache_t *, stats_t *);
+static void unlock_stats(int, const stats_t *);
+static void evict(const cache_t *, stats_t *);
+static int compare_use(const void *, const void *);
+
+/* Returns the key of compiling the text. The output also depends on the
+ * compiler, on whether it is an object, on whether it keeps frame pointers and
+ * on the passes that do not run. The number of jobs does not change the
+ * output. */
+cache_key_t cache_key(const char *text, size_t size, bool object_file, bool frame_pointer,
+    unsigned disabled_passes) {
+  hash_t parts[4] = {compiler_hash(), hash_bytes(text, size), {{object_file, frame_pointer}},
+      {{disabled_passes, 0}}};
+  return hash_bytes(parts, sizeof(parts));
+}
+
+/* Tells compilers apart by their version and their executable, so that output
+ * kept by one build of the compiler is not taken for the output of another. */
+hash_t compiler_hash(void) {
+  struct stat executable;
+  if (stat("/proc/self/exe", &executable) != 0) {
+    memset(&executable, 0, sizeof(executable));
+  }
+  char compiler[256];
+  int length = snprintf(compiler, sizeof(compiler), "paola %s %lld %lld.%09ld",
+      PAOLA_VERSION, (long long) executable.st_size, (long long) executable.st_mtim.tv_sec,
+      (long) executable.st_mtim.tv_nsec);
+  return hash_bytes(compiler, (size_t) length);
+}
+
+/* Looks the key up, and reads the entry if it is found. */
+bool cache_lookup(const cache_t *cache, cache_key_t key, cache_entry_t *entry) {
+  char path[PATH_SIZE], directory[PATH_SIZE];
+  entry_path(cache, key, path, directory);
+
+  FILE *file = fopen(path, "rb");
+  entry_header_t header;
+  struct stat status;
+  bool found = file && fread(&header, sizeof(header), 1, file) == 1
+      && memcmp(header.magic, ENTRY_MAGIC, sizeof(header.magic)) == 0
+      && fstat(fileno(file), &status) == 0
+      && (uint64_t) status.st_size == sizeof(header) + header.output_size + header.message_size;
+  if (found) {
+    entry->output_size = header.output_size;
+    entry->output = (char *) malloc(header.output_size + 1);
+    entry->messages = (char *) malloc(header.message_size + 1);
+    entry->messages[header.message_size] = '\0';
+    found = fread(entry->output, 1, header.output_size, file) == header.output_size
+        && fread(entry->messages, 1, header.message_size, file) == header.message_size;
+    if (!found) {
+      free_cache_entry(entry);
+    }
+  }
+  if (file) {
+    fclose(file);
+  }
+  if (found) {
+    // Mark the entry as the most recently used.
+    utimensat(AT_FDCWD, path, NULL, 0);
+  }
+
+  count_lookup(cache, found);
+  return found;
+}
+
+/* Stores the output and the messages of compiling under the key, and evicts
+ * entries if the cache grows past its size. Failing to store is not an error,
+ * the entry is left out. */
+void cache_store(const cache_t *cache, cache_key_t key, const char *output, size_t output_size,
+    const char *messages) {
+  static atomic_uint temporaries;
+  char path[PATH_SIZE], directory[PATH_SIZE], temporary[PATH_SIZE];
+  entry_path(cache, key, path, directory);
+  mkdir(cache->directory, 0777);
+  mkdir(directory, 0777);
+  snprintf(temporary, sizeof(temporary), "%s/tmp.%ld.%u", cache->directory, (long) getpid(),
+      atomic_fetch_add(&temporaries, 1));
+
+  entry_header_t header = {ENTRY_MAGIC, output_size, strlen(messages)};
+  FILE *file = fopen(temporary, "wb");
+  if (file == 0) {
+    return;
+  }
+  bool written = fwrite(&header, sizeof(header), 1, file) == 1
+      && fwrite(output, 1, output_size, file) == output_size
+      && fwrite(messages, 1, header.message_size, file) == header.message_size;
+  written = fclose(file) == 0 && written;
+  if (!written || rename(temporary, path) != 0) {
+    remove(temporary);
+    return;
+  }
+
+  stats_t stats;
+  int lock = lock_stats(cache, &stats);
+  stats.stores++;
+  stats.entries++;
+  stats.size += sizeof(header) + output_size + header.message_size;
+  if (stats.size > cache->max_size) {
+    evict(cache, &stats);
+  }
+  unlock_stats(lock, &stats);
+}
+
+void free_cache_entry(cache_entry_t *entry) {
+  free(entry->output);
+  free(entry->messages);
+}
+
+void print_cache_stats(const cache_t *cache) {
+  stats_t stats;
+  int lock = lock_stats(cache, &stats);
+  unlock_stats(lock, &stats);
+
+  uint64_t lookups = stats.hits + stats.misses;
+  printf("Cache directory: %s\n", cache->directory);
+  printf("Hits: %llu\n", (unsigned long long) stats.hits);
+  printf("Misses: %llu\n", (unsigned long long) stats.misses);
+  printf("Hit rate: %.1f%%\n", lookups > 0 ? 100.0 * stats.hits / lookups : 0.0);
+  printf("Stores: %llu\n", (unsigned long long) stats.stores);
+  printf("Evictions: %llu\n", (unsigned long long) stats.evictions);
+  printf("Entries: %llu\n", (unsigned long long) stats.entries);
+  printf("Size: %.1f MB of %.1f MB\n", stats.size / 1048576.0, cache->max_size / 1048576.0);
+}
+
+/* Stores the path of the entry, and of the subdirectory it is in. */
+static void entry_path(const cache_t *cache, cache_key_t key, char *path, char *directory) {
+  snprintf(directory, PATH_SIZE, "%s/%02x", cache->directory, (unsigned) (key.hash[0] >> 56));
+  snprintf(path, PATH_SIZE, "%s/%016llx%016llx", directory, (unsigned long long) key.hash[0],
+      (unsigned long long) key.hash[1]);
+}
+
+/* Appends a hit or a miss to the lookups file. Appending a byte is atomic, so
+ * lookups only share the lock, which keeps them out of a fold in progress. */
+static void count_lookup(const cache_t *cache, bool hit) {
+  char path[PATH_SIZE];
+  snprintf(path, sizeof(path), "%s/lookups", cache->directory);
+  mkdir(cache->directory, 0777);
+
+  int fd = open(path, O_WRONLY | O_APPEND | O_CREAT, 0666);
+  if (fd == -1) {
+    return;
+  }
+  if (flock(fd, LOCK_SH) == 0) {
+    // A failed write only loses the count.
+    write(fd, hit ? "h" : "m", 1);
+  }
+  close(fd);
+}
+
+/* Locks the cache and reads its stats, with the lookups since they were last
+ * saved. Returns the lock, or -1 if the stats
+ * file cannot be opened, in which case the stats start from zero and are not
+ * saved. */
+static int lock_stats(const cache_t *cache, stats_t *stats) {
+  char path[PATH_SIZE];
+  snprintf(path, sizeof(path), "%s/stats", cache->directory);
+  mkdir(cache->directory, 0777);
+  memset(stats, 0, sizeof(*stats));
+
+  int fd = open(path, O_RDWR | O_CREAT, 0666);
+  if (fd == -1) {
+    return -1;
+  }
+  if (flock(fd, LOCK_EX) != 0) {
+    close(fd);
+    return -1;
+  }
+  if (pread(fd, stats, sizeof(*stats), 0) != sizeof(*stats)) {
+    memset(stats, 0, sizeof(*stats));
+  }
+  fold_lookups(cache, stats);
+  return fd;
+}
+
+/* Adds the lookups file to the stats and empties it. Called with the cache
+ * locked. */
+static void fold_lookups(const cache_t *cache, stats_t *stats) {
+  char path[PATH_SIZE];
+  snprintf(path, sizeof(path), "%s/lookups", cache->directory);
+  int fd = open(path, O_RDWR);
+  if (fd == -1) {
+    return;
+  }
+  if (flock(fd, LOCK_EX) != 0) {
+    close(fd);
+    return;
+  }
+  char buffer[4096];
+  ssize_t count;
+  while ((count = read(fd, buffer, sizeof(buffer))) > 0) {
+    for (ssize_t i = 0; i < count; i++) {
+      stats->hits += buffer[i] == 'h';
+      stats->misses += buffer[i] == 'm';
+    }
+  }
+  ftruncate(fd, 0);
+  close(fd);
+}
+
+/* Saves the stats and unlocks the cache. */
+static void unlock_stats(int fd, const stats_t *stats) {
+  if (fd == -1) {
+    return;
+  }
+  // A failed write only loses counts, and eviction recounts the size.
+  pwrite(fd, stats, sizeof(*stats), 0);
+  close(fd);
+}
+
+/* Removes the least recently used entries until the cache is down to nine
+ * tenths of its size, so that the next few stores do not evict again. Called
+ * with the cache locked, and counts the entries and their size exactly. */
+static void evict(const cache_t *cache, stats_t *stats) {
+  cached_file_t *files = NULL;
+  int count = 0, capacity = 0;
+  uint64_t size = 0;
+  for (unsigned i = 0; i < 256; i++) {
+    char directory[PATH_SIZE];
+    snprintf(directory, sizeof(directory), "%s/%02x", cache->directory, i);
+    DIR *dir = opendir(directory);
+    if (dir == NULL) {
+      continue;
+    }
+    struct dirent *item;
+    while ((item = readdir(dir)) != NULL) {
+      char path[PATH_SIZE];
+      struct stat status;
+      if (item->d_name[0] == '.'
+          || snprintf(path, sizeof(path), "%s/%s", directory, item->d_name) >= PATH_SIZE
+          || stat(path, &status) != 0 || !S_ISREG(status.st_mode)) {
+        continue;
+      }
+      if (count == capacity) {
+        capacity = capacity ? capacity * 2 : 64;
+        files = (cached_file_t *) realloc(files, sizeof(cached_file_t) * capacity);
+      }
+      files[count].path = (char *) malloc(strlen(path) + 1);
+      strcpy(files[count].path, path);
+      files[count].size = (uint64_t) status.st_size;
+      files[count].used = status.st_mtim;
+      count++;
+      size += (uint64_t) status.st_size;
+    }
+    closedir(dir);
+  }
+
+  qsort(files, count, sizeof(cached_file_t), compare_use);
+  uint64_t target = cache->max_size / 10 * 9;
+  int kept = count;
+  for (int i = 0; i < count; i++) {
+    if (size > target && remove(files[i].path) == 0) {
+      size -= files[i].size;
+      kept--;
+      stats->evictions++;
+    }
+    free(files[i].path);
+  }
+  free(files);
+  stats->size = size;
+  stats->entries = (uint64_t) kept;
+}
+
+static int compare_use(const void *a, const void *b) {
+  const struct timespec *x = &((const cached_file_t *) a)->used;
+  const struct timespec *y = &((const cached_file_t *) b)->used;
+  if (x->tv_sec != y->tv_sec) {
+    return x->tv_sec < y->tv_sec ? -1 : 1;
+  }
+  return (x->tv_nsec > y->tv_nsec) - (x->tv_nsec < y->tv_nsec);
+}
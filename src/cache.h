@@ -0,0 +1,34 @@
+#ifndef CACHE_H
+#define CACHE_H
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "hash.h"
+
+/* A cache of compiled files on disk, addressed by a hash of everything the
+ * output depends on. Several compilers can use the same cache directory at the
+ * same time. */
+
+#define CACHE_DEFAULT_SIZE (256 << 20)
+
+typedef struct {
+  const char *directory;
+  uint64_t max_size; // In bytes, the least recently used entries are evicted past it
+} cache_t;
+
+typedef hash_t cache_key_t;
+
+typedef struct {
+  char *output; // Not terminated
+  size_t output_size;
+  char *messages; // Terminated
+} cache_entry_t;
+
+cache_key_t cache_key(const char *, size_t, bool, bool, unsigned);
+hash_t compiler_hash(void);
+bool cache_lookup(const cache_t *, cache_key_t, cache_entry_t *);
+void cache_store(const cache_t *, cache_key_t, const char *, size_t, const char *);
+void free_cache_entry(cache_entry_t *);
+void print_cache_stats(const cache_t *);
+
+#endif
@@ -0,0 +1,338 @@
+#pragma GCC diagnostic ignored "-Wwrite-strings"
+
+#include <stdlib.h>
+#include <string.h>
+#include "callgraph.h"
+#include "arena.h"
+#include "context.h"
+#include "errors.h"
+#include "pgo.h"
+
+/* The call graph of the program. Semcheck adds a node for each function
+ * definition and a call site for each function call it resolves, later passes
+ * remove the call sites of code they delete.
+ *
+ * Functions that cannot be reached from main are not emitted at all. The rest
+ * are split by a static estimate of how often they run: a call site is likely
+ * to be executed if it is inside a loop, or if it is not in a branch of an if
+ * statement. Functions that main reaches through likely call sites only are
+ * hot, the others are cold and placed in .text.unlikely by the code generator.
+ * Both groups are ordered depth first from main, visiting the callees that are
+ * called most often first, so that callers end up next to their callees.
+ *
+ * Functions that have counts in the profile are hot if their code was called,
+ * rather than expanded in place, and their calls weigh as often as they ran. */
+
+#define LOOP_WEIGHT 10
+#define MAX_LOOP_WEIGHT 10000
+#define MAX_PROFILE_WEIGHT 100000
+
+typedef struct {
+  symbol_t *callee;
+  int weight;
+} callee_t;
+
+static void mark(symbol_t *, bool, bool);
+static void connect(symbol_t *);
+static void place(symbol_t *, bool, symbol_t **, int *);
+static int site_weight(symbol_t *, call_site_t *);
+static int compare_weight(const void *, const void *);
+static symbol_t *find_main(void);
+
+// The functions are kept in the context, the marks only while they are used.
+static _Thread_local bool *reachable, *hot, *visited;
+
+// The state of callgraph_recursive while it runs.
+static _Thread_local bool *recursive;
+static _Thread_local int *order_index, *low_index, *stack;
+static _Thread_local int stack_size, next_index;
+
+void callgraph_init(void) {
+  free(context->functions);
+  context->function_count = 0;
+  context->function_capacity = 16;
+  context->functions = (symbol_t **) malloc(sizeof(symbol_t *) * context->function_capacity);
+}
+
+/* Adds a node for a function definition. */
+void callgraph_add_function(symbol_t *function) {
+  if (function->callgraph_id != -1) {
+    return;
+  }
+
+  if (context->function_count == context->function_capacity) {
+    context->function_capacity *= 2;
+    context->functions = (symbol_t **) realloc(context->functions,
+        sizeof(symbol_t *) * context->function_capacity);
+  }
+  function->callgraph_id = context->function_count;
+  context->functions[context->function_count++] = function;
+}
+
+/* Records that caller calls the function of the FUNC_CALL expression. This
+ * only changes the caller, so that the bodies of different functions can be
+ * checked in parallel. The calls are counted by callgraph_count_calls. */
+void callgraph_add_call(symbol_t *caller, expr_ast_t *call, int loop_depth, bool conditional) {
+  if (!caller) {
+    return;
+  }
+
+  call_site_t *site = (call_site_t *) arena_alloc(sizeof(call_site_t));
+  site->call = call;
+  site->loop_depth = loop_depth;
+  site->conditional = conditional;
+  list_push_back(&caller->call_sites, &site->elem);
+}
+
+/* Sets the call count of every function to the number of its call sites. */
+void callgraph_count_calls(void) {
+  for (int i = 0; i < context->function_count; i++) {
+    for (list_elem_t *e = list_begin(&context->functions[i]->call_sites);
+        e != list_end(&context->functions[i]->call_sites); e = list_next(e)) {
+      list_entry(e, call_site_t, elem)->call->symbol->call_count++;
+    }
+  }
+}
+
+/* Forgets a call site, because the code containing it was removed. */
+void callgraph_remove_call(symbol_t *caller, expr_ast_t *call) {
+  call->symbol->call_count--;
+  if (!caller) {
+    return;
+  }
+
+  for (list_elem_t *e = list_begin(&caller->call_sites); e != list_end(&caller->call_sites);
+      e = list_next(e)) {
+    call_site_t *site = list_entry(e, call_site_t, elem);
+    if (site->call == call) {
+      list_remove(e);
+      return;
+    }
+  }
+}
+
+/* Finds the recursive functions, those on a cycle of calls. Returns an array
+ * the caller frees, indexed by callgraph_id. Tarjan's algorithm numbers the
+ * functions depth first, and a function that reaches no function numbered
+ * before it closes a strongly connected component, which is recursive if it
+ * has more than one function or calls itself. */
+bool *callgraph_recursive(void) {
+  recursive = (bool *) calloc(context->function_count + 1, sizeof(bool));
+  order_index = (int *) malloc(sizeof(int) * (context->function_count + 1));
+  low_index = (int *) malloc(sizeof(int) * (context->function_count + 1));
+  stack = (int *) malloc(sizeof(int) * (context->function_count + 1));
+  visited = (bool *) calloc(context->function_count + 1, sizeof(bool));
+  stack_size = 0;
+  next_index = 0;
+  for (int i = 0; i < context->function_count; i++) {
+    if (!visited[i]) {
+      connect(context->functions[i]);
+    }
+  }
+
+  free(order_index);
+  free(low_index);
+  free(stack);
+  free(visited);
+  bool *result = recursive;
+  recursive = visited = NULL;
+  return result;
+}
+
+/* Gets the defined functions, numbered by their callgraph_id. Returns their
+ * number. */
+int callgraph_functions(symbol_t ***result) {
+  *result = context->functions;
+  return context->function_count;
+}
+
+/* Computes the order in which functions are emitted, and marks cold functions.
+ * Returns the number of functions in the order, the functions that are left
+ * out are unreachable. If there is no main, every function is kept. */
+int callgraph_order(symbol_t ***order) {
+  reachable = (bool *) calloc(context->function_count, sizeof(bool));
+  hot = (bool *) calloc(context->function_count, sizeof(bool));
+  visited = (bool *) calloc(context->function_count, sizeof(bool));
+
+  symbol_t *main = find_main();
+  if (main) {
+    mark(main, true, true);
+  } else {
+    for (int i = 0; i < context->function_count; i++) {
+      reachable[i] = hot[i] = true;
+    }
+  }
+  for (int i = 0; i < context->function_count; i++) {
+    int64_t calls = pgo_count(context->functions[i], 0);
+    if (calls >= 0) {
+      hot[i] = reachable[i] && calls > 0;
+    }
+  }
+
+  *order = (symbol_t **) malloc(sizeof(symbol_t *) * (context->function_count + 1));
+  int count = 0;
+  for (int pass = 0; pass < 2; pass++) {
+    if (main) {
+      place(main, pass == 1, *order, &count);
+    }
+    for (int i = 0; i < context->function_count; i++) {
+      place(context->functions[i], pass == 1, *order, &count);
+    }
+    memset(visited, 0, sizeof(bool) * context->function_count);
+  }
+
+  for (int i = 0; i < context->function_count; i++) {
+    symbol_t *function = context->functions[i];
+    function->cold = reachable[i] && !hot[i];
+    if (!reachable[i] && !function->folded) {
+      warning(&function->decl->pos, "Function %s is unreachable from main.", function->name);
+    }
+  }
+
+  free(reachable);
+  free(hot);
+  free(visited);
+  reachable = hot = visited = NULL;
+  return count;
+}
+
+/* Marks the functions reachable from function. If likely is set, the function
+ * is reached through likely call sites only, and so are the callees reached
+ * through its likely call sites. */
+static void mark(symbol_t *function, bool self, bool likely) {
+  int id = function->callgraph_id;
+  if (id == -1) {
+    return;
+  }
+  if (self) {
+    if (reachable[id] && (!likely || (hot && hot[id]))) {
+      return;
+    }
+    reachable[id] = true;
+    if (likely && hot) {
+      hot[id] = true;
+    }
+  }
+
+  for (list_elem_t *e = list_begin(&function->call_sites);
+      e != list_end(&function->call_sites); e = list_next(e)) {
+    call_site_t *site = list_entry(e, call_site_t, elem);
+    mark(site->call->symbol, true, likely && (site->loop_depth > 0 || !site->conditional));
+  }
+}
+
+/* Numbers the function and the functions it calls, and pops the component the
+ * function closes. A function is on the stack while visited is set and its
+ * component is not closed, which is when its low index is still set. */
+static void connect(symbol_t *function) {
+  int id = function->callgraph_id;
+  visited[id] = true;
+  order_index[id] = low_index[id] = next_index++;
+  stack[stack_size++] = id;
+
+  for (list_elem_t *e = list_begin(&function->call_sites);
+      e != list_end(&function->call_sites); e = list_next(e)) {
+    int callee = list_entry(e, call_site_t, elem)->call->symbol->callgraph_id;
+    if (callee == -1) {
+      continue;
+    } else if (callee == id) {
+      recursive[id] = true;
+    } else if (!visited[callee]) {
+      connect(context->functions[callee]);
+      low_index[id] = low_index[callee] < low_index[id] ? low_index[callee] : low_index[id];
+    } else if (low_index[callee] != -1) {
+      low_index[id] = order_index[callee] < low_index[id] ? order_index[callee] : low_index[id];
+    }
+  }
+
+  if (low_index[id] != order_index[id]) {
+    return;
+  }
+  int top = stack_size;
+  do {
+    stack_size--;
+  } while (stack[stack_size] != id);
+  for (int i = stack_size; i < top; i++) {
+    low_index[stack[i]] = -1;
+    recursive[stack[i]] |= top - stack_size > 1;
+  }
+}
+
+/* Appends the reachable functions of one temperature to the order, depth first
+ * from function, heaviest calls first. Functions of the other temperature are
+ * walked through but not placed, so that their callees stay close. */
+static void place(symbol_t *function, bool cold, symbol_t **order, int *count) {
+  int id = function->callgraph_id;
+  if (id == -1 || visited[id] || !reachable[id]) {
+    return;
+  }
+  visited[id] = true;
+  if (hot[id] != cold) {
+    order[(*count)++] = function;
+  }
+
+  // Sum up the weight of the calls to each callee.
+  int callee_count = 0;
+  for (list_elem_t *e = list_begin(&function->call_sites);
+      e != list_end(&function->call_sites); e = list_next(e)) {
+    callee_count++;
+  }
+  callee_t *callees = (callee_t *) malloc(sizeof(callee_t) * (callee_count + 1));
+  int distinct = 0;
+  for (list_elem_t *e = list_begin(&function->call_sites);
+      e != list_end(&function->call_sites); e = list_next(e)) {
+    call_site_t *site = list_entry(e, call_site_t, elem);
+    int i = 0;
+    while (i < distinct && callees[i].callee != site->call->symbol) {
+      i++;
+    }
+    if (i == distinct) {
+      callees[distinct].callee = site->call->symbol;
+      callees[distinct++].weight = 0;
+    }
+    callees[i].weight += site_weight(function, site);
+  }
+
+  // Heaviest first. Insertion sort is stable, so ties keep their source order.
+  for (int i = 1; i < distinct; i++) {
+    callee_t c = callees[i];
+    int j = i;
+    while (j > 0 && compare_weight(&callees[j - 1], &c) > 0) {
+      callees[j] = callees[j - 1];
+      j--;
+    }
+    callees[j] = c;
+  }
+
+  for (int i = 0; i < distinct; i++) {
+    place(callees[i].callee, cold, order, count);
+  }
+  free(callees);
+}
+
+/* Estimated number of executions of a call site per call of its function, or
+ * the number of executions in the profile. */
+static int site_weight(symbol_t *caller, call_site_t *site) {
+  int64_t count = pgo_count(caller, site->call->counter);
+  if (count >= 0) {
+    return (int) (count < MAX_PROFILE_WEIGHT ? count : MAX_PROFILE_WEIGHT);
+  }
+  int weight = site->conditional ? 1 : 2;
+  for (int i = 0; i < site->loop_depth && weight < MAX_LOOP_WEIGHT; i++) {
+    weight *= LOOP_WEIGHT;
+  }
+  return weight;
+}
+
+static int compare_weight(const void *a, const void *b) {
+  return ((const callee_t *) b)->weight - ((const callee_t *) a)->weight;
+}
+
+static symbol_t *find_main(void) {
+  for (int i = 0; i < context->function_count; i++) {
+    if (strcmp(context->functions[i]->name, "main") == 0) {
+      return context->functions[i];
+    }
+  }
+  return NULL;
+}
@@ -0,0 +1,23 @@
+#ifndef CALLGRAPH_H
+#define CALLGRAPH_H
+#include "parser.h"
+
+/* A call made by a function, as resolved by semcheck. Call sites are kept in
+ * the call_sites list of the calling function's symbol. */
+typedef struct {
+  expr_ast_t *call;  // The FUNC_CALL expression
+  int loop_depth;    // Number of loops around the call
+  bool conditional;  // Whether the call is in a branch of an if statement
+  list_elem_t elem;
+} call_site_t;
+
+void callgraph_init(void);
+void callgraph_add_function(symbol_t *);
+void callgraph_add_call(symbol_t *, expr_ast_t *, int, bool);
+void callgraph_count_calls(void);
+void callgraph_remove_call(symbol_t *, expr_ast_t *);
+bool *callgraph_recursive(void);
+int callgraph_order(symbol_t ***);
+int callgraph_functions(symbol_t ***);
+
+#endif
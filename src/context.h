@@ -0,0 +1,70 @@
+#ifndef CONTEXT_H
+#define CONTEXT_H
+#include <stdatomic.h>
+#include "libpaola.h"
+#include "arena.h"
+#include "bytecode.h"
+#include "incremental.h"
+#include "list.h"
+#include "outbuf.h"
+#include "parser.h"
+#include "report.h"
+#include "symtable.h"
+#include "x86.h"
+
+/* The state of a compilation that the threads compiling it share. Phases
+ * reach it through the context of the calling thread, which the library sets
+ * for the duration of a call, and which pool workers take over from the thread
+ * that started them. State that only the thread running a phase uses is kept
+ * in thread locals of the phase instead. */
+struct paola_ctx {
+  paola_options_t options;
+  arena_t arena;
+
+  // Messages, see errors.c
+  list_t messages;
+  atomic_int error_count, warning_count;
+  char *message_text;
+  char *remark_text; // The remarks among the messages, as JSON
+
+  // The global scope, see symtable.c
+  scope_t *global_scope;
+  int global_count;
+  symbol_t **globals; // In declaration order
+  int globals_capacity;
+  int *global_table; // Open addressing, indexes into globals
+  int global_table_size;
+
+  // The call graph, see callgraph.c
+  symbol_t **functions;
+  int function_count, function_capacity;
+
+  // Code generation, see gen.c
+  outbuf_t output;
+  x86_obj_t *object; // The object being assembled, 0 when emitting assembly.
+  int *function_slots; // Stack slots each function takes, -1 if unknown
+
+  // Generated functions, see incremental.c
+  char *previous_index; // Of the previous compilation, given by paola_set_index
+  size_t previous_index_size;
+  index_entry_t *index_entries; // Of the previous index
+  int index_entry_count, index_entry_capacity;
+  outbuf_t index; // Of this compilation
+
+  // The analyses that are valid for the AST, see passes.c
+  unsigned valid_analyses;
+
+  // The profile the code is optimized with, see pgo.c
+  char *profile; // Given by paola_set_profile, 0 if there is none
+
+  // Measurements, see report.c
+  report_t report;
+
+  // The compiled program, for paola_run
+  x86_obj_t *executable;
+  bc_program_t *program;
+};
+
+extern _Thread_local paola_ctx_t *context;
+
+#endif
@@ -0,0 +1,266 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include "ctfe.h"
+#include "bytecode.h"
+#include "callgraph.h"
+#include "errors.h"
+#include "interp.h"
+
+/* Compile-time evaluation of calls to pure functions. Functions take no
+ * arguments, so a function without side effects that only reads variables
+ * which never change returns the same value on every call. A function is pure
+ * if it:
+ *  - only assigns to its own local variables,
+ *  - only reads its own local variables and global variables that are never
+ *    assigned,
+ *  - only calls pure functions.
+ * Each pure function that is called is run once in the bytecode interpreter,
+ * with a limited number of steps and registers, and if it returns a value that
+ * fits in an int, its calls are replaced with that value. The pure functions it
+ * calls are evaluated first, and the bytecode of those that turn out constant
+ * is replaced with their value, so that no function runs more than once. All
+ * the evaluations of a compile share a budget of steps. */
+
+#define MAX_STEPS 1000000
+#define MAX_TOTAL_STEPS 20000000
+#define MAX_REGISTERS (1 << 16)
+
+typedef enum {
+  NOT_EVALUATED,
+  EVALUATING,
+  CONSTANT,
+  // Why a function is not constant
+  OUT_OF_STEPS,  // It ran into the step limit of one evaluation
+  OUT_OF_BUDGET, // The steps of the compile ran out
+  FAULTED,       // It divided by zero, or recursed past the register limit
+  TOO_WIDE       // It returned a value that does not fit in an int
+} evaluation_t;
+
+static void mark_assigned(expr_ast_t *, walk_t *);
+static bool stat_is_pure(stat_ast_t *);
+static bool expr_is_pure(expr_ast_t *);
+static bool is_own_local(symbol_t *);
+static bool evaluate(symbol_t *, int *);
+static void remark_unfolded(symbol_t **, int);
+
+// The analysis of the variables that are assigned to, see passes.h.
+const visitor_t assigned_visitor = {.expr = mark_assigned};
+
+static _Thread_local bc_program_t *program;
+static _Thread_local evaluation_t *evaluations;
+static _Thread_local int *values;
+static _Thread_local long budget; // Steps left for the evaluations of this compile
+
+// Local variables declared so far in the function being analyzed.
+static _Thread_local symbol_t **locals;
+static _Thread_local int local_count, local_capacity;
+
+void evaluate_pure_calls(stat_ast_t *ast) {
+  symbol_t **functions;
+  int function_count = callgraph_functions(&functions);
+
+  bool any_pure = false;
+  for (int i = 0; i < function_count; i++) {
+    local_count = 0;
+    functions[i]->pure = stat_is_pure(functions[i]->decl->func_body);
+    any_pure = any_pure || functions[i]->pure;
+  }
+  free(locals);
+  locals = NULL;
+  local_capacity = 0;
+  if (!any_pure) {
+    remark_unfolded(functions, function_count);
+    return;
+  }
+
+  // Calling an impure function is impure, until nothing changes.
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (int i = 0; i < function_count; i++) {
+      symbol_t *function = functions[i];
+      if (!function->pure) {
+        continue;
+      }
+      for (list_elem_t *e = list_begin(&function->call_sites);
+          e != list_end(&function->call_sites); e = list_next(e)) {
+        symbol_t *callee = list_entry(e, call_site_t, elem)->call->symbol;
+        if (callee->callgraph_id == -1 || !callee->pure) {
+          function->pure = false;
+          changed = true;
+          break;
+        }
+      }
+    }
+  }
+
+  program = lower_program(ast);
+  evaluations = (evaluation_t *) calloc(function_count, sizeof(evaluation_t));
+  values = (int *) calloc(function_count, sizeof(int));
+  budget = MAX_TOTAL_STEPS;
+
+  for (int i = 0; i < function_count; i++) {
+    symbol_t *caller = functions[i];
+    list_elem_t *e = list_begin(&caller->call_sites);
+    while (e != list_end(&caller->call_sites)) {
+      expr_ast_t *call = list_entry(e, call_site_t, elem)->call;
+      e = list_next(e);
+
+      int value;
+      if (call->symbol->pure && evaluate(call->symbol, &value)) {
+        remark(PAOLA_REMARK_PASSED, "ctfe", &call->pos, caller->name,
+            "folded call to %s into the constant %d", call->name, value);
+        call->symbol->folded = true;
+        callgraph_remove_call(caller, call);
+        call->type = INT_LIT;
+        call->ival = value;
+      }
+    }
+  }
+
+  remark_unfolded(functions, function_count);
+  free(evaluations);
+  free(values);
+  evaluations = NULL;
+  bc_free(program);
+}
+
+/* Sets the assigned flag of every variable that is assigned to. */
+static void mark_assigned(expr_ast_t *expr, walk_t *walk) {
+  if (expr->type == BIN_OP && expr->op == ASSIGN) {
+    expr->left->symbol->assigned = true;
+  }
+}
+
+/* Checks the variables the statement uses. Calls are checked separately, on
+ * the call graph. Nested functions are analyzed on their own. */
+static bool stat_is_pure(stat_ast_t *stat) {
+  switch (stat->type) {
+    case RETURN_STAT:
+    case EXPR_STAT:
+      return expr_is_pure(stat->expr);
+    case IF_STAT:
+      return expr_is_pure(stat->cond) && stat_is_pure(stat->tstat)
+          && (!stat->fstat || stat_is_pure(stat->fstat));
+    case WHILE_STAT:
+      return expr_is_pure(stat->cond) && stat_is_pure(stat->body);
+    case FOR_STAT:
+      return expr_is_pure(stat->init) && expr_is_pure(stat->cond)
+          && expr_is_pure(stat->iter) && stat_is_pure(stat->body);
+    case BLOCK_STAT:
+      for (list_elem_t *e = list_begin(&stat->stats); e != list_end(&stat->stats);
+          e = list_next(e)) {
+        if (!stat_is_pure(list_entry(e, stat_ast_t, block_elem))) {
+          return false;
+        }
+      }
+      return true;
+    case DECL_STAT:
+      if (stat->is_func) {
+        return true;
+      }
+      if (local_count == local_capacity) {
+        local_capacity = local_capacity ? local_capacity * 2 : 16;
+        locals = (symbol_t **) realloc(locals, sizeof(symbol_t *) * local_capacity);
+      }
+      locals[local_count++] = stat->symbol;
+      return !stat->value || expr_is_pure(stat->value);
+    default:
+      return true;
+  }
+}
+
+static bool expr_is_pure(expr_ast_t *expr) {
+  switch (expr->type) {
+    case VAR_REF:
+      return is_own_local(expr->symbol) || (expr->symbol->is_global && !expr->symbol->assigned);
+    case BIN_OP:
+      if (expr->op == ASSIGN) {
+        return is_own_local(expr->left->symbol) && expr_is_pure(expr->right);
+      }
+      return expr_is_pure(expr->left) && expr_is_pure(expr->right);
+    default:
+      return true;
+  }
+}
+
+static bool is_own_local(symbol_t *symbol) {
+  for (int i = 0; i < local_count; i++) {
+    if (locals[i] == symbol) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/* Runs the pure function, once, after the pure functions it calls. Returns
+ * false if it does not return an int within the limits, or if it is already
+ * being evaluated because it calls itself. */
+static bool evaluate(symbol_t *function, int *value) {
+  int id = function->callgraph_id;
+  if (evaluations[id] == NOT_EVALUATED) {
+    evaluations[id] = EVALUATING;
+    for (list_elem_t *e = list_begin(&function->call_sites);
+        e != list_end(&function->call_sites); e = list_next(e)) {
+      int callee_value;
+      evaluate(list_entry(e, call_site_t, elem)->call->symbol, &callee_value);
+    }
+
+    int64_t result;
+    long limit = budget < MAX_STEPS ? budget : MAX_STEPS, steps = limit;
+    evaluation_t evaluation = CONSTANT;
+    if (!interpret_bounded(program, id, &steps, MAX_REGISTERS, &result)) {
+      evaluation = steps >= 0 ? FAULTED : limit < MAX_STEPS ? OUT_OF_BUDGET : OUT_OF_STEPS;
+    } else if (result < INT32_MIN || result > INT32_MAX) {
+      evaluation = TOO_WIDE;
+    }
+    budget -= limit - (steps > 0 ? steps : 0);
+    if (evaluation == CONSTANT) {
+      bc_set_constant(program, id, (int32_t) result);
+    }
+    evaluations[id] = evaluation;
+    values[id] = evaluation == CONSTANT ? (int) result : 0;
+  }
+  *value = values[id];
+  return evaluations[id] == CONSTANT;
+}
+
+/* Explains why each call left in the call graph was not folded. Called while
+ * the evaluations are kept, if there are any. */
+static void remark_unfolded(symbol_t **functions, int function_count) {
+  if (!remarks_enabled(PAOLA_REMARK_MISSED)) {
+    return;
+  }
+  for (int i = 0; i < function_count; i++) {
+    symbol_t *caller = functions[i];
+    for (list_elem_t *e = list_begin(&caller->call_sites); e != list_end(&caller->call_sites);
+        e = list_next(e)) {
+      expr_ast_t *call = list_entry(e, call_site_t, elem)->call;
+      int id = call->symbol->callgraph_id;
+      const char *reason = "it has side effects or reads variables that change";
+      if (id == -1) {
+        reason = "its body is not known";
+      } else if (call->symbol->pure) {
+        switch (evaluations[id]) {
+          case OUT_OF_STEPS:
+            reason = "it does not return within the step limit";
+            break;
+          case OUT_OF_BUDGET:
+            reason = "the steps for evaluating calls in this compile ran out";
+            break;
+          case FAULTED:
+            reason = "it divides by zero or recurses too deep";
+            break;
+          case TOO_WIDE:
+            reason = "its result does not fit in an int";
+            break;
+          default:
+            reason = "it does not return an int at compile time";
+            break;
+        }
+      }
+      remark(PAOLA_REMARK_MISSED, "ctfe", &call->pos, caller->name,
+          "could not fold call to %s: %s", call->name, reason);
+    }
+  }
+}
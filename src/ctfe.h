@@ -0,0 +1,10 @@
+#ifndef CTFE_H
+#define CTFE_H
+#include "parser.h"
+#include "passes.h"
+
+extern const visitor_t assigned_visitor;
+
+void evaluate_pure_calls(stat_ast_t *);
+
+#endif
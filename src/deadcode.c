@@ -0,0 +1,239 @@
+#pragma GCC diagnostic ignored "-Wwrite-strings"
+
+#include <stdlib.h>
+#include "deadcode.h"
+#include "arena.h"
+#include "arith.h"
+#include "errors.h"
+#include "callgraph.h"
+
+/* Unreachable code elimination. Walks the control flow of each function body
+ * and removes:
+ *  - statements that follow a statement which never completes, i.e. a return,
+ *    a loop with a constant true condition (there is no break), or an if
+ *    statement whose branches both never complete,
+ *  - if branches whose condition is constant, and loops whose condition is
+ *    constant false.
+ * A warning is reported for each piece of code removed. Calls in removed code
+ * are removed from the call graph. */
+
+static bool prune(stat_ast_t **);
+static bool prune_block(stat_ast_t *);
+static bool eval_const(expr_ast_t *, int64_t *);
+static void forget_calls(stat_ast_t *);
+static void forget_expr_calls(expr_ast_t *);
+static stat_ast_t *create_stat(stat_ast_type_t, position_t);
+
+// Function whose body is being pruned.
+static _Thread_local symbol_t *current_function;
+
+void eliminate_dead_code(stat_ast_t *program) {
+  for (list_elem_t *e = list_begin(&program->stats); e != list_end(&program->stats);
+      e = list_next(e)) {
+    stat_ast_t *stat = list_entry(e, stat_ast_t, block_elem);
+    if (stat->type == DECL_STAT && stat->is_func && stat->func_body) {
+      current_function = stat->symbol;
+      prune(&stat->func_body);
+    }
+  }
+}
+
+/* Removes the dead code in the statement, which may replace the statement
+ * itself. Returns true if control never leaves the statement normally. */
+static bool prune(stat_ast_t **slot) {
+  stat_ast_t *stat = *slot;
+  int64_t cond;
+
+  switch (stat->type) {
+    case RETURN_STAT:
+      return true;
+    case IF_STAT:
+      if (eval_const(stat->cond, &cond)) {
+        remark(PAOLA_REMARK_PASSED, "deadcode", &stat->cond->pos, current_function->name,
+            "folded constant condition, the if statement always goes %s",
+            cond ? "into its branch" : "past its branch");
+        stat_ast_t *taken = cond ? stat->tstat : stat->fstat;
+        stat_ast_t *dead = cond ? stat->fstat : stat->tstat;
+        if (dead) {
+          if (dead->type != SKIP_STAT) {
+            warning(&dead->pos, cond ? "Condition is always true, else branch is unreachable."
+                : "Condition is always false, branch is unreachable.");
+          }
+          forget_calls(dead);
+        }
+
+        *slot = taken ? taken : create_stat(SKIP_STAT, stat->pos);
+        return prune(slot);
+      }
+
+      bool tstat_exits = prune(&stat->tstat);
+      bool fstat_exits = stat->fstat && prune(&stat->fstat);
+      return tstat_exits && fstat_exits;
+    case WHILE_STAT:
+    case FOR_STAT:
+      if (eval_const(stat->cond, &cond) && !cond) {
+        warning(&stat->body->pos, "Loop condition is always false, body is unreachable.");
+        remark(PAOLA_REMARK_PASSED, "deadcode", &stat->cond->pos, current_function->name,
+            "folded constant condition, removed the loop");
+        forget_calls(stat->body);
+        if (stat->type == FOR_STAT) {
+          // The init expression still runs once.
+          forget_expr_calls(stat->iter);
+          stat_ast_t *init = create_stat(EXPR_STAT, stat->pos);
+          init->expr = stat->init;
+          *slot = init;
+        } else {
+          *slot = create_stat(SKIP_STAT, stat->pos);
+        }
+        return false;
+      }
+
+      prune(&stat->body);
+      // Without break statements, a loop on a constant true condition can only
+      // be left by returning.
+      return eval_const(stat->cond, &cond) && cond;
+    case BLOCK_STAT:
+      return prune_block(stat);
+    default:
+      return false;
+  }
+}
+
+/* Prunes each statement of the block, and removes the statements following one
+ * that never completes. Returns true if the block never completes. */
+static bool prune_block(stat_ast_t *block) {
+  list_t *stats = &block->stats;
+  for (list_elem_t *e = list_begin(stats); e != list_end(stats); e = list_next(e)) {
+    stat_ast_t *stat = list_entry(e, stat_ast_t, block_elem);
+    stat_ast_t *pruned = stat;
+    bool exits = prune(&pruned);
+    if (pruned != stat) {
+      list_insert(e, &pruned->block_elem);
+      list_remove(e);
+      e = &pruned->block_elem;
+    }
+
+    if (!exits) {
+      continue;
+    }
+
+    bool warned = false;
+    list_elem_t *dead = list_next(e);
+    while (dead != list_end(stats)) {
+      stat_ast_t *s = list_entry(dead, stat_ast_t, block_elem);
+      if (s->type == DECL_STAT && s->is_func) {
+        // Nested functions are reached through calls, not control flow.
+        dead = list_next(dead);
+        continue;
+      }
+
+      if (!warned && s->type != SKIP_STAT) {
+        warning(&s->pos, "Unreachable code.");
+        warned = true;
+      }
+      forget_calls(s);
+      dead = list_remove(dead);
+    }
+    return true;
+  }
+
+  return false;
+}
+
+/* Evaluates an expression made of literals only, in 64 bits and dividing like
+ * the generated code does. Returns false if the expression is not constant, or
+ * if an operation overflows or faults. */
+static bool eval_const(expr_ast_t *expr, int64_t *value) {
+  if (expr->type == INT_LIT) {
+    *value = expr->ival;
+    return true;
+  }
+
+  int64_t left, right;
+  if (expr->type != BIN_OP || expr->op == ASSIGN || !eval_const(expr->left, &left)
+      || !eval_const(expr->right, &right)) {
+    return false;
+  }
+
+  switch (expr->op) {
+    case ADD:
+      return !__builtin_add_overflow(left, right, value);
+    case SUBS:
+      return !__builtin_sub_overflow(left, right, value);
+    case MUL:
+      return !__builtin_mul_overflow(left, right, value);
+    case DIV:
+      return arith_divide(left, right, value);
+    case EQ:
+      *value = left == right;
+      return true;
+    case GT:
+      *value = left > right;
+      return true;
+    case GTE:
+      *value = left >= right;
+      return true;
+    case LT:
+      *value = left < right;
+      return true;
+    case LTE:
+      *value = left <= right;
+      return true;
+    default:
+      return false;
+  }
+}
+
+/* Removes the calls made by removed code from the call graph. */
+static void forget_calls(stat_ast_t *stat) {
+  switch (stat->type) {
+    case RETURN_STAT:
+    case EXPR_STAT:
+      forget_expr_calls(stat->expr);
+      break;
+    case IF_STAT:
+      forget_expr_calls(stat->cond);
+      forget_calls(stat->tstat);
+      if (stat->fstat) {
+        forget_calls(stat->fstat);
+      }
+      break;
+    case FOR_STAT:
+      forget_expr_calls(stat->init);
+      forget_expr_calls(stat->iter);
+      // Fall through
+    case WHILE_STAT:
+      forget_expr_calls(stat->cond);
+      forget_calls(stat->body);
+      break;
+    case BLOCK_STAT:
+      for (list_elem_t *e = list_begin(&stat->stats); e != list_end(&stat->stats);
+          e = list_next(e)) {
+        forget_calls(list_entry(e, stat_ast_t, block_elem));
+      }
+      break;
+    case DECL_STAT:
+      if (!stat->is_func && stat->value) {
+        forget_expr_calls(stat->value);
+      }
+      break;
+    default:
+      break;
+  }
+}
+
+static void forget_expr_calls(expr_ast_t *expr) {
+  if (expr->type == BIN_OP) {
+    forget_expr_calls(expr->left);
+    forget_expr_calls(expr->right);
+  } else if (expr->type == FUNC_CALL && expr->symbol) {
+    callgraph_remove_call(current_function, expr);
+  }
+}
+
+static stat_ast_t *create_stat(stat_ast_type_t type, position_t pos) {
+  stat_ast_t *stat = (stat_ast_t *) arena_alloc(sizeof(stat_ast_t));
+  stat->type = type;
+  stat->pos = pos;
+  return stat;
+}
@@ -0,0 +1,7 @@
+#ifndef DEADCODE_H
+#define DEADCODE_H
+#include "parser.h"
+
+void eliminate_dead_code(stat_ast_t *);
+
+#endif
@@ -0,0 +1,389 @@
+#include <stdlib.h>
+#include <string.h>
+#include <elf.h>
+#include "elfobj.h"
+#include "outbuf.h"
+
+/* Writer of ELF64 relocatable objects. The file holds, in order: the ELF
+ * header, the contents of the sections of the object, the .eh_frame unwind
+ * information of its functions, a .rela section for each section with
+ * relocations, an empty .note.GNU-stack so that the stack is not made
+ * executable, the symbol and string tables, and the section header table. */
+
+#define SYMBOL_SIZE sizeof(Elf64_Sym)
+#define RELA_SIZE sizeof(Elf64_Rela)
+
+// Call frame information, see write_eh_frame.
+#define DW_CFA_advance_loc 0x40
+#define DW_CFA_offset 0x80
+#define DW_CFA_restore 0xc0
+#define DW_CFA_advance_loc1 0x02
+#define DW_CFA_advance_loc4 0x04
+#define DW_CFA_def_cfa 0x0c
+#define DW_CFA_def_cfa_offset 0x0e
+#define DW_EH_PE_pcrel 0x10
+#define DW_EH_PE_sdata4 0x0b
+#define DWARF_RBP 6
+#define DWARF_RSP 7
+#define DWARF_RETURN_ADDRESS 16
+// The number of rsp in x86_cfa_t. The frame address is based on rsp or rbp.
+#define X86_RSP 4
+
+/* A growable byte buffer, the contents of one section of the file. */
+typedef struct {
+  uint8_t *data;
+  size_t size, capacity;
+} bytes_t;
+
+static void append(bytes_t *, const void *, size_t);
+static uint32_t add_string(bytes_t *, const char *);
+static void pad(bytes_t *, size_t);
+static Elf64_Shdr section_header(uint32_t, uint32_t, uint64_t, uint64_t, uint64_t);
+static void write_eh_frame(x86_obj_t *, const int *, bytes_t *, bytes_t *);
+static void write_cfa_change(bytes_t *, const x86_cfa_t *, const x86_cfa_t *);
+static void append_byte(bytes_t *, uint8_t);
+static void append_uleb(bytes_t *, uint64_t);
+static void append32(bytes_t *, size_t, uint32_t);
+
+/* Writes the object, which must already be finished, to the buffer. Returns
+ * false if the output could not be written. */
+bool elf_write(x86_obj_t *obj, outbuf_t *out) {
+  bytes_t body = {0, 0, 0};        // Everything between the header and the section headers
+  bytes_t shstrtab = {0, 0, 0};
+  bytes_t strtab = {0, 0, 0};
+  bytes_t symtab = {0, 0, 0};
+  bytes_t headers = {0, 0, 0};
+  bytes_t eh_frame = {0, 0, 0};
+  bytes_t eh_frame_relas = {0, 0, 0};
+  add_string(&shstrtab, "");
+  add_string(&strtab, "");
+
+  // Section headers are numbered: null, the object's sections, .eh_frame if
+  // there are functions, the .rela sections, .note.GNU-stack, .symtab,
+  // .strtab, .shstrtab.
+  bool unwind = obj->function_count > 0;
+  int eh_frame_index = 1 + obj->section_count;
+  int rela_count = unwind;
+  for (int i = 0; i < obj->section_count; i++) {
+    rela_count += obj->sections[i].reloc_count > 0;
+  }
+  int note_index = 1 + obj->section_count + unwind + rela_count;
+  int symtab_index = note_index + 1;
+  int strtab_index = symtab_index + 1;
+  int shstrtab_index = strtab_index + 1;
+  int section_count = shstrtab_index + 1;
+
+  // Symbols: the null symbol, the locals, then the globals.
+  int *symbol_index = (int *) malloc(sizeof(int) * (obj->symbol_count + 1));
+  Elf64_Sym null_symbol;
+  memset(&null_symbol, 0, SYMBOL_SIZE);
+  append(&symtab, &null_symbol, SYMBOL_SIZE);
+  int elf_symbol_count = 1, first_global = 0;
+  for (int pass = 0; pass < 2; pass++) {
+    bool global = pass == 1;
+    if (global) {
+      first_global = elf_symbol_count;
+    }
+    for (int i = 0; i < obj->symbol_count; i++) {
+      x86_symbol_t *symbol = &obj->symbols[i];
+      // Undefined symbols are always global.
+      if ((symbol->global || symbol->section == -1) != global) {
+        continue;
+      }
+
+      Elf64_Sym sym;
+      memset(&sym, 0, SYMBOL_SIZE);
+      sym.st_name = add_string(&strtab, symbol->name);
+      sym.st_info = ELF64_ST_INFO(global ? STB_GLOBAL : STB_LOCAL,
+          symbol->function ? STT_FUNC : STT_NOTYPE);
+      sym.st_shndx = symbol->section == -1 ? SHN_UNDEF : symbol->section + 1;
+      sym.st_value = symbol->code_offset;
+      sym.st_size = symbol->function ? symbol->size : 0;
+      append(&symtab, &sym, SYMBOL_SIZE);
+      symbol_index[i] = elf_symbol_count++;
+    }
+  }
+
+  Elf64_Shdr null_header;
+  memset(&null_header, 0, sizeof(Elf64_Shdr));
+  append(&headers, &null_header, sizeof(Elf64_Shdr));
+
+  size_t offset = sizeof(Elf64_Ehdr);
+  for (int i = 0; i < obj->section_count; i++) {
+    section_t *section = &obj->sections[i];
+    Elf64_Shdr header;
+    if (section->type == BSS_SECTION) {
+      header = section_header(add_string(&shstrtab, section->name), SHT_NOBITS,
+          SHF_ALLOC | SHF_WRITE, offset + body.size, section->bss_size);
+      header.sh_addralign = 8;
+    } else {
+      if (section->type == DATA_SECTION) {
+        pad(&body, 8);
+      }
+      header = section_header(add_string(&shstrtab, section->name), SHT_PROGBITS,
+          section->type == TEXT_SECTION ? SHF_ALLOC | SHF_EXECINSTR : SHF_ALLOC | SHF_WRITE,
+          offset + body.size, section->size);
+      header.sh_addralign = section->type == TEXT_SECTION ? 1 : 8;
+      append(&body, section->code, section->size);
+    }
+    append(&headers, &header, sizeof(Elf64_Shdr));
+  }
+
+  if (unwind) {
+    write_eh_frame(obj, symbol_index, &eh_frame, &eh_frame_relas);
+    pad(&body, 8);
+    Elf64_Shdr header = section_header(add_string(&shstrtab, ".eh_frame"), SHT_X86_64_UNWIND,
+        SHF_ALLOC, offset + body.size, eh_frame.size);
+    header.sh_addralign = 8;
+    append(&headers, &header, sizeof(Elf64_Shdr));
+    append(&body, eh_frame.data, eh_frame.size);
+  }
+
+  for (int i = 0; i < obj->section_count; i++) {
+    section_t *section = &obj->sections[i];
+    if (section->reloc_count == 0) {
+      continue;
+    }
+
+    char *name = (char *) malloc(strlen(section->name) + 6);
+    strcpy(name, ".rela");
+    strcat(name, section->name);
+    pad(&body, 8);
+    Elf64_Shdr header = section_header(add_string(&shstrtab, name), SHT_RELA, SHF_INFO_LINK,
+        offset + body.size, section->reloc_count * RELA_SIZE);
+    header.sh_link = symtab_index;
+    header.sh_info = i + 1;
+    header.sh_addralign = 8;
+    header.sh_entsize = RELA_SIZE;
+    append(&headers, &header, sizeof(Elf64_Shdr));
+    free(name);
+
+    for (int j = 0; j < section->reloc_count; j++) {
+      reloc_t *reloc = &section->relocs[j];
+      Elf64_Rela rela;
+      rela.r_offset = reloc->code_offset;
+      rela.r_info = ELF64_R_INFO(symbol_index[reloc->symbol], reloc->type);
+      rela.r_addend = reloc->addend;
+      append(&body, &rela, RELA_SIZE);
+    }
+  }
+
+  if (unwind) {
+    pad(&body, 8);
+    Elf64_Shdr header = section_header(add_string(&shstrtab, ".rela.eh_frame"), SHT_RELA,
+        SHF_INFO_LINK, offset + body.size, eh_frame_relas.size);
+    header.sh_link = symtab_index;
+    header.sh_info = eh_frame_index;
+    header.sh_addralign = 8;
+    header.sh_entsize = RELA_SIZE;
+    append(&headers, &header, sizeof(Elf64_Shdr));
+    append(&body, eh_frame_relas.data, eh_frame_relas.size);
+  }
+
+  Elf64_Shdr note = section_header(add_string(&shstrtab, ".note.GNU-stack"), SHT_PROGBITS, 0,
+      offset + body.size, 0);
+  note.sh_addralign = 1;
+  append(&headers, &note, sizeof(Elf64_Shdr));
+
+  pad(&body, 8);
+  Elf64_Shdr symtab_header = section_header(add_string(&shstrtab, ".symtab"), SHT_SYMTAB, 0,
+      offset + body.size, symtab.size);
+  symtab_header.sh_link = strtab_index;
+  symtab_header.sh_info = first_global;
+  symtab_header.sh_addralign = 8;
+  symtab_header.sh_entsize = SYMBOL_SIZE;
+  append(&headers, &symtab_header, sizeof(Elf64_Shdr));
+  append(&body, symtab.data, symtab.size);
+
+  Elf64_Shdr strtab_header = section_header(add_string(&shstrtab, ".strtab"), SHT_STRTAB, 0,
+      offset + body.size, strtab.size);
+  strtab_header.sh_addralign = 1;
+  append(&headers, &strtab_header, sizeof(Elf64_Shdr));
+  append(&body, strtab.data, strtab.size);
+
+  uint32_t shstrtab_name = add_string(&shstrtab, ".shstrtab");
+  Elf64_Shdr shstrtab_header = section_header(shstrtab_name, SHT_STRTAB, 0,
+      offset + body.size, shstrtab.size);
+  shstrtab_header.sh_addralign = 1;
+  append(&headers, &shstrtab_header, sizeof(Elf64_Shdr));
+  append(&body, shstrtab.data, shstrtab.size);
+  pad(&body, 8);
+
+  Elf64_Ehdr elf_header;
+  memset(&elf_header, 0, sizeof(Elf64_Ehdr));
+  memcpy(elf_header.e_ident, ELFMAG, SELFMAG);
+  elf_header.e_ident[EI_CLASS] = ELFCLASS64;
+  elf_header.e_ident[EI_DATA] = ELFDATA2LSB;
+  elf_header.e_ident[EI_VERSION] = EV_CURRENT;
+  elf_header.e_ident[EI_OSABI] = ELFOSABI_SYSV;
+  elf_header.e_type = ET_REL;
+  elf_header.e_machine = EM_X86_64;
+  elf_header.e_version = EV_CURRENT;
+  elf_header.e_shoff = offset + body.size;
+  elf_header.e_ehsize = sizeof(Elf64_Ehdr);
+  elf_header.e_shentsize = sizeof(Elf64_Shdr);
+  elf_header.e_shnum = section_count;
+  elf_header.e_shstrndx = shstrtab_index;
+
+  outbuf_write(out, (const char *) &elf_header, sizeof(Elf64_Ehdr));
+  outbuf_write(out, (const char *) body.data, body.size);
+  outbuf_write(out, (const char *) headers.data, headers.size);
+  outbuf_flush(out);
+  bool ok = !out->failed;
+
+  free(symbol_index);
+  free(body.data);
+  free(shstrtab.data);
+  free(strtab.data);
+  free(symtab.data);
+  free(headers.data);
+  free(eh_frame.data);
+  free(eh_frame_relas.data);
+  return ok;
+}
+
+/* Writes the unwind information of the functions, as the call frame
+ * information of DWARF: a common entry with the rule at the entry of every
+ * function, where the return address is at the top of the stack, and an entry
+ * for each function with the changes of its rows. The relocations that give
+ * the start of each function go to relas. */
+static void write_eh_frame(x86_obj_t *obj, const int *symbol_index, bytes_t *frame,
+    bytes_t *relas) {
+  append32(frame, frame->size, 0); // Length, filled in below
+  append32(frame, frame->size, 0); // Common entry
+  append_byte(frame, 1); // Version
+  append(frame, "zR", 3);
+  append_uleb(frame, 1); // Code alignment
+  append_byte(frame, 0x78); // Data alignment, -8 in SLEB128
+  append_uleb(frame, DWARF_RETURN_ADDRESS);
+  append_uleb(frame, 1); // Augmentation data: the encoding of addresses
+  append_byte(frame, DW_EH_PE_pcrel | DW_EH_PE_sdata4);
+  append_byte(frame, DW_CFA_def_cfa);
+  append_uleb(frame, DWARF_RSP);
+  append_uleb(frame, 8);
+  append_byte(frame, DW_CFA_offset | DWARF_RETURN_ADDRESS);
+  append_uleb(frame, 1); // At the frame address - 8
+  pad(frame, 8);
+  append32(frame, 0, frame->size - 4);
+
+  for (int i = 0; i < obj->function_count; i++) {
+    x86_function_t *function = &obj->functions[i];
+    x86_symbol_t *symbol = &obj->symbols[function->symbol];
+    size_t start = frame->size;
+    append32(frame, frame->size, 0); // Length
+    append32(frame, frame->size, frame->size); // Back to the common entry
+    Elf64_Rela rela;
+    rela.r_offset = frame->size;
+    rela.r_info = ELF64_R_INFO(symbol_index[function->symbol], R_X86_64_PC32);
+    rela.r_addend = 0;
+    append(relas, &rela, RELA_SIZE);
+    append32(frame, frame->size, 0); // The start of the function, relocated
+    append32(frame, frame->size, symbol->size);
+    append_uleb(frame, 0); // Augmentation data
+
+    size_t position = symbol->code_offset;
+    x86_cfa_t entry = {0, 0, X86_RSP, 8, false};
+    const x86_cfa_t *last = &entry;
+    for (int j = function->first_row; j < function->first_row + function->row_count; j++) {
+      x86_cfa_t *row = &obj->rows[j];
+      size_t advance = row->code_offset - position;
+      if (advance > 0xff) {
+        append_byte(frame, DW_CFA_advance_loc4);
+        append32(frame, frame->size, advance);
+      } else if (advance >= 0x40) {
+        append_byte(frame, DW_CFA_advance_loc1);
+        append_byte(frame, advance);
+      } else if (advance > 0) {
+        append_byte(frame, DW_CFA_advance_loc | advance);
+      }
+      position = row->code_offset;
+      write_cfa_change(frame, last, row);
+      last = row;
+    }
+    pad(frame, 8);
+    append32(frame, start, frame->size - start - 4);
+  }
+}
+
+/* Writes the instructions that change the rule of from into the rule of to. */
+static void write_cfa_change(bytes_t *frame, const x86_cfa_t *from, const x86_cfa_t *to) {
+  if (to->cfa_register != from->cfa_register) {
+    append_byte(frame, DW_CFA_def_cfa);
+    append_uleb(frame, to->cfa_register == X86_RSP ? DWARF_RSP : DWARF_RBP);
+    append_uleb(frame, to->cfa_offset);
+  } else if (to->cfa_offset != from->cfa_offset) {
+    append_byte(frame, DW_CFA_def_cfa_offset);
+    append_uleb(frame, to->cfa_offset);
+  }
+  if (to->rbp_saved && !from->rbp_saved) {
+    append_byte(frame, DW_CFA_offset | DWARF_RBP);
+    append_uleb(frame, 2); // At the frame address - 16
+  } else if (!to->rbp_saved && from->rbp_saved) {
+    append_byte(frame, DW_CFA_restore | DWARF_RBP);
+  }
+}
+
+static void append_byte(bytes_t *bytes, uint8_t byte) {
+  append(bytes, &byte, 1);
+}
+
+static void append_uleb(bytes_t *bytes, uint64_t value) {
+  do {
+    uint8_t byte = value & 0x7f;
+    value >>= 7;
+    append_byte(bytes, value ? byte | 0x80 : byte);
+  } while (value);
+}
+
+/* Writes a little endian 32-bit value at the offset, which is at most the size
+ * of the buffer. */
+static void append32(bytes_t *bytes, size_t offset, uint32_t value) {
+  uint8_t data[4];
+  for (int i = 0; i < 4; i++) {
+    data[i] = (uint8_t) (value >> (8 * i));
+  }
+  if (offset == bytes->size) {
+    append(bytes, data, 4);
+  } else {
+    memcpy(bytes->data + offset, data, 4);
+  }
+}
+
+static void append(bytes_t *bytes, const void *data, size_t size) {
+  if (bytes->size + size > bytes->capacity) {
+    bytes->capacity = bytes->capacity ? bytes->capacity : 256;
+    while (bytes->size + size > bytes->capacity) {
+      bytes->capacity *= 2;
+    }
+    bytes->data = (uint8_t *) realloc(bytes->data, bytes->capacity);
+  }
+  if (size) {
+    memcpy(bytes->data + bytes->size, data, size);
+  }
+  bytes->size += size;
+}
+
+/* Adds a string to a string table, and returns its offset in the table. */
+static uint32_t add_string(bytes_t *table, const char *str) {
+  uint32_t offset = table->size;
+  append(table, str, strlen(str) + 1);
+  return offset;
+}
+
+/* Pads the buffer with zeroes to a multiple of alignment. */
+static void pad(bytes_t *bytes, size_t alignment) {
+  static const uint8_t zeroes[8] = {0};
+  append(bytes, zeroes, (alignment - bytes->size % alignment) % alignment);
+}
+
+static Elf64_Shdr section_header(uint32_t name, uint32_t type, uint64_t flags, uint64_t offset,
+    uint64_t size) {
+  Elf64_Shdr header;
+  memset(&header, 0, sizeof(Elf64_Shdr));
+  header.sh_name = name;
+  header.sh_type = type;
+  header.sh_flags = flags;
+  header.sh_offset = offset;
+  header.sh_size = size;
+  return header;
+}
@@ -0,0 +1,8 @@
+#ifndef ELFOBJ_H
+#define ELFOBJ_H
+#include "outbuf.h"
+#include "x86.h"
+
+bool elf_write(x86_obj_t *, outbuf_t *);
+
+#endif
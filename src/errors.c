@@ -1,18 +1,34 @@
 #include "errors.h"
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdarg.h>
+#include "context.h"
 
-static void create_message(position_t *, const char *, char *, va_list *);
-static void add_message(char *);
+typedef enum {
+  ERROR_MESSAGE,
+  WARNING_MESSAGE,
+  REMARK_MESSAGE
+} message_type_t;
 
 typedef struct {
   char *str;
+  message_type_t type;
+  // Of remarks, for remarks_to_json
+  paola_remark_t kind;
+  const char *pass;
+  char *function, *text;
+  int line, column;
   list_elem_t elem;
 } message_t;
 
-static list_t messages;
-static int errors, warnings;
+static void create_message(position_t *, message_type_t, char *, va_list *);
+static message_t *add_message(char *, message_type_t);
+static void json_string(outbuf_t *, const char *);
+static char *copy_string(const char *);
+
+// The list this thread's messages go to, if not the main one.
+static _Thread_local list_t *redirect;
 
 const char *token_t_to_str(token_type_t type) {
   switch (type) {
@@ -50,6 +66,8 @@ const char *token_t_to_str(token_type_t type) {
       return "FOR";
     case ELSE_TOK:
       return "ELSE";
+    case INLINE_TOK:
+      return "INLINE";
     case ASSIGN_TOK:
       return "ASSIGN";
     case EQ_TOK:
@@ -146,7 +164,7 @@ const char *expr_t_to_str(expr_ast_type_t expr_type) {
   }
 }
 
-static void create_message(position_t *pos, const char *beginning, char *format, va_list *args) {
+static void create_message(position_t *pos, message_type_t type, char *format, va_list *args) {
   char str[1024];
   int line = 0, column = 0, len = 0;
 
@@ -155,7 +173,7 @@ static void create_message(position_t *pos, const char *beginning, char *format,
     column = pos->character;
   }
 
-  sprintf(str, "%s line %d:%d: ", beginning, line, column);
+  sprintf(str, "%s line %d:%d: ", type == ERROR_MESSAGE ? "Error" : "Warning", line, column);
 
   len = strlen(str);
   vsprintf(str + len, format, *args);
@@ -163,57 +181,199 @@ static void create_message(position_t *pos, const char *beginning, char *format,
   len = strlen(str);
   sprintf(str + len, "\n");
 
-  add_message(str);
+  add_message(str, type);
 }
 
 void error(position_t *pos, char *format, ...) {
-  errors++;
+  context->error_count++;
 
   va_list args;
   va_start(args, format);
-  create_message(pos, "Error", format, &args);
+  create_message(pos, ERROR_MESSAGE, format, &args);
   va_end(args);
 }
 
 void warning(position_t *pos, char *format, ...) {
-  warnings++;
+  context->warning_count++;
 
   va_list args;
   va_start(args, format);
-  create_message(pos, "Warning", format, &args);
+  create_message(pos, WARNING_MESSAGE, format, &args);
   va_end(args);
 }
 
-static void add_message(char *str) {
+/* Returns true if the options ask for remarks of the kind, so that passes can
+ * skip working out the ones nobody will see. */
+bool remarks_enabled(paola_remark_t kind) {
+  return (context->options.remarks & kind) != 0;
+}
+
+/* Reports what an optimization pass did, or could not do and why, at a
+ * position in the given function (which may be 0). Remarks are messages like
+ * warnings, but are only given when the options ask for their kind, and are
+ * not counted. Each is named after the -R flag that asks for it. */
+void remark(paola_remark_t kind, const char *pass, position_t *pos, const char *function,
+    char *format, ...) {
+  if (!remarks_enabled(kind)) {
+    return;
+  }
+
+  char text[1024], str[1200];
+  va_list args;
+  va_start(args, format);
+  vsnprintf(text, sizeof(text), format, args);
+  va_end(args);
+
+  int line = pos ? pos->line : 0, column = pos ? pos->character : 0;
+  const char *flag = kind == PAOLA_REMARK_PASSED ? "-Rpass"
+      : kind == PAOLA_REMARK_MISSED ? "-Rpass-missed" : "-Rpass-analysis";
+  snprintf(str, sizeof(str), "Remark line %d:%d: %s [%s=%s]\n", line, column, text, flag, pass);
+
+  message_t *message = add_message(str, REMARK_MESSAGE);
+  message->kind = kind;
+  message->pass = pass;
+  message->function = function ? copy_string(function) : 0;
+  message->text = copy_string(text);
+  message->line = line;
+  message->column = column;
+}
+
+static message_t *add_message(char *str, message_type_t type) {
   int len = strlen(str);
   message_t *message = (message_t *) malloc(sizeof(message_t));
   message->str = (char *) malloc(sizeof(char) * (len + 1));
+  message->type = type;
+  message->function = message->text = 0;
   strcpy(message->str, str);
 
-  list_push_back(&messages, &message->elem);
+  list_push_back(redirect ? redirect : &context->messages, &message->elem);
+  return message;
 }
 
+/* Throws away the messages of the previous compilation. */
 void errors_init(void) {
-  warnings = 0;
-  errors = 0;
-  list_init(&messages);
+  errors_discard(&context->messages);
+  context->error_count = 0;
+  context->warning_count = 0;
+}
+
+/* Collects the messages of this thread in the log instead, or in the main list
+ * again if log is NULL. Tasks running in parallel keep their messages apart
+ * this way, and add them with errors_append in a deterministic order. */
+void errors_redirect(list_t *log) {
+  redirect = log;
+}
+
+/* Moves the messages of a log to the end of the main list. */
+void errors_append(list_t *log) {
+  if (!list_empty(log)) {
+    list_splice(list_end(&context->messages), list_begin(log), list_end(log));
+  }
+}
+
+/* Throws away the messages of a log, as if they were never reported. */
+void errors_discard(list_t *log) {
+  while (!list_empty(log)) {
+    message_t *message = list_entry(list_pop_front(log), message_t, elem);
+    if (message->type == ERROR_MESSAGE) {
+      context->error_count--;
+    } else if (message->type == WARNING_MESSAGE) {
+      context->warning_count--;
+    }
+    free(message->str);
+    free(message->function);
+    free(message->text);
+    free(message);
+  }
 }
 
 int error_count(void) {
-  return errors;
+  return context->error_count;
 }
 
 int warning_count(void) {
-  return warnings;
+  return context->warning_count;
+}
+
+/* Returns all messages as one string. */
+char *messages_to_str(void) {
+  size_t length = 0;
+  for (list_elem_t *e = list_begin(&context->messages); e != list_end(&context->messages);
+      e = list_next(e)) {
+    length += strlen(list_entry(e, message_t, elem)->str);
+  }
+
+  char *str = (char *) malloc(length + 1);
+  length = 0;
+  for (list_elem_t *e = list_begin(&context->messages); e != list_end(&context->messages);
+      e = list_next(e)) {
+    message_t *msg = list_entry(e, message_t, elem);
+    strcpy(str + length, msg->str);
+    length += strlen(msg->str);
+  }
+  str[length] = 0;
+  return str;
 }
 
-void print_messages(FILE *out) {
-  for (list_elem_t *e = list_begin(&messages); e != list_end(&messages);
+/* Returns the remarks among the messages as a JSON document, with an object
+ * for each remark that tools can aggregate over many files. */
+char *remarks_to_json(void) {
+  outbuf_t json;
+  outbuf_init_memory(&json);
+  outbuf_str(&json, "{\"remarks\":[");
+  bool first = true;
+  for (list_elem_t *e = list_begin(&context->messages); e != list_end(&context->messages);
       e = list_next(e)) {
     message_t *msg = list_entry(e, message_t, elem);
-#pragma GCC diagnostic push
-#pragma GCC diagnostic ignored "-Wformat-security"
-    fprintf(out, msg->str);
-#pragma GCC diagnostic pop
+    if (msg->type != REMARK_MESSAGE) {
+      continue;
+    }
+    outbuf_str(&json, first ? "\n" : ",\n");
+    first = false;
+    outbuf_str(&json, "{\"kind\":\"");
+    outbuf_str(&json, msg->kind == PAOLA_REMARK_PASSED ? "passed"
+        : msg->kind == PAOLA_REMARK_MISSED ? "missed" : "analysis");
+    outbuf_str(&json, "\",\"pass\":");
+    json_string(&json, msg->pass);
+    outbuf_str(&json, ",\"function\":");
+    if (msg->function) {
+      json_string(&json, msg->function);
+    } else {
+      outbuf_str(&json, "null");
+    }
+    outbuf_str(&json, ",\"line\":");
+    outbuf_int(&json, msg->line);
+    outbuf_str(&json, ",\"column\":");
+    outbuf_int(&json, msg->column);
+    outbuf_str(&json, ",\"message\":");
+    json_string(&json, msg->text);
+    outbuf_char(&json, '}');
+  }
+  outbuf_str(&json, "\n]}\n");
+  outbuf_char(&json, '\0');
+  return json.data;
+}
+
+/* Appends the string quoted and escaped for JSON. */
+static void json_string(outbuf_t *json, const char *string) {
+  outbuf_char(json, '"');
+  for (; *string; string++) {
+    if (*string == '"' || *string == '\\') {
+      outbuf_char(json, '\\');
+      outbuf_char(json, *string);
+    } else if ((unsigned char) *string < ' ') {
+      char escape[8];
+      snprintf(escape, sizeof(escape), "\\u%04x", (unsigned char) *string);
+      outbuf_str(json, escape);
+    } else {
+      outbuf_char(json, *string);
+    }
   }
+  outbuf_char(json, '"');
+}
+
+static char *copy_string(const char *string) {
+  char *copy = (char *) malloc(strlen(string) + 1);
+  strcpy(copy, string);
+  return copy;
 }
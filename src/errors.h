@@ -1,5 +1,7 @@
 #ifndef ERRORS_H
 #define ERRORS_H
+#include <stdbool.h>
+#include "libpaola.h"
 #include "lexer.h"
 #include "parser.h"
 
@@ -11,11 +13,17 @@ const char *datatype_to_str(datatype_t datatype);
 
 void error(position_t *, char *, ...);
 void warning(position_t *, char *, ...);
+bool remarks_enabled(paola_remark_t);
+void remark(paola_remark_t, const char *, position_t *, const char *, char *, ...);
 void errors_init(void);
+void errors_redirect(list_t *);
+void errors_append(list_t *);
+void errors_discard(list_t *);
 
 int error_count(void);
 int warning_count(void);
 
-void print_messages(FILE *out);
+char *messages_to_str(void);
+char *remarks_to_json(void);
 
 #endif
@@ -1,12 +1,25 @@
 #pragma GCC diagnostic ignored "-Wwrite-strings"
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
 #include <assert.h>
 #include "gen.h"
+#include "inline.h"
+#include "callgraph.h"
+#include "outbuf.h"
+#include "x86.h"
 #include "symtable.h"
 #include "errors.h"
+#include "pool.h"
+#include "context.h"
+#include "arena.h"
+#include "hash.h"
+#include "incremental.h"
+#include "report.h"
+#include "pgo.h"
+#include "passes.h"
 
 /* A Register Set, or RegSet, is represented with a 16-bit number where
  * the i-th bit is on iff the i-th register is available (for i in
@@ -29,37 +42,168 @@ static const char *register_names[10] = {
   "r15"
 };
 
-static FILE *out;
-static int next_label;
-static int next_stack_offset;
-
-/* A struct representing x86 command arguments. Instances of this struct can be
- * constructed with methods below. */
+/* Functions are generated by separate tasks, in parallel when emitting
+ * assembly. Each has its own output buffer and labels, and the buffers are
+ * written out in emission order. The state of the function being generated is
+ * local to the thread generating it. */
 typedef struct {
-  enum arg_type_t {
-    LIT_ARG,
-    REG_ARG,
-    MEM_ARG
-  } type;
-
-  union {
-    int32_t lit;
-    struct {
-      const char *reg;
-      int32_t offset;
-    };
-  };
-} arg_t;
+  symbol_t *function;
+  int number;           // Position in the emission order, names its labels
+  int label_base;       // First label number, in an object
+  hash_t fingerprint;   // When indexing, see fingerprint_function
+  outbuf_t text;
+  list_t messages;
+} gen_task_t;
+
+static _Thread_local outbuf_t *out;
+static _Thread_local int next_label, label_base, function_number;
+static _Thread_local int next_stack_offset;
+
+// Holds the last symbol that symbol_name got on the thread.
+static _Thread_local char *symbol_buffer;
+static _Thread_local size_t symbol_capacity;
+
+/* A function call that is being expanded in place. Return statements in the
+ * callee's body leave their result in the destination register of the call
+ * and jump to the return label, which follows the expanded body. */
+typedef struct inline_frame {
+  symbol_t *callee;
+  int return_label;
+  stat_ast_t *last_stat; // A return statement here can fall through instead.
+  struct inline_frame *parent;
+  // The stack offsets of the callee's locals in this expansion. They are not
+  // stored in the symbols, which other threads may be expanding too.
+  symbol_t **locals;
+  uint32_t *offsets;
+  int local_count, local_capacity;
+} inline_frame_t;
+
+static _Thread_local inline_frame_t *inline_frame; // The innermost expansion, or 0.
+static _Thread_local int inline_depth;
+
+/* The function being generated, and the label right after its entry that self
+ * recursive tail calls jump to (-1 if it has none). */
+static _Thread_local symbol_t *current_function;
+static _Thread_local int entry_label;
+
+/* The loops around the code being generated, and the variables of the task
+ * that were already remarked on as kept on the stack inside one. */
+static _Thread_local int loop_depth;
+static _Thread_local symbol_t **stack_remarked;
+static _Thread_local int stack_remarked_count, stack_remarked_capacity;
+
+/* Every function has a frame below its return address. With frame pointers,
+ * see frame_pointer, it starts with the caller's rbp, which rbp points to.
+ * Instrumented functions then push the two quads of profile_entry, and the
+ * locals take the frame_size bytes below them, which keep the stack pointer
+ * 16 byte aligned at calls. A function that makes no calls keeps its locals
+ * below the stack pointer instead, in the 128 byte red zone that signal
+ * handlers leave alone, and has no frame without frame pointers.
+ *
+ * The unwind rules, the register the caller's stack pointer is at an offset
+ * from and whether rbp is saved, follow every change of the stack pointer or
+ * rbp. Debuggers and profilers read them from the .cfi directives, or from the
+ * .eh_frame of objects. */
+typedef struct {
+  const char *reg; // 0 outside of functions
+  int32_t offset;
+  bool rbp_saved;
+} cfa_t;
 
-static void init_gen(FILE *);
+static _Thread_local uint32_t frame_size;
+static _Thread_local bool frame_profiled;
+static _Thread_local cfa_t cfa, body_cfa; // Now, and where the body of the function runs
+
+#define RED_ZONE_SIZE 128
+
+/* An arm of an if statement that the profile found cold. It is generated after
+ * the end of its function, and jumps back to the end of the if statement. */
+typedef struct {
+  stat_ast_t *stat; // 0 for a missing else arm, which only counts its runs
+  int counter;
+  regset_t regset;
+  int label, join_label;
+  int loop_depth;
+} cold_block_t;
+
+static _Thread_local cold_block_t *cold_blocks;
+static _Thread_local int cold_count, cold_capacity;
+
+/* Loops that ran at least UNROLL_MIN_TRIPS iterations per entry in the profile
+ * are unrolled twice, and four times from 4 * UNROLL_MIN_TRIPS, as far as the
+ * unrolled loop stays within UNROLL_MAX_SIZE AST nodes. */
+#define UNROLL_MIN_TRIPS 8
+#define UNROLL_MAX_SIZE 96
+
+/* The description of the function being fingerprinted, and its locals in the
+ * order they were declared. */
+static _Thread_local outbuf_t fingerprint_text;
+static _Thread_local symbol_t **fingerprint_locals;
+static _Thread_local int fingerprint_count, fingerprint_capacity;
+
+static void init_gen(x86_obj_t *);
+static void generate_task(int, int, void *);
+static hash_t fingerprint_function(gen_task_t *);
+static void fingerprint_statement(stat_ast_t *);
+static void fingerprint_expression(expr_ast_t *);
+static int count_slots(stat_ast_t *);
+static int count_expr_slots(expr_ast_t *);
+static int function_slot_count(symbol_t *);
+static void place_local(symbol_t *);
+static uint32_t stack_offset(symbol_t *);
 
 /* Recursive code generators. */
+static void generate_program(stat_ast_t *, int);
 static void generate_statement(stat_ast_t *, regset_t);
+static void generate_if(stat_ast_t *, regset_t);
+static void generate_arm(stat_ast_t *, int, regset_t);
+static void generate_cold_blocks(void);
+static void generate_loop(stat_ast_t *, regset_t);
+static int unroll_factor(stat_ast_t *);
+static void generate_condition(expr_ast_t *, regset_t);
 static void generate_expression(expr_ast_t *, regset_t);
 static void generate_var_ref(expr_ast_t *, regset_t);
+static void remark_stack_variable(expr_ast_t *);
 static void generate_binop(expr_ast_t *, regset_t);
 static void generate_int_lit(expr_ast_t *, regset_t);
 static void generate_func_call(expr_ast_t *, regset_t);
+static void generate_inline_call(expr_ast_t *, regset_t);
+static bool can_inline(symbol_t *);
+static int stat_registers(stat_ast_t *);
+static int expr_registers(expr_ast_t *);
+static void generate_function(stat_ast_t *, regset_t);
+static bool generate_tail_call(expr_ast_t *, regset_t);
+static bool has_self_tail_call(stat_ast_t *, symbol_t *);
+static bool ends_with_return(stat_ast_t *);
+static void generate_globals(stat_ast_t *);
+static void function_return(void);
+
+/* Frames and unwind rules, see frame_size. */
+static bool frame_pointer(void);
+static void begin_function(const char *);
+static void end_function(const char *);
+static void enter_frame(int, bool, bool);
+static void leave_frame(void);
+static arg_t local_arg(uint32_t);
+static void set_cfa(const char *, int32_t, bool);
+static void clear_calls(stat_ast_t *, walk_t *);
+static void mark_calls(expr_ast_t *, walk_t *);
+
+/* Profiling of instrumented programs, see profile_entry. */
+static bool instrumenting(void);
+static void profile_entry(void);
+static void profile_exit(void);
+static void generate_profile_dump(symbol_t **, int);
+static void generate_profile_data(symbol_t **, int);
+static const char *profile_symbol(const char *, const char *);
+static void read_timestamp(void);
+
+/* Counters of programs compiled for profile-guided optimization, see pgo.c. */
+static bool counting(void);
+static void increment_counter(int);
+static int64_t node_count(int);
+static void generate_counter_dump(symbol_t **, int);
+static void generate_counter_data(symbol_t **, int);
 
 /* Gets the number of the next unused label. The full name of the labels shall
  * be lX, where X is the numbers this function returns. */
@@ -76,16 +220,20 @@ static const char *next_reg_name(regset_t);
 static arg_t arg_lit(int32_t);
 static arg_t arg_reg(const char *);
 static arg_t arg_mem(const char *, uint32_t);
+static arg_t arg_global(const char *);
 
 /* Helper functions for generating instructions. */
 static void gen_arg(arg_t);
 static void two_arg_command(const char *, arg_t, arg_t);
 static void one_arg_command(const char *, arg_t);
+static void jump_command(const char *, int32_t);
+static void func_command(const char *, const char *);
 static void save_registers(void);
 static void load_registers(void);
 
 /* Functions that generate x86 commands. */
 static void mov(arg_t, arg_t);
+static void lea(arg_t, arg_t);
 static void push(arg_t);
 static void pop(arg_t);
 static void cjmp(operator_t op, int jlabel); // Conditional jump
@@ -98,25 +246,337 @@ static void jne(int32_t);
 static void je(int32_t);
 static void jmp(int32_t);
 static void label(int32_t);
-static void func_label(char *);
+static void label_name(int32_t);
+static void func_section(symbol_t *);
+static void section(const char *, section_type_t);
+static void global(const char *);
+static void define(const char *);
+static void quad(int64_t);
+static void zero(size_t);
+static const char *symbol_name(const char *);
+static void free_symbol_buffer(void);
 static void call(char *);
+static void tail_jmp(char *);
 static void ret(void);
+static void string(const char *);
+static void call_library(const char *);
+
+// The analysis of the functions that make calls, see passes.h.
+const visitor_t calls_visitor = {.function = clear_calls, .expr = mark_calls};
+
+/* Generates assembly for the program into the output of the context, with the
+ * functions split among the given number of threads. */
+void generate_code(stat_ast_t *ast, int threads) {
+  init_gen(0);
+  generate_program(ast, threads);
+
+  outbuf_flush(&context->output);
+  if (context->output.failed) {
+    error(0, "Could not write the output file.");
+  }
+}
 
-void generate_code(FILE *file, stat_ast_t *ast) {
-  init_gen(file);
+/* Generates the program into an object, for an object file or for running it
+ * in memory. Returns 0 if the object could not be assembled. */
+x86_obj_t *generate_object(stat_ast_t *ast) {
+  init_gen(x86_create());
+  generate_program(ast, 1);
+
+  x86_obj_t *result = context->object;
+  context->object = 0;
+  if (!x86_finish(result)) {
+    x86_free(result);
+    return 0;
+  }
+  return result;
+}
+
+static void generate_program(stat_ast_t *ast, int threads) {
+  section(".text", TEXT_SECTION);
+  global(SYMBOL_PREFIX "main");
+  global("main");
+
+  // Functions are emitted in call graph order, unreachable ones are left out.
+  symbol_t **order;
+  int function_count = callgraph_order(&order);
+  symbol_t **functions;
+  int all_functions = callgraph_functions(&functions);
+  context->function_slots = (int *) malloc(sizeof(int) * (all_functions + 1));
+  for (int i = 0; i < all_functions; i++) {
+    context->function_slots[i] = -1;
+  }
+
+  gen_task_t *tasks = (gen_task_t *) malloc(sizeof(gen_task_t) * (function_count + 1));
+  for (int i = 0; i < function_count; i++) {
+    tasks[i].function = order[i];
+    tasks[i].number = i;
+    tasks[i].label_base = 0;
+    tasks[i].text.data = NULL;
+    list_init(&tasks[i].messages);
+    function_slot_count(order[i]); // The tasks only read the counts.
+  }
+
+  // Objects are assembled by one thread, and so is assembly for one thread,
+  // straight into the output, unless the functions are indexed.
+  bool indexed = !context->object && context->options.incremental;
+  if (indexed) {
+    index_load();
+  }
+  bool buffered = !context->object && (threads > 1 || indexed);
+  for (int i = 0; i < function_count && buffered; i++) {
+    outbuf_init_memory(&tasks[i].text);
+  }
+  pool_run(buffered ? threads : 1, function_count, generate_task, tasks);
+  for (int i = 0; i < function_count; i++) {
+    // Functions with messages are generated every time, to give them again.
+    if (indexed && list_empty(&tasks[i].messages)) {
+      index_add(tasks[i].fingerprint, tasks[i].text.data, tasks[i].text.size);
+    }
+    errors_append(&tasks[i].messages);
+    if (buffered) {
+      outbuf_append(&context->output, &tasks[i].text);
+      outbuf_free(&tasks[i].text);
+    }
+  }
+  free(tasks);
+  free(context->function_slots);
+
+  out = &context->output;
+
+  // main calls _main, with a slot for its status in the frame.
+  section(".text", TEXT_SECTION);
+  begin_function("main");
+  enter_frame(1, true, false);
+  call("main");
+  // The code after the call has labels of its own, after the ones of the functions.
+  function_number = function_count;
+  if (!context->object) {
+    next_label = 0;
+  }
+  if (instrumenting()) {
+    generate_profile_dump(order, function_count);
+  }
+  if (counting()) {
+    generate_counter_dump(order, function_count);
+  }
+  leave_frame();
+  ret();
+  end_function("main");
+  generate_globals(ast);
+  if (!context->object) {
+    // Like the objects paola writes, the program does not need an executable stack.
+    outbuf_str(out, "\t.section .note.GNU-stack,\"\",@progbits\n");
+  }
+  if (instrumenting()) {
+    generate_profile_data(order, function_count);
+  }
+  if (counting()) {
+    generate_counter_data(order, function_count);
+  }
+  free(order);
+  free_symbol_buffer();
+}
+
+static void generate_task(int index, int worker, void *data) {
+  gen_task_t *tasks = (gen_task_t *) data;
+  gen_task_t *task = &tasks[index];
+  double start = report_time();
+  errors_redirect(&task->messages);
+
+  out = context->object || task->text.data == NULL ? &context->output : &task->text;
+  if (context->object && index > 0) {
+    // Objects are generated in order, continue after the previous labels.
+    task->label_base = tasks[index - 1].label_base + next_label;
+  }
+  label_base = task->label_base;
+  next_label = 0;
+  function_number = task->number;
+  next_stack_offset = 8;
+  inline_frame = 0;
+  inline_depth = 0;
+  current_function = 0;
+  entry_label = -1;
+  loop_depth = 0;
+  stack_remarked_count = 0;
+
+  if (context->options.incremental) {
+    task->fingerprint = fingerprint_function(task);
+    const char *text;
+    size_t size;
+    if (index_find(task->fingerprint, &text, &size)) {
+      outbuf_write(out, text, size);
+      errors_redirect(NULL);
+      report_span(task->function->name, -1, "reused", worker, start);
+      return;
+    }
+  }
+
+  func_section(task->function);
+  generate_function(task->function->decl, initial_regset);
+  free_symbol_buffer();
+  free(stack_remarked);
+  stack_remarked = NULL;
+  stack_remarked_capacity = 0;
+  errors_redirect(NULL);
+  report_span(task->function->name, -1, "codegen", worker, start);
+}
+
+/* Hashes everything the code of a function depends on: its number, which comes
+ * from the emission order, its name, section and kind of frame, the passes of
+ * the code generator that run, and its checked and optimized body, together
+ * with the bodies of the calls that are expanded in place. Locals are told
+ * apart by the order they are declared in, which gives their stack slots. The
+ * code of a function with the same fingerprint is the same. */
+static hash_t fingerprint_function(gen_task_t *task) {
+  outbuf_init_memory(&fingerprint_text);
+  fingerprint_locals = NULL;
+  fingerprint_count = fingerprint_capacity = 0;
+
+  symbol_t *function = task->function;
+  outbuf_int(&fingerprint_text, task->number);
+  outbuf_char(&fingerprint_text, ' ');
+  // The slots count the expansions too, even those too deep to follow.
+  outbuf_int(&fingerprint_text, function_slot_count(function));
+  outbuf_str(&fingerprint_text, function->cold ? " cold " : " ");
+  outbuf_str(&fingerprint_text, frame_pointer() ? "frame pointer " : "");
+  outbuf_str(&fingerprint_text, instrumenting() ? "instrumented " : "");
+  outbuf_str(&fingerprint_text, counting() ? "counted " : "");
+  outbuf_str(&fingerprint_text, pass_enabled(PAOLA_PASS_TAILCALL) ? "" : "no tail calls ");
+  outbuf_str(&fingerprint_text, pass_enabled(PAOLA_PASS_UNROLL) ? "" : "not unrolled ");
+  outbuf_str(&fingerprint_text, function->name);
+  current_function = function; // Whose counts the profile gives
+  fingerprint_statement(function->decl->func_body);
+  current_function = 0;
+  hash_t fingerprint = hash_bytes(fingerprint_text.data, fingerprint_text.size);
+
+  outbuf_free(&fingerprint_text);
+  free(fingerprint_locals);
+  return fingerprint;
+}
+
+static void fingerprint_statement(stat_ast_t *stat) {
+  outbuf_t *text = &fingerprint_text;
+  outbuf_char(text, '(');
+  outbuf_int(text, stat->type);
+  if (context->profile && (stat->type == IF_STAT || stat->type == WHILE_STAT
+      || stat->type == FOR_STAT)) {
+    // The counts lay out the code.
+    outbuf_char(text, ' ');
+    outbuf_int(text, node_count(stat->counter));
+    outbuf_char(text, ' ');
+    outbuf_int(text, node_count(stat->counter + 1));
+  }
+  switch (stat->type) {
+    case RETURN_STAT:
+    case EXPR_STAT:
+      fingerprint_expression(stat->expr);
+      break;
+    case IF_STAT:
+      fingerprint_expression(stat->cond);
+      fingerprint_statement(stat->tstat);
+      if (stat->fstat) {
+        fingerprint_statement(stat->fstat);
+      }
+      break;
+    case WHILE_STAT:
+      fingerprint_expression(stat->cond);
+      fingerprint_statement(stat->body);
+      break;
+    case FOR_STAT:
+      fingerprint_expression(stat->init);
+      fingerprint_expression(stat->cond);
+      fingerprint_expression(stat->iter);
+      fingerprint_statement(stat->body);
+      break;
+    case BLOCK_STAT:
+      for (list_elem_t *e = list_begin(&stat->stats); e != list_end(&stat->stats);
+          e = list_next(e)) {
+        fingerprint_statement(list_entry(e, stat_ast_t, block_elem));
+      }
+      break;
+    case DECL_STAT:
+      if (!stat->is_func && !stat->symbol->is_global) {
+        if (fingerprint_count == fingerprint_capacity) {
+          fingerprint_capacity = fingerprint_capacity ? fingerprint_capacity * 2 : 16;
+          fingerprint_locals = (symbol_t **) realloc(fingerprint_locals,
+              sizeof(symbol_t *) * fingerprint_capacity);
+        }
+        fingerprint_locals[fingerprint_count++] = stat->symbol;
+        if (stat->value) {
+          fingerprint_expression(stat->value);
+        }
+      }
+      break;
+    default:
+      break;
+  }
+  outbuf_char(text, ')');
+}
 
-  fprintf(out, "\t.text\n\t.globl _main\n");
-  generate_statement(ast, initial_regset);
-  fprintf(out, "main:\n\tcall _main\n\tret\n");
+static void fingerprint_expression(expr_ast_t *expr) {
+  outbuf_t *text = &fingerprint_text;
+  outbuf_char(text, '(');
+  outbuf_int(text, expr->type);
+  outbuf_char(text, expr->assign ? '=' : ' ');
+  switch (expr->type) {
+    case INT_LIT:
+      outbuf_int(text, expr->ival);
+      break;
+    case BIN_OP:
+      outbuf_int(text, expr->op);
+      fingerprint_expression(expr->left);
+      fingerprint_expression(expr->right);
+      break;
+    case VAR_REF: {
+      // The latest declaration of a local is the one in the innermost expansion.
+      int local = fingerprint_count - 1;
+      while (local >= 0 && fingerprint_locals[local] != expr->symbol) {
+        local--;
+      }
+      if (local >= 0) {
+        outbuf_int(text, local);
+      } else {
+        outbuf_str(text, expr->name);
+      }
+      break;
+    } case FUNC_CALL:
+      outbuf_str(text, expr->name);
+      if (can_inline(expr->symbol)) {
+        // Follow the expansion the same way the code generator would.
+        inline_frame_t frame = {expr->symbol, 0, 0, inline_frame, 0, 0, 0, 0};
+        inline_frame = &frame;
+        inline_depth++;
+        fingerprint_statement(expr->symbol->decl->func_body);
+        inline_depth--;
+        inline_frame = frame.parent;
+      }
+      break;
+    default:
+      break;
+  }
+  outbuf_char(text, ')');
 }
 
 static void generate_statement(stat_ast_t *stat, regset_t regset) {
   switch (stat->type) {
     case RETURN_STAT: {
+      if (!inline_frame && pass_enabled(PAOLA_PASS_TAILCALL)
+          && generate_tail_call(stat->expr, regset)) {
+        break;
+      }
+
       /* Generate code that will calculate the result of the expression to the
        * first free register of regset. */
       generate_expression(stat->expr, regset);
 
+      if (inline_frame) {
+        /* The result is already where the expanded call expects it. */
+        if (stat != inline_frame->last_stat) {
+          jmp(inline_frame->return_label);
+        }
+        break;
+      }
+
       /* Copy the result to rax and return. */
       const char *result_reg = next_reg_name(regset);
       if (strcmp(result_reg, "rax") != 0) {
@@ -126,58 +586,14 @@ static void generate_statement(stat_ast_t *stat, regset_t regset) {
         );
       }
 
-      ret();
+      function_return();
       break;
     } case IF_STAT: {
-      int flabel = get_label();
-      const char *cond_reg = next_reg_name(regset);
-      generate_expression(stat->expr, regset);
-
-      cmp(
-        arg_lit(0),
-        arg_reg(cond_reg)
-      );
-      je(flabel);
-
-      generate_statement(stat->tstat, regset);
-
-      label(flabel);
-      if (stat->fstat) {
-        generate_statement(stat->fstat, regset);
-      }
+      generate_if(stat, regset);
       break;
-    } case WHILE_STAT: {
-      int cond_label = get_label(), body_label = get_label();
-      jmp(cond_label);
-
-      label(body_label);
-      generate_statement(stat->body, regset);
-
-      label(cond_label);
-      const char *cond_reg = next_reg_name(regset);
-      generate_expression(stat->expr, regset);
-
-      cmp(
-        arg_lit(0),
-        arg_reg(cond_reg)
-      );
-      jne(body_label);
-      break;
-    } case FOR_STAT: {
-      int cond_label = get_label(), body_label = get_label();
-
-      generate_expression(stat->init, regset);
-      jmp(cond_label);
-
-      label(body_label);
-      generate_statement(stat->body, regset);
-      generate_expression(stat->iter, regset);
-
-      label(cond_label);
-      const char *cond_reg = next_reg_name(regset);
-      generate_expression(stat->cond, regset);
-      cmp(arg_lit(0), arg_reg(cond_reg));
-      jne(body_label);
+    } case WHILE_STAT:
+      case FOR_STAT: {
+      generate_loop(stat, regset);
       break;
     } case BLOCK_STAT: {
       for (list_elem_t *e = list_begin(&(stat->stats)); e != list_end(&(stat->stats));
@@ -191,12 +607,18 @@ static void generate_statement(stat_ast_t *stat, regset_t regset) {
       assert(symbol != 0);
 
       if (stat->is_func) {
-        func_label(stat->target);
-        generate_statement(stat->func_body, regset);
-      } else {
-        int datatype_size = 8; //TODO: Should depend on sizeof(type)
-        symbol->stack_offset = next_stack_offset;
-        next_stack_offset += datatype_size;
+        // Functions are emitted separately by generate_code.
+      } else if (!symbol->is_global) { // Globals are emitted by generate_globals
+        place_local(symbol);
+
+        if (stat->value) {
+          const char *value_reg = next_reg_name(regset);
+          generate_expression(stat->value, regset);
+          mov(
+            arg_reg(value_reg),
+            local_arg(stack_offset(symbol))
+          );
+        }
       }
       break;
     } case EXPR_STAT: {
@@ -211,6 +633,167 @@ static void generate_statement(stat_ast_t *stat, regset_t regset) {
   }
 }
 
+/* Generates an if statement. Without a profile, the then arm falls through and
+ * the else arm is jumped to. With one, the arm that ran more often falls
+ * through, and an arm that is cold next to the other one is moved after the end
+ * of the function, unless it is in an expanded call. */
+static void generate_if(stat_ast_t *stat, regset_t regset) {
+  stat_ast_t *first = stat->tstat, *second = stat->fstat;
+  int first_counter = stat->counter, second_counter = stat->counter + 1;
+  int64_t first_count = node_count(first_counter), second_count = node_count(second_counter);
+  bool swapped = second && second_count > first_count;
+  if (swapped) {
+    first = stat->fstat;
+    second = stat->tstat;
+    first_counter = stat->counter + 1;
+    second_counter = stat->counter;
+    int64_t count = first_count;
+    first_count = second_count;
+    second_count = count;
+    remark(PAOLA_REMARK_PASSED, "layout", &stat->pos, current_function->name,
+        "made the else arm the fall through: it ran %lld times, the then arm %lld",
+        (long long) first_count, (long long) second_count);
+  }
+  // The jump to the second arm, and the one to the first.
+  const char *skip_first = swapped ? "jne" : "je", *skip_second = swapped ? "je" : "jne";
+  bool cold_first = !inline_frame && pgo_cold(first_count, second_count);
+  bool cold_second = !inline_frame && (second || counting())
+      && pgo_cold(second_count, first_count);
+
+  int second_label = get_label();
+  generate_condition(stat->cond, regset);
+  if (cold_first || cold_second) {
+    // The cold arm is jumped to, and jumps back to the end.
+    jump_command(cold_first ? skip_second : skip_first, second_label);
+    if (cold_first) {
+      generate_arm(second, second_counter, regset);
+    } else {
+      generate_arm(first, first_counter, regset);
+    }
+    int end_label = get_label();
+    label(end_label);
+
+    if (cold_count == cold_capacity) {
+      cold_capacity = cold_capacity ? cold_capacity * 2 : 8;
+      cold_blocks = (cold_block_t *) realloc(cold_blocks, sizeof(cold_block_t) * cold_capacity);
+    }
+    cold_block_t *block = &cold_blocks[cold_count++];
+    block->stat = cold_first ? first : second;
+    block->counter = cold_first ? first_counter : second_counter;
+    block->regset = regset;
+    block->label = second_label;
+    block->join_label = end_label;
+    block->loop_depth = loop_depth;
+    remark(PAOLA_REMARK_PASSED, "layout", &stat->pos, current_function->name,
+        "moved the cold arm out of line: it ran %lld times, the other arm %lld",
+        (long long) (cold_first ? first_count : second_count),
+        (long long) (cold_first ? second_count : first_count));
+    return;
+  }
+
+  jump_command(skip_first, second_label);
+  generate_arm(first, first_counter, regset);
+  if (second || counting()) {
+    int end_label = get_label();
+    jmp(end_label);
+    label(second_label);
+    generate_arm(second, second_counter, regset);
+    label(end_label);
+  } else {
+    label(second_label);
+  }
+}
+
+/* Generates an arm of an if statement, which may be missing. */
+static void generate_arm(stat_ast_t *arm, int counter, regset_t regset) {
+  increment_counter(counter);
+  if (arm) {
+    generate_statement(arm, regset);
+  }
+}
+
+/* Generates the cold arms of the function after its end. Cold arms may have
+ * cold arms of their own, which are added to the end. */
+static void generate_cold_blocks(void) {
+  for (int i = 0; i < cold_count; i++) {
+    cold_block_t block = cold_blocks[i];
+    label(block.label);
+    loop_depth = block.loop_depth;
+    generate_arm(block.stat, block.counter, block.regset);
+    if (!block.stat || !ends_with_return(block.stat)) {
+      jmp(block.join_label);
+    }
+  }
+  cold_count = 0;
+  loop_depth = 0;
+}
+
+/* Generates a while or for loop, with the test at the bottom. A loop the
+ * profile found to run many iterations per entry has its body repeated, with a
+ * test between the copies, so that fewer iterations take the jump back. */
+static void generate_loop(stat_ast_t *stat, regset_t regset) {
+  int cond_label = get_label(), body_label = get_label();
+  int factor = unroll_factor(stat);
+  int exit_label = factor > 1 ? get_label() : -1;
+
+  increment_counter(stat->counter);
+  if (stat->type == FOR_STAT) {
+    generate_expression(stat->init, regset);
+  }
+  jmp(cond_label);
+
+  loop_depth++;
+  label(body_label);
+  for (int i = 0; i < factor; i++) {
+    if (i > 0) {
+      generate_condition(stat->cond, regset);
+      je(exit_label);
+    }
+    increment_counter(stat->counter + 1);
+    generate_statement(stat->body, regset);
+    if (stat->type == FOR_STAT) {
+      generate_expression(stat->iter, regset);
+    }
+  }
+
+  label(cond_label);
+  generate_condition(stat->cond, regset);
+  jne(body_label);
+  loop_depth--;
+  if (factor > 1) {
+    label(exit_label);
+  }
+}
+
+/* Returns how many copies of the body of the loop to generate. Loops that
+ * declare variables, or expand calls that do, are never unrolled, as their
+ * stack slots are counted once. */
+static int unroll_factor(stat_ast_t *loop) {
+  int64_t entries = node_count(loop->counter), iterations = node_count(loop->counter + 1);
+  if (!pass_enabled(PAOLA_PASS_UNROLL) || entries <= 0 || iterations < UNROLL_MIN_TRIPS * entries
+      || count_slots(loop) > 0) {
+    return 1;
+  }
+
+  int factor = iterations >= 4 * UNROLL_MIN_TRIPS * entries ? 4 : 2;
+  while (factor > 1 && loop->size * factor > UNROLL_MAX_SIZE) {
+    factor /= 2;
+  }
+  if (factor > 1) {
+    remark(PAOLA_REMARK_PASSED, "unroll", &loop->pos, current_function->name,
+        "unrolled the loop %d times: it ran %lld iterations per entry", factor,
+        (long long) (iterations / entries));
+  }
+  return factor;
+}
+
+/* Computes the condition, and compares it with 0. */
+static void generate_condition(expr_ast_t *cond, regset_t regset) {
+  const char *cond_reg = next_reg_name(regset);
+  generate_expression(cond, regset);
+  cmp(arg_lit(0), arg_reg(cond_reg));
+}
+
 static void generate_expression(expr_ast_t *expr, regset_t regset) {
   switch (expr->type) {
     case BIN_OP:
@@ -235,27 +818,84 @@ static void generate_expression(expr_ast_t *expr, regset_t regset) {
 static void generate_var_ref(expr_ast_t *expr, regset_t regset) {
   symbol_t *symbol = expr->symbol;
   assert(symbol != 0);
-  
-  if (expr->assign) { // Leave the address at the destination register
-    const char *dst = next_reg_name(regset);
-    mov(
-      arg_lit(-symbol->stack_offset),
-      arg_reg(dst)
-    );
+  remark_stack_variable(expr);
 
-    add(
-      arg_reg("rsp"),
-      arg_reg(dst)
+  if (symbol->is_global) {
+    if (expr->assign) {
+      lea(
+        arg_global(symbol->name),
+        arg_reg(next_reg_name(regset))
+      );
+    } else {
+      mov(
+        arg_global(symbol->name),
+        arg_reg(next_reg_name(regset))
+      );
+    }
+  } else if (expr->assign) { // Leave the address at the destination register
+    lea(
+      local_arg(stack_offset(symbol)),
+      arg_reg(next_reg_name(regset))
     );
   } else { // Leave the value at the destination register
     mov(
-      arg_mem("rsp", -symbol->stack_offset),
+      local_arg(stack_offset(symbol)),
       arg_reg(next_reg_name(regset))
     );
   }
 }
 
+/* Remarks once on each variable of the function that is used in a loop, where
+ * keeping it in a register would matter most. The temporaries of loopopt are
+ * left out, and so are the variables of expanded calls. */
+static void remark_stack_variable(expr_ast_t *expr) {
+  symbol_t *symbol = expr->symbol;
+  if (loop_depth == 0 || inline_frame || symbol->is_global || strchr(symbol->name, '.')
+      || !remarks_enabled(PAOLA_REMARK_MISSED)) {
+    return;
+  }
+  for (int i = 0; i < stack_remarked_count; i++) {
+    if (stack_remarked[i] == symbol) {
+      return;
+    }
+  }
+  if (stack_remarked_count == stack_remarked_capacity) {
+    stack_remarked_capacity = stack_remarked_capacity ? stack_remarked_capacity * 2 : 16;
+    stack_remarked = (symbol_t **) realloc(stack_remarked,
+        sizeof(symbol_t *) * stack_remarked_capacity);
+  }
+  stack_remarked[stack_remarked_count++] = symbol;
+  remark(PAOLA_REMARK_MISSED, "regalloc", &expr->pos, current_function->name,
+      "could not promote variable %s: it is used in a loop, but variables are kept on the stack",
+      symbol->name);
+}
+
 static void generate_func_call(expr_ast_t *expr, regset_t regset) {
+  increment_counter(expr->counter);
+  if (can_inline(expr->symbol)
+      && stat_registers(expr->symbol->decl->func_body) <= __builtin_popcount(regset)) {
+    generate_inline_call(expr, regset);
+    return;
+  }
+  if (can_inline(expr->symbol)) {
+    remark(PAOLA_REMARK_MISSED, "inline", &expr->pos, current_function->name,
+        "could not inline call to %s: its expansion needs more registers than are free",
+        expr->name);
+  } else if (expr->symbol->inlinable) {
+    remark(PAOLA_REMARK_MISSED, "inline", &expr->pos, current_function->name,
+        "could not inline call to %s: inside an expansion of itself, or nested too deep",
+        expr->name);
+  }
+
+  if (remarks_enabled(PAOLA_REMARK_ANALYSIS)) {
+    int live = 0;
+    for (int i = 0; i < register_count; i++) {
+      live += !(regset & (1 << i));
+    }
+    remark(PAOLA_REMARK_ANALYSIS, "regalloc", &expr->pos, current_function->name,
+        "spilled %d registers around call to %s, %d of them live", register_count, expr->name,
+        live);
+  }
   save_registers();
   call(expr->name);
   load_registers();
@@ -266,6 +906,568 @@ static void generate_func_call(expr_ast_t *expr, regset_t regset) {
   );
 }
 
+static void generate_function(stat_ast_t *stat, regset_t regset) {
+  symbol_t *outer_function = current_function;
+  int outer_entry_label = entry_label;
+
+  current_function = stat->symbol;
+  begin_function(symbol_name(stat->target));
+  enter_frame(function_slot_count(stat->symbol), stat->symbol->makes_calls, instrumenting());
+  increment_counter(0);
+  cold_count = 0;
+  entry_label = -1;
+  if (pass_enabled(PAOLA_PASS_TAILCALL) && has_self_tail_call(stat->func_body, stat->symbol)) {
+    entry_label = get_label();
+    label(entry_label);
+  }
+
+  generate_statement(stat->func_body, regset);
+  if (!ends_with_return(stat->func_body)) {
+    // Functions are not emitted in source order, never fall through into the
+    // next one.
+    function_return();
+  }
+  generate_cold_blocks();
+  end_function(symbol_name(stat->target));
+
+  current_function = outer_function;
+  entry_label = outer_entry_label;
+}
+
+/* A call whose result is returned right away does not need the registers
+ * saved around it, nor a return of its own: jumping to the callee makes it
+ * return straight to our caller, and the stack does not grow. A function
+ * calling itself this way becomes a loop. Returns false if the expression is
+ * not such a call. */
+static bool generate_tail_call(expr_ast_t *expr, regset_t regset) {
+  if (expr->type != FUNC_CALL) {
+    return false;
+  }
+
+  if (expr->symbol == current_function && entry_label >= 0) {
+    increment_counter(expr->counter);
+    jmp(entry_label);
+    remark(PAOLA_REMARK_PASSED, "tailcall", &expr->pos, current_function->name,
+        "turned the recursive tail call into a loop");
+  } else if (can_inline(expr->symbol)
+      && stat_registers(expr->symbol->decl->func_body) <= __builtin_popcount(regset)) {
+    return false;
+  } else {
+    increment_counter(expr->counter);
+    leave_frame();
+    tail_jmp(expr->name);
+    remark(PAOLA_REMARK_PASSED, "tailcall", &expr->pos, current_function->name,
+        "turned the tail call to %s into a jump", expr->name);
+  }
+  return true;
+}
+
+/* Returns true if the statement returns the result of a call to function. */
+static bool has_self_tail_call(stat_ast_t *stat, symbol_t *function) {
+  switch (stat->type) {
+    case RETURN_STAT:
+      return stat->expr->type == FUNC_CALL && stat->expr->symbol == function;
+    case IF_STAT:
+      return has_self_tail_call(stat->tstat, function)
+          || (stat->fstat && has_self_tail_call(stat->fstat, function));
+    case WHILE_STAT:
+    case FOR_STAT:
+      return has_self_tail_call(stat->body, function);
+    case BLOCK_STAT:
+      for (list_elem_t *e = list_begin(&stat->stats); e != list_end(&stat->stats);
+          e = list_next(e)) {
+        if (has_self_tail_call(list_entry(e, stat_ast_t, block_elem), function)) {
+          return true;
+        }
+      }
+      return false;
+    default:
+      return false;
+  }
+}
+
+/* Functions that may call another keep a frame, see enter_frame. Calls that
+ * are expanded in place count too. */
+static void clear_calls(stat_ast_t *decl, walk_t *walk) {
+  decl->symbol->makes_calls = false;
+}
+
+static void mark_calls(expr_ast_t *expr, walk_t *walk) {
+  if (expr->type == FUNC_CALL) {
+    walk->function->makes_calls = true;
+  }
+}
+
+/* Returns true if the last statement of the block is a return. */
+static bool ends_with_return(stat_ast_t *block) {
+  if (block->type != BLOCK_STAT || list_empty(&block->stats)) {
+    return block->type == RETURN_STAT;
+  }
+  return list_entry(list_back(&block->stats), stat_ast_t, block_elem)->type == RETURN_STAT;
+}
+
+/* Global variables live in the data section if they have an initial value
+ * and in the bss section otherwise. Initial values are constants. */
+static void generate_globals(stat_ast_t *program) {
+  for (list_elem_t *e = list_begin(&program->stats); e != list_end(&program->stats);
+      e = list_next(e)) {
+    stat_ast_t *stat = list_entry(e, stat_ast_t, block_elem);
+    if (stat->type != DECL_STAT || stat->is_func) {
+      continue;
+    }
+
+    if (stat->value) {
+      section(".data", DATA_SECTION);
+      define(symbol_name(stat->target));
+      quad(stat->value->ival);
+    } else {
+      section(".bss", BSS_SECTION);
+      define(symbol_name(stat->target));
+      zero(8);
+    }
+  }
+}
+
+/* Generates the callee's body in place of the call. The body only uses the
+ * registers that are free at the call, so nothing needs to be saved. */
+static void generate_inline_call(expr_ast_t *expr, regset_t regset) {
+  stat_ast_t *body = expr->symbol->decl->func_body;
+  remark(PAOLA_REMARK_PASSED, "inline", &expr->pos, current_function->name,
+      "inlined call to %s", expr->name);
+
+  inline_frame_t frame;
+  frame.callee = expr->symbol;
+  frame.return_label = get_label();
+  frame.last_stat = list_empty(&body->stats) ? 0
+      : list_entry(list_back(&body->stats), stat_ast_t, block_elem);
+  frame.parent = inline_frame;
+  frame.locals = 0;
+  frame.offsets = 0;
+  frame.local_count = frame.local_capacity = 0;
+
+  inline_frame = &frame;
+  inline_depth++;
+  generate_statement(body, regset);
+  inline_depth--;
+  inline_frame = frame.parent;
+  free(frame.locals);
+  free(frame.offsets);
+
+  label(frame.return_label);
+}
+
+/* A function is never expanded inside its own expansion, so that recursion
+ * ends in a real call. */
+static bool can_inline(symbol_t *callee) {
+  if (!callee->inlinable || !callee->decl->func_body
+      || callee->decl->func_body->type != BLOCK_STAT || inline_depth >= MAX_INLINE_DEPTH) {
+    return false;
+  }
+
+  for (inline_frame_t *f = inline_frame; f; f = f->parent) {
+    if (f->callee == callee) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/* Returns the most registers the expressions of the statement take at once.
+ * An expansion only has the registers that are free at its call site, and
+ * calls in it check their own expansions when they are generated. */
+static int stat_registers(stat_ast_t *stat) {
+  int most = 0, registers;
+  switch (stat->type) {
+    case RETURN_STAT:
+    case EXPR_STAT:
+      return expr_registers(stat->expr);
+    case IF_STAT:
+      most = expr_registers(stat->cond);
+      registers = stat_registers(stat->tstat);
+      most = registers > most ? registers : most;
+      registers = stat->fstat ? stat_registers(stat->fstat) : 0;
+      return registers > most ? registers : most;
+    case FOR_STAT:
+      most = expr_registers(stat->init);
+      registers = expr_registers(stat->iter);
+      most = registers > most ? registers : most;
+      // Fall through
+    case WHILE_STAT:
+      registers = expr_registers(stat->cond);
+      most = registers > most ? registers : most;
+      registers = stat_registers(stat->body);
+      return registers > most ? registers : most;
+    case BLOCK_STAT:
+      for (list_elem_t *e = list_begin(&stat->stats); e != list_end(&stat->stats);
+          e = list_next(e)) {
+        registers = stat_registers(list_entry(e, stat_ast_t, block_elem));
+        most = registers > most ? registers : most;
+      }
+      return most;
+    case DECL_STAT:
+      return !stat->is_func && stat->value ? expr_registers(stat->value) : 0;
+    default:
+      return 0;
+  }
+}
+
+/* The left operand of an operator stays in its register while the right one
+ * is computed, in the next register. */
+static int expr_registers(expr_ast_t *expr) {
+  if (expr->type != BIN_OP) {
+    return 1;
+  }
+  int left = expr_registers(expr->left), right = 1 + expr_registers(expr->right);
+  return left > right ? left : right;
+}
+
+/* Returns from the function being generated, with the result in rax. */
+static void function_return(void) {
+  leave_frame();
+  ret();
+}
+
+/* Functions keep the caller's rbp and point rbp to it with
+ * -fno-omit-frame-pointer, so that profilers and debuggers can walk the stack
+ * without the unwind information. */
+static bool frame_pointer(void) {
+  return context->options.frame_pointer;
+}
+
+/* Defines the symbol of a function at the current position, as a function
+ * whose unwind information starts there. */
+static void begin_function(const char *name) {
+  if (context->object) {
+    x86_define(context->object, name);
+    x86_function_start(context->object, name);
+  } else {
+    outbuf_str(out, "\t.type ");
+    outbuf_str(out, name);
+    outbuf_str(out, ", @function\n");
+    outbuf_str(out, name);
+    outbuf_str(out, ":\n\t.cfi_startproc\n");
+  }
+  cfa.reg = "rsp";
+  cfa.offset = 8;
+  cfa.rbp_saved = false;
+}
+
+/* Ends the function at the current position, which gives its size. */
+static void end_function(const char *name) {
+  if (context->object) {
+    x86_function_end(context->object);
+  } else {
+    outbuf_str(out, "\t.cfi_endproc\n\t.size ");
+    outbuf_str(out, name);
+    outbuf_str(out, ", .-");
+    outbuf_str(out, name);
+    outbuf_char(out, '\n');
+  }
+  cfa.reg = 0;
+}
+
+/* Sets up the frame of a function with the given number of local slots. */
+static void enter_frame(int slots, bool calls, bool profiled) {
+  if (frame_pointer()) {
+    push(arg_reg("rbp"));
+    set_cfa("rsp", 16, true);
+    mov(arg_reg("rsp"), arg_reg("rbp"));
+    set_cfa("rbp", 16, true);
+  }
+  frame_profiled = profiled;
+  if (profiled) {
+    profile_entry();
+  }
+
+  // The stack pointer is 8 bytes past a multiple of 16 at the entry, and the
+  // pushes of the frame pointer and of the profile keep it so or align it.
+  uint32_t size = 8 * slots;
+  if (!calls && size <= RED_ZONE_SIZE) {
+    frame_size = 0;
+  } else if (frame_pointer()) {
+    frame_size = (size + 15) / 16 * 16;
+  } else {
+    frame_size = (size + 8 + 15) / 16 * 16 - 8;
+  }
+  if (frame_size) {
+    sub(arg_lit(frame_size), arg_reg("rsp"));
+    if (!frame_pointer()) {
+      set_cfa("rsp", cfa.offset + frame_size, false);
+    }
+  }
+  body_cfa = cfa;
+}
+
+/* Takes the frame down, to return or jump to another function. The code after
+ * it is only reached by jumps, and label brings the unwind rules of the body
+ * back there. */
+static void leave_frame(void) {
+  if (frame_size) {
+    add(arg_lit(frame_size), arg_reg("rsp"));
+    if (!frame_pointer()) {
+      set_cfa("rsp", cfa.offset - frame_size, false);
+    }
+  }
+  if (frame_profiled) {
+    profile_exit();
+  }
+  if (frame_pointer()) {
+    pop(arg_reg("rbp"));
+    set_cfa("rsp", 8, false);
+  }
+}
+
+/* Gets the operand of the local at the stack offset. */
+static arg_t local_arg(uint32_t offset) {
+  if (frame_pointer()) {
+    return arg_mem("rbp", -(frame_profiled ? 16 : 0) - offset);
+  }
+  return arg_mem("rsp", frame_size - offset);
+}
+
+/* Changes the unwind rule of the code that follows. */
+static void set_cfa(const char *reg, int32_t offset, bool rbp_saved) {
+  if (context->object) {
+    x86_cfa(context->object, reg, offset, rbp_saved);
+  } else if (strcmp(reg, cfa.reg) != 0) {
+    outbuf_str(out, "\t.cfi_def_cfa %");
+    outbuf_str(out, reg);
+    outbuf_str(out, ", ");
+    outbuf_int(out, offset);
+    outbuf_char(out, '\n');
+  } else if (offset != cfa.offset) {
+    outbuf_str(out, "\t.cfi_def_cfa_offset ");
+    outbuf_int(out, offset);
+    outbuf_char(out, '\n');
+  }
+  if (!context->object && rbp_saved && !cfa.rbp_saved) {
+    outbuf_str(out, "\t.cfi_offset %rbp, -16\n");
+  } else if (!context->object && !rbp_saved && cfa.rbp_saved) {
+    outbuf_str(out, "\t.cfi_restore %rbp\n");
+  }
+  cfa.reg = reg;
+  cfa.offset = offset;
+  cfa.rbp_saved = rbp_saved;
+}
+
+/* Instrumented programs count the calls to each function, and the cycles spent
+ * in it, as read by rdtsc: the inclusive ones, from its entry to its return,
+ * and the exclusive ones, without the cycles of the calls it makes. Each
+ * function has a table of three quads in the bss section for these, and the
+ * cycles of the calls made by the running function add up in profile.children.
+ * The entry pushes the time and the caller's sum of children, which the exit
+ * pops, so that the stack pointer the body sees moves by 16 bytes. The calls
+ * within a recursion are counted in the inclusive cycles of each of its
+ * levels. When main returns, the tables are written to PROFILE_FILE.
+ *
+ * Only rax, rdx, rsi and rdi are used, which the function body does not keep
+ * anything in, except for the result in rax. Calls expanded in place are part
+ * of the function they are expanded in. Programs run in memory are never
+ * instrumented, as they cannot call the C library to write the report. */
+static bool instrumenting(void) {
+  return context->options.instrument && context->options.output != PAOLA_RUN;
+}
+
+static void profile_entry(void) {
+  read_timestamp();
+  push(arg_reg("rax"));
+  mov(arg_global("profile.children"), arg_reg("rdx"));
+  push(arg_reg("rdx"));
+  mov(arg_lit(0), arg_global("profile.children"));
+  lea(arg_global(profile_symbol(current_function->name, ".profile")), arg_reg("rdx"));
+  add(arg_lit(1), arg_mem("rdx", 0));
+}
+
+static void profile_exit(void) {
+  mov(arg_reg("rax"), arg_reg("rsi"));
+  read_timestamp();
+  sub(arg_mem("rsp", 8), arg_reg("rax")); // Inclusive cycles
+  mov(arg_reg("rax"), arg_reg("rdx"));
+  sub(arg_global("profile.children"), arg_reg("rdx")); // Exclusive cycles
+  lea(arg_global(profile_symbol(current_function->name, ".profile")), arg_reg("rdi"));
+  add(arg_reg("rax"), arg_mem("rdi", 8));
+  add(arg_reg("rdx"), arg_mem("rdi", 16));
+  pop(arg_reg("rdx")); // The caller's children, which now include this call
+  add(arg_reg("rax"), arg_reg("rdx"));
+  mov(arg_reg("rdx"), arg_global("profile.children"));
+  pop(arg_reg("rdx")); // The entry time
+  mov(arg_reg("rsi"), arg_reg("rax"));
+}
+
+/* Writes the tables of the functions to the report with the C library, after
+ * main has returned its status in rax. */
+static void generate_profile_dump(symbol_t **functions, int function_count) {
+  int skip_label = get_label();
+
+  mov(arg_reg("rax"), local_arg(8));
+  lea(arg_global("profile.path"), arg_reg("rdi"));
+  lea(arg_global("profile.mode"), arg_reg("rsi"));
+  call_library("fopen");
+  cmp(arg_lit(0), arg_reg("rax"));
+  je(skip_label);
+  mov(arg_reg("rax"), arg_reg("rbx"));
+
+  mov(arg_reg("rbx"), arg_reg("rdi"));
+  lea(arg_global("profile.header"), arg_reg("rsi"));
+  mov(arg_lit(0), arg_reg("rax"));
+  call_library("fprintf");
+  for (int i = 0; i < function_count; i++) {
+    const char *name = functions[i]->name;
+    mov(arg_reg("rbx"), arg_reg("rdi"));
+    lea(arg_global("profile.row"), arg_reg("rsi"));
+    lea(arg_global(profile_symbol(name, ".profile_name")), arg_reg("rdx"));
+    lea(arg_global(profile_symbol(name, ".profile")), arg_reg("rax"));
+    mov(arg_mem("rax", 0), arg_reg("rcx"));
+    mov(arg_mem("rax", 8), arg_reg("r8"));
+    mov(arg_mem("rax", 16), arg_reg("r9"));
+    mov(arg_lit(0), arg_reg("rax"));
+    call_library("fprintf");
+  }
+  mov(arg_reg("rbx"), arg_reg("rdi"));
+  call_library("fclose");
+
+  label(skip_label);
+  mov(local_arg(8), arg_reg("rax"));
+}
+
+static void generate_profile_data(symbol_t **functions, int function_count) {
+  section(".data", DATA_SECTION);
+  define(symbol_name("profile.path"));
+  string(PROFILE_FILE);
+  define(symbol_name("profile.mode"));
+  string("w");
+  define(symbol_name("profile.header"));
+  string("function                calls          cycles     self cycles\n");
+  define(symbol_name("profile.row"));
+  string("%-16s %12ld %15ld %15ld\n");
+  for (int i = 0; i < function_count; i++) {
+    define(symbol_name(profile_symbol(functions[i]->name, ".profile_name")));
+    string(functions[i]->name);
+  }
+
+  section(".bss", BSS_SECTION);
+  define(symbol_name("profile.children"));
+  zero(8);
+  for (int i = 0; i < function_count; i++) {
+    define(symbol_name(profile_symbol(functions[i]->name, ".profile")));
+    zero(24); // Calls, cycles and self cycles
+  }
+}
+
+/* Names the profiling data of a function. Source names cannot contain dots, so
+ * these never clash with them. */
+static const char *profile_symbol(const char *function, const char *suffix) {
+  char *name = (char *) arena_alloc(strlen(function) + strlen(suffix) + 1);
+  strcpy(name, function);
+  strcat(name, suffix);
+  return name;
+}
+
+/* Programs compiled with profile_generate count the calls of each function,
+ * the runs of the arms of if statements and of the bodies of loops, and the
+ * runs of each call site, as numbered by pgo.c. Each function has a table of
+ * its counters in the bss section, which is written to the profile when main
+ * returns. Counters use rdx only. */
+static bool counting(void) {
+  return context->options.profile_generate && context->options.output != PAOLA_RUN;
+}
+
+static void increment_counter(int counter) {
+  if (!counting()) {
+    return;
+  }
+  symbol_t *function = inline_frame ? inline_frame->callee : current_function;
+  lea(arg_global(profile_symbol(function->name, ".counters")), arg_reg("rdx"));
+  add(arg_lit(1), arg_mem("rdx", 8 * counter));
+}
+
+/* Gets the count of a counter of the code being generated from the profile, or
+ * -1. The code of an expanded call has the counters of the callee. */
+static int64_t node_count(int counter) {
+  return pgo_count(inline_frame ? inline_frame->callee : current_function, counter);
+}
+
+/* Writes the counters of the functions to the profile with the C library, after
+ * main has returned its status in rax. */
+static void generate_counter_dump(symbol_t **functions, int function_count) {
+  int skip_label = get_label();
+
+  mov(arg_reg("rax"), local_arg(8));
+  lea(arg_global("pgo.path"), arg_reg("rdi"));
+  lea(arg_global("pgo.mode"), arg_reg("rsi"));
+  call_library("fopen");
+  cmp(arg_lit(0), arg_reg("rax"));
+  je(skip_label);
+  mov(arg_reg("rax"), arg_reg("rbx"));
+
+  lea(arg_global("pgo.magic"), arg_reg("rdi"));
+  mov(arg_reg("rbx"), arg_reg("rsi"));
+  call_library("fputs");
+  for (int i = 0; i < function_count; i++) {
+    const char *name = functions[i]->name;
+    int loop_label = get_label();
+    lea(arg_global(profile_symbol(name, ".pgo_header")), arg_reg("rdi"));
+    mov(arg_reg("rbx"), arg_reg("rsi"));
+    call_library("fputs");
+
+    // One line per counter.
+    lea(arg_global(profile_symbol(name, ".counters")), arg_reg("r12"));
+    mov(arg_lit(functions[i]->counter_count), arg_reg("r13"));
+    label(loop_label);
+    mov(arg_reg("rbx"), arg_reg("rdi"));
+    lea(arg_global("pgo.count"), arg_reg("rsi"));
+    mov(arg_mem("r12", 0), arg_reg("rdx"));
+    mov(arg_lit(0), arg_reg("rax"));
+    call_library("fprintf");
+    add(arg_lit(8), arg_reg("r12"));
+    sub(arg_lit(1), arg_reg("r13"));
+    jne(loop_label);
+  }
+  mov(arg_reg("rbx"), arg_reg("rdi"));
+  call_library("fclose");
+
+  label(skip_label);
+  mov(local_arg(8), arg_reg("rax"));
+}
+
+static void generate_counter_data(symbol_t **functions, int function_count) {
+  section(".data", DATA_SECTION);
+  define(symbol_name("pgo.path"));
+  string(context->options.profile_generate);
+  define(symbol_name("pgo.mode"));
+  string("w");
+  define(symbol_name("pgo.magic"));
+  string(PGO_MAGIC "\n");
+  define(symbol_name("pgo.count"));
+  string("%ld\n");
+  for (int i = 0; i < function_count; i++) {
+    symbol_t *function = functions[i];
+    size_t size = strlen(function->name) + 64;
+    char *header = (char *) arena_alloc(size);
+    snprintf(header, size, "function %s %016llx %d\n", function->name,
+        (unsigned long long) function->checksum, function->counter_count);
+    define(symbol_name(profile_symbol(function->name, ".pgo_header")));
+    string(header);
+  }
+
+  section(".bss", BSS_SECTION);
+  for (int i = 0; i < function_count; i++) {
+    define(symbol_name(profile_symbol(functions[i]->name, ".counters")));
+    zero(8 * functions[i]->counter_count);
+  }
+}
+
+/* Reads the time stamp counter into rax, overwriting rdx. */
+static void read_timestamp(void) {
+  if (context->object) {
+    x86_no_arg(context->object, "rdtsc");
+  } else {
+    outbuf_str(out, "\trdtsc\n");
+  }
+  two_arg_command("shl", arg_lit(32), arg_reg("rdx"));
+  two_arg_command("or", arg_reg("rdx"), arg_reg("rax"));
+}
+
 static void save_registers() {
   for (int i = 0; i < register_count; i++) {
     push(arg_reg(register_names[i]));
@@ -365,10 +1567,107 @@ static int get_label() {
   return next_label++;
 }
 
-static void init_gen(FILE *file) {
-  out = file;
+static void init_gen(x86_obj_t *object) {
+  context->object = object;
+  out = &context->output;
   next_label = 0;
+  label_base = 0;
+  function_number = 0;
   next_stack_offset = 8;
+  inline_frame = 0;
+  inline_depth = 0;
+  current_function = 0;
+  entry_label = -1;
+}
+
+/* Counts the stack slots the code of a statement may take, including the
+ * locals of the calls expanded in it. Calls to inlinable functions are assumed
+ * to be expanded, which makes this an upper bound. */
+static int count_slots(stat_ast_t *stat) {
+  switch (stat->type) {
+    case RETURN_STAT:
+    case EXPR_STAT:
+      return count_expr_slots(stat->expr);
+    case IF_STAT:
+      return count_expr_slots(stat->cond) + count_slots(stat->tstat)
+          + (stat->fstat ? count_slots(stat->fstat) : 0);
+    case WHILE_STAT:
+      return count_expr_slots(stat->cond) + count_slots(stat->body);
+    case FOR_STAT:
+      return count_expr_slots(stat->init) + count_expr_slots(stat->cond)
+          + count_expr_slots(stat->iter) + count_slots(stat->body);
+    case BLOCK_STAT: {
+      int slots = 0;
+      for (list_elem_t *e = list_begin(&stat->stats); e != list_end(&stat->stats);
+          e = list_next(e)) {
+        slots += count_slots(list_entry(e, stat_ast_t, block_elem));
+      }
+      return slots;
+    } case DECL_STAT:
+      if (stat->is_func || stat->symbol->is_global) {
+        return 0;
+      }
+      return 1 + (stat->value ? count_expr_slots(stat->value) : 0);
+    default:
+      return 0;
+  }
+}
+
+static int count_expr_slots(expr_ast_t *expr) {
+  switch (expr->type) {
+    case BIN_OP:
+      return count_expr_slots(expr->left) + count_expr_slots(expr->right);
+    case FUNC_CALL:
+      return expr->symbol->inlinable ? function_slot_count(expr->symbol) : 0;
+    default:
+      return 0;
+  }
+}
+
+static int function_slot_count(symbol_t *function) {
+  int id = function->callgraph_id;
+  if (id == -1 || !function->decl->func_body) {
+    return 0;
+  }
+  if (context->function_slots[id] == -1) {
+    context->function_slots[id] = 0; // Inlinable functions do not recurse, but be safe.
+    context->function_slots[id] = count_slots(function->decl->func_body);
+  }
+  return context->function_slots[id];
+}
+
+/* Gives a local variable the next stack slot. */
+static void place_local(symbol_t *symbol) {
+  int datatype_size = 8; //TODO: Should depend on sizeof(type)
+  uint32_t offset = next_stack_offset;
+  next_stack_offset += datatype_size;
+
+  if (!inline_frame) {
+    symbol->stack_offset = offset;
+    return;
+  }
+
+  inline_frame_t *frame = inline_frame;
+  if (frame->local_count == frame->local_capacity) {
+    frame->local_capacity = frame->local_capacity ? frame->local_capacity * 2 : 8;
+    frame->locals = (symbol_t **) realloc(frame->locals,
+        sizeof(symbol_t *) * frame->local_capacity);
+    frame->offsets = (uint32_t *) realloc(frame->offsets,
+        sizeof(uint32_t) * frame->local_capacity);
+  }
+  frame->locals[frame->local_count] = symbol;
+  frame->offsets[frame->local_count++] = offset;
+}
+
+static uint32_t stack_offset(symbol_t *symbol) {
+  for (inline_frame_t *f = inline_frame; f; f = f->parent) {
+    for (int i = 0; i < f->local_count; i++) {
+      if (f->locals[i] == symbol) {
+        return f->offsets[i];
+      }
+    }
+  }
+  return symbol->stack_offset;
 }
 
 static regset_t consume_reg(regset_t regset) {
@@ -406,19 +1705,35 @@ static arg_t arg_mem(const char *reg, uint32_t offset) {
   return arg;
 }
 
+static arg_t arg_global(const char *name) {
+  arg_t arg;
+  arg.type = GLOBAL_ARG;
+  arg.name = name;
+  return arg;
+}
+
 static void gen_arg(arg_t arg) {
   switch(arg.type) {
     case LIT_ARG:
-      fprintf(out, "$%d", arg.lit);
+      outbuf_char(out, '$');
+      outbuf_int(out, arg.lit);
       break;
     case REG_ARG:
-      fprintf(out, "%%%s", arg.reg); 
+      outbuf_char(out, '%');
+      outbuf_str(out, arg.reg);
       break;
     case MEM_ARG:
       if (arg.offset) {
-        fprintf(out, "%d", arg.offset);
+        outbuf_int(out, arg.offset);
       }
-      fprintf(out, "(%%%s)", arg.reg); 
+      outbuf_str(out, "(%");
+      outbuf_str(out, arg.reg);
+      outbuf_char(out, ')');
+      break;
+    case GLOBAL_ARG:
+      outbuf_str(out, SYMBOL_PREFIX);
+      outbuf_str(out, arg.name);
+      outbuf_str(out, "(%rip)");
       break;
     default:
       error(0, "Don't know how to generate code for argument type %d.\n", arg.type);
@@ -426,29 +1741,87 @@ static void gen_arg(arg_t arg) {
 }
 
 static void two_arg_command(const char *command, arg_t src, arg_t dst) {
-  fprintf(out, "\t%s ", command);
+  if (context->object) {
+    x86_two_arg(context->object, command, src, dst);
+    return;
+  }
+
+  outbuf_char(out, '\t');
+  outbuf_str(out, command);
+  if (src.type == LIT_ARG && (dst.type == MEM_ARG || dst.type == GLOBAL_ARG)) {
+    outbuf_char(out, 'q'); // No register gives the size, the object encoder uses quads too
+  }
+  outbuf_char(out, ' ');
   gen_arg(src);
-  fprintf(out, ", ");
+  outbuf_str(out, ", ");
   gen_arg(dst);
-  fprintf(out, "\n");
+  outbuf_char(out, '\n');
 }
 
 static void one_arg_command(const char *command, arg_t src) {
-  fprintf(out, "\t%s ", command);
+  if (context->object) {
+    x86_one_arg(context->object, command, src);
+    return;
+  }
+
+  outbuf_char(out, '\t');
+  outbuf_str(out, command);
+  outbuf_char(out, ' ');
   gen_arg(src);
-  fprintf(out, "\n");
+  outbuf_char(out, '\n');
+}
+
+/* Emits a jump to label lX. */
+static void jump_command(const char *command, int32_t label_id) {
+  if (context->object) {
+    x86_jump(context->object, command, label_base + label_id);
+    return;
+  }
+
+  outbuf_char(out, '\t');
+  outbuf_str(out, command);
+  outbuf_char(out, ' ');
+  label_name(label_id);
+  outbuf_char(out, '\n');
+}
+
+/* Emits a command whose argument is a function symbol. */
+static void func_command(const char *command, const char *name) {
+  if (context->object) {
+    x86_symbol_command(context->object, command, symbol_name(name));
+    return;
+  }
+
+  outbuf_char(out, '\t');
+  outbuf_str(out, command);
+  outbuf_char(out, ' ');
+  outbuf_str(out, SYMBOL_PREFIX);
+  outbuf_str(out, name);
+  outbuf_char(out, '\n');
 }
 
 static void mov(arg_t src, arg_t dst) {
   two_arg_command("mov", src, dst);
 }
 
+static void lea(arg_t src, arg_t dst) {
+  two_arg_command("lea", src, dst);
+}
+
+/* Pushes and pops move the frame address away from the stack pointer, when it
+ * is based on it. */
 static void push(arg_t arg) {
   one_arg_command("push", arg);
+  if (cfa.reg && strcmp(cfa.reg, "rsp") == 0) {
+    set_cfa("rsp", cfa.offset + 8, cfa.rbp_saved);
+  }
 }
 
 static void pop(arg_t arg) {
   one_arg_command("pop", arg);
+  if (cfa.reg && strcmp(cfa.reg, "rsp") == 0) {
+    set_cfa("rsp", cfa.offset - 8, cfa.rbp_saved);
+  }
 }
 
 static void cjmp(operator_t op, int jlabel) { // Conditional jump
@@ -475,7 +1848,7 @@ static void cjmp(operator_t op, int jlabel) { // Conditional jump
       return;
   }
 
-  fprintf(out, "\t%s l%d\n", command, jlabel);
+  jump_command(command, jlabel);
 }
 
 static void add(arg_t src, arg_t dst) {
@@ -501,9 +1874,7 @@ static void idiv(arg_t src, arg_t dst) {
     arg_reg("rdx")
   );
 
-  fprintf(out, "\tidivq ");
-  gen_arg(src);
-  fprintf(out, "\n");
+  one_arg_command("idivq", src);
 
   mov(
     arg_reg("rax"),
@@ -516,29 +1887,174 @@ static void cmp(arg_t src, arg_t dst) {
 }
 
 static void jne(int32_t label_id) {
-  fprintf(out, "\tjne l%d\n", label_id);
+  jump_command("jne", label_id);
 }
 
 static void je(int32_t label_id) {
-  fprintf(out, "\tje l%d\n", label_id);
+  jump_command("je", label_id);
 }
 
 static void jmp(int32_t label_id) {
-  fprintf(out, "\tjmp l%d\n", label_id);
+  jump_command("jmp", label_id);
 }
 
 static void ret(void) {
-  fprintf(out, "\tret\n");
+  if (context->object) {
+    x86_ret(context->object);
+    return;
+  }
+  outbuf_str(out, "\tret\n");
 }
 
 static void label(int32_t label_id) {
-  fprintf(out, "l%d:\n", label_id);
+  if (context->object) {
+    x86_label(context->object, label_base + label_id);
+  } else {
+    label_name(label_id);
+    outbuf_str(out, ":\n");
+  }
+
+  // Labels are only in the body of a function, which may follow a return.
+  if (cfa.reg && (strcmp(cfa.reg, body_cfa.reg) != 0 || cfa.offset != body_cfa.offset
+      || cfa.rbp_saved != body_cfa.rbp_saved)) {
+    set_cfa(body_cfa.reg, body_cfa.offset, body_cfa.rbp_saved);
+  }
+}
+
+/* Labels are numbered within each function, and named after both numbers. */
+static void label_name(int32_t label_id) {
+  outbuf_char(out, 'l');
+  outbuf_int(out, function_number);
+  outbuf_char(out, '_');
+  outbuf_int(out, label_id);
+}
+
+/* Starts a section for the function, so that the linker can drop or reorder it
+ * on its own. Cold functions are grouped away from the hot ones. */
+static void func_section(symbol_t *function) {
+  const char *prefix = function->cold ? ".text.unlikely." : ".text.";
+  const char *name = symbol_name(function->name);
+  char *section_name = (char *) malloc(strlen(prefix) + strlen(name) + 1);
+  strcpy(section_name, prefix);
+  strcat(section_name, name);
+  section(section_name, TEXT_SECTION);
+  free(section_name);
+}
+
+/* Switches to a section. The text, data and bss sections have their own
+ * directives, other sections are assumed to hold code. */
+static void section(const char *name, section_type_t type) {
+  if (context->object) {
+    x86_section(context->object, name, type);
+    return;
+  }
+
+  if (strcmp(name, ".text") == 0 || strcmp(name, ".data") == 0 || strcmp(name, ".bss") == 0) {
+    outbuf_char(out, '\t');
+    outbuf_str(out, name);
+    outbuf_char(out, '\n');
+  } else {
+    outbuf_str(out, "\t.section ");
+    outbuf_str(out, name);
+    outbuf_str(out, ",\"ax\",@progbits\n");
+  }
+}
+
+static void global(const char *name) {
+  if (context->object) {
+    x86_global(context->object, name);
+    return;
+  }
+  outbuf_str(out, "\t.globl ");
+  outbuf_str(out, name);
+  outbuf_char(out, '\n');
+}
+
+/* Defines a symbol at the current position. */
+static void define(const char *name) {
+  if (context->object) {
+    x86_define(context->object, name);
+    return;
+  }
+  outbuf_str(out, name);
+  outbuf_str(out, ":\n");
+}
+
+static void quad(int64_t value) {
+  if (context->object) {
+    x86_quad(context->object, value);
+    return;
+  }
+  outbuf_str(out, "\t.quad ");
+  outbuf_int(out, value);
+  outbuf_char(out, '\n');
+}
+
+static void zero(size_t size) {
+  if (context->object) {
+    x86_zero(context->object, size);
+    return;
+  }
+  outbuf_str(out, "\t.zero ");
+  outbuf_int(out, size);
+  outbuf_char(out, '\n');
+}
+
+/* Gets the assembly symbol of a function or global variable. The symbol is
+ * only valid until the next call, which reuses its buffer. */
+static const char *symbol_name(const char *name) {
+  size_t size = strlen(SYMBOL_PREFIX) + strlen(name) + 1;
+  if (size > symbol_capacity) {
+    symbol_capacity = size * 2;
+    symbol_buffer = (char *) realloc(symbol_buffer, symbol_capacity);
+  }
+  strcpy(symbol_buffer, SYMBOL_PREFIX);
+  strcat(symbol_buffer, name);
+  return symbol_buffer;
 }
 
-static void func_label(char *name) {
-  fprintf(out, "_%s:\n", name);
+/* Frees the buffer of symbol_name, once the program is generated. */
+static void free_symbol_buffer(void) {
+  free(symbol_buffer);
+  symbol_buffer = 0;
+  symbol_capacity = 0;
 }
 
 static void call(char *name) {
-  fprintf(out, "\tcall _%s\n", name);
+  func_command("call", name);
+}
+
+/* Calls a function of the C library, whose symbol has no prefix. */
+static void call_library(const char *name) {
+  if (context->object) {
+    x86_symbol_command(context->object, "call", name);
+    return;
+  }
+  outbuf_str(out, "\tcall ");
+  outbuf_str(out, name);
+  outbuf_char(out, '\n');
+}
+
+/* Emits the string with its terminating zero. */
+static void string(const char *text) {
+  if (context->object) {
+    x86_string(context->object, text);
+    return;
+  }
+  outbuf_str(out, "\t.asciz \"");
+  for (; *text; text++) {
+    if (*text == '\n') {
+      outbuf_str(out, "\\n");
+    } else {
+      if (*text == '"' || *text == '\\') {
+        outbuf_char(out, '\\');
+      }
+      outbuf_char(out, *text);
+    }
+  }
+  outbuf_str(out, "\"\n");
+}
+
+static void tail_jmp(char *name) {
+  func_command("jmp", name);
 }
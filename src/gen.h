@@ -1,7 +1,16 @@
 #ifndef GEN_H
 #define GEN_H
 #include "parser.h"
+#include "passes.h"
+#include "x86.h"
 
-void generate_code(FILE *file, stat_ast_t *ast);
+// The report an instrumented program writes when main returns, in the
+// directory it runs in.
+#define PROFILE_FILE "paola-profile.txt"
+
+extern const visitor_t calls_visitor;
+
+void generate_code(stat_ast_t *ast, int threads);
+x86_obj_t *generate_object(stat_ast_t *ast);
 
 #endif
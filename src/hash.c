@@ -0,0 +1,48 @@
+#include <string.h>
+#include "hash.h"
+
+static uint64_t rotate(uint64_t, int);
+static uint64_t mix(uint64_t);
+
+/* MurmurHash3, x64 128-bit variant, with seed 0. */
+hash_t hash_bytes(const void *data, size_t size) {
+  const uint64_t c1 = 0x87c37b91114253d5ULL, c2 = 0x4cf5ad432745937fULL;
+  const uint8_t *bytes = (const uint8_t *) data;
+  uint64_t h1 = 0, h2 = 0, k1, k2;
+  size_t blocks = size / 16;
+  for (size_t i = 0; i < blocks; i++) {
+    memcpy(&k1, bytes + i * 16, 8);
+    memcpy(&k2, bytes + i * 16 + 8, 8);
+    k1 *= c1; k1 = rotate(k1, 31); k1 *= c2; h1 ^= k1;
+    h1 = rotate(h1, 27); h1 += h2; h1 = h1 * 5 + 0x52dce729;
+    k2 *= c2; k2 = rotate(k2, 33); k2 *= c1; h2 ^= k2;
+    h2 = rotate(h2, 31); h2 += h1; h2 = h2 * 5 + 0x38495ab5;
+  }
+
+  // The tail, padded with zeros, which leave the hash as it is.
+  uint8_t tail[16] = {0};
+  memcpy(tail, bytes + blocks * 16, size % 16);
+  memcpy(&k1, tail, 8);
+  memcpy(&k2, tail + 8, 8);
+  k2 *= c2; k2 = rotate(k2, 33); k2 *= c1; h2 ^= k2;
+  k1 *= c1; k1 = rotate(k1, 31); k1 *= c2; h1 ^= k1;
+
+  h1 ^= size; h2 ^= size;
+  h1 += h2; h2 += h1;
+  h1 = mix(h1); h2 = mix(h2);
+  h1 += h2; h2 += h1;
+  return (hash_t) {{h1, h2}};
+}
+
+static uint64_t rotate(uint64_t x, int bits) {
+  return (x << bits) | (x >> (64 - bits));
+}
+
+static uint64_t mix(uint64_t k) {
+  k ^= k >> 33;
+  k *= 0xff51afd7ed558ccdULL;
+  k ^= k >> 33;
+  k *= 0xc4ceb9fe1a85ec53ULL;
+  k ^= k >> 33;
+  return k;
+}
@@ -0,0 +1,13 @@
+#ifndef HASH_H
+#define HASH_H
+#include <stddef.h>
+#include <stdint.h>
+
+// A 128-bit hash, for telling inputs apart by content.
+typedef struct {
+  uint64_t hash[2];
+} hash_t;
+
+hash_t hash_bytes(const void *, size_t);
+
+#endif
@@ -0,0 +1,94 @@
+#include <stdlib.h>
+#include <string.h>
+#include "incremental.h"
+#include "context.h"
+
+/* An index is the magic, followed by an entry per function: its fingerprint,
+ * the size of its assembly and the assembly. Entries are sorted by fingerprint
+ * when the index is loaded. */
+
+#define INDEX_MAGIC "PAOLAFI1"
+#define MAGIC_SIZE 8
+
+static int compare_fingerprint(const void *, const void *);
+
+/* Reads the entries of the previous index of the context. An index that is
+ * not well formed is ignored. */
+void index_load(void) {
+  context->index_entry_count = 0;
+  const char *data = context->previous_index;
+  size_t size = context->previous_index_size;
+  if (size < MAGIC_SIZE || memcmp(data, INDEX_MAGIC, MAGIC_SIZE) != 0) {
+    return;
+  }
+
+  int capacity = context->index_entry_capacity;
+  size_t position = MAGIC_SIZE;
+  while (position < size) {
+    index_entry_t entry;
+    uint64_t text_size;
+    if (size - position < sizeof(entry.fingerprint) + sizeof(text_size)) {
+      context->index_entry_count = 0;
+      return;
+    }
+    memcpy(&entry.fingerprint, data + position, sizeof(entry.fingerprint));
+    memcpy(&text_size, data + position + sizeof(entry.fingerprint), sizeof(text_size));
+    position += sizeof(entry.fingerprint) + sizeof(text_size);
+    if (size - position < text_size) {
+      context->index_entry_count = 0;
+      return;
+    }
+    entry.text = data + position;
+    entry.size = text_size;
+    position += text_size;
+
+    if (context->index_entry_count == capacity) {
+      capacity = capacity ? capacity * 2 : 64;
+      context->index_entries = (index_entry_t *) realloc(context->index_entries,
+          sizeof(index_entry_t) * capacity);
+      context->index_entry_capacity = capacity;
+    }
+    context->index_entries[context->index_entry_count++] = entry;
+  }
+  qsort(context->index_entries, context->index_entry_count, sizeof(index_entry_t),
+      compare_fingerprint);
+}
+
+/* Finds the assembly of the function with the fingerprint in the previous
+ * index. Safe to call from several threads. */
+bool index_find(hash_t fingerprint, const char **text, size_t *size) {
+  if (context->index_entry_count == 0) {
+    return false;
+  }
+  index_entry_t key = {fingerprint, 0, 0};
+  index_entry_t *entry = (index_entry_t *) bsearch(&key, context->index_entries,
+      context->index_entry_count, sizeof(index_entry_t), compare_fingerprint);
+  if (entry == NULL) {
+    return false;
+  }
+  *text = entry->text;
+  *size = entry->size;
+  return true;
+}
+
+/* Adds a function to the index of this compilation. */
+void index_add(hash_t fingerprint, const char *text, size_t size) {
+  if (context->index.size == 0) {
+    outbuf_write(&context->index, INDEX_MAGIC, MAGIC_SIZE);
+  }
+  uint64_t text_size = size;
+  outbuf_write(&context->index, (const char *) &fingerprint, sizeof(fingerprint));
+  outbuf_write(&context->index, (const char *) &text_size, sizeof(text_size));
+  outbuf_write(&context->index, text, size);
+}
+
+static int compare_fingerprint(const void *a, const void *b) {
+  const hash_t *x = &((const index_entry_t *) a)->fingerprint;
+  const hash_t *y = &((const index_entry_t *) b)->fingerprint;
+  for (int i = 0; i < 2; i++) {
+    if (x->hash[i] != y->hash[i]) {
+      return x->hash[i] < y->hash[i] ? -1 : 1;
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,21 @@
+#ifndef INCREMENTAL_H
+#define INCREMENTAL_H
+#include <stdbool.h>
+#include <stddef.h>
+#include "hash.h"
+
+/* The index of a compilation maps the fingerprint of each function to the
+ * assembly generated for it. Generating a function whose fingerprint is in the
+ * index of the previous compilation copies its assembly instead, see gen.c. */
+
+typedef struct {
+  hash_t fingerprint;
+  const char *text;
+  size_t size;
+} index_entry_t;
+
+void index_load(void);
+bool index_find(hash_t, const char **, size_t *);
+void index_add(hash_t, const char *, size_t);
+
+#endif
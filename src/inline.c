@@ -0,0 +1,172 @@
+#include <stdlib.h>
+#include "inline.h"
+#include "callgraph.h"
+#include "context.h"
+#include "errors.h"
+#include "pgo.h"
+
+/* Inlining cost model. Calls are expanded in place by the code generator, this
+ * module only decides which functions are worth it, and marks them inlinable.
+ *
+ * Sizes are measured in AST nodes. A call costs about as much code as a small
+ * function body (every register is pushed and popped around it), so functions
+ * below INLINE_SMALL_SIZE are always inlined. Functions with a single call site
+ * are inlined up to INLINE_SINGLE_CALL_SIZE, since the expansion replaces the
+ * only use. The total code growth, the size of a function times its number of
+ * call sites, is bounded by the growth budget. Functions declared inline are
+ * always inlined.
+ *
+ * With a profile, functions that were never called are not inlined, and the
+ * ones called at least INLINE_HOT_CALLS times are inlined up to
+ * INLINE_HOT_SIZE, wherever they are called from.
+ *
+ * A recursive function is never inlined unless it is declared inline, and even
+ * then the code generator does not expand a function inside its own expansion,
+ * so recursion always ends in a real call. */
+
+#define INLINE_SMALL_SIZE 16
+#define INLINE_SINGLE_CALL_SIZE 256
+#define INLINE_MIN_BUDGET 256
+#define INLINE_HOT_CALLS 1000
+#define INLINE_HOT_SIZE 64
+
+typedef struct {
+  symbol_t *symbol;
+  int size;
+  bool recursive;
+  int64_t calls; // Counted by the profile at its call sites, -1 if none were
+} func_info_t;
+
+static void collect_functions(stat_ast_t *);
+static void count_profiled_calls(void);
+static void size_begin(stat_ast_t *, walk_t *);
+static void size_end(stat_ast_t *, walk_t *);
+static int compare_size(const void *, const void *);
+
+// The analysis of the size of every statement, see passes.h.
+const visitor_t sizes_visitor = {.stat = size_begin, .stat_end = size_end};
+
+static _Thread_local func_info_t *functions;
+static _Thread_local int function_count, function_capacity;
+
+void plan_inlining(stat_ast_t *program) {
+  function_count = 0;
+  function_capacity = 16;
+  functions = (func_info_t *) malloc(sizeof(func_info_t) * function_capacity);
+  collect_functions(program);
+
+  int function_total = 0;
+  bool *recursive = callgraph_recursive();
+  for (int i = 0; i < function_count; i++) {
+    func_info_t *info = &functions[i];
+    info->size = info->symbol->decl->func_body->size;
+    function_total += info->size;
+    info->recursive = info->symbol->callgraph_id != -1 && recursive[info->symbol->callgraph_id];
+  }
+  free(recursive);
+  count_profiled_calls();
+
+  // Smallest functions first, they give the most benefit for their growth.
+  qsort(functions, function_count, sizeof(func_info_t), compare_size);
+
+  int budget = function_total > INLINE_MIN_BUDGET ? function_total : INLINE_MIN_BUDGET;
+  for (int i = 0; i < function_count; i++) {
+    func_info_t *info = &functions[i];
+    symbol_t *symbol = info->symbol;
+    int growth = info->size * symbol->call_count;
+
+    if (symbol->decl->is_inline) {
+      symbol->inlinable = true;
+    } else if (info->recursive || symbol->call_count == 0) {
+      symbol->inlinable = false;
+      if (info->recursive) {
+        remark(PAOLA_REMARK_MISSED, "inline", &symbol->decl->pos, symbol->name,
+            "calls to %s are not inlined: it is recursive", symbol->name);
+      }
+    } else if (info->calls == 0) {
+      symbol->inlinable = false;
+      remark(PAOLA_REMARK_MISSED, "inline", &symbol->decl->pos, symbol->name,
+          "calls to %s are not inlined: they never ran in the profile", symbol->name);
+    } else if (info->size <= INLINE_SMALL_SIZE
+        || (symbol->call_count == 1 && info->size <= INLINE_SINGLE_CALL_SIZE)
+        || (info->calls >= INLINE_HOT_CALLS && info->size <= INLINE_HOT_SIZE)) {
+      symbol->inlinable = growth <= budget;
+      if (!symbol->inlinable) {
+        remark(PAOLA_REMARK_MISSED, "inline", &symbol->decl->pos, symbol->name,
+            "calls to %s are not inlined: %d calls of size %d exceed the growth budget of %d",
+            symbol->name, symbol->call_count, info->size, budget);
+      }
+    } else {
+      remark(PAOLA_REMARK_MISSED, "inline", &symbol->decl->pos, symbol->name,
+          "calls to %s are not inlined: size %d with %d calls is too large", symbol->name,
+          info->size, symbol->call_count);
+    }
+
+    if (symbol->inlinable) {
+      budget -= growth;
+    }
+  }
+
+  free(functions);
+}
+
+static void collect_functions(stat_ast_t *program) {
+  for (list_elem_t *e = list_begin(&program->stats); e != list_end(&program->stats);
+      e = list_next(e)) {
+    stat_ast_t *stat = list_entry(e, stat_ast_t, block_elem);
+    if (stat->type != DECL_STAT || !stat->is_func || !stat->func_body || !stat->symbol) {
+      continue;
+    }
+
+    if (function_count == function_capacity) {
+      function_capacity *= 2;
+      functions = (func_info_t *) realloc(functions, sizeof(func_info_t) * function_capacity);
+    }
+    functions[function_count].symbol = stat->symbol;
+    functions[function_count].size = 0;
+    functions[function_count].recursive = false;
+    functions[function_count].calls = -1;
+    function_count++;
+  }
+}
+
+/* Adds up the runs of the call sites of each function that the profile
+ * counted. */
+static void count_profiled_calls(void) {
+  // The function of each call graph node.
+  func_info_t **infos = (func_info_t **) calloc(context->function_count + 1,
+      sizeof(func_info_t *));
+  for (int i = 0; i < function_count; i++) {
+    if (functions[i].symbol->callgraph_id != -1) {
+      infos[functions[i].symbol->callgraph_id] = &functions[i];
+    }
+  }
+
+  for (int i = 0; i < function_count; i++) {
+    list_t *sites = &functions[i].symbol->call_sites;
+    for (list_elem_t *e = list_begin(sites); e != list_end(sites); e = list_next(e)) {
+      expr_ast_t *call = list_entry(e, call_site_t, elem)->call;
+      int64_t count = pgo_count(functions[i].symbol, call->counter);
+      int id = call->symbol->callgraph_id;
+      if (count < 0 || id == -1 || !infos[id]) {
+        continue;
+      }
+      infos[id]->calls = (infos[id]->calls > 0 ? infos[id]->calls : 0) + count;
+    }
+  }
+  free(infos);
+}
+
+/* Sizes are kept in the statements. The nodes of a statement are the ones the
+ * walk visits from it until it leaves it, nested functions included. */
+static void size_begin(stat_ast_t *stat, walk_t *walk) {
+  stat->size = walk->nodes;
+}
+
+static void size_end(stat_ast_t *stat, walk_t *walk) {
+  stat->size = walk->nodes - stat->size;
+}
+
+static int compare_size(const void *a, const void *b) {
+  return ((const func_info_t *) a)->size - ((const func_info_t *) b)->size;
+}
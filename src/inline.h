@@ -0,0 +1,13 @@
+#ifndef INLINE_H
+#define INLINE_H
+#include "parser.h"
+#include "passes.h"
+
+/* The deepest chain of calls expanded into each other. */
+#define MAX_INLINE_DEPTH 8
+
+extern const visitor_t sizes_visitor;
+
+void plan_inlining(stat_ast_t *);
+
+#endif
@@ -0,0 +1,326 @@
+#pragma GCC diagnostic ignored "-Wwrite-strings"
+// The dispatch table takes the addresses of labels, a GNU extension.
+#pragma GCC diagnostic ignored "-Wpedantic"
+
+#include <limits.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "interp.h"
+#include "arith.h"
+#include "errors.h"
+
+/* Bytecode interpreter. All frames share one stack of registers, a call only
+ * moves the frame base past the caller's frame, and a tail call reuses the
+ * caller's frame, so tail recursion runs in constant space like the compiled
+ * code. Arithmetic wraps and division faults like the x86 instructions it
+ * stands for.
+ *
+ * When evaluating at compile time, the number of jumps and calls taken and the
+ * size of the register stack are limited, and a faulting division stops the
+ * evaluation instead of the compiler.
+ *
+ * The AST walker evaluates the same program straight from the tree. It only
+ * exists as the baseline the bytecode is measured against. */
+
+typedef struct {
+  bc_function_t *function;
+  bc_insn_t *return_pc;
+  size_t base;
+  uint16_t dst; // Caller register receiving the return value
+} frame_t;
+
+typedef enum {
+  FLOW_NEXT,
+  FLOW_RETURNED
+} flow_t;
+
+static void reserve(size_t);
+static int64_t walk_function(int);
+static flow_t walk_stat(stat_ast_t *, int64_t *, int64_t *);
+static int64_t walk_expr(expr_ast_t *, int64_t *);
+
+static _Thread_local bc_program_t *program;
+static _Thread_local int64_t *registers;
+static _Thread_local size_t register_capacity;
+
+/* Runs the function with the given number, returns its return value. */
+int64_t interpret(bc_program_t *prog, int number) {
+  int64_t value = 0;
+  long steps = LONG_MAX;
+  interpret_bounded(prog, number, &steps, SIZE_MAX, &value);
+  return value;
+}
+
+/* Runs the function with the given number, taking at most *budget jumps and
+ * calls, and using at most the given number of registers. The steps taken are
+ * subtracted from the budget, which is negative if it ran out. Returns false if
+ * the function exceeds the limits, would fault, or calls a function that failed
+ * to lower, otherwise stores its return value. */
+bool interpret_bounded(bc_program_t *prog, int number, long *budget, size_t max_registers,
+    int64_t *value) {
+  long steps = *budget;
+  bool bounded = steps != LONG_MAX;
+  program = prog;
+  frame_t *frames = 0;
+  size_t frame_count = 0, frame_capacity = 0;
+
+  static void *dispatch[BC_OP_COUNT] = {
+    [BC_LOADI] = &&do_loadi, [BC_MOV] = &&do_mov,
+    [BC_ADD] = &&do_add, [BC_SUB] = &&do_sub, [BC_MUL] = &&do_mul, [BC_DIV] = &&do_div,
+    [BC_EQ] = &&do_eq, [BC_LT] = &&do_lt, [BC_LTE] = &&do_lte, [BC_GT] = &&do_gt,
+    [BC_GTE] = &&do_gte,
+    [BC_JEQ] = &&do_jeq, [BC_JNE] = &&do_jne, [BC_JLT] = &&do_jlt, [BC_JLTE] = &&do_jlte,
+    [BC_JGT] = &&do_jgt, [BC_JGTE] = &&do_jgte,
+    [BC_LOADG] = &&do_loadg, [BC_STOREG] = &&do_storeg,
+    [BC_JMP] = &&do_jmp, [BC_JZ] = &&do_jz, [BC_JNZ] = &&do_jnz,
+    [BC_CALL] = &&do_call, [BC_TAILCALL] = &&do_tailcall, [BC_RET] = &&do_ret
+  };
+
+  #define DISPATCH() goto *dispatch[pc->op]
+  #define NEXT() do { pc++; DISPATCH(); } while (0)
+  #define JUMP(target) do { \
+    if (--steps < 0) goto stop; \
+    pc = code + (target); \
+    DISPATCH(); \
+  } while (0)
+  #define ENTER(n) do { \
+    function = &program->functions[n]; \
+    if (function->failed || --steps < 0 \
+        || base + function->frame_size > max_registers) goto stop; \
+    code = function->code; \
+    reserve(base + function->frame_size); \
+    r = registers + base; \
+    memset(r, 0, sizeof(int64_t) * function->frame_size); \
+    pc = code; \
+  } while (0)
+
+  int64_t *globals = program->globals;
+  bc_function_t *function;
+  bc_insn_t *code, *pc;
+  size_t base = 0;
+  int64_t *r;
+  ENTER(number);
+  DISPATCH();
+
+do_loadi:
+  r[pc->dst] = pc->imm;
+  NEXT();
+do_mov:
+  r[pc->dst] = r[pc->a];
+  NEXT();
+do_add:
+  r[pc->dst] = (int64_t) ((uint64_t) r[pc->a] + (uint64_t) r[pc->b]);
+  NEXT();
+do_sub:
+  r[pc->dst] = (int64_t) ((uint64_t) r[pc->a] - (uint64_t) r[pc->b]);
+  NEXT();
+do_mul:
+  r[pc->dst] = (int64_t) ((uint64_t) r[pc->a] * (uint64_t) r[pc->b]);
+  NEXT();
+do_div:
+  if (!arith_divide(r[pc->a], r[pc->b], &r[pc->dst])) {
+    if (bounded) goto stop;
+    raise(SIGFPE);
+  }
+  NEXT();
+do_eq:
+  r[pc->dst] = r[pc->a] == r[pc->b];
+  NEXT();
+do_lt:
+  r[pc->dst] = r[pc->a] < r[pc->b];
+  NEXT();
+do_lte:
+  r[pc->dst] = r[pc->a] <= r[pc->b];
+  NEXT();
+do_gt:
+  r[pc->dst] = r[pc->a] > r[pc->b];
+  NEXT();
+do_gte:
+  r[pc->dst] = r[pc->a] >= r[pc->b];
+  NEXT();
+do_jeq:
+  if (r[pc->dst] == r[pc->a]) JUMP(pc->b);
+  NEXT();
+do_jne:
+  if (r[pc->dst] != r[pc->a]) JUMP(pc->b);
+  NEXT();
+do_jlt:
+  if (r[pc->dst] < r[pc->a]) JUMP(pc->b);
+  NEXT();
+do_jlte:
+  if (r[pc->dst] <= r[pc->a]) JUMP(pc->b);
+  NEXT();
+do_jgt:
+  if (r[pc->dst] > r[pc->a]) JUMP(pc->b);
+  NEXT();
+do_jgte:
+  if (r[pc->dst] >= r[pc->a]) JUMP(pc->b);
+  NEXT();
+do_loadg:
+  r[pc->dst] = globals[pc->imm];
+  NEXT();
+do_storeg:
+  globals[pc->imm] = r[pc->dst];
+  NEXT();
+do_jmp:
+  JUMP(pc->imm);
+do_jz:
+  if (r[pc->dst] == 0) JUMP(pc->imm);
+  NEXT();
+do_jnz:
+  if (r[pc->dst] != 0) JUMP(pc->imm);
+  NEXT();
+do_call:
+  if (frame_count == frame_capacity) {
+    frame_capacity = frame_capacity ? frame_capacity * 2 : 64;
+    frames = (frame_t *) realloc(frames, sizeof(frame_t) * frame_capacity);
+  }
+  frames[frame_count++] = (frame_t) {function, pc + 1, base, pc->dst};
+  base += function->frame_size;
+  ENTER(pc->imm);
+  DISPATCH();
+do_tailcall:
+  ENTER(pc->imm);
+  DISPATCH();
+do_ret: {
+  int64_t result = r[pc->dst];
+  if (frame_count == 0) {
+    free(frames);
+    *budget = steps;
+    *value = result;
+    return true;
+  }
+  frame_t *frame = &frames[--frame_count];
+  function = frame->function;
+  code = function->code;
+  base = frame->base;
+  r = registers + base;
+  r[frame->dst] = result;
+  pc = frame->return_pc;
+  DISPATCH();
+}
+stop:
+  free(frames);
+  *budget = steps;
+  return false;
+
+  #undef DISPATCH
+  #undef NEXT
+  #undef JUMP
+  #undef ENTER
+}
+
+/* Runs the function with the given number by walking its AST. */
+int64_t interpret_ast(bc_program_t *prog, int number) {
+  program = prog;
+  return walk_function(number);
+}
+
+/* Makes room for at least size registers. */
+static void reserve(size_t size) {
+  if (size <= register_capacity) {
+    return;
+  }
+  while (register_capacity < size) {
+    register_capacity = register_capacity ? register_capacity * 2 : 1024;
+  }
+  registers = (int64_t *) realloc(registers, sizeof(int64_t) * register_capacity);
+}
+
+static int64_t walk_function(int number) {
+  bc_function_t *function = &program->functions[number];
+  int64_t *locals = (int64_t *) calloc(function->local_count + 1, sizeof(int64_t));
+  int64_t value = 0;
+  walk_stat(function->symbol->decl->func_body, locals, &value);
+  free(locals);
+  return value;
+}
+
+static flow_t walk_stat(stat_ast_t *stat, int64_t *locals, int64_t *value) {
+  switch (stat->type) {
+    case RETURN_STAT:
+      *value = walk_expr(stat->expr, locals);
+      return FLOW_RETURNED;
+    case IF_STAT:
+      if (walk_expr(stat->cond, locals)) {
+        return walk_stat(stat->tstat, locals, value);
+      }
+      return stat->fstat ? walk_stat(stat->fstat, locals, value) : FLOW_NEXT;
+    case WHILE_STAT:
+      while (walk_expr(stat->cond, locals)) {
+        if (walk_stat(stat->body, locals, value) == FLOW_RETURNED) {
+          return FLOW_RETURNED;
+        }
+      }
+      return FLOW_NEXT;
+    case FOR_STAT:
+      for (walk_expr(stat->init, locals); walk_expr(stat->cond, locals);
+          walk_expr(stat->iter, locals)) {
+        if (walk_stat(stat->body, locals, value) == FLOW_RETURNED) {
+          return FLOW_RETURNED;
+        }
+      }
+      return FLOW_NEXT;
+    case BLOCK_STAT:
+      for (list_elem_t *e = list_begin(&stat->stats); e != list_end(&stat->stats);
+          e = list_next(e)) {
+        if (walk_stat(list_entry(e, stat_ast_t, block_elem), locals, value) == FLOW_RETURNED) {
+          return FLOW_RETURNED;
+        }
+      }
+      return FLOW_NEXT;
+    case DECL_STAT:
+      if (!stat->is_func) {
+        locals[stat->symbol->slot] = stat->value ? walk_expr(stat->value, locals) : 0;
+      }
+      return FLOW_NEXT;
+    case EXPR_STAT:
+      walk_expr(stat->expr, locals);
+      return FLOW_NEXT;
+    default:
+      return FLOW_NEXT;
+  }
+}
+
+static int64_t walk_expr(expr_ast_t *expr, int64_t *locals) {
+  switch (expr->type) {
+    case INT_LIT:
+      return expr->ival;
+    case VAR_REF:
+      return expr->symbol->is_global ? program->globals[expr->symbol->slot]
+          : locals[expr->symbol->slot];
+    case FUNC_CALL:
+      return walk_function(expr->symbol->callgraph_id);
+    case BIN_OP: {
+      if (expr->op == ASSIGN) {
+        symbol_t *symbol = expr->left->symbol;
+        int64_t value = walk_expr(expr->right, locals);
+        return (symbol->is_global ? program->globals : locals)[symbol->slot] = value;
+      }
+      uint64_t left = (uint64_t) walk_expr(expr->left, locals);
+      uint64_t right = (uint64_t) walk_expr(expr->right, locals);
+      switch (expr->op) {
+        case ADD: return (int64_t) (left + right);
+        case SUBS: return (int64_t) (left - right);
+        case MUL: return (int64_t) (left * right);
+        case DIV: {
+          int64_t quotient = 0;
+          if (!arith_divide((int64_t) left, (int64_t) right, &quotient)) {
+            raise(SIGFPE);
+          }
+          return quotient;
+        }
+        case EQ: return left == right;
+        case LT: return (int64_t) left < (int64_t) right;
+        case LTE: return (int64_t) left <= (int64_t) right;
+        case GT: return (int64_t) left > (int64_t) right;
+        case GTE: return (int64_t) left >= (int64_t) right;
+        default: return 0;
+      }
+    }
+    default:
+      return 0;
+  }
+}
@@ -0,0 +1,10 @@
+#ifndef INTERP_H
+#define INTERP_H
+#include <stddef.h>
+#include "bytecode.h"
+
+int64_t interpret(bc_program_t *, int);
+bool interpret_bounded(bc_program_t *, int, long *, size_t, int64_t *);
+int64_t interpret_ast(bc_program_t *, int);
+
+#endif
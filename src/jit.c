@@ -0,0 +1,167 @@
+#pragma GCC diagnostic ignored "-Wwrite-strings"
+#define _DEFAULT_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "jit.h"
+#include "errors.h"
+
+/* Runs an assembled program in memory. The code sections are copied one after
+ * the other into an anonymous mapping, followed by the data sections, so that
+ * every rel32 reference is in reach. Relocations are resolved in place, then
+ * the code pages are made executable and the data pages are left writable.
+ *
+ * Generated code uses every register, including the ones C callers expect to
+ * survive a call, so main is entered through a trampoline that saves them. */
+
+#define CODE_ALIGN 16
+#define DATA_ALIGN 8
+
+// push %rbx, %rbp, %r12-%r15; sub $8, %rsp; call <rel32>
+static const uint8_t trampoline_entry[] = {
+  0x53, 0x55, 0x41, 0x54, 0x41, 0x55, 0x41, 0x56, 0x41, 0x57, 0x48, 0x83, 0xec, 0x08, 0xe8
+};
+// add $8, %rsp; pop %r15-%r12, %rbp, %rbx; ret
+static const uint8_t trampoline_exit[] = {
+  0x48, 0x83, 0xc4, 0x08, 0x41, 0x5f, 0x41, 0x5e, 0x41, 0x5d, 0x41, 0x5c, 0x5d, 0x5b, 0xc3
+};
+
+static size_t align(size_t, size_t);
+static bool relocate(x86_obj_t *, uint8_t **);
+static bool write_rel32(uint8_t *, int64_t);
+
+/* Runs the program's main. Returns false if the program cannot be loaded,
+ * otherwise stores main's return value in status. */
+bool jit_run(x86_obj_t *obj, int *status) {
+  size_t page_size = (size_t) sysconf(_SC_PAGESIZE);
+  uint8_t **section_base = (uint8_t **) malloc(sizeof(uint8_t *) * (obj->section_count + 1));
+
+  // Lay out the code, then the trampoline, then the data on a fresh page.
+  size_t code_size = 0;
+  for (int i = 0; i < obj->section_count; i++) {
+    if (obj->sections[i].type == TEXT_SECTION) {
+      code_size = align(code_size, CODE_ALIGN) + obj->sections[i].size;
+    }
+  }
+  size_t trampoline = align(code_size, CODE_ALIGN);
+  code_size = align(trampoline + sizeof(trampoline_entry) + 4 + sizeof(trampoline_exit),
+      page_size);
+
+  size_t data_size = 0;
+  for (int i = 0; i < obj->section_count; i++) {
+    section_t *section = &obj->sections[i];
+    if (section->type != TEXT_SECTION) {
+      data_size = align(data_size, DATA_ALIGN)
+          + (section->type == BSS_SECTION ? section->bss_size : section->size);
+    }
+  }
+
+  size_t size = code_size + align(data_size, page_size);
+  uint8_t *memory = (uint8_t *) mmap(0, size, PROT_READ | PROT_WRITE,
+      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (memory == MAP_FAILED) {
+    error(0, "Could not map memory for the program.");
+    free(section_base);
+    return false;
+  }
+
+  size_t code_offset = 0, data_offset = code_size;
+  for (int i = 0; i < obj->section_count; i++) {
+    section_t *section = &obj->sections[i];
+    if (section->type == TEXT_SECTION) {
+      code_offset = align(code_offset, CODE_ALIGN);
+      section_base[i] = memory + code_offset;
+      code_offset += section->size;
+    } else {
+      data_offset = align(data_offset, DATA_ALIGN);
+      section_base[i] = memory + data_offset;
+      data_offset += section->type == BSS_SECTION ? section->bss_size : section->size;
+    }
+    // The mapping is zeroed, which is all bss needs.
+    if (section->type != BSS_SECTION && section->size) {
+      memcpy(section_base[i], section->code, section->size);
+    }
+  }
+
+  bool loaded = relocate(obj, section_base);
+
+  // The trampoline calls _main.
+  uint8_t *entry = memory + trampoline;
+  memcpy(entry, trampoline_entry, sizeof(trampoline_entry));
+  uint8_t *call_end = entry + sizeof(trampoline_entry) + 4;
+  memcpy(call_end, trampoline_exit, sizeof(trampoline_exit));
+  int main_symbol = -1;
+  for (int i = 0; i < obj->symbol_count; i++) {
+    if (strcmp(obj->symbols[i].name, SYMBOL_PREFIX "main") == 0) {
+      main_symbol = i;
+    }
+  }
+  if (main_symbol == -1 || obj->symbols[main_symbol].section == -1) {
+    error(0, "The program has no main function.");
+    loaded = false;
+  } else {
+    x86_symbol_t *main = &obj->symbols[main_symbol];
+    write_rel32(call_end - 4, section_base[main->section] + main->code_offset - call_end);
+  }
+
+  if (loaded && mprotect(memory, code_size, PROT_READ | PROT_EXEC) != 0) {
+    error(0, "Could not make the program executable.");
+    loaded = false;
+  }
+
+  if (loaded) {
+    // ISO C has no cast from object to function pointers, copy the address.
+    int64_t (*run)(void);
+    memcpy(&run, &entry, sizeof(run));
+    *status = (int) run();
+  }
+
+  munmap(memory, size);
+  free(section_base);
+  return loaded;
+}
+
+static size_t align(size_t offset, size_t alignment) {
+  return (offset + alignment - 1) / alignment * alignment;
+}
+
+/* Resolves the relocations of every section. Returns false if a symbol is
+ * not defined by the program. */
+static bool relocate(x86_obj_t *obj, uint8_t **section_base) {
+  bool resolved = true;
+
+  for (int i = 0; i < obj->section_count; i++) {
+    section_t *section = &obj->sections[i];
+    for (int j = 0; j < section->reloc_count; j++) {
+      reloc_t *reloc = &section->relocs[j];
+      x86_symbol_t *symbol = &obj->symbols[reloc->symbol];
+      if (symbol->section == -1) {
+        error(0, "Undefined symbol %s.", symbol->name);
+        resolved = false;
+        continue;
+      }
+
+      // Both relocation types are S + A - P.
+      uint8_t *place = section_base[i] + reloc->code_offset;
+      uint8_t *target = section_base[symbol->section] + symbol->code_offset;
+      if (!write_rel32(place, target + reloc->addend - place)) {
+        error(0, "Symbol %s is out of reach.", symbol->name);
+        resolved = false;
+      }
+    }
+  }
+
+  return resolved;
+}
+
+static bool write_rel32(uint8_t *place, int64_t value) {
+  if (value < INT32_MIN || value > INT32_MAX) {
+    return false;
+  }
+  for (int i = 0; i < 4; i++) {
+    place[i] = (uint8_t) ((uint32_t) value >> (8 * i));
+  }
+  return true;
+}
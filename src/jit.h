@@ -0,0 +1,7 @@
+#ifndef JIT_H
+#define JIT_H
+#include "x86.h"
+
+bool jit_run(x86_obj_t *, int *);
+
+#endif
@@ -6,7 +6,15 @@
 #include <string.h>
 #include "errors.h"
 #include "lexer.h"
-
+#include "pool.h"
+#include "arena.h"
+#include "report.h"
+
+static void split_source(source_t *, size_t);
+static bool followed_by_else(source_t *, size_t);
+static void add_chunk(source_t *, size_t, size_t, position_t);
+static void tokenize_task(int, int, void *);
+static void tokenize_chunk(source_t *, chunk_t *);
 static token_t next_token(void);
 static token_t create_token(token_type_t);
 static position_t create_position(void);
@@ -16,50 +24,191 @@ static bool is_digit(char);
 static bool is_whitespace(char);
 static int consume_int_literal(void);
 static void consume_char(void);
-static void init_tokenizer(FILE *);
+static void init_tokenizer(const char *, const char *, position_t);
 static void skip_whitespace();
 static bool is_alphabetic(char);
 static bool is_alphanumeric(char);
-static token_t create_ident_or_keyword_token(char *);
-static char *consume_string(void);
+static token_t create_ident_or_keyword_token(const char *, int);
+static const char *consume_string(int *);
 static void skip_line();
-static char peek();
+static int peek();
+
+// The input is split into about this many chunks per thread, so that chunks of
+// uneven cost balance out.
+static const int CHUNKS_PER_THREAD = 8;
+
+static _Thread_local int next_char; /* The next character to be tokenized. */
+static _Thread_local const char *input, *input_end;
+static _Thread_local int line, character;
+
+/* Prepares the text for tokenizing. With more than one thread, the text is
+ * split into chunks of top-level statements that are tokenized and parsed in
+ * parallel. The text must outlive the source. */
+source_t *create_source(const char *text, size_t size, int threads) {
+  source_t *source = (source_t *) calloc(1, sizeof(source_t));
+  source->text = text;
+  source->size = size;
+
+  if (threads > 1) {
+    split_source(source, source->size / (threads * CHUNKS_PER_THREAD));
+  } else {
+    add_chunk(source, 0, source->size, (position_t) {1, 2});
+  }
+  return source;
+}
 
-static const int MAX_TOKENS = 10000; //TODO: We don't want this.
-static const int MAX_STRING_SIZE = 64; //TODO: We don't want this either.
+/* Frees the source and its tokens. The names of identifiers stay, in the
+ * arena. */
+void free_source(source_t *source) {
+  if (source->chunk_count > 1) {
+    free(source->tokens);
+  }
+  for (int i = 0; i < source->chunk_count; i++) {
+    free(source->chunks[i].tokens);
+  }
+  free(source->chunks);
+  free(source);
+}
 
-static char next_char; /* The next character to be tokenized. */
-static FILE *input;
-static int line, character;
+/* Pre-scans the brace depth, and splits the input after the closing braces of
+ * top-level statements, once a chunk has at least chunk_size characters. The
+ * positions of the chunks are counted the way consume_char counts them. */
+static void split_source(source_t *source, size_t chunk_size) {
+  const char *text = source->text;
+  size_t size = source->size;
+  size_t begin = 0, line_begin = 0;
+  position_t start = {1, 2};
+  int depth = 0, line = 1;
+
+  for (size_t i = 0; i < size && depth >= 0; i++) {
+    switch (text[i]) {
+      case '\n':
+        line++;
+        line_begin = i + 1;
+        break;
+      case '/':
+        if (i + 1 < size && text[i + 1] == '/') {
+          while (i + 1 < size && text[i + 1] != '\n') {
+            i++;
+          }
+        }
+        break;
+      case '{':
+        depth++;
+        break;
+      case '}':
+        // An unbalanced brace ends the splitting, the parser reports it.
+        depth--;
+        if (depth == 0 && i + 1 - begin >= chunk_size && !followed_by_else(source, i + 1)) {
+          add_chunk(source, begin, i + 1, start);
+          begin = i + 1;
+          start.line = line;
+          start.character = (int) (begin - line_begin) + (line == 1 ? 2 : 0);
+        }
+        break;
+    }
+  }
+  add_chunk(source, begin, size, start);
+}
 
-/* Takes a file pointer, and returns the series of tokens in that file.
- * An additional token is added at the end, the PROGRAM_END_TOK.
- * TODO: Return a linked list (or resizable vector) of tokens. */
-token_t *tokenize(FILE *file) {
-  init_tokenizer(file);
+/* A closing brace followed by an else does not end the if statement. */
+static bool followed_by_else(source_t *source, size_t i) {
+  const char *text = source->text;
+  while (i < source->size) {
+    if (text[i] == ' ' || text[i] == '\t' || text[i] == '\n' || text[i] == '\r') {
+      i++;
+    } else if (text[i] == '/' && i + 1 < source->size && text[i + 1] == '/') {
+      while (i < source->size && text[i] != '\n') {
+        i++;
+      }
+    } else {
+      break;
+    }
+  }
+  return source->size - i >= 4 && strncmp(text + i, "else", 4) == 0;
+}
+
+static void add_chunk(source_t *source, size_t begin, size_t end, position_t start) {
+  int count = source->chunk_count++;
+  if ((count & (count - 1)) == 0) { // Grow at powers of two
+    source->chunks = (chunk_t *) realloc(source->chunks,
+        sizeof(chunk_t) * (count ? count * 2 : 1));
+  }
+  chunk_t *chunk = &source->chunks[count];
+  chunk->begin = begin;
+  chunk->end = end;
+  chunk->start = start;
+  chunk->tokens = NULL;
+  chunk->token_count = 0;
+}
+
+/* Returns the series of tokens in the source, tokenizing the chunks in
+ * parallel. An additional token is added at the end, the PROGRAM_END_TOK. */
+token_t *tokenize(source_t *source, int threads) {
+  for (int i = 0; i < source->chunk_count; i++) {
+    list_init(&source->chunks[i].messages);
+  }
+  pool_run(threads, source->chunk_count, tokenize_task, source);
+  for (int i = 0; i < source->chunk_count; i++) {
+    errors_append(&source->chunks[i].messages);
+  }
+
+  if (source->chunk_count == 1) {
+    source->tokens = source->chunks[0].tokens;
+    return source->tokens;
+  }
+
+  // Join the chunks, keeping only the PROGRAM_END_TOK of the last one.
+  int count = 1;
+  for (int i = 0; i < source->chunk_count; i++) {
+    count += source->chunks[i].token_count - 1;
+  }
+  source->tokens = (token_t *) malloc(sizeof(token_t) * count);
+  token_t *next = source->tokens;
+  for (int i = 0; i < source->chunk_count; i++) {
+    chunk_t *chunk = &source->chunks[i];
+    int copied = chunk->token_count - (i + 1 < source->chunk_count ? 1 : 0);
+    memcpy(next, chunk->tokens, sizeof(token_t) * copied);
+    next += copied;
+  }
+  return source->tokens;
+}
+
+static void tokenize_task(int i, int worker, void *data) {
+  source_t *source = (source_t *) data;
+  chunk_t *chunk = &source->chunks[i];
+  double start = report_time();
+  errors_redirect(&chunk->messages);
+  tokenize_chunk(source, chunk);
+  errors_redirect(NULL);
+  report_span("chunk", i, "lexer", worker, start);
+}
+
+static void tokenize_chunk(source_t *source, chunk_t *chunk) {
+  init_tokenizer(source->text + chunk->begin, source->text + chunk->end, chunk->start);
+
+  int capacity = 256;
+  token_t *tokens = (token_t *) malloc(sizeof(token_t) * capacity);
+  int count = 0;
+  token_t token;
 
-  token_t *tokens = (token_t *) malloc(sizeof(token_t) * MAX_TOKENS);
-  int i = 0;
-  int token_count = 0;
-  
   do {
-    tokens[i] = next_token();
-    if (tokens[i].type != INVALID_TOK) token_count++;
-  } while (tokens[i++].type != PROGRAM_END_TOK);
-
-  token_t *ret = (token_t *) malloc(sizeof(token_t) * token_count);
-  int c = 0;
-  for (int j = 0; j < i; j++) {
-    if (tokens[j].type != INVALID_TOK) {
-      ret[c++] = tokens[j];
+    token = next_token();
+    if (token.type == INVALID_TOK) {
+      continue;
     }
-  }
-  free(tokens);
+    if (count == capacity) {
+      capacity *= 2;
+      tokens = (token_t *) realloc(tokens, sizeof(token_t) * capacity);
+    }
+    tokens[count++] = token;
+  } while (token.type != PROGRAM_END_TOK);
 
-  return ret;
+  chunk->tokens = tokens;
+  chunk->token_count = count;
 }
 
-/* Consumes a character from the input file, and parses the token starting at
+/* Consumes a character from the input, and parses the token starting at
  * that character. It may consumer more characters during this process, if the
  * token consists of more than one characters. */
 token_t next_token() {
@@ -67,7 +216,9 @@ token_t next_token() {
   skip_whitespace();
 
   if (is_alphabetic(next_char)) {
-    token = create_ident_or_keyword_token(consume_string());
+    int length;
+    const char *str = consume_string(&length);
+    token = create_ident_or_keyword_token(str, length);
     // We don't need to consume a char, consume_string has already done that.
   }
   else if (is_digit(next_char)) {
@@ -190,7 +341,7 @@ static int consume_int_literal(void) {
   return val;
 }
 
-/* Takes a single char from the input file and stores it in next_char. */
+/* Takes a single char from the input and stores it in next_char. */
 static void consume_char(void) {
   if (next_char == '\n') {
     line++;
@@ -199,7 +350,7 @@ static void consume_char(void) {
     character++;
   }
 
-  next_char = fgetc(input);
+  next_char = input < input_end ? (unsigned char) *input++ : EOF;
 }
 
 /* Skips all whitespace. When called, next_char must be a whitespace character,
@@ -212,15 +363,13 @@ static void skip_whitespace(void) {
 }
 
 static void skip_line() {
-  while (next_char != '\n') {
+  while (next_char != '\n' && next_char != EOF) {
     consume_char();
   }
 }
 
-static char peek() {
-  char c = fgetc(input);
-  ungetc(c, input);
-  return c;
+static int peek() {
+  return input < input_end ? (unsigned char) *input : EOF;
 }
 
 /* Returns true if the char is in a-z, A-Z or an underscore (_). */
@@ -232,37 +381,42 @@ static bool is_alphanumeric(char c) {
   return is_alphabetic(c) || is_digit(c);
 }
 
-static char *consume_string(void) {
-  char *str = (char *) malloc(sizeof(char) * MAX_STRING_SIZE);
-  int i = 0;
+/* Consumes an identifier or a keyword. Returns where it starts in the input,
+ * and stores its length. */
+static const char *consume_string(int *length) {
+  const char *str = input - 1; // next_char was read from there
+  *length = 0;
   while (is_alphanumeric(next_char)) {
-    str[i++] = next_char;
+    (*length)++;
     consume_char();
   }
-  str[i] = 0; /* End of string */
   return str;
 }
 
-static token_t create_ident_or_keyword_token(char *str) {
-  if (strcmp("return", str) == 0) {
-    free(str); /* We don't need the string anymore. */
-    return create_token(RETURN_TOK);
-  } else if (strcmp("if", str) == 0) {
-    free(str);
-    return create_token(IF_TOK);
-  } else if (strcmp("while", str) == 0) {
-    free(str);
-    return create_token(WHILE_TOK);
-  } else if (strcmp("for", str) == 0) {
-    free(str);
-    return create_token(FOR_TOK);
-  } else if (strcmp("else", str) == 0) {
-    free(str);
-    return create_token(ELSE_TOK);
-  } else {
-    /* It's not a reserved keyword, so it's an identifier. */
-    return create_identifier_token(str);
+static token_t create_ident_or_keyword_token(const char *str, int length) {
+  static const struct {
+    const char *word;
+    token_type_t type;
+  } keywords[] = {
+    {"return", RETURN_TOK},
+    {"if", IF_TOK},
+    {"while", WHILE_TOK},
+    {"for", FOR_TOK},
+    {"else", ELSE_TOK},
+    {"inline", INLINE_TOK}
+  };
+
+  for (size_t i = 0; i < sizeof(keywords) / sizeof(keywords[0]); i++) {
+    if ((int) strlen(keywords[i].word) == length && memcmp(keywords[i].word, str, length) == 0) {
+      return create_token(keywords[i].type);
+    }
   }
+
+  /* It's not a reserved keyword, so it's an identifier. */
+  char *name = (char *) arena_alloc(length + 1);
+  memcpy(name, str, length);
+  name[length] = 0;
+  return create_identifier_token(name);
 }
 
 static token_t create_identifier_token(char *str) {
@@ -272,10 +426,10 @@ static token_t create_identifier_token(char *str) {
   return token;
 }
 
-static void init_tokenizer(FILE *file) {
-  input = file;
-  next_char = 0;
-  line = 1;
-  character = 1;
-  consume_char();
+static void init_tokenizer(const char *begin, const char *end, position_t start) {
+  input = begin;
+  input_end = end;
+  line = start.line;
+  character = start.character;
+  next_char = input < input_end ? (unsigned char) *input++ : EOF;
 }
@@ -2,6 +2,8 @@
 #define LEXER_H
 
 #include <stdio.h>
+#include <stddef.h>
+#include "list.h"
 
 typedef enum {
   PROGRAM_END_TOK,
@@ -20,6 +22,7 @@ typedef enum {
   WHILE_TOK,
   FOR_TOK,
   ELSE_TOK,
+  INLINE_TOK,
   IDENT_TOK,
   SCOL_TOK,
   ASSIGN_TOK,
@@ -44,6 +47,26 @@ typedef struct token {
   };
 } token_t;
 
-token_t *tokenize(FILE *);
+/* A part of the input that holds whole top-level statements, so that it can be
+ * tokenized and parsed on its own. */
+typedef struct {
+  size_t begin, end; // The characters [begin, end) of the input
+  position_t start; // The position of the first character
+  token_t *tokens; // Ending with a PROGRAM_END_TOK
+  int token_count;
+  list_t messages;
+} chunk_t;
+
+typedef struct {
+  const char *text;
+  size_t size;
+  chunk_t *chunks;
+  int chunk_count;
+  token_t *tokens; // The tokens of all chunks, ending with a PROGRAM_END_TOK
+} source_t;
+
+source_t *create_source(const char *, size_t, int);
+token_t *tokenize(source_t *, int);
+void free_source(source_t *);
 
 #endif
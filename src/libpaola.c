@@ -0,0 +1,271 @@
+#include <stdlib.h>
+#include <string.h>
+#include "libpaola.h"
+#include "context.h"
+#include "gen.h"
+#include "lexer.h"
+#include "parser.h"
+#include "semcheck.h"
+#include "passes.h"
+#include "elfobj.h"
+#include "jit.h"
+#include "bytecode.h"
+#include "interp.h"
+#include "errors.h"
+#include "report.h"
+#include "utils.h"
+
+static paola_status_t compile(const char *, size_t);
+static paola_status_t run(int *);
+static void free_program(void);
+
+// The context of the call the thread is running, if any.
+_Thread_local paola_ctx_t *context;
+
+paola_ctx_t *paola_create(const paola_options_t *options) {
+  paola_ctx_t *ctx = (paola_ctx_t *) calloc(1, sizeof(paola_ctx_t));
+  ctx->options = *options;
+  if (ctx->options.jobs < 1) {
+    ctx->options.jobs = 1;
+  }
+  arena_init(&ctx->arena);
+  list_init(&ctx->messages);
+  outbuf_init_memory(&ctx->output);
+  outbuf_init_memory(&ctx->index);
+  report_init(&ctx->report);
+  return ctx;
+}
+
+void paola_destroy(paola_ctx_t *ctx) {
+  paola_ctx_t *caller = context;
+  context = ctx;
+  errors_init();
+  free_program();
+  context = caller;
+
+  arena_destroy(&ctx->arena);
+  free(ctx->message_text);
+  free(ctx->remark_text);
+  free(ctx->functions);
+  outbuf_free(&ctx->output);
+  outbuf_free(&ctx->index);
+  free(ctx->previous_index);
+  free(ctx->index_entries);
+  free(ctx->profile);
+  report_destroy(&ctx->report);
+  free(ctx);
+}
+
+/* Compiles the program in the buffer. The output, if there is any, is kept in
+ * the context until the next compilation, which also reuses the memory of this
+ * one. */
+paola_status_t paola_compile(paola_ctx_t *ctx, const char *text, size_t size) {
+  paola_ctx_t *caller = context;
+  context = ctx;
+  paola_status_t status = compile(text, size);
+  context = caller;
+  return status;
+}
+
+/* Runs the program of the last successful compilation, if it was compiled to
+ * be run, and stores the status main returns. */
+paola_status_t paola_run(paola_ctx_t *ctx, int *status) {
+  paola_ctx_t *caller = context;
+  context = ctx;
+  paola_status_t result = run(status);
+  context = caller;
+  return result;
+}
+
+const char *paola_output(paola_ctx_t *ctx, size_t *size) {
+  *size = ctx->output.size;
+  return ctx->output.data;
+}
+
+/* Returns the index of the functions generated by the last compilation, if it
+ * was an incremental one. Given to paola_set_index before compiling a changed
+ * version of the program, it lets the functions that did not change be copied
+ * instead of generated again. Empty for objects. */
+const char *paola_index(paola_ctx_t *ctx, size_t *size) {
+  *size = ctx->index.size;
+  return ctx->index.data;
+}
+
+/* Sets the index that the next compilations take functions from. */
+void paola_set_index(paola_ctx_t *ctx, const char *index, size_t size) {
+  free(ctx->previous_index);
+  ctx->previous_index = (char *) malloc(size + 1);
+  memcpy(ctx->previous_index, index, size);
+  ctx->previous_index_size = size;
+}
+
+/* Sets the profile that the next compilations are optimized with, as written
+ * by a program compiled with profile_generate. */
+void paola_set_profile(paola_ctx_t *ctx, const char *profile, size_t size) {
+  free(ctx->profile);
+  ctx->profile = (char *) malloc(size + 1);
+  memcpy(ctx->profile, profile, size);
+  ctx->profile[size] = '\0';
+}
+
+/* Returns the messages of the last compilation or run. */
+const char *paola_messages(paola_ctx_t *ctx) {
+  paola_ctx_t *caller = context;
+  context = ctx;
+  free(ctx->message_text);
+  ctx->message_text = messages_to_str();
+  context = caller;
+  return ctx->message_text;
+}
+
+/* Returns the remarks of the last compilation as a JSON document, for tools
+ * that collect them. They are also among its messages. */
+const char *paola_remarks(paola_ctx_t *ctx) {
+  paola_ctx_t *caller = context;
+  context = ctx;
+  free(ctx->remark_text);
+  ctx->remark_text = remarks_to_json();
+  context = caller;
+  return ctx->remark_text;
+}
+
+/* Returns the report of the last compilation, empty unless the options ask for
+ * one. */
+const char *paola_report(paola_ctx_t *ctx) {
+  paola_ctx_t *caller = context;
+  context = ctx;
+  const char *text = report_text();
+  context = caller;
+  return text;
+}
+
+/* Returns the phases of the last compilation, and the chunks and functions
+ * they handled, as a Chrome trace. */
+const char *paola_trace(paola_ctx_t *ctx) {
+  paola_ctx_t *caller = context;
+  context = ctx;
+  const char *trace = report_trace();
+  context = caller;
+  return trace;
+}
+
+static paola_status_t compile(const char *text, size_t size) {
+  paola_options_t *options = &context->options;
+  errors_init();
+  free_program();
+  arena_reset(&context->arena);
+  context->output.size = 0;
+  context->index.size = 0;
+  report_start(options->report);
+
+  /* Lexer: Produce a list of tokens from the input. */
+  phase_begin(PHASE_LEXER);
+  source_t *source = create_source(text, size, options->jobs);
+  token_t *tokens = tokenize(source, options->jobs);
+  phase_end(PHASE_LEXER);
+  report_tokens(tokens);
+  if (error_count() > 0) {
+    free_source(source);
+    return PAOLA_LEXER_ERR;
+  }
+
+  if (options->print_tokens) {
+    print_tokens(tokens);
+  }
+
+  /* Parser: Produce an Abstract Syntax Tree from the list of tokens. */
+  phase_begin(PHASE_PARSER);
+  stat_ast_t *ast = parse(source, options->jobs);
+  phase_end(PHASE_PARSER);
+  free_source(source);
+  if (error_count() > 0) {
+    return PAOLA_PARSE_ERR;
+  }
+
+  report_ast(ast);
+  if (options->print_ast) {
+    print_stat_ast(ast);
+  }
+
+  /* Semantic checker: Check the AST for semantic errors. */
+  phase_begin(PHASE_SEMCHECK);
+  semcheck(ast, options->jobs);
+  phase_end(PHASE_SEMCHECK);
+  if (error_count() > 0) {
+    return PAOLA_SEM_ERR;
+  }
+
+  /* Optimization: Rewrite the checked AST into a cheaper equivalent, with the
+   * passes the options leave on. */
+  run_passes(ast);
+
+  /* Code generation: Produce x86 assembly code, an object, or bytecode from the AST. */
+  phase_begin(PHASE_CODEGEN);
+  switch (options->output) {
+    case PAOLA_ASSEMBLY:
+      generate_code(ast, options->jobs);
+      break;
+    case PAOLA_OBJECT: {
+      x86_obj_t *obj = generate_object(ast);
+      if (obj && !elf_write(obj, &context->output)) {
+        error(0, "Could not write the output file.");
+      }
+      if (obj) {
+        x86_free(obj);
+      }
+      break;
+    }
+    case PAOLA_RUN:
+      context->executable = generate_object(ast);
+      break;
+    case PAOLA_INTERPRET:
+    case PAOLA_INTERPRET_AST:
+      context->program = lower_program(ast);
+      bc_check(context->program);
+      break;
+  }
+  phase_end(PHASE_CODEGEN);
+  return error_count() > 0 ? PAOLA_GEN_ERR : PAOLA_OK;
+}
+
+static paola_status_t run(int *status) {
+  errors_init();
+  switch (context->options.output) {
+    case PAOLA_RUN:
+      /* JIT: Assemble the program in memory and run it. */
+      if (context->executable && jit_run(context->executable, status)) {
+        return PAOLA_OK;
+      }
+      break;
+    case PAOLA_INTERPRET:
+      /* Interpreter: Run the bytecode of the program. */
+      if (context->program) {
+        *status = (int) interpret(context->program, context->program->main);
+        return PAOLA_OK;
+      }
+      break;
+    case PAOLA_INTERPRET_AST:
+      if (context->program) {
+        *status = (int) interpret_ast(context->program, context->program->main);
+        return PAOLA_OK;
+      }
+      break;
+    default:
+      break;
+  }
+  if (error_count() == 0) {
+    error(0, "The program was not compiled to be run.");
+  }
+  return PAOLA_GEN_ERR;
+}
+
+static void free_program(void) {
+  if (context->executable) {
+    x86_free(context->executable);
+    context->executable = 0;
+  }
+  if (context->program) {
+    bc_free(context->program);
+    context->program = 0;
+  }
+}
@@ -0,0 +1,86 @@
+#ifndef LIBPAOLA_H
+#define LIBPAOLA_H
+#include <stdbool.h>
+#include <stddef.h>
+
+/* The compiler as a library. A context holds all of the state of a
+ * compilation, and compiles a program from a buffer into a buffer. Contexts
+ * are independent of each other, so different threads can compile with
+ * different contexts at the same time. A context must not be used by more than
+ * one thread at a time. */
+
+#define PAOLA_VERSION "0.1"
+
+typedef struct paola_ctx paola_ctx_t;
+
+// Results of compiling: different codes denote different error types, and
+// PAOLA_OK indicates success. The compiler exits with these codes.
+typedef enum {
+  PAOLA_OK,
+  PAOLA_OTHER_ERR,
+  PAOLA_LEXER_ERR,
+  PAOLA_PARSE_ERR,
+  PAOLA_SEM_ERR,
+  PAOLA_GEN_ERR
+} paola_status_t;
+
+typedef enum {
+  PAOLA_ASSEMBLY,      // x86-64 assembly text
+  PAOLA_OBJECT,        // An ELF object file
+  PAOLA_RUN,           // No output, paola_run runs the program in memory
+  PAOLA_INTERPRET,     // No output, paola_run runs the program in the bytecode interpreter
+  PAOLA_INTERPRET_AST  // No output, paola_run walks the AST of the program
+} paola_output_t;
+
+// Kinds of optimization remarks, combined in the remarks option.
+typedef enum {
+  PAOLA_REMARK_PASSED = 1,  // Optimizations that were made
+  PAOLA_REMARK_MISSED = 2,  // Optimizations that could not be made, and why
+  PAOLA_REMARK_ANALYSIS = 4 // What the compiler found out about the code
+} paola_remark_t;
+
+// Optimization passes, in the order they run. The disabled_passes option
+// turns a pass off with the bit 1 << pass.
+typedef enum {
+  PAOLA_PASS_CTFE,     // Folds calls to pure functions into their value
+  PAOLA_PASS_DEADCODE, // Removes code that never runs
+  PAOLA_PASS_LOOPOPT,  // Strength reduces induction variables
+  PAOLA_PASS_INLINE,   // Expands calls to small functions in place
+  PAOLA_PASS_TAILCALL, // Turns tail calls into jumps, in the code generator
+  PAOLA_PASS_UNROLL,   // Unrolls the loops the profile found hot, in the code generator
+  PAOLA_PASS_COUNT
+} paola_pass_t;
+
+typedef struct {
+  paola_output_t output;
+  int jobs; // Threads compiling the program
+  bool print_tokens, print_ast; // Print the tokens or the AST to stdout
+  bool incremental; // Index the generated functions, see paola_index
+  bool report; // Measure the phases, see paola_report and paola_trace
+  int remarks; // The kinds of remarks given with the messages, see paola_remarks
+  bool instrument; // Profile the functions of assembly and objects, see gen.c
+  // Count the branches, loops and calls of the program into this file, see pgo.c
+  const char *profile_generate;
+  bool frame_pointer; // Keep the caller's rbp in every frame, see gen.c
+  unsigned disabled_passes; // The passes that do not run, see paola_pass_t
+} paola_options_t;
+
+paola_ctx_t *paola_create(const paola_options_t *);
+void paola_destroy(paola_ctx_t *);
+
+paola_status_t paola_compile(paola_ctx_t *, const char *, size_t);
+paola_status_t paola_run(paola_ctx_t *, int *);
+
+const char *paola_output(paola_ctx_t *, size_t *);
+const char *paola_index(paola_ctx_t *, size_t *);
+void paola_set_index(paola_ctx_t *, const char *, size_t);
+void paola_set_profile(paola_ctx_t *, const char *, size_t);
+const char *paola_messages(paola_ctx_t *);
+const char *paola_report(paola_ctx_t *);
+const char *paola_trace(paola_ctx_t *);
+const char *paola_remarks(paola_ctx_t *);
+
+const char *paola_pass_name(paola_pass_t);
+unsigned paola_disabled_passes(int);
+
+#endif
@@ -0,0 +1,823 @@
+#pragma GCC diagnostic ignored "-Wwrite-strings"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "loopopt.h"
+#include "arena.h"
+#include "symtable.h"
+#include "errors.h"
+
+/* Induction variable strength reduction.
+ *
+ * A basic induction variable is a variable v whose only assignment in a loop is
+ * a top-level statement v = v + c (or v = v - c) for a constant c, so that it
+ * runs exactly once per iteration. A derived induction variable is a product
+ * v * k, where k is a literal or a variable that the loop does not modify.
+ *
+ * Every derived product is replaced by a new variable t, which is set to v * k
+ * before the loop and advanced by c * k right after v is updated. If v is then
+ * only read by its own update and by the exit test, and nothing after the loop
+ * reads it, the exit test is rewritten in terms of t and v is removed from the
+ * loop altogether. */
+
+#define MAX_IVS 16
+#define MAX_DERIVED 32
+
+typedef struct {
+  symbol_t *symbol;
+  int step;           // The constant added to the variable on every iteration.
+  stat_ast_t *update; // The EXPR_STAT holding v = v + c, 0 until normalized.
+  bool from_iter;     // Whether the update is the iter expression of a FOR_STAT.
+} basic_iv_t;
+
+typedef struct {
+  basic_iv_t *base;
+  expr_ast_t *factor; // INT_LIT or VAR_REF to a loop-invariant variable.
+  symbol_t *temp;     // The variable that holds base * factor.
+  stat_ast_t *init;   // The statement initializing temp before the loop.
+} derived_iv_t;
+
+typedef struct {
+  stat_ast_t *loop;
+  stat_ast_t *pre; // Setup code, inserted in front of the loop when done.
+  stat_ast_t *init; // The init expression of a FOR_STAT, moved into pre.
+  bool has_call;
+  basic_iv_t ivs[MAX_IVS];
+  int iv_count;
+  derived_iv_t derived[MAX_DERIVED];
+  int derived_count;
+} loop_info_t;
+
+typedef struct {
+  loop_info_t *info;
+  bool found;
+} derived_search_t;
+
+typedef struct {
+  symbol_t *symbol;
+  int count;
+} symbol_count_t;
+
+/* Visitors receive the address of each expression so that they can replace it.
+ * Returning true stops the walk from descending into the expression. */
+typedef bool (*expr_visitor_t)(expr_ast_t **, void *);
+
+static void optimize_stat(stat_ast_t *);
+static stat_ast_t *wrap_loop(stat_ast_t *);
+static void optimize_loop(stat_ast_t *);
+static void find_basic_ivs(loop_info_t *);
+static void try_basic_iv(loop_info_t *, expr_ast_t *, stat_ast_t *);
+static void normalize_loop(loop_info_t *);
+static void add_step(loop_info_t *, derived_iv_t *);
+static void try_eliminate(loop_info_t *, basic_iv_t *);
+static bool rewrite_exit_test(loop_info_t *, basic_iv_t *, derived_iv_t *);
+
+static void visit_stat(stat_ast_t *, expr_visitor_t, void *);
+static void visit_loop(stat_ast_t *, expr_visitor_t, void *);
+static void visit_expr(expr_ast_t **, expr_visitor_t, void *);
+static bool find_derived_visitor(expr_ast_t **, void *);
+static bool replace_derived_visitor(expr_ast_t **, void *);
+static bool has_call_visitor(expr_ast_t **, void *);
+
+static basic_iv_t *match_derived(loop_info_t *, expr_ast_t *, expr_ast_t **);
+static derived_iv_t *find_derived(loop_info_t *, basic_iv_t *, expr_ast_t *);
+static basic_iv_t *find_iv(loop_info_t *, symbol_t *);
+static bool is_invariant(loop_info_t *, expr_ast_t *);
+static bool is_var(expr_ast_t *, symbol_t *);
+static bool same_factor(expr_ast_t *, expr_ast_t *);
+static int count_reads(stat_ast_t *, symbol_t *);
+static int count_assigns(stat_ast_t *, symbol_t *);
+static bool count_reads_visitor(expr_ast_t **, void *);
+static bool count_assigns_visitor(expr_ast_t **, void *);
+static bool add_local_reads_visitor(expr_ast_t **, void *);
+static void add_local_reads(stat_ast_t *, int);
+static void mark_locals(stat_ast_t *, int);
+static bool is_local(symbol_t *);
+static operator_t mirror_op(operator_t);
+
+/* AST constructors for the code this pass introduces. */
+static expr_ast_t *create_expr(expr_ast_type_t, position_t);
+static expr_ast_t *create_int_lit(int, position_t);
+static expr_ast_t *create_var_ref(symbol_t *, position_t);
+static expr_ast_t *create_binop(operator_t, expr_ast_t *, expr_ast_t *);
+static expr_ast_t *create_mul(expr_ast_t *, expr_ast_t *);
+static bool fold_mul(int, int, int *);
+static expr_ast_t *copy_operand(expr_ast_t *);
+static stat_ast_t *create_stat(stat_ast_type_t, position_t);
+static stat_ast_t *create_expr_stat(expr_ast_t *);
+static stat_ast_t *create_assign_stat(symbol_t *, expr_ast_t *);
+static stat_ast_t *create_block(position_t);
+static symbol_t *create_temp(stat_ast_t *, position_t);
+
+// The function whose body is currently being optimized, and its name.
+static _Thread_local stat_ast_t *current_function;
+static _Thread_local const char *function_name;
+static _Thread_local int next_temp;
+
+void optimize_loops(stat_ast_t *program) {
+  next_temp = 0;
+  for (list_elem_t *e = list_begin(&program->stats); e != list_end(&program->stats);
+      e = list_next(e)) {
+    stat_ast_t *stat = list_entry(e, stat_ast_t, block_elem);
+    if (stat->type == DECL_STAT && stat->is_func && stat->func_body) {
+      current_function = stat->func_body;
+      function_name = stat->target;
+      mark_locals(current_function, 0);
+      add_local_reads(current_function, 1);
+      optimize_stat(stat->func_body);
+      mark_locals(current_function, -1);
+    }
+  }
+}
+
+/* Optimizes the loops nested in the statement, innermost first. Each loop must
+ * be in a block, as its setup code is inserted in front of it. */
+static void optimize_stat(stat_ast_t *stat) {
+  switch (stat->type) {
+    case IF_STAT:
+      stat->tstat = wrap_loop(stat->tstat);
+      optimize_stat(stat->tstat);
+      if (stat->fstat) {
+        stat->fstat = wrap_loop(stat->fstat);
+        optimize_stat(stat->fstat);
+      }
+      break;
+    case WHILE_STAT:
+    case FOR_STAT:
+      stat->body = wrap_loop(stat->body);
+      optimize_stat(stat->body);
+      optimize_loop(stat);
+      break;
+    case BLOCK_STAT:
+      for (list_elem_t *e = list_begin(&stat->stats); e != list_end(&stat->stats);
+          e = list_next(e)) {
+        optimize_stat(list_entry(e, stat_ast_t, block_elem));
+      }
+      break;
+    case DECL_STAT:
+      if (stat->is_func && stat->func_body) {
+        optimize_stat(stat->func_body);
+      }
+      break;
+    default:
+      break;
+  }
+}
+
+/* Puts a loop that is the direct child of another statement in a block. */
+static stat_ast_t *wrap_loop(stat_ast_t *stat) {
+  if (stat->type != WHILE_STAT && stat->type != FOR_STAT) {
+    return stat;
+  }
+
+  stat_ast_t *block = create_block(stat->pos);
+  list_push_back(&block->stats, &stat->block_elem);
+  return block;
+}
+
+static void optimize_loop(stat_ast_t *loop) {
+  loop_info_t info;
+  info.loop = loop;
+  info.pre = 0;
+  info.init = 0;
+  info.iv_count = 0;
+  info.derived_count = 0;
+  info.has_call = false;
+  visit_loop(info.loop, has_call_visitor, &info.has_call);
+
+  find_basic_ivs(&info);
+  if (info.iv_count == 0) {
+    return;
+  }
+
+  derived_search_t search = { &info, false };
+  visit_loop(info.loop, find_derived_visitor, &search);
+  if (!search.found) {
+    return;
+  }
+
+  // Until the loop is done, the counts leave out the loop and its setup code.
+  add_local_reads(loop, -1);
+  normalize_loop(&info);
+  visit_loop(info.loop, replace_derived_visitor, &info);
+  for (int i = 0; i < info.derived_count; i++) {
+    add_step(&info, &info.derived[i]);
+  }
+  for (int i = 0; i < info.iv_count; i++) {
+    try_eliminate(&info, &info.ivs[i]);
+  }
+  add_local_reads(loop, 1);
+  add_local_reads(info.pre, 1);
+
+  list_splice(&loop->block_elem, list_begin(&info.pre->stats), list_end(&info.pre->stats));
+}
+
+/* Basic induction variables are updated either by the iter expression of a
+ * FOR_STAT or by an expression statement directly in the loop body. */
+static void find_basic_ivs(loop_info_t *info) {
+  stat_ast_t *loop = info->loop;
+  if (loop->type == FOR_STAT) {
+    try_basic_iv(info, loop->iter, 0);
+  }
+
+  if (loop->body->type == BLOCK_STAT) {
+    list_t *stats = &loop->body->stats;
+    for (list_elem_t *e = list_begin(stats); e != list_end(stats); e = list_next(e)) {
+      stat_ast_t *s = list_entry(e, stat_ast_t, block_elem);
+      if (s->type == EXPR_STAT) {
+        try_basic_iv(info, s->expr, s);
+      }
+    }
+  }
+}
+
+static void try_basic_iv(loop_info_t *info, expr_ast_t *expr, stat_ast_t *stat) {
+  if (info->iv_count == MAX_IVS || expr->type != BIN_OP || expr->op != ASSIGN
+      || expr->left->type != VAR_REF) {
+    return;
+  }
+
+  symbol_t *symbol = expr->left->symbol;
+  expr_ast_t *value = expr->right;
+  if (value->type != BIN_OP || (value->op != ADD && value->op != SUBS)) {
+    return;
+  }
+
+  int step;
+  if (is_var(value->left, symbol) && value->right->type == INT_LIT) {
+    step = value->op == ADD ? value->right->ival : -value->right->ival;
+  } else if (value->op == ADD && value->left->type == INT_LIT
+      && is_var(value->right, symbol)) {
+    step = value->left->ival;
+  } else {
+    return;
+  }
+
+  if (find_iv(info, symbol) || (info->has_call && !is_local(symbol))) {
+    return;
+  }
+
+  if (count_assigns(info->loop, symbol) != 1) {
+    return;
+  }
+
+  basic_iv_t *iv = &info->ivs[info->iv_count++];
+  iv->symbol = symbol;
+  iv->step = step;
+  iv->update = stat;
+  iv->from_iter = (stat == 0);
+  remark(PAOLA_REMARK_ANALYSIS, "loopopt", &expr->pos, function_name,
+      "%s is an induction variable with step %d", symbol->name, step);
+}
+
+/* Turns a FOR_STAT into the equivalent WHILE_STAT, with the init expression
+ * moved in front of the loop and the iter expression appended to the body,
+ * so that every induction variable update is a statement of the body. */
+static void normalize_loop(loop_info_t *info) {
+  stat_ast_t *loop = info->loop;
+  info->pre = create_block(loop->pos);
+
+  if (loop->body->type != BLOCK_STAT) {
+    stat_ast_t *body = create_block(loop->body->pos);
+    list_push_back(&body->stats, &loop->body->block_elem);
+    loop->body = body;
+  }
+
+  if (loop->type == FOR_STAT) {
+    info->init = create_expr_stat(loop->init);
+    list_push_back(&info->pre->stats, &info->init->block_elem);
+
+    stat_ast_t *iter = create_expr_stat(loop->iter);
+    list_push_back(&loop->body->stats, &iter->block_elem);
+    for (int i = 0; i < info->iv_count; i++) {
+      if (info->ivs[i].from_iter) {
+        info->ivs[i].update = iter;
+      }
+    }
+
+    loop->type = WHILE_STAT;
+  }
+}
+
+/* Advances the derived variable right after its basic variable is updated. */
+static void add_step(loop_info_t *info, derived_iv_t *derived) {
+  basic_iv_t *iv = derived->base;
+  position_t pos = iv->update->pos;
+  operator_t op;
+  expr_ast_t *amount;
+
+  int step;
+  if (derived->factor->type == INT_LIT && fold_mul(iv->step, derived->factor->ival, &step)
+      && step != INT32_MIN) {
+    op = step < 0 ? SUBS : ADD;
+    amount = create_int_lit(step < 0 ? -step : step, pos);
+  } else {
+    op = iv->step < 0 ? SUBS : ADD;
+    int abs_step = iv->step < 0 ? -iv->step : iv->step;
+    if (abs_step == 1) {
+      amount = copy_operand(derived->factor);
+    } else {
+      // Multiply once, outside the loop.
+      symbol_t *step_var = create_temp(info->pre, pos);
+      stat_ast_t *init = create_assign_stat(step_var,
+          create_mul(copy_operand(derived->factor), create_int_lit(abs_step, pos)));
+      list_push_back(&info->pre->stats, &init->block_elem);
+      amount = create_var_ref(step_var, pos);
+    }
+  }
+
+  stat_ast_t *update = create_assign_stat(derived->temp,
+      create_binop(op, create_var_ref(derived->temp, pos), amount));
+  list_insert(list_next(&iv->update->block_elem), &update->block_elem);
+}
+
+/* Removes the basic variable from the loop if nothing but its own update and
+ * the exit test reads it anymore. Only locals qualify: other functions may read
+ * a global after the loop. */
+static void try_eliminate(loop_info_t *info, basic_iv_t *iv) {
+  stat_ast_t *loop = info->loop;
+  symbol_t *symbol = iv->symbol;
+  if (!is_local(symbol)) {
+    return;
+  }
+
+  symbol_count_t cond_reads = { symbol, 0 };
+  visit_expr(&loop->cond, count_reads_visitor, &cond_reads);
+  int loop_reads = count_reads(loop, symbol);
+  if (loop_reads != cond_reads.count + 1) {
+    return;
+  }
+
+  // Anything else reading the variable (e.g. after the loop) is an extra read.
+  if (symbol->local_reads != 0) {
+    return;
+  }
+
+  derived_iv_t *derived = 0;
+  for (int i = 0; i < info->derived_count; i++) {
+    derived_iv_t *d = &info->derived[i];
+    if (d->base == iv && d->factor->type == INT_LIT && d->factor->ival != 0) {
+      derived = d;
+      break;
+    }
+  }
+
+  if (cond_reads.count > 0 && (!derived || !rewrite_exit_test(info, iv, derived))) {
+    return;
+  }
+
+  list_remove(&iv->update->block_elem);
+  remark(PAOLA_REMARK_PASSED, "loopopt", &iv->update->pos, function_name,
+      "removed induction variable %s from the loop", symbol->name);
+
+  // With a constant start value, the derived variables can start from a
+  // constant as well and the initialization of the counter goes away.
+  expr_ast_t *init = info->init ? info->init->expr : 0;
+  if (init && init->type == BIN_OP && init->op == ASSIGN && is_var(init->left, symbol)
+      && init->right->type == INT_LIT) {
+    for (int i = 0; i < info->derived_count; i++) {
+      derived_iv_t *d = &info->derived[i];
+      if (d->base == iv) {
+        d->init->expr->right = create_mul(create_int_lit(init->right->ival, init->pos),
+            copy_operand(d->factor));
+      }
+    }
+    list_remove(&info->init->block_elem);
+    info->init = 0;
+  }
+}
+
+/* Rewrites an exit test on the basic variable v into a test on the derived
+ * variable t = v * k, where k is a non-zero constant. */
+static bool rewrite_exit_test(loop_info_t *info, basic_iv_t *iv, derived_iv_t *derived) {
+  stat_ast_t *loop = info->loop;
+  expr_ast_t *cond = loop->cond;
+  int factor = derived->factor->ival;
+
+  if (is_var(cond, iv->symbol)) { // v != 0 iff v * k != 0
+    loop->cond = create_var_ref(derived->temp, cond->pos);
+    return true;
+  }
+
+  if (cond->type != BIN_OP) {
+    return false;
+  }
+
+  operator_t op = cond->op;
+  if (op != EQ && op != GT && op != GTE && op != LT && op != LTE) {
+    return false;
+  }
+
+  expr_ast_t *bound;
+  if (is_var(cond->left, iv->symbol) && is_invariant(info, cond->right)) {
+    bound = cond->right;
+  } else if (is_var(cond->right, iv->symbol) && is_invariant(info, cond->left)) {
+    bound = cond->left;
+    op = mirror_op(op);
+  } else {
+    return false;
+  }
+
+  if (factor < 0) {
+    op = mirror_op(op);
+  }
+
+  expr_ast_t *scaled;
+  int product;
+  if (bound->type == INT_LIT && fold_mul(bound->ival, factor, &product)) {
+    scaled = create_int_lit(product, bound->pos);
+  } else {
+    symbol_t *bound_var = create_temp(info->pre, cond->pos);
+    stat_ast_t *init = create_assign_stat(bound_var,
+        create_mul(copy_operand(bound), create_int_lit(factor, cond->pos)));
+    list_push_back(&info->pre->stats, &init->block_elem);
+    scaled = create_var_ref(bound_var, cond->pos);
+  }
+
+  loop->cond = create_binop(op, create_var_ref(derived->temp, cond->pos), scaled);
+  return true;
+}
+
+static bool find_derived_visitor(expr_ast_t **slot, void *data) {
+  derived_search_t *search = (derived_search_t *) data;
+  expr_ast_t *factor;
+  if (match_derived(search->info, *slot, &factor)) {
+    search->found = true;
+    return true;
+  }
+  return false;
+}
+
+/* Replaces v * k with the variable holding it, creating that variable and its
+ * initialization the first time the product is seen. */
+static bool replace_derived_visitor(expr_ast_t **slot, void *data) {
+  loop_info_t *info = (loop_info_t *) data;
+  expr_ast_t *expr = *slot, *factor;
+  basic_iv_t *iv = match_derived(info, expr, &factor);
+  if (!iv) {
+    return false;
+  }
+
+  derived_iv_t *derived = find_derived(info, iv, factor);
+  if (!derived) {
+    if (info->derived_count == MAX_DERIVED) {
+      remark(PAOLA_REMARK_MISSED, "loopopt", &expr->pos, function_name,
+          "could not hoist a product of %s: the loop has too many", iv->symbol->name);
+      return true;
+    }
+    if (factor->type == INT_LIT) {
+      remark(PAOLA_REMARK_PASSED, "loopopt", &expr->pos, function_name,
+          "hoisted invariant product %s * %d into an induction variable", iv->symbol->name,
+          factor->ival);
+    } else {
+      remark(PAOLA_REMARK_PASSED, "loopopt", &expr->pos, function_name,
+          "hoisted invariant product %s * %s into an induction variable", iv->symbol->name,
+          factor->symbol->name);
+    }
+
+    derived = &info->derived[info->derived_count++];
+    derived->base = iv;
+    derived->factor = factor;
+    derived->temp = create_temp(info->pre, expr->pos);
+    derived->init = create_assign_stat(derived->temp,
+        create_mul(create_var_ref(iv->symbol, expr->pos), copy_operand(factor)));
+    list_push_back(&info->pre->stats, &derived->init->block_elem);
+  }
+
+  *slot = create_var_ref(derived->temp, expr->pos);
+  return true;
+}
+
+static bool has_call_visitor(expr_ast_t **slot, void *data) {
+  if ((*slot)->type == FUNC_CALL) {
+    *(bool *) data = true;
+  }
+  return false;
+}
+
+static bool count_reads_visitor(expr_ast_t **slot, void *data) {
+  symbol_count_t *count = (symbol_count_t *) data;
+  expr_ast_t *expr = *slot;
+  if (expr->type == VAR_REF && expr->symbol == count->symbol && !expr->assign) {
+    count->count++;
+  }
+  return false;
+}
+
+static bool add_local_reads_visitor(expr_ast_t **slot, void *data) {
+  expr_ast_t *expr = *slot;
+  if (expr->type == VAR_REF && !expr->assign && expr->symbol->local_reads >= 0) {
+    expr->symbol->local_reads += *(int *) data;
+  }
+  return false;
+}
+
+static bool count_assigns_visitor(expr_ast_t **slot, void *data) {
+  symbol_count_t *count = (symbol_count_t *) data;
+  expr_ast_t *expr = *slot;
+  if (expr->type == BIN_OP && expr->op == ASSIGN && is_var(expr->left, count->symbol)) {
+    count->count++;
+  }
+  return false;
+}
+
+static void visit_expr(expr_ast_t **slot, expr_visitor_t visitor, void *data) {
+  if (!*slot || visitor(slot, data)) {
+    return;
+  }
+
+  expr_ast_t *expr = *slot;
+  if (expr->type == BIN_OP) {
+    visit_expr(&expr->left, visitor, data);
+    visit_expr(&expr->right, visitor, data);
+  }
+}
+
+static void visit_stat(stat_ast_t *stat, expr_visitor_t visitor, void *data) {
+  switch (stat->type) {
+    case RETURN_STAT:
+    case EXPR_STAT:
+      visit_expr(&stat->expr, visitor, data);
+      break;
+    case IF_STAT:
+      visit_expr(&stat->cond, visitor, data);
+      visit_stat(stat->tstat, visitor, data);
+      if (stat->fstat) {
+        visit_stat(stat->fstat, visitor, data);
+      }
+      break;
+    case FOR_STAT:
+      visit_expr(&stat->init, visitor, data);
+      visit_loop(stat, visitor, data);
+      break;
+    case WHILE_STAT:
+      visit_loop(stat, visitor, data);
+      break;
+    case BLOCK_STAT:
+      for (list_elem_t *e = list_begin(&stat->stats); e != list_end(&stat->stats);
+          e = list_next(e)) {
+        visit_stat(list_entry(e, stat_ast_t, block_elem), visitor, data);
+      }
+      break;
+    case DECL_STAT:
+      if (stat->is_func) {
+        if (stat->func_body) {
+          visit_stat(stat->func_body, visitor, data);
+        }
+      } else if (stat->value) {
+        visit_expr(&stat->value, visitor, data);
+      }
+      break;
+    default:
+      break;
+  }
+}
+
+/* Visits the parts of a loop that run on every iteration, which excludes the
+ * init expression of a FOR_STAT. */
+static void visit_loop(stat_ast_t *loop, expr_visitor_t visitor, void *data) {
+  visit_expr(&loop->cond, visitor, data);
+  if (loop->type == FOR_STAT) {
+    visit_expr(&loop->iter, visitor, data);
+  }
+  visit_stat(loop->body, visitor, data);
+}
+
+/* If expr is v * k (or k * v) for a basic induction variable v and an invariant
+ * k, returns v's entry and stores k in factor. */
+static basic_iv_t *match_derived(loop_info_t *info, expr_ast_t *expr, expr_ast_t **factor) {
+  if (expr->type != BIN_OP || expr->op != MUL) {
+    return 0;
+  }
+
+  basic_iv_t *iv;
+  if (expr->left->type == VAR_REF && (iv = find_iv(info, expr->left->symbol))
+      && is_invariant(info, expr->right)) {
+    *factor = expr->right;
+    return iv;
+  }
+  if (expr->right->type == VAR_REF && (iv = find_iv(info, expr->right->symbol))
+      && is_invariant(info, expr->left)) {
+    *factor = expr->left;
+    return iv;
+  }
+  return 0;
+}
+
+static derived_iv_t *find_derived(loop_info_t *info, basic_iv_t *iv, expr_ast_t *factor) {
+  for (int i = 0; i < info->derived_count; i++) {
+    if (info->derived[i].base == iv && same_factor(info->derived[i].factor, factor)) {
+      return &info->derived[i];
+    }
+  }
+  return 0;
+}
+
+static basic_iv_t *find_iv(loop_info_t *info, symbol_t *symbol) {
+  for (int i = 0; i < info->iv_count; i++) {
+    if (info->ivs[i].symbol == symbol) {
+      return &info->ivs[i];
+    }
+  }
+  return 0;
+}
+
+/* Literals are invariant, and so are variables the loop never assigns to. A
+ * variable that is not local to the function could be modified by a call. */
+static bool is_invariant(loop_info_t *info, expr_ast_t *expr) {
+  if (expr->type == INT_LIT) {
+    return true;
+  }
+  if (expr->type != VAR_REF) {
+    return false;
+  }
+  if (info->has_call && !is_local(expr->symbol)) {
+    return false;
+  }
+  return count_assigns(info->loop, expr->symbol) == 0;
+}
+
+static bool is_var(expr_ast_t *expr, symbol_t *symbol) {
+  return expr->type == VAR_REF && expr->symbol == symbol;
+}
+
+static bool same_factor(expr_ast_t *a, expr_ast_t *b) {
+  if (a->type != b->type) {
+    return false;
+  }
+  return a->type == INT_LIT ? a->ival == b->ival : a->symbol == b->symbol;
+}
+
+static int count_reads(stat_ast_t *stat, symbol_t *symbol) {
+  symbol_count_t count = { symbol, 0 };
+  visit_stat(stat, count_reads_visitor, &count);
+  return count.count;
+}
+
+/* Counts the assignments to symbol made on each iteration of the loop. */
+static int count_assigns(stat_ast_t *loop, symbol_t *symbol) {
+  symbol_count_t count = { symbol, 0 };
+  visit_loop(loop, count_assigns_visitor, &count);
+  return count.count;
+}
+
+/* Adds the reads in the statement to the counts of the locals, or subtracts
+ * them with a negative sign. */
+static void add_local_reads(stat_ast_t *stat, int sign) {
+  visit_stat(stat, add_local_reads_visitor, &sign);
+}
+
+static bool is_local(symbol_t *symbol) {
+  return symbol->local_reads >= 0;
+}
+
+/* Sets the read count of the variables the statement declares, which does not
+ * include the variables of nested functions. */
+static void mark_locals(stat_ast_t *stat, int reads) {
+  switch (stat->type) {
+    case IF_STAT:
+      mark_locals(stat->tstat, reads);
+      if (stat->fstat) {
+        mark_locals(stat->fstat, reads);
+      }
+      break;
+    case WHILE_STAT:
+    case FOR_STAT:
+      mark_locals(stat->body, reads);
+      break;
+    case BLOCK_STAT:
+      for (list_elem_t *e = list_begin(&stat->stats); e != list_end(&stat->stats);
+          e = list_next(e)) {
+        mark_locals(list_entry(e, stat_ast_t, block_elem), reads);
+      }
+      break;
+    case DECL_STAT:
+      stat->symbol->local_reads = reads;
+      break;
+    default:
+      break;
+  }
+}
+
+/* Returns op' such that a op b iff b op' a. */
+static operator_t mirror_op(operator_t op) {
+  switch (op) {
+    case LT:
+      return GT;
+    case LTE:
+      return GTE;
+    case GT:
+      return LT;
+    case GTE:
+      return LTE;
+    default:
+      return op;
+  }
+}
+
+static expr_ast_t *create_expr(expr_ast_type_t type, position_t pos) {
+  expr_ast_t *expr = (expr_ast_t *) arena_alloc(sizeof(expr_ast_t));
+  expr->type = type;
+  expr->pos = pos;
+  expr->assign = false;
+  return expr;
+}
+
+static expr_ast_t *create_int_lit(int val, position_t pos) {
+  expr_ast_t *expr = create_expr(INT_LIT, pos);
+  expr->ival = val;
+  return expr;
+}
+
+static expr_ast_t *create_var_ref(symbol_t *symbol, position_t pos) {
+  expr_ast_t *expr = create_expr(VAR_REF, pos);
+  expr->name = symbol->name;
+  expr->symbol = symbol;
+  return expr;
+}
+
+static expr_ast_t *create_binop(operator_t op, expr_ast_t *left, expr_ast_t *right) {
+  expr_ast_t *expr = create_expr(BIN_OP, left->pos);
+  expr->op = op;
+  expr->left = left;
+  expr->right = right;
+  return expr;
+}
+
+/* Creates left * right, folding it when possible. */
+static expr_ast_t *create_mul(expr_ast_t *left, expr_ast_t *right) {
+  int product;
+  if (left->type == INT_LIT && right->type == INT_LIT
+      && fold_mul(left->ival, right->ival, &product)) {
+    left->ival = product;
+    return left;
+  } else if (left->type == INT_LIT && left->ival == 1) {
+    return right;
+  } else if (right->type == INT_LIT && right->ival == 1) {
+    return left;
+  }
+  return create_binop(MUL, left, right);
+}
+
+/* Multiplies two literals, unless the product does not fit in a literal. The
+ * generated code multiplies in 64 bits, so the folded value must not wrap. */
+static bool fold_mul(int a, int b, int *product) {
+  int64_t wide = (int64_t) a * b;
+  if (wide < INT32_MIN || wide > INT32_MAX) {
+    return false;
+  }
+  *product = (int) wide;
+  return true;
+}
+
+/* Copies a loop-invariant operand, which is either a literal or a variable. */
+static expr_ast_t *copy_operand(expr_ast_t *expr) {
+  if (expr->type == INT_LIT) {
+    return create_int_lit(expr->ival, expr->pos);
+  }
+  return create_var_ref(expr->symbol, expr->pos);
+}
+
+static stat_ast_t *create_stat(stat_ast_type_t type, position_t pos) {
+  stat_ast_t *stat = (stat_ast_t *) arena_alloc(sizeof(stat_ast_t));
+  stat->type = type;
+  stat->pos = pos;
+  return stat;
+}
+
+static stat_ast_t *create_expr_stat(expr_ast_t *expr) {
+  stat_ast_t *stat = create_stat(EXPR_STAT, expr->pos);
+  stat->expr = expr;
+  return stat;
+}
+
+static stat_ast_t *create_assign_stat(symbol_t *symbol, expr_ast_t *value) {
+  expr_ast_t *target = create_var_ref(symbol, value->pos);
+  target->assign = true;
+  return create_expr_stat(create_binop(ASSIGN, target, value));
+}
+
+static stat_ast_t *create_block(position_t pos) {
+  stat_ast_t *stat = create_stat(BLOCK_STAT, pos);
+  list_init(&stat->stats);
+  return stat;
+}
+
+/* Declares a new variable at the end of the block. */
+static symbol_t *create_temp(stat_ast_t *block, position_t pos) {
+  char *name = (char *) arena_alloc(16);
+  sprintf(name, "iv.%d", next_temp++);
+
+  stat_ast_t *decl = create_stat(DECL_STAT, pos);
+  decl->datatype = INT_DT;
+  decl->target = name;
+  decl->is_func = false;
+  decl->value = 0;
+  decl->symbol = create_symtable_entry(name, INT_DT);
+  decl->symbol->local_reads = 0;
+  list_push_back(&block->stats, &decl->block_elem);
+
+  return decl->symbol;
+}
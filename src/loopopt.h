@@ -0,0 +1,7 @@
+#ifndef LOOPOPT_H
+#define LOOPOPT_H
+#include "parser.h"
+
+void optimize_loops(stat_ast_t *);
+
+#endif
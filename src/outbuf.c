@@ -0,0 +1,124 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "outbuf.h"
+
+static bool reserve(outbuf_t *, size_t);
+static void write_all(outbuf_t *, const char *, size_t);
+
+/* Starts buffering output to the file. Anything already buffered by stdio is
+ * written first, so that the output stays in order. */
+void outbuf_init(outbuf_t *buf, FILE *file) {
+  fflush(file);
+  buf->fd = fileno(file);
+  buf->size = 0;
+  buf->capacity = OUTBUF_SIZE;
+  buf->data = (char *) malloc(OUTBUF_SIZE);
+  buf->failed = buf->fd < 0;
+}
+
+/* Starts a buffer that keeps its text in memory. */
+void outbuf_init_memory(outbuf_t *buf) {
+  buf->fd = -1;
+  buf->size = 0;
+  buf->capacity = 256;
+  buf->data = (char *) malloc(buf->capacity);
+  buf->failed = false;
+}
+
+void outbuf_write(outbuf_t *buf, const char *data, size_t length) {
+  if (!reserve(buf, length)) {
+    // Too large to buffer, write it directly.
+    write_all(buf, data, length);
+    return;
+  }
+
+  memcpy(buf->data + buf->size, data, length);
+  buf->size += length;
+}
+
+void outbuf_str(outbuf_t *buf, const char *str) {
+  outbuf_write(buf, str, strlen(str));
+}
+
+void outbuf_char(outbuf_t *buf, char c) {
+  reserve(buf, 1);
+  buf->data[buf->size++] = c;
+}
+
+/* Appends the decimal representation of the integer. Unlike printf, this does
+ * not parse a format string or consult the locale. */
+void outbuf_int(outbuf_t *buf, int64_t value) {
+  char digits[20];
+  int count = 0;
+  // Work with the magnitude as unsigned, so that INT64_MIN does not overflow.
+  uint64_t magnitude = value < 0 ? -(uint64_t) value : (uint64_t) value;
+
+  do {
+    digits[count++] = '0' + magnitude % 10;
+    magnitude /= 10;
+  } while (magnitude);
+
+  reserve(buf, count + 1);
+  if (value < 0) {
+    buf->data[buf->size++] = '-';
+  }
+  while (count) {
+    buf->data[buf->size++] = digits[--count];
+  }
+}
+
+/* Appends the text of a memory buffer. */
+void outbuf_append(outbuf_t *buf, outbuf_t *text) {
+  outbuf_write(buf, text->data, text->size);
+}
+
+/* Writes out everything buffered so far. Memory buffers keep their text. */
+void outbuf_flush(outbuf_t *buf) {
+  if (buf->fd == -1) {
+    return;
+  }
+  write_all(buf, buf->data, buf->size);
+  buf->size = 0;
+}
+
+void outbuf_free(outbuf_t *buf) {
+  free(buf->data);
+  buf->data = NULL;
+  buf->size = buf->capacity = 0;
+}
+
+/* Makes room for length more bytes, by flushing a file buffer or growing a
+ * memory buffer. Returns false if a file buffer cannot hold that much. */
+static bool reserve(outbuf_t *buf, size_t length) {
+  if (buf->size + length <= buf->capacity) {
+    return true;
+  }
+
+  if (buf->fd != -1) {
+    outbuf_flush(buf);
+    return length <= buf->capacity;
+  }
+
+  while (buf->size + length > buf->capacity) {
+    buf->capacity *= 2;
+  }
+  buf->data = (char *) realloc(buf->data, buf->capacity);
+  return true;
+}
+
+/* Writes the data to the file. This takes one write() unless the system
+ * accepts only part of it. */
+static void write_all(outbuf_t *buf, const char *data, size_t length) {
+  while (length > 0 && !buf->failed) {
+    ssize_t written = write(buf->fd, data, length);
+    if (written <= 0) {
+      buf->failed = true;
+      break;
+    }
+    data += written;
+    length -= written;
+  }
+}
@@ -0,0 +1,31 @@
+#ifndef OUTBUF_H
+#define OUTBUF_H
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#define OUTBUF_SIZE (1 << 16)
+
+/* Buffered output to a file descriptor. Text is appended to an in-memory
+ * buffer, which is written out with a single write() when it fills up or is
+ * flushed. A buffer without a file (fd -1) grows instead, and keeps all of its
+ * text in memory until it is appended to another buffer. */
+typedef struct {
+  int fd;
+  bool failed; // Whether a write failed, the output is incomplete.
+  size_t size, capacity;
+  char *data;
+} outbuf_t;
+
+void outbuf_init(outbuf_t *, FILE *);
+void outbuf_init_memory(outbuf_t *);
+void outbuf_append(outbuf_t *, outbuf_t *);
+void outbuf_free(outbuf_t *);
+void outbuf_write(outbuf_t *, const char *, size_t);
+void outbuf_str(outbuf_t *, const char *);
+void outbuf_char(outbuf_t *, char);
+void outbuf_int(outbuf_t *, int64_t);
+void outbuf_flush(outbuf_t *);
+
+#endif
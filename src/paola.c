@@ -1,64 +1,488 @@
+#define _DEFAULT_SOURCE
+
 #include <stdio.h>
 #include <stdlib.h>
-#include "gen.h"
-#include "lexer.h"
-#include "parser.h"
-#include "semcheck.h"
-#include "errors.h"
+#include <string.h>
+#include "cache.h"
+#include "libpaola.h"
+#include "pool.h"
+#include "server.h"
 #include "utils.h"
 
-// Compiler exit codes: different exit codes denote different error types, 0 indicates success.
-enum { 
-  OTHER_ERR = 1,
-  LEXER_ERR,
-  PARSE_ERR,
-  SEM_ERR,
-  GEN_ERR
-};
+// Several input files are compiled at once, each by one thread.
+typedef struct {
+  const options_t *options;
+  paola_options_t lib_options;
+  paola_ctx_t **contexts; // One per worker, reused for the files it compiles
+  char **paths; // Of the output of each file
+  char **messages; // Of each file
+  paola_status_t *statuses; // Of each file
+} batch_t;
 
-void if_errors_exit(int code) {
-  if (error_count() > 0) {
-    print_messages(stdout);
-    exit(code);
-  }
-}
+static paola_options_t library_options(const options_t *);
+static int compile_file(const options_t *);
+static int compile_files(const options_t *);
+static void compile_task(int, int, void *);
+static int compile_remote(const options_t *);
+static paola_status_t compile_cached(paola_ctx_t *, const options_t *, const char *, size_t,
+    const char *, cache_entry_t *);
+static void load_index(paola_ctx_t *, const char *);
+static void save_index(paola_ctx_t *, const char *);
+static void load_profile(paola_ctx_t *, const char *);
+static char *profile_path(const options_t *);
+static bool report(paola_ctx_t *, const options_t *);
+static char *read_input(const char *, size_t *);
+static bool write_output(const char *, const char *, size_t, bool);
+static char *copy_string(const char *);
 
+/* The compiler driver: reads the input files, compiles them with the library
+ * and writes the outputs, or runs the program. The compiler exits with the
+ * status of the compilation, or with the status of the program it ran. With
+ * several input files, it exits with the status of the first one that failed
+ * to compile. The driver can also serve compile requests, or send them to a
+ * server, see server.c. */
 int main (int argc, char **argv) {
   options_t options = parse_options(argc, argv);
-  if (options.input_file == 0) {
+  if (options.server_socket) {
+    paola_options_t lib_options = library_options(&options);
+    int status = serve(options.server_socket, &lib_options);
+    free(options.input_files);
+    return status;
+  }
+  if (options.cache_stats) {
+    cache_t cache = {options.cache_dir, options.cache_size};
+    int status = PAOLA_OK;
+    if (cache.directory) {
+      print_cache_stats(&cache);
+    } else {
+      printf("No cache directory specified.\n");
+      status = PAOLA_OTHER_ERR;
+    }
+    free(options.input_files);
+    return status;
+  }
+  if (options.input_count == 0 && !(options.connect_socket
+      && (options.server_stats || options.server_shutdown))) {
     printf("No input file specified.\n");
-    exit(1);
+    exit(PAOLA_OTHER_ERR);
+  }
+  char *profile_file = 0;
+  if (options.profile_generate && !options.profile_file) {
+    profile_file = profile_path(&options);
+    options.profile_file = profile_file;
+  }
+
+  int status;
+  if (options.unknown_pass) {
+    printf("Unknown pass %.*s, the passes are", (int) strcspn(options.unknown_pass, ","),
+        options.unknown_pass);
+    for (int i = 0; i < PAOLA_PASS_COUNT; i++) {
+      printf("%s %s", i > 0 ? "," : "", paola_pass_name((paola_pass_t) i));
+    }
+    printf(".\n");
+    status = PAOLA_OTHER_ERR;
+  } else if (options.unknown_level) {
+    printf("Unknown optimization level %s, the levels are -O0, -O1, -O2.\n",
+        options.unknown_level);
+    status = PAOLA_OTHER_ERR;
+  } else if (options.connect_socket && (options.time_report || options.trace_file || options.remarks
+      || options.instrument || options.profile_generate || options.profile_use)) {
+    printf("Reports, remarks, instrumented and profiled files are only made locally.\n");
+    status = PAOLA_OTHER_ERR;
+  } else if ((options.instrument || options.profile_generate)
+      && (options.run || options.interpret || options.interpret_ast)) {
+    printf("Only assembly and object files can be instrumented.\n");
+    status = PAOLA_OTHER_ERR;
+  } else if (options.connect_socket) {
+    status = compile_remote(&options);
+  } else if (options.input_count == 1) {
+    status = compile_file(&options);
+  } else if (options.run || options.interpret || options.interpret_ast) {
+    printf("Only one input file can be run.\n");
+    status = PAOLA_OTHER_ERR;
+  } else if (options.trace_file) {
+    printf("Only one input file can be traced.\n");
+    status = PAOLA_OTHER_ERR;
+  } else if (options.remarks_file) {
+    printf("Remarks can only be written for one input file.\n");
+    status = PAOLA_OTHER_ERR;
+  } else if (options.profile_use) {
+    printf("A profile can only be used for one input file.\n");
+    status = PAOLA_OTHER_ERR;
+  } else {
+    status = compile_files(&options);
+  }
+  free(profile_file);
+  free(options.input_files);
+  return status;
+}
+
+static paola_options_t library_options(const options_t *options) {
+  paola_options_t lib_options = {PAOLA_ASSEMBLY, options->jobs, options->print_tokens,
+      options->print_ast, options->incremental, options->time_report || options->trace_file,
+      options->remarks, options->instrument,
+      options->profile_generate ? options->profile_file : 0, options->frame_pointer,
+      options->disabled_passes};
+  if (options->interpret_ast) {
+    lib_options.output = PAOLA_INTERPRET_AST;
+  } else if (options->interpret) {
+    lib_options.output = PAOLA_INTERPRET;
+  } else if (options->run) {
+    lib_options.output = PAOLA_RUN;
+  } else if (options->object_file) {
+    lib_options.output = PAOLA_OBJECT;
+  }
+  return lib_options;
+}
+
+/* Compiles the only input file with all of the jobs, into the output file. */
+static int compile_file(const options_t *options) {
+  size_t size;
+  char *text = read_input(options->input_files[0], &size);
+  if (text == 0) {
+    printf("Could not open the input file.\n");
+    return PAOLA_OTHER_ERR;
+  }
+
+  paola_options_t lib_options = library_options(options);
+  paola_ctx_t *ctx = paola_create(&lib_options);
+  if (options->profile_use) {
+    load_profile(ctx, options->profile_use);
+  }
+  int result;
+  if (lib_options.output != PAOLA_ASSEMBLY && lib_options.output != PAOLA_OBJECT) {
+    /* Run the program in memory, exiting with its status. */
+    result = paola_compile(ctx, text, size);
+    fputs(paola_messages(ctx), stdout);
+    if (!report(ctx, options)) {
+      result = PAOLA_OTHER_ERR;
+    }
+    if (result == PAOLA_OK) {
+      fflush(stdout);
+      int program_status;
+      paola_status_t status = paola_run(ctx, &program_status);
+      fputs(paola_messages(ctx), stdout);
+      result = status == PAOLA_OK ? program_status : (int) status;
+    }
+  } else {
+    cache_entry_t compiled;
+    result = compile_cached(ctx, options, text, size, options->output_file, &compiled);
+    fputs(compiled.messages, stdout);
+    if (!report(ctx, options) && result == PAOLA_OK) {
+      result = PAOLA_OTHER_ERR;
+    }
+    if (result == PAOLA_OK && !write_output(options->output_file, compiled.output,
+        compiled.output_size, options->object_file)) {
+      printf("Could not write the output file.\n");
+      result = PAOLA_GEN_ERR;
+    }
+    free_cache_entry(&compiled);
+  }
+
+  free(text);
+  paola_destroy(ctx);
+  return result;
+}
+
+/* Compiles every input file into the output directory, spreading the files
+ * over the jobs. Each file is compiled by one thread, and the messages of the
+ * files are printed in the order the files were given. */
+static int compile_files(const options_t *options) {
+  int count = options->input_count;
+  // Printed tokens and ASTs would interleave, so print them one file at a time.
+  int workers = options->print_tokens || options->print_ast ? 1 : options->jobs;
+  if (workers > count) {
+    workers = count;
+  }
+
+  batch_t batch = {options, library_options(options), 0, 0, 0, 0};
+  batch.paths = (char **) malloc(sizeof(char *) * count);
+  for (int i = 0; i < count; i++) {
+    batch.paths[i] = output_path(options->output_file, options->input_files[i],
+        options->object_file ? ".o" : ".s");
+  }
+  for (int i = 0; i < count; i++) {
+    for (int j = 0; j < i; j++) {
+      if (strcmp(batch.paths[i], batch.paths[j]) == 0) {
+        printf("%s and %s would both be compiled to %s.\n", options->input_files[j],
+            options->input_files[i], batch.paths[i]);
+        for (int k = 0; k < count; k++) {
+          free(batch.paths[k]);
+        }
+        free(batch.paths);
+        return PAOLA_OTHER_ERR;
+      }
+    }
+  }
+
+  batch.lib_options.jobs = 1;
+  batch.contexts = (paola_ctx_t **) malloc(sizeof(paola_ctx_t *) * workers);
+  for (int i = 0; i < workers; i++) {
+    batch.contexts[i] = paola_create(&batch.lib_options);
+  }
+  batch.messages = (char **) calloc(count, sizeof(char *));
+  batch.statuses = (paola_status_t *) calloc(count, sizeof(paola_status_t));
+
+  pool_run(workers, count, compile_task, &batch);
+
+  int result = 0;
+  for (int i = 0; i < count; i++) {
+    if (batch.messages[i][0] != '\0') {
+      printf("%s:\n%s", options->input_files[i], batch.messages[i]);
+    }
+    if (result == 0) {
+      result = batch.statuses[i];
+    }
+    free(batch.messages[i]);
+    free(batch.paths[i]);
+  }
+
+  for (int i = 0; i < workers; i++) {
+    paola_destroy(batch.contexts[i]);
+  }
+  free(batch.contexts);
+  free(batch.paths);
+  free(batch.messages);
+  free(batch.statuses);
+  return result;
+}
+
+static void compile_task(int file, int worker, void *data) {
+  batch_t *batch = (batch_t *) data;
+  const options_t *options = batch->options;
+  const char *input = options->input_files[file];
+
+  size_t size;
+  char *text = read_input(input, &size);
+  if (text == 0) {
+    batch->messages[file] = copy_string("Could not open the input file.\n");
+    batch->statuses[file] = PAOLA_OTHER_ERR;
+    return;
+  }
+
+  cache_entry_t compiled;
+  paola_status_t status = compile_cached(batch->contexts[worker], options, text, size,
+      batch->paths[file], &compiled);
+  free(text);
+  batch->messages[file] = compiled.messages;
+  batch->statuses[file] = status;
+  if (options->time_report) {
+    // The report of each file follows its messages.
+    const char *report = paola_report(batch->contexts[worker]);
+    size_t length = strlen(compiled.messages);
+    batch->messages[file] = (char *) realloc(compiled.messages, length + strlen(report) + 1);
+    strcpy(batch->messages[file] + length, report);
+  }
+  if (status == PAOLA_OK && !write_output(batch->paths[file], compiled.output,
+      compiled.output_size, options->object_file)) {
+    free(batch->messages[file]);
+    batch->messages[file] = copy_string("Could not write the output file.\n");
+    batch->statuses[file] = PAOLA_GEN_ERR;
+  }
+  free(compiled.output);
+}
+
+/* Compiles the text with the context into a copy of its output and messages.
+ * With a cache, files compiled before are read from it instead, and newly
+ * compiled ones are added to it. Incremental builds of assembly keep the index
+ * of the functions next to the output file. */
+static paola_status_t compile_cached(paola_ctx_t *ctx, const options_t *options,
+    const char *text, size_t size, const char *output_file, cache_entry_t *result) {
+  cache_t cache = {options->cache_dir, options->cache_size};
+  // Printing the tokens or the AST, or reporting on the phases, takes running them.
+  bool cached = cache.directory && !options->print_tokens && !options->print_ast
+      && !options->time_report && !options->trace_file && !options->remarks
+      && !options->instrument && !options->profile_generate && !options->profile_use;
+  cache_key_t key = {{0, 0}};
+  if (cached) {
+    key = cache_key(text, size, options->object_file, options->frame_pointer,
+        options->disabled_passes);
+    if (cache_lookup(&cache, key, result)) {
+      return PAOLA_OK;
+    }
+  }
+
+  bool indexed = options->incremental && !options->object_file;
+  if (indexed) {
+    load_index(ctx, output_file);
+  }
+  paola_status_t status = paola_compile(ctx, text, size);
+  if (indexed && status == PAOLA_OK) {
+    save_index(ctx, output_file);
+  }
+  size_t output_size;
+  const char *output = paola_output(ctx, &output_size);
+  result->output_size = status == PAOLA_OK ? output_size : 0;
+  result->output = (char *) malloc(result->output_size + 1);
+  memcpy(result->output, output, result->output_size);
+  result->messages = copy_string(paola_messages(ctx));
+  if (cached && status == PAOLA_OK) {
+    cache_store(&cache, key, result->output, result->output_size, result->messages);
+  }
+  return status;
+}
+
+/* Has the server compile the only input file into the output file, or asks it
+ * for its statistics, or to stop. */
+static int compile_remote(const options_t *options) {
+  const char *socket = options->connect_socket;
+  bool compiling = !options->server_stats && !options->server_shutdown;
+  paola_options_t lib_options = library_options(options);
+  response_t response;
+  bool answered;
+  if (!compiling) {
+    request_kind_t kind = options->server_stats ? REQUEST_STATS : REQUEST_SHUTDOWN;
+    answered = server_request(socket, kind, &lib_options, "", 0, &response);
+  } else if (options->input_count > 1) {
+    printf("Only one input file can be sent to the server.\n");
+    return PAOLA_OTHER_ERR;
+  } else if (options->run || options->interpret || options->interpret_ast) {
+    printf("Programs cannot be run by the server.\n");
+    return PAOLA_OTHER_ERR;
+  } else {
+    // The server may run in another directory, so it needs the absolute path.
+    size_t size;
+    char *text = options->send_path ? realpath(options->input_files[0], NULL)
+        : read_input(options->input_files[0], &size);
+    if (text == 0) {
+      printf("Could not open the input file.\n");
+      return PAOLA_OTHER_ERR;
+    }
+    if (options->send_path) {
+      answered = server_request(socket, REQUEST_COMPILE_PATH, &lib_options, text, strlen(text),
+          &response);
+    } else {
+      answered = server_request(socket, REQUEST_COMPILE, &lib_options, text, size, &response);
+    }
+    free(text);
+  }
+  if (!answered) {
+    printf("Could not reach the server on %s.\n", socket);
+    return PAOLA_OTHER_ERR;
+  }
+
+  fputs(response.messages, stdout);
+  int result = response.status;
+  if (compiling && result == PAOLA_OK && !write_output(options->output_file, response.output,
+      response.output_size, options->object_file)) {
+    printf("Could not write the output file.\n");
+    result = PAOLA_GEN_ERR;
   }
+  free_response(&response);
+  return result;
+}
 
-  FILE *fin = fopen(options.input_file, "r");
-  errors_init();
+/* Gives the context the index kept next to the output file, if the same
+ * compiler wrote it. */
+static void load_index(paola_ctx_t *ctx, const char *output_file) {
+  char *path = (char *) malloc(strlen(output_file) + sizeof(".idx"));
+  sprintf(path, "%s.idx", output_file);
+  size_t size;
+  char *index = read_input(path, &size);
+  free(path);
 
-  /* Lexer: Produce a list of tokens from the input file. */
-  token_t *tokens = tokenize(fin);
-  if_errors_exit(LEXER_ERR);
+  hash_t compiler = compiler_hash();
+  if (index && size >= sizeof(compiler) && memcmp(index, &compiler, sizeof(compiler)) == 0) {
+    paola_set_index(ctx, index + sizeof(compiler), size - sizeof(compiler));
+  } else {
+    paola_set_index(ctx, "", 0);
+  }
+  free(index);
+}
 
-  if (options.print_tokens) {
-    print_tokens(tokens);
+/* Replaces the index next to the output file with the one of the context. A
+ * partly written index is never left in its place. */
+static void save_index(paola_ctx_t *ctx, const char *output_file) {
+  char *path = (char *) malloc(strlen(output_file) + sizeof(".idx"));
+  char *temporary = (char *) malloc(strlen(output_file) + sizeof(".idx.tmp"));
+  sprintf(path, "%s.idx", output_file);
+  sprintf(temporary, "%s.idx.tmp", output_file);
+
+  size_t size;
+  const char *index = paola_index(ctx, &size);
+  hash_t compiler = compiler_hash();
+  FILE *fout = fopen(temporary, "wb");
+  bool written = fout && fwrite(&compiler, sizeof(compiler), 1, fout) == 1
+      && fwrite(index, 1, size, fout) == size;
+  written = fout && fclose(fout) == 0 && written;
+  if (!written || rename(temporary, path) != 0) {
+    remove(temporary);
   }
+  free(path);
+  free(temporary);
+}
 
-  /* Parser: Produce an Abstract Syntax Tree from the list of tokens. */
-  stat_ast_t *ast = parse(tokens);
-  if_errors_exit(PARSE_ERR);
+/* Gives the context the profile to optimize with. Like a missing index, a
+ * missing profile only makes the code less optimized. */
+static void load_profile(paola_ctx_t *ctx, const char *path) {
+  size_t size;
+  char *profile = read_input(path, &size);
+  if (profile == 0) {
+    printf("Could not open the profile %s, compiling without it.\n", path);
+    return;
+  }
+  paola_set_profile(ctx, profile, size);
+  free(profile);
+}
 
-  if (options.print_ast) {
-    print_stat_ast(ast);
+/* Returns where a counting program writes its profile by default: next to the
+ * output file, like its index, or in the output directory. */
+static char *profile_path(const options_t *options) {
+  if (options->input_count > 1) {
+    return output_path(options->output_file, "paola", ".pgo");
   }
+  char *path = (char *) malloc(strlen(options->output_file) + sizeof(".pgo"));
+  sprintf(path, "%s.pgo", options->output_file);
+  return path;
+}
 
-  /* Semantic checker: Check the AST for semantic errors. */
-  semcheck(ast);
-  if_errors_exit(SEM_ERR);
+/* Prints the report of the last compilation of the context, and writes its
+ * trace and its remarks, if the options ask for them. Returns false if a file
+ * could not be written. */
+static bool report(paola_ctx_t *ctx, const options_t *options) {
+  if (options->time_report) {
+    fputs(paola_report(ctx), stdout);
+  }
+  if (options->trace_file) {
+    const char *trace = paola_trace(ctx);
+    if (!write_output(options->trace_file, trace, strlen(trace), false)) {
+      printf("Could not write the trace file.\n");
+      return false;
+    }
+  }
+  if (options->remarks_file) {
+    const char *remarks = paola_remarks(ctx);
+    if (!write_output(options->remarks_file, remarks, strlen(remarks), false)) {
+      printf("Could not write the remarks file.\n");
+      return false;
+    }
+  }
+  return true;
+}
+
+/* Reads the whole input file, or returns 0 if it cannot be opened. */
+static char *read_input(const char *path, size_t *size) {
+  FILE *fin = fopen(path, "r");
+  if (fin == 0) {
+    return 0;
+  }
+  char *text = read_file(fin, size);
+  fclose(fin);
+  return text;
+}
 
-  /* Code generation: Produce x86 assembly code from the AST. */
-  FILE *fout = fopen(options.output_file, "w");
-  generate_code(fout, ast);
-  fclose(fout);
-  if_errors_exit(GEN_ERR);
+static bool write_output(const char *path, const char *output, size_t size, bool binary) {
+  FILE *fout = fopen(path, binary ? "wb" : "w");
+  if (fout == 0) {
+    return false;
+  }
+  bool written = fwrite(output, 1, size, fout) == size;
+  return fclose(fout) == 0 && written;
+}
 
-  print_messages(stdout);
-  return 0;
+static char *copy_string(const char *string) {
+  size_t size = strlen(string) + 1;
+  char *copy = (char *) malloc(size);
+  memcpy(copy, string, size);
+  return copy;
 }
@@ -1,12 +1,17 @@
 #pragma GCC diagnostic ignored "-Wwrite-strings"
 
 #include "parser.h"
+#include "arena.h"
 #include <assert.h>
 #include <string.h>
 #include <stdbool.h>
 #include <stdlib.h>
 #include "errors.h"
+#include "pool.h"
+#include "report.h"
 
+static void parse_task(int, int, void *);
+static stat_ast_t *parse_tokens(token_t *);
 static void init_parser(token_t *tokens);
 
 static expr_ast_t *parse_expr(void);
@@ -45,10 +50,62 @@ static bool is_term_binop(token_t *token);
 static bool is_expr_binop(token_t *token);
 static bool is_type_ident(token_t *token);
 
+typedef struct {
+  source_t *source;
+  stat_ast_t **programs; // The statements of each chunk
+} parse_data_t;
+
 // Points to the next token that has not been parsed yet.
-static token_t *next_token;
+static _Thread_local token_t *next_token;
+
+/* Parses the chunks of the source in parallel, and joins their statements in
+ * order. A chunk holds whole top-level statements, so a program without errors
+ * parses the same in chunks. If there are errors, the chunks are thrown away,
+ * and all tokens are parsed at once, so that the errors are the same too. */
+stat_ast_t *parse(source_t *source, int threads) {
+  if (source->chunk_count == 1) {
+    return parse_tokens(source->tokens);
+  }
 
-stat_ast_t *parse(token_t *tokens) {
+  int errors = error_count();
+  parse_data_t data = {source, (stat_ast_t **) malloc(sizeof(stat_ast_t *) * source->chunk_count)};
+  for (int i = 0; i < source->chunk_count; i++) {
+    list_init(&source->chunks[i].messages);
+  }
+  pool_run(threads, source->chunk_count, parse_task, &data);
+
+  stat_ast_t *program = NULL;
+  if (error_count() == errors) {
+    init_parser(source->tokens);
+    program = create_block_stat();
+    for (int i = 0; i < source->chunk_count; i++) {
+      list_t *stats = &data.programs[i]->stats;
+      if (!list_empty(stats)) {
+        list_splice(list_end(&program->stats), list_begin(stats), list_end(stats));
+      }
+      errors_append(&source->chunks[i].messages);
+    }
+  } else {
+    for (int i = 0; i < source->chunk_count; i++) {
+      errors_discard(&source->chunks[i].messages);
+    }
+    program = parse_tokens(source->tokens);
+  }
+  free(data.programs);
+  return program;
+}
+
+static void parse_task(int i, int worker, void *arg) {
+  parse_data_t *data = (parse_data_t *) arg;
+  chunk_t *chunk = &data->source->chunks[i];
+  double start = report_time();
+  errors_redirect(&chunk->messages);
+  data->programs[i] = parse_tokens(chunk->tokens);
+  errors_redirect(NULL);
+  report_span("chunk", i, "parser", worker, start);
+}
+
+static stat_ast_t *parse_tokens(token_t *tokens) {
   init_parser(tokens);
 
   stat_ast_t *program = create_block_stat();
@@ -113,7 +170,17 @@ stat_ast_t *parse_stat() {
     } case LBRACE_TOK:
       stat = parse_block_stat();
             break;
-    case IDENT_TOK:
+    case INLINE_TOK: {
+      position_t pos = next_token->pos;
+      match_token(INLINE_TOK);
+      stat = parse_declaration();
+      if (stat->type != DECL_STAT || !stat->is_func) {
+        error(&pos, "Only functions can be declared inline.");
+      } else {
+        stat->is_inline = true;
+      }
+      break;
+    } case IDENT_TOK:
       if (is_type_ident(next_token)) {
         stat = parse_declaration();
       } else {
@@ -233,6 +300,7 @@ static stat_ast_t *parse_declaration() {
     match_token(LPAREN_TOK);
     match_token(RPAREN_TOK);
     decl_stat->is_func = true;
+    decl_stat->is_inline = false;
     if (next_token->type == LBRACE_TOK) {
       decl_stat->func_body = parse_block_stat();
     } else {
@@ -253,7 +321,7 @@ static stat_ast_t *parse_declaration() {
 static stat_ast_t *parse_block_stat() {
   match_token(LBRACE_TOK);
   stat_ast_t *stat = create_block_stat();
-  while (next_token->type != RBRACE_TOK) {
+  while (next_token->type != RBRACE_TOK && next_token->type != PROGRAM_END_TOK) {
     stat_ast_t *x = parse_stat();
     list_push_back(&stat->stats, &x->block_elem);
   }
@@ -431,6 +499,7 @@ static expr_ast_t *create_variable_ref(char *name) {
 
 static expr_ast_t *create_function_call(char *name) {
   expr_ast_t *expr = create_expr();
+  expr->assign = false;
   expr->type = FUNC_CALL;
   expr->name = name;
   return expr;
@@ -442,17 +511,18 @@ static stat_ast_t *create_declaration(datatype_t datatype, char *target) {
   stat->datatype = datatype;
   stat->target = target;
   stat->symbol = 0;
+  stat->value = 0; // Also clears func_body, as they share storage.
   return stat;
 }
 
 static stat_ast_t *create_stat() {
-  stat_ast_t *stat = (stat_ast_t *) malloc(sizeof(stat_ast_t));
+  stat_ast_t *stat = (stat_ast_t *) arena_alloc(sizeof(stat_ast_t));
   stat->pos = next_token->pos;
   return stat;
 }
 
 static expr_ast_t *create_expr() {
-  expr_ast_t *expr = (expr_ast_t *) malloc(sizeof(expr_ast_t));
+  expr_ast_t *expr = (expr_ast_t *) arena_alloc(sizeof(expr_ast_t));
   expr->pos = next_token->pos;
   return expr;
 
@@ -1,5 +1,6 @@
 #ifndef PARSER_H
 #define PARSER_H
+#include <stdint.h>
 #include "lexer.h"
 #include "list.h"
 
@@ -47,12 +48,31 @@ typedef struct {
   datatype_t datatype;
   list_elem_t scope_elem;
   uint32_t stack_offset;
-  //TODO: Also store info about whether it's a function, if it's constant etc.
+  int local_reads; // In the function loopopt.c is optimizing, -1 if not one of its locals
+
+  bool is_global;
+  bool is_func;
+  struct stat_ast_type *decl; // The function declaration, if is_func.
+  int call_count; // Number of calls to the function found by semcheck.
+  bool inlinable; // Whether calls to the function are expanded in place.
+  list_t call_sites; // Calls the function makes, see callgraph.h.
+  int callgraph_id;
+  bool cold; // Whether the function is unlikely to be called.
+  int slot; // Register or global number of a variable in the bytecode.
+  bool assigned; // Whether the variable is ever assigned to.
+  bool pure; // Whether the function has no side effects and reads no changing variable.
+  bool makes_calls; // Whether the function calls any, see gen.c
+  bool folded; // Whether calls to the function were replaced by its value.
+  int counter_count; // Profile counters of the function, see pgo.c
+  uint64_t checksum; // Of the code the counters count
+  int64_t *counts; // Of the counters in the profile, 0 if the function has none.
+  //TODO: Also store info about whether it's constant etc.
 } symbol_t;
 
 typedef struct expr_ast_type {
   expr_ast_type_t type;
   position_t pos;
+  int counter; // Profile counter of a FUNC_CALL, see pgo.c
 
   bool assign;
   union {
@@ -71,6 +91,8 @@ typedef struct expr_ast_type {
 typedef struct stat_ast_type {
   stat_ast_type_t type;
   position_t pos;
+  int counter; // First profile counter of an IF_STAT, WHILE_STAT or FOR_STAT
+  int size; // In AST nodes, see inline.c
 
   union {
     expr_ast_t *expr; // RETURN_STAT, EXPR_STAT
@@ -101,7 +123,8 @@ typedef struct stat_ast_type {
         expr_ast_t *value; // Variable declaration
         struct { // Function declaration
           struct stat_ast_type *func_body;
-          // TODO: Argument list, inline specifier etc.
+          bool is_inline;
+          // TODO: Argument list.
         };
       };
     };
@@ -109,6 +132,6 @@ typedef struct stat_ast_type {
   list_elem_t block_elem;
 } stat_ast_t;
 
-stat_ast_t *parse(token_t *);
+stat_ast_t *parse(source_t *, int);
 
 #endif
@@ -0,0 +1,246 @@
+#include "passes.h"
+#include "context.h"
+#include "ctfe.h"
+#include "deadcode.h"
+#include "gen.h"
+#include "inline.h"
+#include "loopopt.h"
+#include "pgo.h"
+#include "report.h"
+
+/* The pass manager. Transforms rewrite the checked AST one after the other, in
+ * the order of paola_pass_t, and the passes of the code generator act while it
+ * generates. Every pass has the lowest optimization level that runs it, and can
+ * be turned off on its own with the disabled_passes option.
+ *
+ * Before a pass runs, the analyses it requires that are not valid are computed
+ * in a single walk of the functions, which visits each node with the hooks of
+ * all of them. After it, the analyses it does not preserve are no longer valid.
+ * The code generator requires the analyses of its passes and of the frames and
+ * counters it generates, which are computed after the last transform. */
+
+typedef struct {
+  const char *name;
+  int level; // The lowest optimization level that runs the pass
+  phase_t phase;
+  void (*run)(stat_ast_t *); // 0 for the passes of the code generator
+  unsigned requires, preserves; // Bits of analysis_t
+} pass_info_t;
+
+#define ASSIGNED (1u << ANALYSIS_ASSIGNED)
+#define SIZES (1u << ANALYSIS_SIZES)
+#define CALLS (1u << ANALYSIS_CALLS)
+#define COUNTERS (1u << ANALYSIS_COUNTERS)
+
+/* Removing code may leave a variable marked as assigned, which only makes the
+ * passes that read the flag more careful, so every pass preserves it. */
+static const pass_info_t passes[PAOLA_PASS_COUNT] = {
+  {"ctfe", 1, PHASE_CTFE, evaluate_pure_calls, ASSIGNED, ASSIGNED},
+  {"deadcode", 1, PHASE_DEADCODE, eliminate_dead_code, 0, ASSIGNED},
+  {"loopopt", 2, PHASE_LOOPOPT, optimize_loops, 0, ASSIGNED},
+  {"inline", 1, PHASE_INLINE, plan_inlining, SIZES | COUNTERS, ALL_ANALYSES},
+  {"tailcall", 1, PHASE_CODEGEN, 0, 0, ALL_ANALYSES},
+  {"unroll", 2, PHASE_CODEGEN, 0, SIZES | COUNTERS, ALL_ANALYSES},
+};
+
+// What the code generator requires whatever passes run.
+#define CODEGEN_REQUIRES (CALLS | COUNTERS)
+
+static const visitor_t *analyses[ANALYSIS_COUNT] = {
+  &assigned_visitor, &sizes_visitor, &calls_visitor, &counters_visitor
+};
+
+static void require_analyses(stat_ast_t *, unsigned);
+static void walk_function(stat_ast_t *, walk_t *);
+static void walk_statement(stat_ast_t *, walk_t *);
+static void walk_expression(expr_ast_t *, walk_t *);
+
+// The visitors of the analyses the walk computes.
+static _Thread_local const visitor_t *visitors[ANALYSIS_COUNT];
+static _Thread_local int visitor_count;
+
+/* Runs the transforms that are enabled on the checked AST, and computes what
+ * the code generator requires. */
+void run_passes(stat_ast_t *program) {
+  context->valid_analyses = 0;
+  unsigned codegen_requires = CODEGEN_REQUIRES;
+  for (int i = 0; i < PAOLA_PASS_COUNT; i++) {
+    const pass_info_t *pass = &passes[i];
+    if (!pass_enabled((paola_pass_t) i)) {
+      continue;
+    }
+    if (!pass->run) {
+      codegen_requires |= pass->requires;
+      continue;
+    }
+
+    require_analyses(program, pass->requires);
+    phase_begin(pass->phase);
+    pass->run(program);
+    phase_end(pass->phase);
+    context->valid_analyses &= pass->preserves;
+  }
+  require_analyses(program, codegen_requires);
+}
+
+bool pass_enabled(paola_pass_t pass) {
+  return !(context->options.disabled_passes & (1u << pass));
+}
+
+const char *paola_pass_name(paola_pass_t pass) {
+  return passes[pass].name;
+}
+
+/* Returns the passes that the optimization level does not run, as the bits of
+ * the disabled_passes option. Level 0 runs none of them, and level 2 all. */
+unsigned paola_disabled_passes(int level) {
+  unsigned disabled = 0;
+  for (int i = 0; i < PAOLA_PASS_COUNT; i++) {
+    if (passes[i].level > level) {
+      disabled |= 1u << i;
+    }
+  }
+  return disabled;
+}
+
+/* Computes the required analyses that are not valid, in one walk. The profile
+ * counters are only required when the program is counted or optimized with a
+ * profile. */
+static void require_analyses(stat_ast_t *program, unsigned required) {
+  if (!context->options.profile_generate && !context->profile) {
+    required &= ~COUNTERS;
+  }
+  unsigned missing = required & ~context->valid_analyses;
+  if (!missing) {
+    return;
+  }
+
+  phase_begin(PHASE_ANALYSIS);
+  visitor_count = 0;
+  for (int i = 0; i < ANALYSIS_COUNT; i++) {
+    if (missing & (1u << i)) {
+      visitors[visitor_count++] = analyses[i];
+    }
+  }
+  for (int i = 0; i < visitor_count; i++) {
+    if (visitors[i]->begin) {
+      visitors[i]->begin();
+    }
+  }
+
+  walk_t walk = {0, 0, 0};
+  for (list_elem_t *e = list_begin(&program->stats); e != list_end(&program->stats);
+      e = list_next(e)) {
+    stat_ast_t *stat = list_entry(e, stat_ast_t, block_elem);
+    if (stat->type == DECL_STAT && stat->is_func && stat->func_body && stat->symbol) {
+      walk_function(stat, &walk);
+    }
+  }
+
+  for (int i = 0; i < visitor_count; i++) {
+    if (visitors[i]->end) {
+      visitors[i]->end();
+    }
+  }
+  context->valid_analyses |= missing;
+  phase_end(PHASE_ANALYSIS);
+}
+
+/* Walks the body of a function declaration. The declaration itself is a node
+ * of the function it is nested in, if any. */
+static void walk_function(stat_ast_t *decl, walk_t *walk) {
+  symbol_t *outer_function = walk->function;
+  walk->function = decl->symbol;
+  walk->depth++;
+  for (int i = 0; i < visitor_count; i++) {
+    if (visitors[i]->function) {
+      visitors[i]->function(decl, walk);
+    }
+  }
+
+  walk_statement(decl->func_body, walk);
+
+  for (int i = 0; i < visitor_count; i++) {
+    if (visitors[i]->function_end) {
+      visitors[i]->function_end(decl, walk);
+    }
+  }
+  walk->depth--;
+  walk->function = outer_function;
+}
+
+static void walk_statement(stat_ast_t *stat, walk_t *walk) {
+  for (int i = 0; i < visitor_count; i++) {
+    if (visitors[i]->stat) {
+      visitors[i]->stat(stat, walk);
+    }
+  }
+  walk->nodes++;
+
+  switch (stat->type) {
+    case RETURN_STAT:
+    case EXPR_STAT:
+      walk_expression(stat->expr, walk);
+      break;
+    case IF_STAT:
+      walk_expression(stat->cond, walk);
+      walk_statement(stat->tstat, walk);
+      if (stat->fstat) {
+        walk_statement(stat->fstat, walk);
+      }
+      break;
+    case WHILE_STAT:
+      walk_expression(stat->cond, walk);
+      walk_statement(stat->body, walk);
+      break;
+    case FOR_STAT:
+      walk_expression(stat->init, walk);
+      walk_expression(stat->cond, walk);
+      walk_expression(stat->iter, walk);
+      walk_statement(stat->body, walk);
+      break;
+    case BLOCK_STAT:
+      for (list_elem_t *e = list_begin(&stat->stats); e != list_end(&stat->stats);
+          e = list_next(e)) {
+        walk_statement(list_entry(e, stat_ast_t, block_elem), walk);
+      }
+      break;
+    case DECL_STAT:
+      if (stat->is_func) {
+        if (stat->func_body) {
+          walk_function(stat, walk);
+        }
+      } else if (stat->value) {
+        walk_expression(stat->value, walk);
+      }
+      break;
+    default:
+      break;
+  }
+
+  for (int i = 0; i < visitor_count; i++) {
+    if (visitors[i]->stat_end) {
+      visitors[i]->stat_end(stat, walk);
+    }
+  }
+}
+
+static void walk_expression(expr_ast_t *expr, walk_t *walk) {
+  for (int i = 0; i < visitor_count; i++) {
+    if (visitors[i]->expr) {
+      visitors[i]->expr(expr, walk);
+    }
+  }
+  walk->nodes++;
+
+  if (expr->type == BIN_OP) {
+    walk_expression(expr->left, walk);
+    walk_expression(expr->right, walk);
+  }
+
+  for (int i = 0; i < visitor_count; i++) {
+    if (visitors[i]->expr_end) {
+      visitors[i]->expr_end(expr, walk);
+    }
+  }
+}
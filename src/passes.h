@@ -0,0 +1,46 @@
+#ifndef PASSES_H
+#define PASSES_H
+#include <stdbool.h>
+#include "libpaola.h"
+#include "parser.h"
+
+/* The facts about the checked AST that passes read. Each is kept in the nodes
+ * and symbols it is about, and stays valid until a pass that does not preserve
+ * it changes the AST. */
+typedef enum {
+  ANALYSIS_ASSIGNED, // The assigned flag of variables, see ctfe.c
+  ANALYSIS_SIZES,    // The size of statements, see inline.c
+  ANALYSIS_CALLS,    // The makes_calls flag of functions, see gen.c
+  ANALYSIS_COUNTERS, // Profile counters and their counts, see pgo.c
+  ANALYSIS_COUNT
+} analysis_t;
+
+#define ALL_ANALYSES ((1u << ANALYSIS_COUNT) - 1)
+
+/* Where a walk of the functions is: the innermost function it is in, how
+ * deeply that function is nested (1 for functions declared at the top level),
+ * and the number of nodes visited before. */
+typedef struct {
+  symbol_t *function;
+  int depth;
+  int nodes;
+} walk_t;
+
+/* The hooks an analysis computes its facts with. The walk calls the hooks of
+ * every analysis it computes on one node before moving to the next, so they
+ * must only depend on the nodes visited before. Missing hooks are 0. */
+typedef struct {
+  void (*begin)(void);
+  void (*function)(stat_ast_t *, walk_t *); // The declaration, before its body
+  void (*function_end)(stat_ast_t *, walk_t *);
+  void (*stat)(stat_ast_t *, walk_t *); // Before the children of the node
+  void (*stat_end)(stat_ast_t *, walk_t *); // After them
+  void (*expr)(expr_ast_t *, walk_t *);
+  void (*expr_end)(expr_ast_t *, walk_t *);
+  void (*end)(void);
+} visitor_t;
+
+void run_passes(stat_ast_t *);
+bool pass_enabled(paola_pass_t);
+
+#endif
@@ -0,0 +1,228 @@
+#include <stdlib.h>
+#include <string.h>
+#include "pgo.h"
+#include "arena.h"
+#include "context.h"
+#include "errors.h"
+#include "hash.h"
+#include "outbuf.h"
+
+/* Profile-guided optimization. A program compiled with profile_generate counts
+ * how often its code runs, and writes the counts to the file profile_generate
+ * names when main returns. Compiling it again with the profile, see paola_set_profile, lets
+ * the code generator and the inliner act on the counts.
+ *
+ * The counters of a function are numbered in the order its checked and
+ * optimized AST is walked in: counter 0 counts the calls of the function, each
+ * if statement has two, for the runs of each of its arms (whether or not it
+ * has an else), each loop two, for its entries and the runs of its body, and
+ * each call one. The code of a function expanded in place counts into the
+ * counters of that function, so the counts are per line of source.
+ *
+ * The profile is text: PGO_MAGIC, then for every function a line
+ * "function NAME CHECKSUM COUNTERS" followed by the count of each counter on
+ * its own line. The checksum hashes the shape of the code the counters count.
+ * A function whose checksum or number of counters differs from the profile
+ * changed since it was profiled, and its counts are ignored with a warning. */
+
+// An arm that runs this many times less than the other one is cold.
+#define PGO_COLD_RATIO 1000
+
+static void start_numbering(void);
+static void end_numbering(void);
+static void number_function(stat_ast_t *, walk_t *);
+static void hash_function(stat_ast_t *, walk_t *);
+static void number_statement(stat_ast_t *, walk_t *);
+static void number_expression(expr_ast_t *, walk_t *);
+static void close_statement(stat_ast_t *, walk_t *);
+static void close_expression(expr_ast_t *, walk_t *);
+static void read_profile(void);
+static bool read_function(const char **, char **, uint64_t *, int *);
+static symbol_t *find_function(const char *);
+static void skip_space(const char **);
+
+/* The analysis that numbers the counters of every function, and gives the
+ * functions their counts, see passes.h. It only runs if the program is counted
+ * or optimized with a profile. */
+const visitor_t counters_visitor = {
+  .begin = start_numbering, .function = number_function, .function_end = hash_function,
+  .stat = number_statement, .stat_end = close_statement, .expr = number_expression,
+  .expr_end = close_expression, .end = end_numbering
+};
+
+// The description the checksum of the function being numbered hashes.
+static _Thread_local outbuf_t checksum_text;
+
+/* Returns the count of a counter of the function, or -1 if the profile has
+ * no counts for the function. */
+int64_t pgo_count(symbol_t *function, int counter) {
+  return function->counts ? function->counts[counter] : -1;
+}
+
+/* Returns true if code that ran count times is cold next to code that ran
+ * other times. Unknown counts are never cold. */
+bool pgo_cold(int64_t count, int64_t other) {
+  return count >= 0 && other > 0 && count * PGO_COLD_RATIO <= other;
+}
+
+static void start_numbering(void) {
+  outbuf_init_memory(&checksum_text);
+}
+
+/* Frees the description, and gives the functions their counts if the program
+ * is optimized with a profile. */
+static void end_numbering(void) {
+  outbuf_free(&checksum_text);
+  if (context->profile) {
+    read_profile();
+  }
+}
+
+/* Only the functions declared at the top level have counters. The code of the
+ * functions nested in them is left out of their checksums. */
+static void number_function(stat_ast_t *decl, walk_t *walk) {
+  if (walk->depth == 1) {
+    decl->symbol->counter_count = 1; // Its calls
+    checksum_text.size = 0;
+  }
+}
+
+static void hash_function(stat_ast_t *decl, walk_t *walk) {
+  if (walk->depth == 1) {
+    hash_t hash = hash_bytes(checksum_text.data, checksum_text.size);
+    decl->symbol->checksum = hash.hash[0];
+    decl->symbol->counts = 0;
+  }
+}
+
+/* Numbers the counters of the statement, and describes its shape: the types of
+ * its nodes, its operators and the functions it calls. */
+static void number_statement(stat_ast_t *stat, walk_t *walk) {
+  if (walk->depth != 1) {
+    return;
+  }
+  outbuf_char(&checksum_text, '(');
+  outbuf_int(&checksum_text, stat->type);
+  if (stat->type == IF_STAT || stat->type == WHILE_STAT || stat->type == FOR_STAT) {
+    stat->counter = walk->function->counter_count;
+    walk->function->counter_count += 2;
+  }
+}
+
+static void number_expression(expr_ast_t *expr, walk_t *walk) {
+  if (walk->depth != 1) {
+    return;
+  }
+  outbuf_char(&checksum_text, '(');
+  outbuf_int(&checksum_text, expr->type);
+  if (expr->type == BIN_OP) {
+    outbuf_int(&checksum_text, expr->op);
+  } else if (expr->type == FUNC_CALL) {
+    expr->counter = walk->function->counter_count++;
+    outbuf_str(&checksum_text, expr->name);
+  }
+}
+
+static void close_statement(stat_ast_t *stat, walk_t *walk) {
+  if (walk->depth == 1) {
+    outbuf_char(&checksum_text, ')');
+  }
+}
+
+static void close_expression(expr_ast_t *expr, walk_t *walk) {
+  if (walk->depth == 1) {
+    outbuf_char(&checksum_text, ')');
+  }
+}
+
+/* Gives the functions that match their profile their counts. Functions that
+ * are not in the profile keep the static estimates. */
+static void read_profile(void) {
+  const char *position = context->profile;
+  if (strncmp(position, PGO_MAGIC, strlen(PGO_MAGIC)) != 0) {
+    warning(0, "The profile was not written by a paola program, ignoring it.");
+    return;
+  }
+  position += strlen(PGO_MAGIC);
+  skip_space(&position);
+
+  while (*position) {
+    char *name;
+    uint64_t checksum;
+    int count;
+    if (!read_function(&position, &name, &checksum, &count)) {
+      warning(0, "The profile is malformed, ignoring the rest of it.");
+      return;
+    }
+    int64_t *counts = (int64_t *) arena_alloc(sizeof(int64_t) * (count + 1));
+    for (int i = 0; i < count; i++) {
+      char *end;
+      counts[i] = strtoll(position, &end, 10);
+      if (end == position || counts[i] < 0) {
+        warning(0, "The profile is malformed, ignoring the rest of it.");
+        return;
+      }
+      position = end;
+      skip_space(&position);
+    }
+
+    symbol_t *function = find_function(name);
+    if (!function) {
+      continue;
+    }
+    if (function->checksum != checksum || function->counter_count != count) {
+      warning(&function->decl->pos,
+          "The profile of function %s does not match its code, ignoring it.", name);
+      continue;
+    }
+    function->counts = counts;
+  }
+}
+
+/* Reads the line that starts the counts of a function. */
+static bool read_function(const char **position, char **name, uint64_t *checksum,
+    int *count) {
+  const char *p = *position;
+  if (strncmp(p, "function ", 9) != 0) {
+    return false;
+  }
+  p += 9;
+  size_t length = strcspn(p, " \n");
+  if (length == 0 || p[length] != ' ') {
+    return false;
+  }
+  *name = (char *) arena_alloc(length + 1);
+  memcpy(*name, p, length);
+  (*name)[length] = '\0';
+  p += length;
+
+  char *end;
+  *checksum = strtoull(p, &end, 16);
+  if (end == p) {
+    return false;
+  }
+  p = end;
+  long counters = strtol(p, &end, 10);
+  if (end == p || counters < 1 || counters > 1 << 24) {
+    return false;
+  }
+  *count = (int) counters;
+  *position = end;
+  skip_space(position);
+  return true;
+}
+
+static symbol_t *find_function(const char *name) {
+  for (int i = 0; i < context->function_count; i++) {
+    if (strcmp(context->functions[i]->name, name) == 0) {
+      return context->functions[i];
+    }
+  }
+  return NULL;
+}
+
+static void skip_space(const char **position) {
+  while (**position == ' ' || **position == '\n') {
+    (*position)++;
+  }
+}
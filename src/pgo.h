@@ -0,0 +1,15 @@
+#ifndef PGO_H
+#define PGO_H
+#include <stdbool.h>
+#include <stdint.h>
+#include "parser.h"
+#include "passes.h"
+
+#define PGO_MAGIC "# paola profile 1"
+
+extern const visitor_t counters_visitor;
+
+int64_t pgo_count(symbol_t *, int);
+bool pgo_cold(int64_t, int64_t);
+
+#endif
@@ -0,0 +1,138 @@
+#include <stdlib.h>
+#include <threads.h>
+#include "pool.h"
+#include "context.h"
+
+/* Work stealing thread pool. The tasks are numbered, and every worker starts
+ * with an equal share of consecutive task numbers. A worker takes tasks from
+ * the front of its own share, and once it runs out, steals the back half of
+ * the largest remaining share. No tasks are added while the pool runs, so a
+ * worker that finds every share empty is done. The calling thread is one of
+ * the workers, and the others work in its context. */
+
+typedef struct {
+  mtx_t lock;
+  int next, end; // The tasks [next, end) are left to this worker
+} share_t;
+
+typedef struct {
+  int id;
+  int worker_count;
+  share_t *shares;
+  pool_task_t task;
+  void *data;
+  paola_ctx_t *context;
+} worker_t;
+
+static int work(void *);
+static bool take(worker_t *, int *);
+static bool steal(worker_t *);
+
+/* Runs task(i, worker, data) for every i in [0, count) on the given number of
+ * threads, and waits for all of them to finish. Workers are numbered from 0,
+ * and fewer than threads. */
+void pool_run(int threads, int count, pool_task_t task, void *data) {
+  if (threads > count) {
+    threads = count;
+  }
+  if (threads <= 1) {
+    for (int i = 0; i < count; i++) {
+      task(i, 0, data);
+    }
+    return;
+  }
+
+  share_t *shares = (share_t *) malloc(sizeof(share_t) * threads);
+  worker_t *workers = (worker_t *) malloc(sizeof(worker_t) * threads);
+  thrd_t *ids = (thrd_t *) malloc(sizeof(thrd_t) * threads);
+  for (int i = 0; i < threads; i++) {
+    mtx_init(&shares[i].lock, mtx_plain);
+    shares[i].next = (int) ((int64_t) count * i / threads);
+    shares[i].end = (int) ((int64_t) count * (i + 1) / threads);
+    workers[i] = (worker_t) {i, threads, shares, task, data, context};
+  }
+
+  int started = 1;
+  for (; started < threads; started++) {
+    if (thrd_create(&ids[started], work, &workers[started]) != thrd_success) {
+      break; // The workers that did start share the rest of the tasks.
+    }
+  }
+  work(&workers[0]);
+  for (int i = 1; i < started; i++) {
+    thrd_join(ids[i], NULL);
+  }
+
+  for (int i = 0; i < threads; i++) {
+    mtx_destroy(&shares[i].lock);
+  }
+  free(shares);
+  free(workers);
+  free(ids);
+}
+
+static int work(void *arg) {
+  worker_t *worker = (worker_t *) arg;
+  context = worker->context;
+  int task;
+  do {
+    while (take(worker, &task)) {
+      worker->task(task, worker->id, worker->data);
+    }
+  } while (steal(worker));
+  return 0;
+}
+
+/* Takes the next task of the worker's own share. */
+static bool take(worker_t *worker, int *task) {
+  share_t *share = &worker->shares[worker->id];
+  mtx_lock(&share->lock);
+  bool found = share->next < share->end;
+  if (found) {
+    *task = share->next++;
+  }
+  mtx_unlock(&share->lock);
+  return found;
+}
+
+/* Moves the back half of the largest other share into the worker's own.
+ * Returns false if there is nothing left to steal. */
+static bool steal(worker_t *worker) {
+  while (true) {
+    int victim = -1, largest = 0;
+    for (int i = 0; i < worker->worker_count; i++) {
+      share_t *share = &worker->shares[i];
+      mtx_lock(&share->lock);
+      int left = share->end - share->next;
+      mtx_unlock(&share->lock);
+      if (i != worker->id && left > largest) {
+        victim = i;
+        largest = left;
+      }
+    }
+    if (victim == -1) {
+      return false;
+    }
+
+    share_t *from = &worker->shares[victim];
+    int begin = 0, end = 0;
+    mtx_lock(&from->lock);
+    int left = from->end - from->next;
+    if (left > 0) {
+      end = from->end;
+      begin = from->end - (left + 1) / 2;
+      from->end = begin;
+    }
+    mtx_unlock(&from->lock);
+    if (begin == end) {
+      continue; // The victim finished its share meanwhile, look again.
+    }
+
+    share_t *own = &worker->shares[worker->id];
+    mtx_lock(&own->lock);
+    own->next = begin;
+    own->end = end;
+    mtx_unlock(&own->lock);
+    return true;
+  }
+}
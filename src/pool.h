@@ -0,0 +1,11 @@
+#ifndef POOL_H
+#define POOL_H
+#include <stdbool.h>
+#include <stdint.h>
+
+// Runs a task, given its number and the number of the worker running it.
+typedef void (*pool_task_t)(int, int, void *);
+
+void pool_run(int, int, pool_task_t, void *);
+
+#endif
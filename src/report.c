@@ -0,0 +1,359 @@
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+#include <time.h>
+#include "report.h"
+#include "context.h"
+
+/* Phases are timed and measured by the thread that runs the compilation,
+ * between its calls to phase_begin and phase_end. The spans of chunks and
+ * functions are added by whichever worker handles them. The trace is in the
+ * trace event format of Chrome, which trace viewers load. */
+
+static const char *phase_names[PHASE_COUNT] = {
+  "lexer", "parser", "semcheck", "ctfe", "deadcode", "loopopt", "inline", "analysis",
+  "codegen"
+};
+static const char *statement_names[SKIP_STAT + 1] = {
+  "invalid", "return", "if", "while", "for", "block", "declaration", "expression", "skip"
+};
+static const char *expression_names[FUNC_CALL + 1] = {
+  "invalid", "literal", "operator", "variable", "call"
+};
+
+static double cpu_time(void);
+static long max_rss(void);
+static void count_statement(stat_ast_t *);
+static void count_expression(expr_ast_t *);
+static void print_counts(outbuf_t *, const char *, int *, const char **, int);
+static void print_number(outbuf_t *, double, int);
+static void print_row(outbuf_t *, const char *, const phase_report_t *);
+static void print_string(outbuf_t *, const char *);
+
+void report_init(report_t *report) {
+  mtx_init(&report->lock, mtx_plain);
+  report->spans = NULL;
+  report->span_capacity = 0;
+  outbuf_init_memory(&report->text);
+}
+
+void report_destroy(report_t *report) {
+  mtx_destroy(&report->lock);
+  free(report->spans);
+  outbuf_free(&report->text);
+}
+
+/* Forgets the measurements of the previous compilation, and starts measuring
+ * the next one if it is enabled. */
+void report_start(bool enabled) {
+  report_t *report = &context->report;
+  report->enabled = enabled;
+  report->span_count = 0;
+  report->tokens = 0;
+  for (int i = 0; i < PHASE_COUNT; i++) {
+    report->phases[i].ran = false;
+  }
+  for (int i = 0; i <= SKIP_STAT; i++) {
+    report->statements[i] = 0;
+  }
+  for (int i = 0; i <= FUNC_CALL; i++) {
+    report->expressions[i] = 0;
+  }
+  atomic_store(&report->lookups, 0);
+  atomic_store(&report->probes, 0);
+  timespec_get(&report->start, TIME_UTC);
+}
+
+void phase_begin(phase_t phase) {
+  report_t *report = &context->report;
+  if (!report->enabled) {
+    return;
+  }
+  report->phase_wall = report_time();
+  report->phase_cpu = cpu_time();
+  report->phase_lookups = atomic_load(&report->lookups);
+  report->phase_probes = atomic_load(&report->probes);
+}
+
+/* Ends the phase. A phase that runs several times, like the analyses, adds up
+ * its runs. */
+void phase_end(phase_t phase) {
+  report_t *report = &context->report;
+  if (!report->enabled) {
+    return;
+  }
+  phase_report_t *result = &report->phases[phase];
+  if (!result->ran) {
+    result->ran = true;
+    result->wall = result->cpu = 0;
+    result->lookups = result->probes = 0;
+  }
+  result->wall += report_time() - report->phase_wall;
+  result->cpu += cpu_time() - report->phase_cpu;
+  result->lookups += atomic_load(&report->lookups) - report->phase_lookups;
+  result->probes += atomic_load(&report->probes) - report->phase_probes;
+  result->arena = context->arena.allocated;
+  result->max_rss = max_rss();
+  report_span(phase_names[phase], -1, "phase", 0, report->phase_wall);
+}
+
+/* Returns the seconds since the compilation started, or 0 if it is not being
+ * measured. */
+double report_time(void) {
+  if (!context->report.enabled) {
+    return 0;
+  }
+  struct timespec now;
+  timespec_get(&now, TIME_UTC);
+  const struct timespec *start = &context->report.start;
+  return (double) (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+/* Adds a span of the given worker from the start time until now. The name is
+ * kept, and must last until the next compilation. */
+void report_span(const char *name, int number, const char *category, int worker, double start) {
+  report_t *report = &context->report;
+  if (!report->enabled) {
+    return;
+  }
+  span_t span = {name, number, category, worker, start, report_time()};
+  mtx_lock(&report->lock);
+  if (report->span_count == report->span_capacity) {
+    report->span_capacity = report->span_capacity ? report->span_capacity * 2 : 64;
+    report->spans = (span_t *) realloc(report->spans, sizeof(span_t) * report->span_capacity);
+  }
+  report->spans[report->span_count++] = span;
+  mtx_unlock(&report->lock);
+}
+
+/* Counts a lookup in the symbol table that compared the given number of
+ * symbols. */
+void report_lookup(int probes) {
+  report_t *report = &context->report;
+  if (!report->enabled) {
+    return;
+  }
+  atomic_fetch_add_explicit(&report->lookups, 1, memory_order_relaxed);
+  atomic_fetch_add_explicit(&report->probes, (uint_fast64_t) probes, memory_order_relaxed);
+}
+
+void report_tokens(token_t *tokens) {
+  if (!context->report.enabled) {
+    return;
+  }
+  int count = 0;
+  while (tokens[count].type != PROGRAM_END_TOK) {
+    count++;
+  }
+  context->report.tokens = count;
+}
+
+/* Counts the nodes of the AST by their type. */
+void report_ast(stat_ast_t *ast) {
+  if (context->report.enabled) {
+    count_statement(ast);
+  }
+}
+
+/* Returns the report of the last compilation, a table of the phases followed
+ * by what they worked on. Phases that did not run are left out. */
+const char *report_text(void) {
+  report_t *report = &context->report;
+  outbuf_t *text = &report->text;
+  text->size = 0;
+  if (!report->enabled) {
+    outbuf_char(text, '\0');
+    return text->data;
+  }
+
+  outbuf_str(text, "Phase        Wall ms    CPU ms   Lookups    Probes  Arena KB  Max RSS KB\n");
+  phase_report_t total = {true, 0, 0, 0, 0, 0, 0};
+  for (int i = 0; i < PHASE_COUNT; i++) {
+    phase_report_t *phase = &report->phases[i];
+    if (!phase->ran) {
+      continue;
+    }
+    print_row(text, phase_names[i], phase);
+    total.wall += phase->wall;
+    total.cpu += phase->cpu;
+    total.lookups += phase->lookups;
+    total.probes += phase->probes;
+    total.arena = phase->arena;
+    total.max_rss = phase->max_rss;
+  }
+  print_row(text, "total", &total);
+
+  outbuf_str(text, "Tokens: ");
+  outbuf_int(text, report->tokens);
+  outbuf_char(text, '\n');
+  print_counts(text, "Statements", report->statements, statement_names, SKIP_STAT + 1);
+  print_counts(text, "Expressions", report->expressions, expression_names, FUNC_CALL + 1);
+  outbuf_char(text, '\0');
+  return text->data;
+}
+
+/* Returns the spans of the last compilation as a trace: the phases on the
+ * thread that ran the compilation, and the chunks and functions on the workers
+ * that handled them. */
+const char *report_trace(void) {
+  report_t *report = &context->report;
+  outbuf_t *text = &report->text;
+  text->size = 0;
+  outbuf_str(text, "{\"traceEvents\":[");
+  int workers = 0;
+  for (int i = 0; i < report->span_count; i++) {
+    span_t *span = &report->spans[i];
+    outbuf_str(text, i > 0 ? ",\n" : "\n");
+    outbuf_str(text, "{\"name\":\"");
+    print_string(text, span->name);
+    if (span->number >= 0) {
+      outbuf_char(text, ' ');
+      outbuf_int(text, span->number);
+    }
+    outbuf_str(text, "\",\"cat\":\"");
+    outbuf_str(text, span->category);
+    outbuf_str(text, "\",\"ph\":\"X\",\"pid\":1,\"tid\":");
+    outbuf_int(text, span->worker);
+    outbuf_str(text, ",\"ts\":");
+    print_number(text, span->start * 1e6, 3);
+    outbuf_str(text, ",\"dur\":");
+    print_number(text, (span->end - span->start) * 1e6, 3);
+    outbuf_char(text, '}');
+    if (span->worker >= workers) {
+      workers = span->worker + 1;
+    }
+  }
+  for (int i = 0; i < workers; i++) {
+    outbuf_str(text, report->span_count + i > 0 ? ",\n" : "\n");
+    outbuf_str(text, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":");
+    outbuf_int(text, i);
+    outbuf_str(text, ",\"args\":{\"name\":\"worker ");
+    outbuf_int(text, i);
+    outbuf_str(text, "\"}}");
+  }
+  outbuf_str(text, "\n],\"displayTimeUnit\":\"ms\"}\n");
+  outbuf_char(text, '\0');
+  return text->data;
+}
+
+/* Returns the processor time of the whole process, so that a phase is charged
+ * for the time of its workers too. */
+static double cpu_time(void) {
+  return (double) clock() / CLOCKS_PER_SEC;
+}
+
+static long max_rss(void) {
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) != 0) {
+    return 0;
+  }
+  return usage.ru_maxrss;
+}
+
+static void count_statement(stat_ast_t *stat) {
+  if (!stat) {
+    return;
+  }
+  context->report.statements[stat->type]++;
+  switch (stat->type) {
+    case RETURN_STAT:
+    case EXPR_STAT:
+      count_expression(stat->expr);
+      break;
+    case IF_STAT:
+      count_expression(stat->cond);
+      count_statement(stat->tstat);
+      count_statement(stat->fstat);
+      break;
+    case WHILE_STAT:
+      count_expression(stat->cond);
+      count_statement(stat->body);
+      break;
+    case FOR_STAT:
+      count_expression(stat->init);
+      count_expression(stat->cond);
+      count_expression(stat->iter);
+      count_statement(stat->body);
+      break;
+    case BLOCK_STAT:
+      for (list_elem_t *e = list_begin(&stat->stats); e != list_end(&stat->stats);
+          e = list_next(e)) {
+        count_statement(list_entry(e, stat_ast_t, block_elem));
+      }
+      break;
+    case DECL_STAT:
+      if (stat->is_func) {
+        count_statement(stat->func_body);
+      } else {
+        count_expression(stat->value);
+      }
+      break;
+    default:
+      break;
+  }
+}
+
+static void count_expression(expr_ast_t *expr) {
+  if (!expr) {
+    return;
+  }
+  context->report.expressions[expr->type]++;
+  if (expr->type == BIN_OP) {
+    count_expression(expr->left);
+    count_expression(expr->right);
+  }
+}
+
+/* Prints the total of the counts, followed by the count of each kind. */
+static void print_counts(outbuf_t *text, const char *title, int *counts, const char **names,
+    int kinds) {
+  int total = 0;
+  for (int i = 0; i < kinds; i++) {
+    total += counts[i];
+  }
+  outbuf_str(text, title);
+  outbuf_str(text, ": ");
+  outbuf_int(text, total);
+  const char *separator = " (";
+  for (int i = 1; i < kinds; i++) { // Without the invalid ones
+    outbuf_str(text, separator);
+    outbuf_str(text, names[i]);
+    outbuf_char(text, ' ');
+    outbuf_int(text, counts[i]);
+    separator = ", ";
+  }
+  outbuf_str(text, ")\n");
+}
+
+static void print_number(outbuf_t *text, double value, int decimals) {
+  char number[64];
+  snprintf(number, sizeof(number), "%.*f", decimals, value);
+  outbuf_str(text, number);
+}
+
+static void print_row(outbuf_t *text, const char *name, const phase_report_t *phase) {
+  char row[160];
+  snprintf(row, sizeof(row), "%-9s %10.3f %9.3f %9llu %9llu %9llu %11ld\n", name,
+      phase->wall * 1000, phase->cpu * 1000, (unsigned long long) phase->lookups,
+      (unsigned long long) phase->probes, (unsigned long long) (phase->arena >> 10),
+      phase->max_rss);
+  outbuf_str(text, row);
+}
+
+/* Prints the string escaped for JSON. */
+static void print_string(outbuf_t *text, const char *string) {
+  for (; *string; string++) {
+    if (*string == '"' || *string == '\\') {
+      outbuf_char(text, '\\');
+    }
+    if ((unsigned char) *string < ' ') {
+      char escape[8];
+      snprintf(escape, sizeof(escape), "\\u%04x", (unsigned char) *string);
+      outbuf_str(text, escape);
+    } else {
+      outbuf_char(text, *string);
+    }
+  }
+}
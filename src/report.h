@@ -0,0 +1,75 @@
+#ifndef REPORT_H
+#define REPORT_H
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <threads.h>
+#include "lexer.h"
+#include "outbuf.h"
+#include "parser.h"
+
+/* Measurements of a compilation, taken when the options ask for a report: the
+ * time and memory each phase takes and what it works on, and a span of time for
+ * each chunk or function that a phase handles on its own. */
+
+typedef enum {
+  PHASE_LEXER,
+  PHASE_PARSER,
+  PHASE_SEMCHECK,
+  PHASE_CTFE,
+  PHASE_DEADCODE,
+  PHASE_LOOPOPT,
+  PHASE_INLINE,
+  PHASE_ANALYSIS, // All the walks of the analyses the passes require
+  PHASE_CODEGEN,
+  PHASE_COUNT
+} phase_t;
+
+typedef struct {
+  bool ran;
+  double wall, cpu; // In seconds
+  uint64_t lookups, probes; // In the symbol table, see symtable_find
+  uint64_t arena; // Bytes held by the arena at the end, the most during the phase
+  long max_rss; // Most memory the process has held, in kilobytes
+} phase_report_t;
+
+typedef struct {
+  const char *name; // Followed by the number, unless it is negative
+  int number;
+  const char *category;
+  int worker;
+  double start, end; // In seconds since the compilation started
+} span_t;
+
+typedef struct {
+  bool enabled;
+  struct timespec start;
+  double phase_wall, phase_cpu; // When the current phase began
+  uint64_t phase_lookups, phase_probes;
+  phase_report_t phases[PHASE_COUNT];
+
+  atomic_uint_fast64_t lookups, probes;
+  int tokens;
+  int statements[SKIP_STAT + 1];
+  int expressions[FUNC_CALL + 1];
+
+  mtx_t lock; // Of the spans
+  span_t *spans;
+  int span_count, span_capacity;
+  outbuf_t text; // The last report or trace asked for
+} report_t;
+
+void report_init(report_t *);
+void report_destroy(report_t *);
+void report_start(bool);
+void phase_begin(phase_t);
+void phase_end(phase_t);
+double report_time(void);
+void report_span(const char *, int, const char *, int, double);
+void report_lookup(int);
+void report_tokens(token_t *);
+void report_ast(stat_ast_t *);
+const char *report_text(void);
+const char *report_trace(void);
+
+#endif
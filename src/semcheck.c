@@ -1,25 +1,104 @@
 #pragma GCC diagnostic ignored "-Wwrite-strings"
 
+#include <stdlib.h>
 #include "semcheck.h"
 #include "list.h"
 #include "symtable.h"
 #include "errors.h"
+#include "callgraph.h"
+#include "pool.h"
+#include "report.h"
 
+/* A top-level statement. Function bodies are checked in parallel once every
+ * global declaration has been, each seeing the global symbols declared before
+ * it. The messages of each statement are kept apart, and reported in source
+ * order at the end. */
+typedef struct {
+  stat_ast_t *stat;
+  int visible_globals;
+  bool check_body;
+  list_t messages;
+} semcheck_task_t;
+
+static void semcheck_task(int, int, void *);
 static void semcheck_stat(stat_ast_t *);
+static void semcheck_decl(stat_ast_t *, semcheck_task_t *);
+static void semcheck_function_body(stat_ast_t *);
+static void add_functions(stat_ast_t *);
 static datatype_t semcheck_expr(expr_ast_t *);
 static datatype_t semcheck_binop(expr_ast_t *);
 static void type_error(position_t *pos, datatype_t, datatype_t, char const *);
 static void init_semcheck(void);
 static bool is_const(expr_ast_t *);
 
-void semcheck(stat_ast_t *ast) {
-  init_semcheck();
+// Number of function bodies being checked, 0 at global scope.
+static _Thread_local int function_depth;
+// Function whose body is being checked, and the number of loops and if
+// statements around the current statement within it.
+static _Thread_local symbol_t *current_function;
+static _Thread_local int loop_depth, branch_depth;
 
+/* Checks the program, with the function bodies split among the given number
+ * of threads. */
+void semcheck(stat_ast_t *ast, int threads) {
+  init_semcheck();
   symtable_open_scope("global");
-  semcheck_stat(ast);
+
+  int count = 0;
+  for (list_elem_t *e = list_begin(&ast->stats); e != list_end(&ast->stats);
+      e = list_next(e)) {
+    count++;
+  }
+
+  semcheck_task_t *tasks = (semcheck_task_t *) malloc(sizeof(semcheck_task_t) * (count + 1));
+  int i = 0;
+  for (list_elem_t *e = list_begin(&ast->stats); e != list_end(&ast->stats);
+      e = list_next(e), i++) {
+    semcheck_task_t *task = &tasks[i];
+    task->stat = list_entry(e, stat_ast_t, block_elem);
+    task->check_body = false;
+    list_init(&task->messages);
+
+    errors_redirect(&task->messages);
+    if (task->stat->type == DECL_STAT) {
+      semcheck_decl(task->stat, task);
+    } else {
+      semcheck_stat(task->stat);
+    }
+    task->visible_globals = symtable_global_count();
+  }
+  errors_redirect(NULL);
+
+  pool_run(threads, count, semcheck_task, tasks);
+
+  for (i = 0; i < count; i++) {
+    errors_append(&tasks[i].messages);
+  }
+  free(tasks);
+
+  // Functions are numbered in source order, whichever thread checked them.
+  add_functions(ast);
+  callgraph_count_calls();
   symtable_close_scope();
 }
 
+static void semcheck_task(int index, int worker, void *data) {
+  semcheck_task_t *task = &((semcheck_task_t *) data)[index];
+  if (!task->check_body) {
+    return;
+  }
+
+  double start = report_time();
+  errors_redirect(&task->messages);
+  symtable_init_thread(task->visible_globals);
+  function_depth = 0;
+  current_function = NULL;
+  loop_depth = branch_depth = 0;
+  semcheck_function_body(task->stat);
+  errors_redirect(NULL);
+  report_span(task->stat->target, -1, "semcheck", worker, start);
+}
+
 static void semcheck_stat(stat_ast_t *stat) {
   switch (stat->type) {
     case INVALID_STAT: {
@@ -36,28 +115,35 @@ static void semcheck_stat(stat_ast_t *stat) {
         type_error(&stat->pos, INT_DT, condition_type, "if condition expression");
       }
 
+      branch_depth++;
       semcheck_stat(stat->tstat);
       if (stat->fstat) {
         semcheck_stat(stat->fstat);
       }
+      branch_depth--;
       break;
     } case WHILE_STAT: {
+      loop_depth++;
       datatype_t condition_type = semcheck_expr(stat->cond);
       if (condition_type != INT_DT) {
         type_error(&stat->pos, INT_DT, condition_type, "while condition expression");
       }
 
       semcheck_stat(stat->body);
+      loop_depth--;
       break;
     } case FOR_STAT: {
+      semcheck_expr(stat->init);
+
+      loop_depth++;
       datatype_t condition_type = semcheck_expr(stat->cond);
       if (condition_type != INT_DT) {
         type_error(&stat->pos, INT_DT, condition_type, "for condition expression");
       }
 
-      semcheck_expr(stat->init);
       semcheck_expr(stat->iter);
       semcheck_stat(stat->body);
+      loop_depth--;
       break;
     } case BLOCK_STAT: {
       for (list_elem_t *e = list_begin(&(stat->stats)); e != list_end(&(stat->stats));
@@ -67,33 +153,7 @@ static void semcheck_stat(stat_ast_t *stat) {
       }
       break;
     } case DECL_STAT: {
-      symbol_t *symbol = symtable_find(stat->target);
-      if (symbol) {
-        error(&stat->pos, "%s is already defined in this scope.", stat->target);
-        break;
-      }
-
-      if (stat->is_func) {
-        if (stat->func_body->type != BLOCK_STAT) {
-          error(&stat->pos, "Function body must be a block statement.");
-        }
-
-        symtable_open_scope(stat->target);
-        semcheck_stat(stat->func_body);
-        symtable_close_scope();
-      } else { // Variable declaration
-        if (stat->value) {
-          datatype_t value_type = semcheck_expr(stat->value);
-          if (value_type != stat->datatype) {
-            type_error(&stat->pos, stat->datatype, value_type, "variable initialization");
-            // Intentionally do not break here, continue to add the variable to
-            // the symbol table.
-          }
-        }
-      }
-
-      stat->symbol = create_symtable_entry(stat->target, stat->datatype);
-      symtable_insert(stat->symbol);
+      semcheck_decl(stat, NULL);
       break;
     } case EXPR_STAT: {
       semcheck_expr(stat->expr);
@@ -107,6 +167,108 @@ static void semcheck_stat(stat_ast_t *stat) {
   }
 }
 
+/* Checks a declaration. The body of a function is checked right away, unless
+ * a task is given to check it later. */
+static void semcheck_decl(stat_ast_t *stat, semcheck_task_t *task) {
+  symbol_t *symbol = symtable_find(stat->target);
+  if (symbol && symbol->is_func && stat->is_func && !symbol->decl->func_body
+      && stat->func_body) {
+    // Definition of a function that was declared earlier.
+    stat->symbol = symbol;
+    symbol->decl = stat;
+  } else if (symbol) {
+    error(&stat->pos, "%s is already defined in this scope.", stat->target);
+    stat->symbol = NULL;
+    return;
+  } else {
+    stat->symbol = create_symtable_entry(stat->target, stat->datatype);
+  }
+
+  if (stat->is_func) {
+    // The function is in scope in its own body, so that it can recurse.
+    if (!symbol) {
+      stat->symbol->is_func = true;
+      stat->symbol->decl = stat;
+      symtable_insert(stat->symbol);
+    }
+
+    if (stat->func_body) {
+      if (stat->func_body->type != BLOCK_STAT) {
+        error(&stat->pos, "Function body must be a block statement.");
+      }
+
+      if (task) {
+        task->check_body = true;
+      } else {
+        semcheck_function_body(stat);
+      }
+    }
+  } else { // Variable declaration
+    stat->symbol->is_global = (function_depth == 0);
+    if (stat->symbol->is_global && stat->value && stat->value->type != INT_LIT) {
+      error(&stat->pos, "Initial value of global variable %s must be a constant.",
+          stat->target);
+    }
+
+    if (stat->value) {
+      datatype_t value_type = semcheck_expr(stat->value);
+      if (value_type != stat->datatype) {
+        type_error(&stat->pos, stat->datatype, value_type, "variable initialization");
+        // Intentionally do not add return here, continue to add the variable
+        // to the symbol table.
+      }
+    }
+    symtable_insert(stat->symbol);
+  }
+}
+
+static void semcheck_function_body(stat_ast_t *stat) {
+  symbol_t *enclosing = current_function;
+  int enclosing_loops = loop_depth, enclosing_branches = branch_depth;
+  current_function = stat->symbol;
+  loop_depth = branch_depth = 0;
+
+  function_depth++;
+  symtable_open_scope(stat->target);
+  semcheck_stat(stat->func_body);
+  symtable_close_scope();
+  function_depth--;
+
+  current_function = enclosing;
+  loop_depth = enclosing_loops;
+  branch_depth = enclosing_branches;
+}
+
+/* Adds the defined functions to the call graph, in source order. */
+static void add_functions(stat_ast_t *stat) {
+  switch (stat->type) {
+    case IF_STAT:
+      add_functions(stat->tstat);
+      if (stat->fstat) {
+        add_functions(stat->fstat);
+      }
+      break;
+    case WHILE_STAT:
+    case FOR_STAT:
+      add_functions(stat->body);
+      break;
+    case BLOCK_STAT:
+      for (list_elem_t *e = list_begin(&stat->stats); e != list_end(&stat->stats);
+          e = list_next(e)) {
+        add_functions(list_entry(e, stat_ast_t, block_elem));
+      }
+      break;
+    case DECL_STAT:
+      if (stat->is_func && stat->func_body && stat->symbol && stat->symbol->decl == stat) {
+        callgraph_add_function(stat->symbol);
+        add_functions(stat->func_body);
+      }
+      break;
+    default:
+      break;
+  }
+}
+
 static datatype_t semcheck_expr(expr_ast_t *expr) {
   switch (expr->type) {
     case INVALID_EXPR: {
@@ -122,7 +284,18 @@ static datatype_t semcheck_expr(expr_ast_t *expr) {
         error(&expr->pos, "Symbol %s not defined in current scope.", expr->name);
         return INVALID_DT;
       }
+      if (expr->type == FUNC_CALL && !symbol->is_func) {
+        error(&expr->pos, "%s is not a function.", expr->name);
+        return INVALID_DT;
+      } else if (expr->type == VAR_REF && symbol->is_func) {
+        error(&expr->pos, "%s is a function, not a variable.", expr->name);
+        return INVALID_DT;
+      }
+
       expr->symbol = symbol;
+      if (expr->type == FUNC_CALL) {
+        callgraph_add_call(current_function, expr, loop_depth, branch_depth > 0);
+      }
       return symbol->datatype;
     } default: {
       error(&expr->pos, "Don't know how to semantically check expression %s.",
@@ -202,4 +375,8 @@ static void type_error(position_t *pos, datatype_t expected, datatype_t actual,
 
 void init_semcheck() {
   symtable_init();
+  function_depth = 0;
+  current_function = NULL;
+  loop_depth = branch_depth = 0;
+  callgraph_init();
 }
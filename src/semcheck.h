@@ -2,6 +2,6 @@
 #define SEMCHECK_H
 #include "parser.h"
 
-void semcheck(stat_ast_t *);
+void semcheck(stat_ast_t *, int);
 
 #endif
@@ -0,0 +1,463 @@
+#define _DEFAULT_SOURCE
+
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <threads.h>
+#include <time.h>
+#include <unistd.h>
+#include "server.h"
+#include "libpaola.h"
+#include "utils.h"
+
+/* The main thread accepts connections and queues them. Worker threads take
+ * connections off the queue and answer them one at a time. Each worker compiles
+ * with contexts of its own, created when the server starts and reused for all
+ * of its requests, so their memory is allocated once, and requests that run at
+ * the same time share nothing. */
+
+#define MAX_REQUEST_SIZE (64 << 20)
+
+// How long a client has to send its whole request, and to read the whole
+// response, before it is dropped so that it does not hold a worker.
+#define IO_DEADLINE_SECONDS 10
+
+typedef struct {
+  int fd;
+  struct timespec accepted;
+} connection_t;
+
+typedef struct {
+  paola_ctx_t *contexts[2]; // Compiling to assembly, and to objects
+} worker_t;
+
+static struct {
+  mtx_t lock;
+  cnd_t ready; // Signalled when a connection is queued, or the server stops.
+  connection_t *queue; // Circular, count connections from head on
+  int head, count, capacity;
+  bool stopping;
+  int listener;
+  // Of the code the server compiles, requests must match
+  bool frame_pointer;
+  unsigned disabled_passes;
+
+  // Statistics
+  int workers, busy, max_count;
+  long served;
+  double total_latency, max_latency; // In seconds, from accept to the response
+} server;
+
+static bool listen_on(const char *);
+static void enqueue(int);
+static int work(void *);
+static void answer(worker_t *, int);
+static void respond(int, int, const char *, size_t, const char *);
+static const char *mismatch(const request_header_t *);
+static char *stats(void);
+static bool socket_address(const char *, struct sockaddr_un *);
+static bool read_all(int, void *, size_t, const struct timespec *);
+static bool write_all(int, const void *, size_t, const struct timespec *);
+static bool wait_for(int, short, const struct timespec *);
+static struct timespec deadline_in(int);
+static double seconds_since(const struct timespec *);
+
+/* Serves requests on the socket at the path until a shutdown request, with a
+ * worker thread per job of the options. The code is compiled with their frame
+ * pointer and disabled passes, the others only apply to local compiles. */
+int serve(const char *path, const paola_options_t *options) {
+  if (!listen_on(path)) {
+    return PAOLA_OTHER_ERR;
+  }
+
+  mtx_init(&server.lock, mtx_plain);
+  cnd_init(&server.ready);
+  server.capacity = 16;
+  server.queue = (connection_t *) malloc(sizeof(connection_t) * server.capacity);
+  int jobs = options->jobs < 1 ? 1 : options->jobs;
+  server.workers = jobs;
+  server.frame_pointer = options->frame_pointer;
+  server.disabled_passes = options->disabled_passes;
+
+  paola_options_t outputs[2] = {{PAOLA_ASSEMBLY, 1, false, false}, {PAOLA_OBJECT, 1, false, false}};
+  for (int i = 0; i < 2; i++) {
+    outputs[i].frame_pointer = options->frame_pointer;
+    outputs[i].disabled_passes = options->disabled_passes;
+  }
+  worker_t *workers = (worker_t *) malloc(sizeof(worker_t) * jobs);
+  thrd_t *threads = (thrd_t *) malloc(sizeof(thrd_t) * jobs);
+  int started = 0;
+  for (; started < jobs; started++) {
+    workers[started].contexts[0] = paola_create(&outputs[0]);
+    workers[started].contexts[1] = paola_create(&outputs[1]);
+    if (thrd_create(&threads[started], work, &workers[started]) != thrd_success) {
+      paola_destroy(workers[started].contexts[0]);
+      paola_destroy(workers[started].contexts[1]);
+      break;
+    }
+  }
+  printf("Listening on %s with %d workers.\n", path, started);
+  fflush(stdout);
+
+  while (started > 0) {
+    int fd = accept(server.listener, NULL, NULL);
+    mtx_lock(&server.lock);
+    bool stopping = server.stopping;
+    mtx_unlock(&server.lock);
+    if (stopping) {
+      if (fd != -1) {
+        close(fd);
+      }
+      break;
+    }
+    if (fd != -1) {
+      enqueue(fd);
+    } else if (errno != EINTR && errno != ECONNABORTED) {
+      printf("Could not accept connections on %s.\n", path);
+      break;
+    }
+  }
+
+  /* Let the workers answer what is queued and stop. */
+  mtx_lock(&server.lock);
+  server.stopping = true;
+  cnd_broadcast(&server.ready);
+  mtx_unlock(&server.lock);
+  for (int i = 0; i < started; i++) {
+    thrd_join(threads[i], NULL);
+    paola_destroy(workers[i].contexts[0]);
+    paola_destroy(workers[i].contexts[1]);
+  }
+  close(server.listener);
+  unlink(path);
+
+  free(workers);
+  free(threads);
+  free(server.queue);
+  cnd_destroy(&server.ready);
+  mtx_destroy(&server.lock);
+  return started > 0 ? PAOLA_OK : PAOLA_OTHER_ERR;
+}
+
+/* Sends a request to compile with the options to the server at the path, and
+ * reads its response. Returns false if the server could not be reached, or did
+ * not answer. */
+bool server_request(const char *path, request_kind_t kind, const paola_options_t *options,
+    const char *payload, size_t size, response_t *response) {
+  struct sockaddr_un address;
+  if (!socket_address(path, &address)) {
+    return false;
+  }
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd == -1) {
+    return false;
+  }
+  if (connect(fd, (struct sockaddr *) &address, sizeof(address)) != 0) {
+    close(fd);
+    return false;
+  }
+
+  request_header_t request = {kind, options->output == PAOLA_OBJECT, options->frame_pointer,
+      options->disabled_passes, size};
+  response_header_t header;
+  bool answered = write_all(fd, &request, sizeof(request), NULL)
+      && write_all(fd, payload, size, NULL) && read_all(fd, &header, sizeof(header), NULL);
+  if (answered) {
+    response->status = (int) header.status;
+    response->output_size = header.output_size;
+    response->output = (char *) malloc(header.output_size + 1);
+    response->messages = (char *) malloc(header.message_size + 1);
+    response->messages[header.message_size] = '\0';
+    answered = read_all(fd, response->output, header.output_size, NULL)
+        && read_all(fd, response->messages, header.message_size, NULL);
+    if (!answered) {
+      free_response(response);
+    }
+  }
+  close(fd);
+  return answered;
+}
+
+void free_response(response_t *response) {
+  free(response->output);
+  free(response->messages);
+}
+
+/* Binds the listening socket. A socket left at the path by a server that is no
+ * longer running is replaced. */
+static bool listen_on(const char *path) {
+  struct sockaddr_un address;
+  if (!socket_address(path, &address)) {
+    printf("The socket path %s is too long.\n", path);
+    return false;
+  }
+
+  struct stat status;
+  if (stat(path, &status) == 0 && S_ISSOCK(status.st_mode)) {
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    bool live = fd != -1 && connect(fd, (struct sockaddr *) &address, sizeof(address)) == 0;
+    if (fd != -1) {
+      close(fd);
+    }
+    if (live) {
+      printf("A server is already listening on %s.\n", path);
+      return false;
+    }
+    unlink(path);
+  }
+
+  server.listener = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (server.listener == -1
+      || bind(server.listener, (struct sockaddr *) &address, sizeof(address)) != 0
+      || listen(server.listener, SOMAXCONN) != 0) {
+    printf("Could not listen on %s.\n", path);
+    if (server.listener != -1) {
+      close(server.listener);
+    }
+    return false;
+  }
+  return true;
+}
+
+static void enqueue(int fd) {
+  connection_t connection = {fd, {0, 0}};
+  timespec_get(&connection.accepted, TIME_UTC);
+
+  mtx_lock(&server.lock);
+  if (server.count == server.capacity) {
+    connection_t *queue = (connection_t *) malloc(sizeof(connection_t) * server.capacity * 2);
+    for (int i = 0; i < server.count; i++) {
+      queue[i] = server.queue[(server.head + i) % server.capacity];
+    }
+    free(server.queue);
+    server.queue = queue;
+    server.head = 0;
+    server.capacity *= 2;
+  }
+  server.queue[(server.head + server.count) % server.capacity] = connection;
+  server.count++;
+  if (server.count > server.max_count) {
+    server.max_count = server.count;
+  }
+  cnd_signal(&server.ready);
+  mtx_unlock(&server.lock);
+}
+
+static int work(void *arg) {
+  worker_t *worker = (worker_t *) arg;
+  while (true) {
+    mtx_lock(&server.lock);
+    while (server.count == 0 && !server.stopping) {
+      cnd_wait(&server.ready, &server.lock);
+    }
+    if (server.count == 0) {
+      mtx_unlock(&server.lock);
+      return 0;
+    }
+    connection_t connection = server.queue[server.head];
+    server.head = (server.head + 1) % server.capacity;
+    server.count--;
+    server.busy++;
+    mtx_unlock(&server.lock);
+
+    answer(worker, connection.fd);
+    close(connection.fd);
+    double latency = seconds_since(&connection.accepted);
+
+    mtx_lock(&server.lock);
+    server.busy--;
+    server.served++;
+    server.total_latency += latency;
+    if (latency > server.max_latency) {
+      server.max_latency = latency;
+    }
+    mtx_unlock(&server.lock);
+  }
+}
+
+/* Reads a request from the connection and answers it. Connections that do not
+ * send a whole request in time are dropped. */
+static void answer(worker_t *worker, int fd) {
+  struct timespec deadline = deadline_in(IO_DEADLINE_SECONDS);
+  request_header_t request;
+  if (!read_all(fd, &request, sizeof(request), &deadline) || request.size > MAX_REQUEST_SIZE) {
+    return;
+  }
+  char *payload = (char *) malloc(request.size + 1);
+  if (!read_all(fd, payload, request.size, &deadline)) {
+    free(payload);
+    return;
+  }
+  payload[request.size] = '\0';
+
+  switch (request.kind) {
+    case REQUEST_COMPILE:
+    case REQUEST_COMPILE_PATH: {
+      char *text = payload;
+      size_t size = request.size;
+      const char *reason = mismatch(&request);
+      if (reason) {
+        respond(fd, PAOLA_OTHER_ERR, 0, 0, reason);
+        break;
+      }
+      if (request.kind == REQUEST_COMPILE_PATH) {
+        FILE *fin = fopen(payload, "r");
+        if (fin == 0) {
+          respond(fd, PAOLA_OTHER_ERR, 0, 0, "Could not open the input file.\n");
+          break;
+        }
+        text = read_file(fin, &size);
+        fclose(fin);
+      }
+      paola_ctx_t *ctx = worker->contexts[request.object_file != 0];
+      paola_status_t status = paola_compile(ctx, text, size);
+      size_t output_size;
+      const char *output = paola_output(ctx, &output_size);
+      respond(fd, status, output, status == PAOLA_OK ? output_size : 0, paola_messages(ctx));
+      if (text != payload) {
+        free(text);
+      }
+      break;
+    }
+    case REQUEST_STATS: {
+      char *text = stats();
+      respond(fd, PAOLA_OK, 0, 0, text);
+      free(text);
+      break;
+    }
+    case REQUEST_SHUTDOWN:
+      mtx_lock(&server.lock);
+      server.stopping = true;
+      mtx_unlock(&server.lock);
+      // Wakes the main thread from accept.
+      shutdown(server.listener, SHUT_RDWR);
+      respond(fd, PAOLA_OK, 0, 0, "");
+      break;
+    default:
+      respond(fd, PAOLA_OTHER_ERR, 0, 0, "Unknown request.\n");
+      break;
+  }
+  free(payload);
+}
+
+static void respond(int fd, int status, const char *output, size_t output_size,
+    const char *messages) {
+  response_header_t header = {(uint32_t) status, 0, output_size, strlen(messages)};
+  struct timespec deadline = deadline_in(IO_DEADLINE_SECONDS);
+  if (write_all(fd, &header, sizeof(header), &deadline)) {
+    if (write_all(fd, output, output_size, &deadline)) {
+      write_all(fd, messages, header.message_size, &deadline);
+    }
+  }
+}
+
+/* Returns why the code the server compiles would not be the code the request
+ * asks for, or 0 if it would be. */
+static const char *mismatch(const request_header_t *request) {
+  if ((request->frame_pointer != 0) != server.frame_pointer) {
+    return server.frame_pointer ? "The server keeps frame pointers, and the request omits them.\n"
+        : "The server omits frame pointers, and the request keeps them.\n";
+  }
+  if (request->disabled_passes != server.disabled_passes) {
+    return "The server runs other passes than the request, start it with the same -O and "
+        "--disable-pass options.\n";
+  }
+  return 0;
+}
+
+static char *stats(void) {
+  mtx_lock(&server.lock);
+  double mean = server.served > 0 ? server.total_latency / server.served : 0;
+  size_t size = 512;
+  char *text = (char *) malloc(size);
+  snprintf(text, size, "Workers: %d\nBusy: %d\nQueued: %d\nMost queued: %d\nServed: %ld\n"
+      "Mean latency: %.3f ms\nMax latency: %.3f ms\n", server.workers, server.busy,
+      server.count, server.max_count, server.served, mean * 1000, server.max_latency * 1000);
+  mtx_unlock(&server.lock);
+  return text;
+}
+
+static bool socket_address(const char *path, struct sockaddr_un *address) {
+  memset(address, 0, sizeof(*address));
+  address->sun_family = AF_UNIX;
+  if (strlen(path) >= sizeof(address->sun_path)) {
+    return false;
+  }
+  strcpy(address->sun_path, path);
+  return true;
+}
+
+/* Reads everything before the deadline, or without one if it is NULL. */
+static bool read_all(int fd, void *data, size_t size, const struct timespec *deadline) {
+  char *next = (char *) data;
+  while (size > 0) {
+    if (!wait_for(fd, POLLIN, deadline)) {
+      return false;
+    }
+    ssize_t count = recv(fd, next, size, deadline ? MSG_DONTWAIT : 0);
+    if (count < 0 && (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK)) {
+      continue;
+    }
+    if (count <= 0) {
+      return false;
+    }
+    next += count;
+    size -= (size_t) count;
+  }
+  return true;
+}
+
+/* Writes everything before the deadline, or without one if it is NULL, without
+ * raising SIGPIPE if the other end is gone. */
+static bool write_all(int fd, const void *data, size_t size, const struct timespec *deadline) {
+  const char *next = (const char *) data;
+  while (size > 0) {
+    if (!wait_for(fd, POLLOUT, deadline)) {
+      return false;
+    }
+    ssize_t count = send(fd, next, size, MSG_NOSIGNAL | (deadline ? MSG_DONTWAIT : 0));
+    if (count < 0 && (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK)) {
+      continue;
+    }
+    if (count <= 0) {
+      return false;
+    }
+    next += count;
+    size -= (size_t) count;
+  }
+  return true;
+}
+
+/* Waits until the connection is ready for the events, returns false if the
+ * deadline passes first. A client that trickles its request a byte at a time
+ * still runs into the deadline. */
+static bool wait_for(int fd, short events, const struct timespec *deadline) {
+  if (deadline == NULL) {
+    return true;
+  }
+  double left = -seconds_since(deadline);
+  if (left <= 0) {
+    return false;
+  }
+  struct pollfd poller = {fd, events, 0};
+  int ready = poll(&poller, 1, (int) (left * 1000) + 1);
+  return ready > 0 || (ready < 0 && errno == EINTR);
+}
+
+static struct timespec deadline_in(int seconds) {
+  struct timespec deadline;
+  timespec_get(&deadline, TIME_UTC);
+  deadline.tv_sec += seconds;
+  return deadline;
+}
+
+static double seconds_since(const struct timespec *start) {
+  struct timespec now;
+  timespec_get(&now, TIME_UTC);
+  return (double) (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
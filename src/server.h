@@ -0,0 +1,48 @@
+#ifndef SERVER_H
+#define SERVER_H
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "libpaola.h"
+
+/* A compile server on a Unix domain socket. A client connects, sends one
+ * request: a header followed by size bytes of payload, and reads one response:
+ * a header followed by the output and the messages. Both ends run on the same
+ * machine, so the headers are in its byte order. The request carries the
+ * options the code depends on, and the server only compiles it if they are its
+ * own. */
+
+typedef enum {
+  REQUEST_COMPILE,      // The payload is the source
+  REQUEST_COMPILE_PATH, // The payload is the absolute path of the source
+  REQUEST_STATS,        // The messages of the response describe the server
+  REQUEST_SHUTDOWN      // Stop once the requests in progress are answered
+} request_kind_t;
+
+typedef struct {
+  uint32_t kind;
+  uint32_t object_file; // Compile to an ELF object instead of assembly
+  uint32_t frame_pointer; // Keep frame pointers, as the server must
+  uint32_t disabled_passes; // The passes that do not run, the same as the server's
+  uint64_t size;
+} request_header_t;
+
+typedef struct {
+  uint32_t status; // A paola_status_t
+  uint32_t padding;
+  uint64_t output_size, message_size;
+} response_header_t;
+
+typedef struct {
+  int status;
+  char *output; // Not terminated
+  size_t output_size;
+  char *messages; // Terminated
+} response_t;
+
+int serve(const char *, const paola_options_t *);
+bool server_request(const char *, request_kind_t, const paola_options_t *, const char *, size_t,
+    response_t *);
+void free_response(response_t *);
+
+#endif
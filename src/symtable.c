@@ -1,38 +1,101 @@
 #include "symtable.h"
+#include "arena.h"
+#include "context.h"
 #include "list.h"
+#include "report.h"
 #include <assert.h>
+#include <limits.h>
+#include <stdint.h>
 #include <string.h>
 #include <stdlib.h>
 
-static symbol_t *symtable_find_in_scope(scope_t *, char *);
+static symbol_t *symtable_find_in_scope(scope_t *, char *, int *);
 static void empty_scope(scope_t *);
 static scope_t *get_current_scope();
+static uint32_t hash(const char *);
+static int find_global(char *, int *);
+static void add_global(symbol_t *);
+static void place_global(int);
 
 // The symtable is a list of scopes, and each scope is a list of symbols.
-// TODO: should be a list of hashtables instead of a list of lists
-static list_t symtable; 
+// The global scope, in the context, is shared by all threads, and only changes
+// before function bodies are checked. The scopes inside it belong to the thread
+// checking a body, which only sees the global symbols declared before that body.
+static _Thread_local list_t symtable;
+static _Thread_local int visible_globals = INT_MAX;
 
 symbol_t *create_symtable_entry(char *name, datatype_t datatype) {
-  symbol_t *entry = (symbol_t *) malloc(sizeof(symbol_t));
+  symbol_t *entry = (symbol_t *) arena_alloc(sizeof(symbol_t));
   entry->name = name;
   entry->datatype = datatype;
+  entry->local_reads = -1;
+  entry->is_global = false;
+  entry->is_func = false;
+  entry->decl = 0;
+  entry->call_count = 0;
+  entry->inlinable = false;
+  list_init(&entry->call_sites);
+  entry->callgraph_id = -1;
+  entry->cold = false;
+  entry->slot = -1;
+  entry->assigned = false;
+  entry->pure = false;
+  entry->folded = false;
+  entry->counter_count = 0;
+  entry->checksum = 0;
+  entry->counts = 0;
   return entry;
 }
 
 void symtable_init(void) {
+  context->global_scope = 0;
+  context->global_count = 0;
+  context->globals = 0;
+  context->globals_capacity = 0;
+  context->global_table = 0;
+  context->global_table_size = 0;
   list_init(&symtable);
+  visible_globals = INT_MAX;
+}
+
+/* Prepares the calling thread to check a function body, which sees the first
+ * visible global symbols. */
+void symtable_init_thread(int visible) {
+  list_init(&symtable);
+  visible_globals = visible;
+}
+
+int symtable_global_count(void) {
+  return context->global_count;
 }
 
 void symtable_open_scope(char *name) {
   scope_t *scope = (scope_t *) malloc(sizeof(scope_t));
   scope->name = name;
   list_init(&scope->symbols);
+  if (!context->global_scope) {
+    context->global_scope = scope;
+    return;
+  }
   list_push_back(&symtable, &scope->symtable_elem);
 }
 
 void symtable_close_scope() {
-  list_elem_t *e = list_pop_back(&symtable); 
-  scope_t *scope = list_entry(e, scope_t, symtable_elem);
+  scope_t *scope;
+  if (list_empty(&symtable)) {
+    scope = context->global_scope;
+    context->global_scope = 0;
+    context->global_count = 0;
+    free(context->globals);
+    context->globals = 0;
+    context->globals_capacity = 0;
+    free(context->global_table);
+    context->global_table = 0;
+    context->global_table_size = 0;
+  } else {
+    list_elem_t *e = list_pop_back(&symtable); 
+    scope = list_entry(e, scope_t, symtable_elem);
+  }
   empty_scope(scope);
   free(scope);
 }
@@ -40,32 +103,54 @@ void symtable_close_scope() {
 symbol_t *symtable_find(char *needle) {
   // Search each scope, starting from the inner-most one. Return the first result,
   // or 0 if the symbol was not found in any scopes.
+  // The symbols compared along the way are counted for the report.
+  int seen = 0;
+  int index = find_global(needle, &seen);
+  if (index != -1 && index < visible_globals) {
+    report_lookup(seen);
+    return context->globals[index];
+  }
+
   for (list_elem_t *e = list_begin(&symtable); e != list_end(&symtable);
     e = list_next(e)) {
     scope_t *scope = list_entry(e, scope_t, symtable_elem);
-    symbol_t *result = symtable_find_in_scope(scope, needle);
+    symbol_t *result = symtable_find_in_scope(scope, needle, &seen);
 
     if (result) {
+      report_lookup(seen);
       return result;
     }
   }
 
+  report_lookup(seen);
   return 0;
 }
 
 void symtable_insert(symbol_t *symbol) {
   scope_t *current_scope = get_current_scope();
 
+  if (current_scope == context->global_scope) {
+    // The symbol must not exist in the global scope
+    int probes = 0;
+    assert(find_global(symbol->name, &probes) == -1);
+    (void) probes;
+    add_global(symbol);
+    return;
+  }
+
   // The symbol must not exist in the current scope
-  assert(symtable_find_in_scope(current_scope, symbol->name) == 0);
+  int probes = 0;
+  assert(symtable_find_in_scope(current_scope, symbol->name, &probes) == 0);
+  (void) probes;
   list_push_back(&current_scope->symbols, &symbol->scope_elem);
 }
 
-// Search a single scope for a symbol
-static symbol_t *symtable_find_in_scope(scope_t *scope, char *needle) { // TODO: Sloooow, O(N)
+// Search a single scope for a symbol, counting the symbols compared in probes
+static symbol_t *symtable_find_in_scope(scope_t *scope, char *needle, int *probes) {
   for (list_elem_t *e = list_begin(&scope->symbols); e != list_end(&scope->symbols);
     e = list_next(e)) {
     symbol_t *symbol = list_entry(e, symbol_t, scope_elem);
+    (*probes)++;
 
     if (strcmp(symbol->name, needle) == 0) {
       return symbol;
@@ -75,17 +160,73 @@ static symbol_t *symtable_find_in_scope(scope_t *scope, char *needle) { // TODO:
   return 0;
 }
 
-// De-allocates the symbols in a scope
+// Removes the symbols from a scope. The symbols themselves are not de-allocated,
+// because the AST keeps referring to them after semantic checking.
 static void empty_scope(scope_t *scope) {
-  for (list_elem_t *e = list_begin(&scope->symbols); e != list_end(&scope->symbols);
-    e = list_next(e)) {
-    symbol_t *symbol = list_entry(e, symbol_t, scope_elem);
-    free(symbol);
-  }
+  list_init(&scope->symbols);
 }
 
 static scope_t *get_current_scope() {
+  if (list_empty(&symtable)) {
+    return context->global_scope;
+  }
   list_elem_t *e = list_back(&symtable); 
   scope_t *scope = list_entry(e, scope_t, symtable_elem);
   return scope;
 }
+
+/* FNV-1a. */
+static uint32_t hash(const char *name) {
+  uint32_t h = 2166136261u;
+  for (; *name; name++) {
+    h = (h ^ (uint8_t) *name) * 16777619u;
+  }
+  return h;
+}
+
+/* Returns the index of the global symbol with the given name, or -1, counting
+ * the symbols compared in probes. */
+static int find_global(char *name, int *probes) {
+  int *table = context->global_table;
+  if (!table) {
+    return -1;
+  }
+  int mask = context->global_table_size - 1;
+  for (int i = hash(name) & mask; table[i] != -1; i = (i + 1) & mask) {
+    (*probes)++;
+    if (strcmp(context->globals[table[i]]->name, name) == 0) {
+      return table[i];
+    }
+  }
+  return -1;
+}
+
+static void add_global(symbol_t *symbol) {
+  if (context->global_count == context->globals_capacity) {
+    int capacity = context->globals_capacity ? context->globals_capacity * 2 : 64;
+    context->globals = (symbol_t **) realloc(context->globals, sizeof(symbol_t *) * capacity);
+    context->globals_capacity = capacity;
+  }
+  context->globals[context->global_count++] = symbol;
+
+  if (context->global_count * 2 <= context->global_table_size) {
+    place_global(context->global_count - 1);
+    return;
+  }
+  int size = context->global_table_size ? context->global_table_size * 2 : 128;
+  context->global_table = (int *) realloc(context->global_table, sizeof(int) * size);
+  context->global_table_size = size;
+  memset(context->global_table, -1, sizeof(int) * size);
+  for (int index = 0; index < context->global_count; index++) {
+    place_global(index);
+  }
+}
+
+static void place_global(int index) {
+  int mask = context->global_table_size - 1;
+  int i = hash(context->globals[index]->name) & mask;
+  while (context->global_table[i] != -1) {
+    i = (i + 1) & mask;
+  }
+  context->global_table[i] = index;
+}
@@ -13,6 +13,8 @@ typedef struct {
 symbol_t *create_symtable_entry(char *, datatype_t);
 
 void symtable_init(void);
+void symtable_init_thread(int);
+int symtable_global_count(void);
 symbol_t *symtable_find(char *);
 void symtable_insert(symbol_t *);
 void symtable_open_scope(char *);
@@ -1,13 +1,115 @@
 #include "utils.h"
 #include <string.h>
+#include <stdlib.h>
+#include "cache.h"
+
+static void disable_passes(options_t *, const char *);
 
 options_t parse_options(int argc, char **argv) {
-  options_t opt = {0, 0, false, false};
+  options_t opt = {.input_files = 0, .input_count = 0, .output_file = 0, .print_tokens = false,
+      .print_ast = false, .object_file = false, .run = false, .interpret = false,
+      .interpret_ast = false, .jobs = 1, .server_socket = 0, .connect_socket = 0,
+      .server_stats = false, .server_shutdown = false, .send_path = false, .cache_dir = 0,
+      .cache_size = CACHE_DEFAULT_SIZE, .cache_stats = false, .incremental = false,
+      .time_report = false, .trace_file = 0, .remarks = 0, .remarks_file = 0, .instrument = false,
+      .profile_generate = false, .profile_file = 0, .profile_use = 0, .frame_pointer = false,
+      .opt_level = 2, .disabled_passes = 0, .unknown_pass = 0, .unknown_level = 0};
+  opt.input_files = (const char **) malloc(sizeof(char *) * argc);
 
   for (int i = 1; i < argc; i++) {
-    if (argv[i][0] != '-') opt.input_file = argv[i];
+    if (argv[i][0] != '-') opt.input_files[opt.input_count++] = argv[i];
     else if (strcmp(argv[i], "--print-tokens") == 0) opt.print_tokens = true;
     else if (strcmp(argv[i], "--print-ast") == 0) opt.print_ast = true;
+    else if (strcmp(argv[i], "-c") == 0) opt.object_file = true;
+    else if (strcmp(argv[i], "--run") == 0) opt.run = true;
+    else if (strcmp(argv[i], "--interpret") == 0) opt.interpret = true;
+    else if (strcmp(argv[i], "--interpret-ast") == 0) opt.interpret_ast = true;
+    else if (strcmp(argv[i], "--stats") == 0) opt.server_stats = true;
+    else if (strcmp(argv[i], "--shutdown") == 0) opt.server_shutdown = true;
+    else if (strcmp(argv[i], "--send-path") == 0) opt.send_path = true;
+    else if (strcmp(argv[i], "--cache-stats") == 0) opt.cache_stats = true;
+    else if (strcmp(argv[i], "--incremental") == 0) opt.incremental = true;
+    else if (strcmp(argv[i], "--time-report") == 0) opt.time_report = true;
+    else if (strcmp(argv[i], "--instrument") == 0) opt.instrument = true;
+    else if (strcmp(argv[i], "--profile-generate") == 0) opt.profile_generate = true;
+    else if (strncmp(argv[i], "--profile-generate=", 19) == 0) {
+      opt.profile_generate = true;
+      opt.profile_file = argv[i] + 19;
+    }
+    else if (strcmp(argv[i], "-fno-omit-frame-pointer") == 0) opt.frame_pointer = true;
+    else if (strcmp(argv[i], "-fomit-frame-pointer") == 0) opt.frame_pointer = false;
+    else if (strcmp(argv[i], "-Rpass") == 0) opt.remarks |= PAOLA_REMARK_PASSED;
+    else if (strcmp(argv[i], "-Rpass-missed") == 0) opt.remarks |= PAOLA_REMARK_MISSED;
+    else if (strcmp(argv[i], "-Rpass-analysis") == 0) opt.remarks |= PAOLA_REMARK_ANALYSIS;
+    else if (strcmp(argv[i], "--cache-dir") == 0) {
+      i++;
+      if (i < argc) {
+        opt.cache_dir = argv[i];
+      }
+    }
+    else if (strcmp(argv[i], "--cache-size") == 0) {
+      // In megabytes
+      i++;
+      if (i < argc) {
+        opt.cache_size = (uint64_t) strtoull(argv[i], NULL, 10) << 20;
+      }
+    }
+    else if (strcmp(argv[i], "--trace-json") == 0) {
+      i++;
+      if (i < argc) {
+        opt.trace_file = argv[i];
+      }
+    }
+    else if (strcmp(argv[i], "--profile-use") == 0) {
+      i++;
+      if (i < argc) {
+        opt.profile_use = argv[i];
+      }
+    }
+    else if (strcmp(argv[i], "--remarks-json") == 0) {
+      i++;
+      if (i < argc) {
+        opt.remarks_file = argv[i];
+      }
+    }
+    else if (strcmp(argv[i], "--disable-pass") == 0) {
+      // A name or a comma separated list of them
+      i++;
+      if (i < argc) {
+        disable_passes(&opt, argv[i]);
+      }
+    }
+    else if (strcmp(argv[i], "--server") == 0) {
+      i++;
+      if (i < argc) {
+        opt.server_socket = argv[i];
+      }
+    }
+    else if (strcmp(argv[i], "--connect") == 0) {
+      i++;
+      if (i < argc) {
+        opt.connect_socket = argv[i];
+      }
+    }
+    else if (strncmp(argv[i], "-O", 2) == 0) {
+      // -O is -O1
+      const char *level = argv[i] + 2;
+      if (!level[0]) {
+        opt.opt_level = 1;
+      } else if (level[0] >= '0' && level[0] <= '2' && !level[1]) {
+        opt.opt_level = level[0] - '0';
+      } else if (!opt.unknown_level) {
+        opt.unknown_level = argv[i];
+      }
+    }
+    else if (strncmp(argv[i], "-j", 2) == 0) {
+      // -j N or -jN
+      const char *count = argv[i][2] ? argv[i] + 2 : (i + 1 < argc ? argv[++i] : "1");
+      opt.jobs = atoi(count);
+      if (opt.jobs < 1) {
+        opt.jobs = 1;
+      }
+    }
     else if (strcmp(argv[i], "-o") == 0) {
       i++;
       if (i < argc) {
@@ -16,13 +118,74 @@ options_t parse_options(int argc, char **argv) {
     }
   }
 
+  opt.disabled_passes |= paola_disabled_passes(opt.opt_level);
+
+  if (opt.remarks_file && opt.remarks == 0) { // All of them, unless some kinds were asked for
+    opt.remarks = PAOLA_REMARK_PASSED | PAOLA_REMARK_MISSED | PAOLA_REMARK_ANALYSIS;
+  }
+
   if (opt.output_file == 0) { // Default
-    opt.output_file = "out.s";
+    if (opt.input_count > 1) {
+      opt.output_file = ".";
+    } else {
+      opt.output_file = opt.object_file ? "out.o" : "out.s";
+    }
   }
 
   return opt;
 }
 
+/* Disables the passes in the comma separated list of names, and keeps the
+ * first name that is not a pass. */
+static void disable_passes(options_t *opt, const char *names) {
+  while (*names) {
+    size_t length = strcspn(names, ",");
+    int pass = 0;
+    while (pass < PAOLA_PASS_COUNT && (strlen(paola_pass_name((paola_pass_t) pass)) != length
+        || strncmp(paola_pass_name((paola_pass_t) pass), names, length) != 0)) {
+      pass++;
+    }
+    if (pass < PAOLA_PASS_COUNT) {
+      opt->disabled_passes |= 1u << pass;
+    } else if (!opt->unknown_pass) {
+      opt->unknown_pass = names;
+    }
+    names += length;
+    if (*names == ',') {
+      names++;
+    }
+  }
+}
+
+/* Reads the whole file into memory, and stores its size. */
+char *read_file(FILE *file, size_t *size) {
+  size_t capacity = 4096, read;
+  char *text = (char *) malloc(capacity);
+  *size = 0;
+  while ((read = fread(text + *size, 1, capacity - *size, file)) > 0) {
+    *size += read;
+    if (*size == capacity) {
+      capacity *= 2;
+      text = (char *) realloc(text, capacity);
+    }
+  }
+  return text;
+}
+
+/* Returns the path of the output of an input file in the output directory: the
+ * name of the input, with the extension in place of its own. */
+char *output_path(const char *directory, const char *input, const char *extension) {
+  const char *name = strrchr(input, '/');
+  name = name ? name + 1 : input;
+  const char *dot = strrchr(name, '.');
+  size_t length = dot && dot != name ? (size_t) (dot - name) : strlen(name);
+
+  size_t size = strlen(directory) + 1 + length + strlen(extension) + 1;
+  char *path = (char *) malloc(size);
+  snprintf(path, size, "%s/%.*s%s", directory, (int) length, name, extension);
+  return path;
+}
+
 void print_tokens(token_t *token) {
   printf("Input tokens:\n");
 
@@ -110,7 +273,8 @@ void print_stat_ast(stat_ast_t *ast) {
       break;
     case DECL_STAT:
       if (ast->is_func) {
-        printf("Function(%s, %s, ", datatype_to_str(ast->datatype), ast->target);
+        printf("%s(%s, %s, ", ast->is_inline ? "InlineFunction" : "Function",
+            datatype_to_str(ast->datatype), ast->target);
         print_stat_ast(ast->func_body);
         printf(")");
       } else {
@@ -1,14 +1,43 @@
 #ifndef UTILS_H
 #define UTILS_H
 #include <stdbool.h>
+#include <stdint.h>
 #include "gen.h"
 #include "lexer.h"
 #include "parser.h"
 #include "errors.h"
 
 typedef struct {
-   const char *input_file, *output_file;
+   const char **input_files;
+   int input_count;
+   const char *output_file; // The output directory if there are several inputs.
    bool print_tokens, print_ast;
+   bool object_file; // Write an ELF object instead of assembly.
+   bool run; // Run the program in memory instead of writing it out.
+   bool interpret; // Run the program in the bytecode interpreter.
+   bool interpret_ast; // Run the program by walking its AST, to compare with the interpreter.
+   int jobs; // Threads parsing, checking and generating code.
+   const char *server_socket; // Serve compile requests on this socket.
+   const char *connect_socket; // Have the server on this socket compile the input.
+   bool server_stats, server_shutdown; // Ask the server for its statistics, or to stop.
+   bool send_path; // Send the server the path of the input instead of its text.
+   const char *cache_dir; // Take compiled files from, and keep them in, this cache.
+   uint64_t cache_size; // In bytes
+   bool cache_stats; // Print the statistics of the cache.
+   bool incremental; // Copy unchanged functions from the index of the previous build.
+   bool time_report; // Print the time and memory each phase takes.
+   const char *trace_file; // Write a Chrome trace of the phases and functions to this file.
+   int remarks; // The kinds of optimization remarks to give, see paola_remark_t
+   const char *remarks_file; // Write the remarks to this file as JSON.
+   bool instrument; // Make the program write a profile of its functions when it exits.
+   bool profile_generate; // Make the program count its branches, loops and calls into a profile.
+   const char *profile_file; // The profile it writes, by default the output file with .pgo
+   const char *profile_use; // Optimize the program with the counts of this profile.
+   bool frame_pointer; // Keep frame pointers, for profilers that walk the stack with them.
+   int opt_level; // -O0 to -O2, 2 by default
+   unsigned disabled_passes; // The passes that do not run, see paola_pass_t
+   const char *unknown_pass; // Given to --disable-pass, 0 if all of them are known
+   const char *unknown_level; // The first -O option that is not a level, or 0
 } options_t;
 
 void print_tokens(token_t *);
@@ -16,5 +45,7 @@ void print_expr_ast(expr_ast_t *);
 void print_stat_ast(stat_ast_t *);
 
 options_t parse_options(int, char **);
+char *read_file(FILE *, size_t *);
+char *output_path(const char *, const char *, const char *);
 
 #endif
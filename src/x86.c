@@ -0,0 +1,695 @@
+#pragma GCC diagnostic ignored "-Wwrite-strings"
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <elf.h>
+#include "x86.h"
+#include "errors.h"
+
+/* x86-64 machine code encoder for the instructions the code generator emits.
+ * Each function takes the same mnemonics and operands as the assembly that
+ * gen.c prints, and appends the encoding an assembler would choose to the
+ * current section.
+ *
+ * Jumps to labels are not encoded right away. They start out in their 2 byte
+ * short form, and x86_finish grows the ones whose target is out of reach of a
+ * rel8 to the rel32 form until every jump fits (branch relaxation). Calls and
+ * jumps to functions, and references to global variables, are left to the
+ * linker as relocations. */
+
+#define REX_W 0x48
+#define REX_R 0x44
+#define REX_B 0x41
+
+#define SHORT_JUMP_SIZE 2
+#define NEAR_JMP_SIZE 5
+#define NEAR_JCC_SIZE 6
+
+typedef struct {
+  const char *name;
+  uint8_t digit;      // ModRM reg field of the immediate forms
+  uint8_t rm_reg;     // op r/m, reg
+  uint8_t reg_rm;     // op reg, r/m
+  uint8_t acc_imm;    // op %rax, imm32
+} alu_op_t;
+
+static const alu_op_t alu_ops[] = {
+  {"add", 0, 0x01, 0x03, 0x05},
+  {"sub", 5, 0x29, 0x2b, 0x2d},
+  {"cmp", 7, 0x39, 0x3b, 0x3d},
+  {"or", 1, 0x09, 0x0b, 0x0d},
+};
+
+static const char *register_numbers[16] = {
+  "rax", "rcx", "rdx", "rbx", "rsp", "rbp", "rsi", "rdi",
+  "r8", "r9", "r10", "r11", "r12", "r13", "r14", "r15"
+};
+
+static const struct {
+  const char *name;
+  uint8_t cond;
+} jumps[] = {
+  {"jmp", JMP_COND}, {"je", 0x4}, {"jne", 0x5}, {"jl", 0xc}, {"jge", 0xd}, {"jle", 0xe},
+  {"jg", 0xf}
+};
+
+static section_t *current(x86_obj_t *);
+static void emit(x86_obj_t *, uint8_t);
+static void emit32(x86_obj_t *, int32_t);
+static void emit_rm(x86_obj_t *, bool, const uint8_t *, int, uint8_t, arg_t, int, int32_t);
+static void emit_reloc(x86_obj_t *, const char *, uint32_t, int64_t);
+static int reg_number(const char *);
+static bool fits_int8(int64_t);
+static uint32_t hash(const char *);
+static int find_symbol(x86_obj_t *, const char *);
+static int add_symbol(x86_obj_t *, const char *);
+static int label_symbol(x86_obj_t *, int);
+static void grow_symbol_table(x86_obj_t *);
+static void set_position(x86_obj_t *, x86_symbol_t *);
+static int branch_size(branch_t *);
+static void relax(x86_obj_t *, section_t *);
+static void place_branches(x86_obj_t *, int);
+static size_t final_offset(size_t *, size_t, int);
+
+x86_obj_t *x86_create(void) {
+  x86_obj_t *obj = (x86_obj_t *) calloc(1, sizeof(x86_obj_t));
+  obj->current = -1;
+  obj->symbol_table_size = 64;
+  obj->symbol_table = (int *) malloc(sizeof(int) * obj->symbol_table_size);
+  memset(obj->symbol_table, -1, sizeof(int) * obj->symbol_table_size);
+  return obj;
+}
+
+void x86_free(x86_obj_t *obj) {
+  for (int i = 0; i < obj->section_count; i++) {
+    section_t *section = &obj->sections[i];
+    free((char *) section->name);
+    free(section->code);
+    free(section->branches);
+    free(section->relocs);
+  }
+  for (int i = 0; i < obj->symbol_count; i++) {
+    free((char *) obj->symbols[i].name);
+  }
+  free(obj->sections);
+  free(obj->symbols);
+  free(obj->symbol_table);
+  free(obj->labels);
+  free(obj->functions);
+  free(obj->rows);
+  free(obj);
+}
+
+/* Switches to the section, creating it the first time it is used. */
+void x86_section(x86_obj_t *obj, const char *name, section_type_t type) {
+  for (int i = 0; i < obj->section_count; i++) {
+    if (strcmp(obj->sections[i].name, name) == 0) {
+      obj->current = i;
+      return;
+    }
+  }
+
+  if (obj->section_count == obj->section_capacity) {
+    obj->section_capacity = obj->section_capacity ? obj->section_capacity * 2 : 8;
+    obj->sections = (section_t *) realloc(obj->sections,
+        sizeof(section_t) * obj->section_capacity);
+  }
+  section_t *section = &obj->sections[obj->section_count];
+  memset(section, 0, sizeof(section_t));
+  section->name = strdup(name);
+  section->type = type;
+  obj->current = obj->section_count++;
+}
+
+/* Defines the symbol at the current position. */
+void x86_define(x86_obj_t *obj, const char *name) {
+  int symbol = find_symbol(obj, name);
+  if (symbol == -1) {
+    symbol = add_symbol(obj, name);
+  }
+  set_position(obj, &obj->symbols[symbol]);
+}
+
+/* Makes the symbol visible to other objects. */
+void x86_global(x86_obj_t *obj, const char *name) {
+  int symbol = find_symbol(obj, name);
+  if (symbol == -1) {
+    symbol = add_symbol(obj, name);
+  }
+  obj->symbols[symbol].global = true;
+}
+
+void x86_label(x86_obj_t *obj, int label) {
+  // label_symbol may move the symbols.
+  int symbol = label_symbol(obj, label);
+  set_position(obj, &obj->symbols[symbol]);
+}
+
+/* Starts a function at its symbol, which must be defined at the current
+ * position. Its caller's frame address is 8 bytes above the stack pointer until
+ * x86_cfa says otherwise. */
+void x86_function_start(x86_obj_t *obj, const char *name) {
+  if (obj->function_count == obj->function_capacity) {
+    obj->function_capacity = obj->function_capacity ? obj->function_capacity * 2 : 16;
+    obj->functions = (x86_function_t *) realloc(obj->functions,
+        sizeof(x86_function_t) * obj->function_capacity);
+  }
+  x86_function_t *function = &obj->functions[obj->function_count++];
+  function->symbol = find_symbol(obj, name);
+  function->first_row = obj->row_count;
+  function->row_count = 0;
+  x86_cfa(obj, "rsp", 8, false);
+}
+
+/* Sets the unwind rule of the current function from the current position on. */
+void x86_cfa(x86_obj_t *obj, const char *reg, int32_t offset, bool rbp_saved) {
+  x86_function_t *function = &obj->functions[obj->function_count - 1];
+  section_t *section = current(obj);
+  if (function->row_count > 0) {
+    // A rule that changes again before any code replaces the previous one.
+    x86_cfa_t *last = &obj->rows[obj->row_count - 1];
+    if (last->code_offset == section->size && last->branch_count == section->branch_count) {
+      obj->row_count--;
+      function->row_count--;
+    }
+  }
+
+  if (obj->row_count == obj->row_capacity) {
+    obj->row_capacity = obj->row_capacity ? obj->row_capacity * 2 : 64;
+    obj->rows = (x86_cfa_t *) realloc(obj->rows, sizeof(x86_cfa_t) * obj->row_capacity);
+  }
+  x86_cfa_t *row = &obj->rows[obj->row_count++];
+  row->code_offset = section->size;
+  row->branch_count = section->branch_count;
+  row->cfa_register = reg_number(reg);
+  row->cfa_offset = offset;
+  row->rbp_saved = rbp_saved;
+  function->row_count++;
+}
+
+/* Ends the current function at the current position. */
+void x86_function_end(x86_obj_t *obj) {
+  x86_function_t *function = &obj->functions[obj->function_count - 1];
+  section_t *section = current(obj);
+  function->end_offset = section->size;
+  function->end_branch_count = section->branch_count;
+}
+
+void x86_two_arg(x86_obj_t *obj, const char *command, arg_t src, arg_t dst) {
+  uint8_t opcode[2];
+
+  for (size_t i = 0; i < sizeof(alu_ops) / sizeof(alu_op_t); i++) {
+    const alu_op_t *op = &alu_ops[i];
+    if (strcmp(command, op->name) != 0) {
+      continue;
+    }
+
+    if (src.type == LIT_ARG && fits_int8(src.lit)) {
+      opcode[0] = 0x83;
+      emit_rm(obj, true, opcode, 1, op->digit, dst, 1, src.lit);
+    } else if (src.type == LIT_ARG && dst.type == REG_ARG && reg_number(dst.reg) == 0) {
+      emit(obj, REX_W);
+      emit(obj, op->acc_imm);
+      emit32(obj, src.lit);
+    } else if (src.type == LIT_ARG) {
+      opcode[0] = 0x81;
+      emit_rm(obj, true, opcode, 1, op->digit, dst, 4, src.lit);
+    } else if (src.type == REG_ARG) {
+      opcode[0] = op->rm_reg;
+      emit_rm(obj, true, opcode, 1, reg_number(src.reg), dst, 0, 0);
+    } else if (dst.type == REG_ARG) {
+      opcode[0] = op->reg_rm;
+      emit_rm(obj, true, opcode, 1, reg_number(dst.reg), src, 0, 0);
+    } else {
+      break;
+    }
+    return;
+  }
+
+  if (strcmp(command, "mov") == 0) {
+    if (src.type == LIT_ARG) {
+      opcode[0] = 0xc7;
+      emit_rm(obj, true, opcode, 1, 0, dst, 4, src.lit);
+      return;
+    } else if (src.type == REG_ARG) {
+      opcode[0] = 0x89;
+      emit_rm(obj, true, opcode, 1, reg_number(src.reg), dst, 0, 0);
+      return;
+    } else if (dst.type == REG_ARG) {
+      opcode[0] = 0x8b;
+      emit_rm(obj, true, opcode, 1, reg_number(dst.reg), src, 0, 0);
+      return;
+    }
+  } else if (strcmp(command, "lea") == 0) {
+    if (src.type != LIT_ARG && src.type != REG_ARG && dst.type == REG_ARG) {
+      opcode[0] = 0x8d;
+      emit_rm(obj, true, opcode, 1, reg_number(dst.reg), src, 0, 0);
+      return;
+    }
+  } else if (strcmp(command, "shl") == 0 && src.type == LIT_ARG) {
+    opcode[0] = 0xc1;
+    emit_rm(obj, true, opcode, 1, 4, dst, 1, src.lit);
+    return;
+  } else if (strcmp(command, "imul") == 0 && dst.type == REG_ARG) {
+    if (src.type == LIT_ARG) {
+      opcode[0] = fits_int8(src.lit) ? 0x6b : 0x69;
+      emit_rm(obj, true, opcode, 1, reg_number(dst.reg), dst,
+          fits_int8(src.lit) ? 1 : 4, src.lit);
+    } else {
+      opcode[0] = 0x0f;
+      opcode[1] = 0xaf;
+      emit_rm(obj, true, opcode, 2, reg_number(dst.reg), src, 0, 0);
+    }
+    return;
+  }
+
+  error(0, "Don't know how to encode %s with argument types %d, %d.", command, src.type,
+      dst.type);
+}
+
+void x86_one_arg(x86_obj_t *obj, const char *command, arg_t arg) {
+  bool is_push = strcmp(command, "push") == 0;
+
+  if ((is_push || strcmp(command, "pop") == 0) && arg.type == REG_ARG) {
+    int reg = reg_number(arg.reg);
+    if (reg >= 8) {
+      emit(obj, REX_B);
+    }
+    emit(obj, (is_push ? 0x50 : 0x58) + (reg & 7));
+  } else if (strcmp(command, "idivq") == 0 && arg.type != LIT_ARG) {
+    uint8_t opcode = 0xf7;
+    emit_rm(obj, true, &opcode, 1, 7, arg, 0, 0);
+  } else {
+    error(0, "Don't know how to encode %s with argument type %d.", command, arg.type);
+  }
+}
+
+/* Appends a jump to a label, to be encoded by x86_finish. */
+void x86_jump(x86_obj_t *obj, const char *command, int label) {
+  uint8_t cond = 0;
+  for (size_t i = 0; i < sizeof(jumps) / sizeof(jumps[0]); i++) {
+    if (strcmp(command, jumps[i].name) == 0) {
+      cond = jumps[i].cond;
+      break;
+    }
+  }
+
+  section_t *section = current(obj);
+  if (section->branch_count == section->branch_capacity) {
+    section->branch_capacity = section->branch_capacity ? section->branch_capacity * 2 : 16;
+    section->branches = (branch_t *) realloc(section->branches,
+        sizeof(branch_t) * section->branch_capacity);
+  }
+  branch_t *branch = &section->branches[section->branch_count++];
+  branch->code_offset = section->size;
+  branch->cond = cond;
+  branch->label = label;
+  branch->near = false;
+  label_symbol(obj, label);
+}
+
+/* Appends a call or jump to a symbol. */
+void x86_symbol_command(x86_obj_t *obj, const char *command, const char *name) {
+  emit(obj, strcmp(command, "call") == 0 ? 0xe8 : 0xe9);
+  emit_reloc(obj, name, R_X86_64_PLT32, -4);
+  emit32(obj, 0);
+}
+
+void x86_ret(x86_obj_t *obj) {
+  emit(obj, 0xc3);
+}
+
+void x86_no_arg(x86_obj_t *obj, const char *command) {
+  if (strcmp(command, "rdtsc") == 0) {
+    emit(obj, 0x0f);
+    emit(obj, 0x31);
+  } else {
+    error(0, "Don't know how to encode %s.", command);
+  }
+}
+
+void x86_quad(x86_obj_t *obj, int64_t value) {
+  for (int i = 0; i < 8; i++) {
+    emit(obj, (uint8_t) ((uint64_t) value >> (8 * i)));
+  }
+}
+
+/* Appends the string with its terminating zero. */
+void x86_string(x86_obj_t *obj, const char *string) {
+  do {
+    emit(obj, (uint8_t) *string);
+  } while (*string++);
+}
+
+void x86_zero(x86_obj_t *obj, size_t size) {
+  section_t *section = current(obj);
+  if (section->type == BSS_SECTION) {
+    section->bss_size += size;
+  } else {
+    for (size_t i = 0; i < size; i++) {
+      emit(obj, 0);
+    }
+  }
+}
+
+/* Chooses the encoding of every jump, and moves the symbols, relocations and
+ * unwind rules to their final offsets. Returns false if a jump targets an
+ * undefined label. */
+bool x86_finish(x86_obj_t *obj) {
+  for (int i = 0; i < obj->section_count; i++) {
+    section_t *section = &obj->sections[i];
+    for (int j = 0; j < section->branch_count; j++) {
+      x86_symbol_t *target = &obj->symbols[obj->labels[section->branches[j].label]];
+      if (target->section != i) {
+        error(0, "Jump to label l%d, which is not in section %s.", section->branches[j].label,
+            section->name);
+        return false;
+      }
+    }
+    relax(obj, section);
+  }
+
+  for (int i = 0; i < obj->section_count; i++) {
+    place_branches(obj, i);
+  }
+  for (int i = 0; i < obj->function_count; i++) {
+    x86_symbol_t *symbol = &obj->symbols[obj->functions[i].symbol];
+    symbol->function = true;
+    symbol->size = obj->functions[i].end_offset - symbol->code_offset;
+  }
+  return true;
+}
+
+static section_t *current(x86_obj_t *obj) {
+  if (obj->current == -1) {
+    x86_section(obj, ".text", TEXT_SECTION);
+  }
+  return &obj->sections[obj->current];
+}
+
+static void emit(x86_obj_t *obj, uint8_t byte) {
+  section_t *section = current(obj);
+  if (section->size == section->capacity) {
+    section->capacity = section->capacity ? section->capacity * 2 : 256;
+    section->code = (uint8_t *) realloc(section->code, section->capacity);
+  }
+  section->code[section->size++] = byte;
+}
+
+static void emit32(x86_obj_t *obj, int32_t value) {
+  for (int i = 0; i < 4; i++) {
+    emit(obj, (uint8_t) ((uint32_t) value >> (8 * i)));
+  }
+}
+
+/* Emits an instruction with a ModRM operand: the REX prefix, the opcode, the
+ * ModRM byte with reg in its reg field, the SIB byte and displacement that rm
+ * needs, and an immediate of imm_size bytes. */
+static void emit_rm(x86_obj_t *obj, bool wide, const uint8_t *opcode, int opcode_size,
+    uint8_t reg, arg_t rm, int imm_size, int32_t imm) {
+  int base = rm.type == REG_ARG || rm.type == MEM_ARG ? reg_number(rm.reg) : 0;
+  uint8_t rex = (wide ? REX_W : 0) | (reg >= 8 ? REX_R : 0) | (base >= 8 ? REX_B : 0);
+  if (rex) {
+    emit(obj, rex);
+  }
+  for (int i = 0; i < opcode_size; i++) {
+    emit(obj, opcode[i]);
+  }
+
+  reg &= 7;
+  if (rm.type == REG_ARG) {
+    emit(obj, 0xc0 | reg << 3 | (base & 7));
+  } else if (rm.type == GLOBAL_ARG) {
+    // RIP relative, the displacement is counted from the end of the instruction.
+    emit(obj, reg << 3 | 5);
+    char *name = (char *) malloc(strlen(SYMBOL_PREFIX) + strlen(rm.name) + 1);
+    strcpy(name, SYMBOL_PREFIX);
+    strcat(name, rm.name);
+    emit_reloc(obj, name, R_X86_64_PC32, -4 - imm_size);
+    free(name);
+    emit32(obj, 0);
+  } else {
+    // rbp and r13 as a base always need a displacement, rsp and r12 need a SIB.
+    uint8_t mod = rm.offset == 0 && (base & 7) != 5 ? 0 : fits_int8(rm.offset) ? 1 : 2;
+    emit(obj, mod << 6 | reg << 3 | (base & 7));
+    if ((base & 7) == 4) {
+      emit(obj, 0x24);
+    }
+    if (mod == 1) {
+      emit(obj, (uint8_t) rm.offset);
+    } else if (mod == 2) {
+      emit32(obj, rm.offset);
+    }
+  }
+
+  if (imm_size == 1) {
+    emit(obj, (uint8_t) imm);
+  } else if (imm_size == 4) {
+    emit32(obj, imm);
+  }
+}
+
+/* Adds a relocation for the 4 bytes about to be emitted. */
+static void emit_reloc(x86_obj_t *obj, const char *name, uint32_t type, int64_t addend) {
+  int symbol = find_symbol(obj, name);
+  if (symbol == -1) {
+    symbol = add_symbol(obj, name);
+  }
+
+  section_t *section = current(obj);
+  if (section->reloc_count == section->reloc_capacity) {
+    section->reloc_capacity = section->reloc_capacity ? section->reloc_capacity * 2 : 16;
+    section->relocs = (reloc_t *) realloc(section->relocs,
+        sizeof(reloc_t) * section->reloc_capacity);
+  }
+  reloc_t *reloc = &section->relocs[section->reloc_count++];
+  reloc->code_offset = section->size;
+  reloc->branch_count = section->branch_count;
+  reloc->symbol = symbol;
+  reloc->type = type;
+  reloc->addend = addend;
+}
+
+static int reg_number(const char *name) {
+  for (int i = 0; i < 16; i++) {
+    if (strcmp(name, register_numbers[i]) == 0) {
+      return i;
+    }
+  }
+  error(0, "Unknown register %s.", name);
+  return 0;
+}
+
+static bool fits_int8(int64_t value) {
+  return value >= -128 && value <= 127;
+}
+
+static uint32_t hash(const char *name) {
+  uint32_t h = 2166136261u;
+  for (; *name; name++) {
+    h = (h ^ (uint8_t) *name) * 16777619u;
+  }
+  return h;
+}
+
+static int find_symbol(x86_obj_t *obj, const char *name) {
+  int mask = obj->symbol_table_size - 1;
+  for (int i = hash(name) & mask; obj->symbol_table[i] != -1; i = (i + 1) & mask) {
+    if (strcmp(obj->symbols[obj->symbol_table[i]].name, name) == 0) {
+      return obj->symbol_table[i];
+    }
+  }
+  return -1;
+}
+
+/* Adds an undefined symbol. */
+static int add_symbol(x86_obj_t *obj, const char *name) {
+  if (obj->symbol_count == obj->symbol_capacity) {
+    obj->symbol_capacity = obj->symbol_capacity ? obj->symbol_capacity * 2 : 64;
+    obj->symbols = (x86_symbol_t *) realloc(obj->symbols,
+        sizeof(x86_symbol_t) * obj->symbol_capacity);
+  }
+  int symbol = obj->symbol_count++;
+  obj->symbols[symbol].name = strdup(name);
+  obj->symbols[symbol].section = -1;
+  obj->symbols[symbol].code_offset = 0;
+  obj->symbols[symbol].branch_count = 0;
+  obj->symbols[symbol].global = false;
+
+  grow_symbol_table(obj);
+  int mask = obj->symbol_table_size - 1;
+  int i = hash(name) & mask;
+  while (obj->symbol_table[i] != -1) {
+    i = (i + 1) & mask;
+  }
+  obj->symbol_table[i] = symbol;
+  return symbol;
+}
+
+static int label_symbol(x86_obj_t *obj, int label) {
+  if (label >= obj->label_capacity) {
+    int capacity = obj->label_capacity ? obj->label_capacity : 64;
+    while (capacity <= label) {
+      capacity *= 2;
+    }
+    obj->labels = (int *) realloc(obj->labels, sizeof(int) * capacity);
+    for (int i = obj->label_capacity; i < capacity; i++) {
+      obj->labels[i] = -1;
+    }
+    obj->label_capacity = capacity;
+  }
+  if (obj->labels[label] == -1) {
+    // Labels are local symbols named like in the assembly.
+    char name[16];
+    snprintf(name, sizeof(name), "l%d", label);
+    obj->labels[label] = add_symbol(obj, name);
+  }
+  return obj->labels[label];
+}
+
+/* Keeps the hash table at most half full. */
+static void grow_symbol_table(x86_obj_t *obj) {
+  if (obj->symbol_count * 2 <= obj->symbol_table_size) {
+    return;
+  }
+
+  obj->symbol_table_size *= 2;
+  obj->symbol_table = (int *) realloc(obj->symbol_table,
+      sizeof(int) * obj->symbol_table_size);
+  memset(obj->symbol_table, -1, sizeof(int) * obj->symbol_table_size);
+  int mask = obj->symbol_table_size - 1;
+  for (int symbol = 0; symbol < obj->symbol_count; symbol++) {
+    int i = hash(obj->symbols[symbol].name) & mask;
+    while (obj->symbol_table[i] != -1) {
+      i = (i + 1) & mask;
+    }
+    obj->symbol_table[i] = symbol;
+  }
+}
+
+static void set_position(x86_obj_t *obj, x86_symbol_t *symbol) {
+  section_t *section = current(obj);
+  symbol->section = obj->current;
+  symbol->code_offset = section->type == BSS_SECTION ? section->bss_size : section->size;
+  symbol->branch_count = section->branch_count;
+}
+
+static int branch_size(branch_t *branch) {
+  if (!branch->near) {
+    return SHORT_JUMP_SIZE;
+  }
+  return branch->cond == JMP_COND ? NEAR_JMP_SIZE : NEAR_JCC_SIZE;
+}
+
+/* Grows the jumps that cannot reach their target with a rel8. Jumps only ever
+ * grow, so this terminates. */
+static void relax(x86_obj_t *obj, section_t *section) {
+  // growth[i] is the size of the first i jumps.
+  size_t *growth = (size_t *) malloc(sizeof(size_t) * (section->branch_count + 1));
+  bool changed = true;
+
+  while (changed) {
+    changed = false;
+    growth[0] = 0;
+    for (int i = 0; i < section->branch_count; i++) {
+      growth[i + 1] = growth[i] + branch_size(&section->branches[i]);
+    }
+
+    for (int i = 0; i < section->branch_count; i++) {
+      branch_t *branch = &section->branches[i];
+      if (branch->near) {
+        continue;
+      }
+      x86_symbol_t *target = &obj->symbols[obj->labels[branch->label]];
+      int64_t end = final_offset(growth, branch->code_offset, i) + SHORT_JUMP_SIZE;
+      int64_t displacement = (int64_t) final_offset(growth, target->code_offset,
+          target->branch_count) - end;
+      if (!fits_int8(displacement)) {
+        branch->near = true;
+        changed = true;
+      }
+    }
+  }
+
+  free(growth);
+}
+
+/* Encodes the jumps into the code, and moves the symbols and relocations of the
+ * section past the jumps before them. */
+static void place_branches(x86_obj_t *obj, int index) {
+  section_t *section = &obj->sections[index];
+  size_t *growth = (size_t *) malloc(sizeof(size_t) * (section->branch_count + 1));
+  growth[0] = 0;
+  for (int i = 0; i < section->branch_count; i++) {
+    growth[i + 1] = growth[i] + branch_size(&section->branches[i]);
+  }
+
+  size_t size = section->size + growth[section->branch_count];
+  uint8_t *code = (uint8_t *) malloc(size ? size : 1);
+  size_t copied = 0, position = 0;
+  for (int i = 0; i < section->branch_count; i++) {
+    branch_t *branch = &section->branches[i];
+    memcpy(code + position, section->code + copied, branch->code_offset - copied);
+    position += branch->code_offset - copied;
+    copied = branch->code_offset;
+
+    x86_symbol_t *target = &obj->symbols[obj->labels[branch->label]];
+    int64_t end = position + branch_size(branch);
+    int32_t displacement = (int32_t) (final_offset(growth, target->code_offset,
+        target->branch_count) - end);
+    if (!branch->near) {
+      code[position++] = branch->cond == JMP_COND ? 0xeb : 0x70 + branch->cond;
+      code[position++] = (uint8_t) displacement;
+    } else {
+      if (branch->cond == JMP_COND) {
+        code[position++] = 0xe9;
+      } else {
+        code[position++] = 0x0f;
+        code[position++] = 0x80 + branch->cond;
+      }
+      for (int j = 0; j < 4; j++) {
+        code[position++] = (uint8_t) ((uint32_t) displacement >> (8 * j));
+      }
+    }
+  }
+  memcpy(code + position, section->code + copied, section->size - copied);
+
+  for (int i = 0; i < obj->symbol_count; i++) {
+    x86_symbol_t *symbol = &obj->symbols[i];
+    if (symbol->section == index && section->type != BSS_SECTION) {
+      symbol->code_offset = final_offset(growth, symbol->code_offset, symbol->branch_count);
+      symbol->branch_count = 0;
+    }
+  }
+  for (int i = 0; i < section->reloc_count; i++) {
+    reloc_t *reloc = &section->relocs[i];
+    reloc->code_offset = final_offset(growth, reloc->code_offset, reloc->branch_count);
+    reloc->branch_count = 0;
+  }
+  for (int i = 0; i < obj->function_count; i++) {
+    x86_function_t *function = &obj->functions[i];
+    if (obj->symbols[function->symbol].section != index) {
+      continue;
+    }
+    function->end_offset = final_offset(growth, function->end_offset, function->end_branch_count);
+    function->end_branch_count = 0;
+    for (int j = function->first_row; j < function->first_row + function->row_count; j++) {
+      x86_cfa_t *row = &obj->rows[j];
+      row->code_offset = final_offset(growth, row->code_offset, row->branch_count);
+      row->branch_count = 0;
+    }
+  }
+
+  free(section->code);
+  section->code = code;
+  section->size = section->capacity = size;
+  section->branch_count = 0;
+  free(growth);
+}
+
+/* Offset of a position in the code, after the given number of jumps. */
+static size_t final_offset(size_t *growth, size_t code_offset, int branch_count) {
+  return code_offset + growth[branch_count];
+}
@@ -0,0 +1,142 @@
+#ifndef X86_H
+#define X86_H
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// Prefix of the assembly symbols of functions and global variables.
+#define SYMBOL_PREFIX "_"
+
+/* An instruction operand, as produced by the code generator. */
+typedef struct {
+  enum arg_type_t {
+    LIT_ARG,
+    REG_ARG,
+    MEM_ARG,
+    GLOBAL_ARG
+  } type;
+
+  union {
+    int32_t lit;
+    struct {
+      const char *reg;
+      int32_t offset;
+    };
+    const char *name; // GLOBAL_ARG, without SYMBOL_PREFIX
+  };
+} arg_t;
+
+typedef enum {
+  TEXT_SECTION,
+  DATA_SECTION,
+  BSS_SECTION
+} section_type_t;
+
+// Condition of branch_t for jmp.
+#define JMP_COND 0xff
+
+/* A jump to a label, whose encoding is only chosen once all labels are known.
+ * It sits between the bytes before code_offset and the bytes after it. */
+typedef struct {
+  size_t code_offset;
+  uint8_t cond;       // Condition code, or JMP_COND for an unconditional jump
+  int label;
+  bool near;          // rel32 instead of rel8
+} branch_t;
+
+/* A relocation against a symbol, at an offset in the code bytes. The branches
+ * before it are counted, to find its final offset. */
+typedef struct {
+  size_t code_offset;
+  int branch_count;
+  int symbol;
+  uint32_t type;
+  int64_t addend;
+} reloc_t;
+
+typedef struct {
+  const char *name;
+  section_type_t type;
+  uint8_t *code;
+  size_t size, capacity;  // Bytes of code, without the branches
+  size_t bss_size;
+  branch_t *branches;
+  int branch_count, branch_capacity;
+  reloc_t *relocs;
+  int reloc_count, reloc_capacity;
+} section_t;
+
+/* A symbol or label. Positions are like those of relocations. The section is
+ * -1 for undefined symbols. */
+typedef struct {
+  const char *name;
+  int section;
+  size_t code_offset;
+  int branch_count;
+  bool global;
+  bool function;
+  size_t size; // Of a function, once the object is finished
+} x86_symbol_t;
+
+/* The unwind rule from a position in a function on: the canonical frame
+ * address, the stack pointer before the call, is at an offset from a
+ * register, and the caller's rbp may be saved right below the return address.
+ * Positions are like those of relocations. */
+typedef struct {
+  size_t code_offset;
+  int branch_count;
+  int cfa_register; // Number in the ModRM encoding
+  int32_t cfa_offset;
+  bool rbp_saved;
+} x86_cfa_t;
+
+/* A function, which gets a size and unwind information. Its code starts at its
+ * symbol and ends at the end position, and the rules of its rows apply in
+ * turn. */
+typedef struct {
+  int symbol;
+  size_t end_offset;
+  int end_branch_count;
+  int first_row, row_count;
+} x86_function_t;
+
+/* An object being assembled. Once x86_finish has chosen the encoding of the
+ * branches, the code of each section is final, and so are the offsets of its
+ * symbols and relocations. */
+typedef struct {
+  section_t *sections;
+  int section_count, section_capacity;
+  int current;
+  x86_symbol_t *symbols;
+  int symbol_count, symbol_capacity;
+  int *symbol_table;  // Hash table of named symbols, -1 for empty slots
+  int symbol_table_size;
+  int *labels;  // Symbol of each label number, -1 if not seen yet
+  int label_capacity;
+  x86_function_t *functions;
+  int function_count, function_capacity;
+  x86_cfa_t *rows;
+  int row_count, row_capacity;
+} x86_obj_t;
+
+x86_obj_t *x86_create(void);
+void x86_free(x86_obj_t *);
+void x86_section(x86_obj_t *, const char *, section_type_t);
+void x86_define(x86_obj_t *, const char *);
+void x86_global(x86_obj_t *, const char *);
+void x86_label(x86_obj_t *, int);
+void x86_function_start(x86_obj_t *, const char *);
+void x86_cfa(x86_obj_t *, const char *, int32_t, bool);
+void x86_function_end(x86_obj_t *);
+void x86_two_arg(x86_obj_t *, const char *, arg_t, arg_t);
+void x86_one_arg(x86_obj_t *, const char *, arg_t);
+void x86_jump(x86_obj_t *, const char *, int);
+void x86_symbol_command(x86_obj_t *, const char *, const char *);
+void x86_ret(x86_obj_t *);
+void x86_no_arg(x86_obj_t *, const char *);
+void x86_quad(x86_obj_t *, int64_t);
+void x86_string(x86_obj_t *, const char *);
+void x86_zero(x86_obj_t *, size_t);
+bool x86_finish(x86_obj_t *);
+
+#endif
@@ -0,0 +1,17 @@
+// @COMPILE OK
+// @EXPECT 10
+// The loop counter is a global that main reads after the loop.
+int i;
+int s;
+
+int f() {
+  for (i = 0; i < 10; i = i + 1) {
+    s = s + i * 4;
+  }
+  return 0;
+}
+
+int main() {
+  f();
+  return i;
+}
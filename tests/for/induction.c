@@ -0,0 +1,15 @@
+// @COMPILE OK
+// @EXPECT 180
+// The counter is only used through i * 4 and the exit test, so the loop runs on
+// the derived value alone.
+int main() {
+  int i;
+  int sum;
+  sum = 0;
+
+  for (i = 0; i < 10; i = i + 1) {
+    sum = sum + i * 4;
+  }
+
+  return sum; // 4 * (0 + 1 + ... + 9)
+}
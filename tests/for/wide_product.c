@@ -0,0 +1,12 @@
+// @COMPILE OK
+// @EXPECT 30
+// i * 100000 does not fit in an int, the products must not be folded into one.
+int main() {
+  int i;
+  int s;
+  s = 0;
+  for (i = 100000; i < 100003; i = i + 1) {
+    s = s + (i * 100000) / 1000000000;
+  }
+  return s;
+}
@@ -0,0 +1,26 @@
+// @COMPILE OK
+// @EXPECT 42
+
+// Functions are emitted callers first, and functions only called under a
+// condition outside of loops are cold. Neither may change the result.
+int g;
+int i;
+
+int fail() {
+  g = 0;
+}
+
+int step() {
+  g = g + 2;
+}
+
+int main() {
+  g = 0;
+  for (i = 0; i < 21; i = i + 1) {
+    step();
+  }
+  if (g < 42) {
+    fail();
+  }
+  return g;
+}
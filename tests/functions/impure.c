@@ -0,0 +1,20 @@
+// @COMPILE OK
+// @EXPECT 3
+// Functions that change or read changing globals are not evaluated early.
+int counter;
+
+int next() {
+  counter = counter + 1;
+  return counter;
+}
+
+int current() {
+  return counter;
+}
+
+int main() {
+  next();
+  next();
+  next();
+  return current();
+}
@@ -0,0 +1,21 @@
+// @COMPILE OK
+// @EXPECT 160
+// Calls to pure functions are replaced with the value they return.
+int scale = 4;
+
+int table_size() {
+  int size = 1;
+  int i;
+  for (i = 0; i < 10; i = i + 1) {
+    size = size * 2;
+  }
+  return size;
+}
+
+int slots() {
+  return (table_size() / 256) * scale;
+}
+
+int main() {
+  return slots() * 10;
+}
@@ -0,0 +1,20 @@
+// @COMPILE OK
+// @EXPECT 5
+// Pure functions that never return or fault are left to run time.
+int enabled;
+
+int spin() {
+  while (1) {
+  }
+  return 0;
+}
+
+int fault() {
+  return 1 / 0;
+}
+
+int main() {
+  if (enabled) return spin();
+  if (enabled) return fault();
+  return 5;
+}
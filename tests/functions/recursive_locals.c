@@ -0,0 +1,19 @@
+// @COMPILE OK
+// @EXPECT 18
+// Every call has a frame of its own, which the calls it makes leave alone.
+int n = 3;
+
+int f() {
+  int x = n;
+  if (x == 0) {
+    return 0;
+  }
+  n = n - 1;
+  f();
+  return x + 10;
+}
+
+int main() {
+  int x = 5;
+  return f() + x;
+}
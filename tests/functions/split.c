@@ -0,0 +1,11 @@
+// @COMPILE OK
+// @EXPECT 9
+// Top-level braces in comments must not split the input: } {
+int three() {
+  if (1) { return 3; } // }
+  else { return 0; }
+}
+// {
+int main() {
+  return three() + three() + three();
+}
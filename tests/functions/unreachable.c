@@ -0,0 +1,19 @@
+// @COMPILE OK
+// @EXPECT 9
+
+// Functions that main never reaches are not emitted.
+int unused() {
+  return 1;
+}
+
+int also_unused() {
+  return unused() + 2;
+}
+
+int nine() {
+  return 9;
+}
+
+int main() {
+  return nine();
+}
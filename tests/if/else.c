@@ -0,0 +1,13 @@
+// @COMPILE OK
+// @EXPECT 7
+// The then branch must not fall through into the else branch.
+int x;
+
+int main() {
+  if (1) {
+    x = 7;
+  } else {
+    x = 9;
+  }
+  return x;
+}
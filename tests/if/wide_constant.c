@@ -0,0 +1,15 @@
+// @COMPILE OK
+// @EXPECT 1
+// Constant conditions are folded the way the generated code computes them: in
+// 64 bits, with the dividend of a division zero-extended.
+int main() {
+  int r;
+  r = 1;
+  if (65536 * 65536 == 0) {
+    r = r + 10;
+  }
+  if ((0 - 7) / 2 < 0) {
+    r = r + 1;
+  }
+  return r;
+}
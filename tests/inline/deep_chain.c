@@ -0,0 +1,21 @@
+// @COMPILE OK
+// @EXPECT 3
+// @EDIT s/int x; x = g;/int x; int y; y = g; x = y;/
+// The chain is deeper than calls are expanded, an edit at its end changes the slots of the
+// functions that expand it without changing the code they follow.
+int g;
+int f10() { int x; x = g; return x; }
+int f9() { int x; x = f10(); return x; }
+int f8() { int x; x = f9(); return x; }
+int f7() { int x; x = f8(); return x; }
+int f6() { int x; x = f7(); return x; }
+int f5() { int x; x = f6(); return x; }
+int f4() { int x; x = f5(); return x; }
+int f3() { int x; x = f4(); return x; }
+int f2() { int x; x = f3(); return x; }
+int f1() { int x; x = f2(); return x; }
+
+int main() {
+  g = 3;
+  return f1();
+}
@@ -0,0 +1,6 @@
+// @COMPILE_STATUS 4
+int main() {
+  int x;
+  x = 1;
+  return x();
+}
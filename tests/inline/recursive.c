@@ -0,0 +1,14 @@
+// @COMPILE OK
+// @EXPECT 7
+
+// Recursive functions are expanded at most once per call chain.
+inline int down() {
+  int x;
+  x = 0;
+  if (x) return down();
+  return 7;
+}
+
+int main() {
+  return down();
+}
@@ -0,0 +1,12 @@
+// @COMPILE OK
+// @EXPECT 18
+// f needs more registers than are free at the call in main, so it is called.
+int f() {
+  int a;
+  a = 1;
+  return a + (2 + (3 + (4 + a)));
+}
+
+int main() {
+  return 1 + (1 + (1 + (1 + (1 + (1 + (1 + f()))))));
+}
@@ -0,0 +1,12 @@
+// @COMPILE OK
+// @EXPECT 126
+
+int answer() {
+  return 42;
+}
+
+int main() {
+  int x;
+  x = answer();
+  return x + answer() * 2;
+}
@@ -0,0 +1,20 @@
+// @COMPILE OK
+// @EXPECT 35
+
+// Returns from several places, each of which continues after the call.
+inline int pick() {
+  int x;
+  int y;
+  x = 3;
+  y = 0;
+  while (x) {
+    y = y + 10;
+    if (y > 15) return y;
+    x = x - 1;
+  }
+  return 1;
+}
+
+int main() {
+  return pick() + pick() - 5;
+}
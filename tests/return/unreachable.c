@@ -0,0 +1,25 @@
+// @COMPILE OK
+// @EXPECT 12
+int calls;
+
+int never() {
+  calls = calls + 100;
+  return 0;
+}
+
+int main() {
+  int x;
+  x = 0;
+
+  if (0) x = never();
+  while (0) x = x + never();
+  for (x = 2; 1 < 0; x = x + 1) x = never();
+
+  while (1) {
+    x = x + 5;
+    if (x > 10) return x + calls;
+  }
+
+  x = never();
+  return x;
+}
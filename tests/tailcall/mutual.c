@@ -0,0 +1,22 @@
+// @COMPILE OK
+// @EXPECT 1
+// @NEEDS_PASS tailcall
+int n;
+int is_odd();
+
+int is_even() {
+  if (n == 0) return 1;
+  n = n - 1;
+  return is_odd();
+}
+
+int is_odd() {
+  if (n == 0) return 0;
+  n = n - 1;
+  return is_even();
+}
+
+int main() {
+  n = 1000001;
+  return is_odd();
+}
@@ -0,0 +1,18 @@
+// @COMPILE OK
+// @EXPECT 192
+// @NEEDS_PASS tailcall
+// Three million levels of recursion only fit in constant stack space.
+int n;
+int calls;
+
+int count() {
+  if (n == 0) return calls;
+  n = n - 1;
+  calls = calls + 1;
+  return count();
+}
+
+int main() {
+  n = 3000000;
+  return count(); // 3000000 % 256
+}
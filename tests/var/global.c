@@ -0,0 +1,16 @@
+// @COMPILE OK
+// @EXPECT 47
+int counter;
+int base = 40;
+
+int bump() {
+  counter = counter + 1;
+  return counter;
+}
+
+int main() {
+  int local = 2;
+  bump();
+  bump();
+  return base + bump() + local + counter - 1;
+}
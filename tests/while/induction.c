@@ -0,0 +1,19 @@
+// @COMPILE OK
+// @EXPECT 210
+
+int main() {
+  int i;
+  int k;
+  int x;
+  k = 3;
+  x = 0;
+  i = 10;
+
+  while (i > 2) {
+    x = x + i * k + k * i;
+    i = i - 2;
+    x = x + 2 * i;
+  }
+
+  return x + i; // 6 * (10 + 8 + 6 + 4) + 2 * (8 + 6 + 4 + 2) + 2
+}
@@ -0,0 +1,41 @@
+// @COMPILE OK
+// @EXPECT 24
+
+// The loop body is too long for rel8 jumps, so the object file writer
+// has to relax them to their rel32 forms.
+int g;
+int i;
+
+int main() {
+  g = 0;
+  for (i = 0; i < 10; i = i + 1) {
+    g = g + 0 * 2 - 1;
+    g = g + 1 * 2 - 1;
+    g = g + 2 * 2 - 1;
+    g = g + 3 * 2 - 1;
+    g = g + 4 * 2 - 1;
+    g = g + 5 * 2 - 1;
+    g = g + 6 * 2 - 1;
+    g = g + 7 * 2 - 1;
+    g = g + 8 * 2 - 1;
+    g = g + 9 * 2 - 1;
+    g = g + 10 * 2 - 1;
+    g = g + 11 * 2 - 1;
+    g = g + 12 * 2 - 1;
+    g = g + 13 * 2 - 1;
+    g = g + 14 * 2 - 1;
+    g = g + 15 * 2 - 1;
+    g = g + 16 * 2 - 1;
+    g = g + 17 * 2 - 1;
+    g = g + 18 * 2 - 1;
+    g = g + 19 * 2 - 1;
+    g = g + 20 * 2 - 1;
+    g = g + 21 * 2 - 1;
+    g = g + 22 * 2 - 1;
+    g = g + 23 * 2 - 1;
+    if (g > 1000) {
+      g = g - 1000;
+    }
+  }
+  return g - g / 256 * 256;
+}